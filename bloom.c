@@ -0,0 +1,174 @@
+#include "cache.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+#include "bloom.h"
+
+static const uint32_t bloom_seed0 = 0x293ae76f;
+static const uint32_t bloom_seed1 = 0x7e646e2c;
+
+static inline uint32_t rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+/*
+ * The 32-bit version of MurmurHash3, with the input read as
+ * little-endian words regardless of the host byte order so that the
+ * filters written on one machine can be read on any other.
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const unsigned char *p = (const unsigned char *)data;
+	size_t i, nwords = len / 4;
+	uint32_t k;
+
+	for (i = 0; i < nwords; i++, p += 4) {
+		k = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		k *= c1;
+		k = rotate_left(k, 15);
+		k *= c2;
+		seed ^= k;
+		seed = rotate_left(seed, 13) * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= p[2] << 16;
+		/* fallthrough */
+	case 2:
+		k ^= p[1] << 8;
+		/* fallthrough */
+	case 1:
+		k ^= p[0];
+		k *= c1;
+		k = rotate_left(k, 15);
+		k *= c2;
+		seed ^= k;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= seed >> 16;
+	seed *= 0x85ebca6b;
+	seed ^= seed >> 13;
+	seed *= 0xc2b2ae35;
+	seed ^= seed >> 16;
+	return seed;
+}
+
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	uint32_t i;
+	uint32_t hash0 = murmur3_seeded(bloom_seed0, data, len);
+	uint32_t hash1 = murmur3_seeded(bloom_seed1, data, len);
+
+	key->hashes = xmalloc(settings->num_hashes * sizeof(*key->hashes));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	free(key->hashes);
+	key->hashes = NULL;
+}
+
+void add_key_to_filter(const struct bloom_key *key, struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % nbits;
+		filter->data[pos >> 3] |= 1 << (pos & 7);
+	}
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	if (!nbits)
+		return 1;
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t pos = key->hashes[i] % nbits;
+		if (!(filter->data[pos >> 3] & (1 << (pos & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+/* Add the path and each of its leading directories to the list. */
+static void add_path_and_dirs(struct string_list *paths, const char *path)
+{
+	const char *slash;
+
+	string_list_insert(paths, path);
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *dir = xmemdupz(path, slash - path);
+		string_list_insert(paths, dir);
+		free(dir);
+	}
+}
+
+void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings)
+{
+	struct diff_options opt;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	int i;
+
+	if (parse_commit(c))
+		die("unable to parse commit %s", sha1_to_hex(c->object.sha1));
+
+	diff_setup(&opt);
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+
+	if (c->parents) {
+		if (parse_commit(c->parents->item))
+			die("unable to parse commit %s",
+			    sha1_to_hex(c->parents->item->object.sha1));
+		diff_tree_sha1(c->parents->item->tree->object.sha1,
+			       c->tree->object.sha1, "", &opt);
+	} else
+		diff_tree_sha1(NULL, c->tree->object.sha1, "", &opt);
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGES) {
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_and_dirs(&paths, diff_queued_diff.queue[i]->two->path);
+
+		filter->len = (paths.nr * settings->bits_per_entry + 7) / 8;
+		if (!filter->len)
+			filter->len = 1;
+		filter->data = xcalloc(filter->len, 1);
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+			fill_bloom_key(paths.items[i].string,
+				       strlen(paths.items[i].string),
+				       &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	} else {
+		/* too many changes: a single byte with every bit set */
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+	}
+
+	diff_flush(&opt);
+	free_pathspec(&opt.pathspec);
+	string_list_clear(&paths, 0);
+}
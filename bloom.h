@@ -0,0 +1,65 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ * Changed-path Bloom filters.  For each commit, a filter records the
+ * paths (and their leading directories) that differ between the commit
+ * and its first parent, so that a history walk limited to some paths
+ * can skip the tree diff of a commit the filter says did not touch
+ * them.  A filter never answers "no" for a path that did change, but
+ * may answer "maybe" for one that did not.
+ */
+
+struct commit;
+
+struct bloom_filter_settings {
+	uint32_t hash_version;
+	uint32_t num_hashes;
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 1, 7, 10 }
+
+/*
+ * Commits that change more paths than this get a filter that matches
+ * everything, rather than one that is large and mostly useless.
+ */
+#define BLOOM_FILTER_MAX_CHANGES 512
+
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/* The bit positions a path sets, one per hash function. */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+extern void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * Return 0 if the path the key was made from is definitely not in the
+ * filter, 1 if it may be.
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the filter of the paths changed by the commit relative to
+ * its first parent (or to the empty tree for a root commit).  The
+ * caller owns filter->data.
+ */
+extern void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings);
+
+#endif
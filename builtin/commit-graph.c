@@ -0,0 +1,109 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "sha1-array.h"
+#include "commit-graph.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph write [--reachable | --stdin-commits] [--append] [--[no-]changed-paths]"),
+	N_("git commit-graph verify"),
+	NULL
+};
+
+static const char * const builtin_commit_graph_write_usage[] = {
+	N_("git commit-graph write [--reachable | --stdin-commits] [--append] [--[no-]changed-paths]"),
+	NULL
+};
+
+static int add_packed_commit(const unsigned char *sha1,
+			     struct packed_git *pack,
+			     uint32_t pos,
+			     void *data)
+{
+	struct sha1_array *commits = data;
+
+	if (sha1_object_info(sha1, NULL) == OBJ_COMMIT)
+		sha1_array_append(commits, sha1);
+	return 0;
+}
+
+static int graph_write(int argc, const char **argv, const char *prefix)
+{
+	struct sha1_array commits = SHA1_ARRAY_INIT;
+	int reachable = 0, stdin_commits = 0, append = 0, changed_paths = -1, ret;
+	unsigned flags = 0;
+	struct option builtin_commit_graph_write_options[] = {
+		OPT_BOOL(0, "reachable", &reachable,
+			N_("start walk at all refs")),
+		OPT_BOOL(0, "stdin-commits", &stdin_commits,
+			N_("start walk at commits listed by stdin")),
+		OPT_BOOL(0, "append", &append,
+			N_("include all commits already in the commit-graph file")),
+		OPT_BOOL(0, "changed-paths", &changed_paths,
+			N_("write changed-path Bloom filters")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_commit_graph_write_options,
+			     builtin_commit_graph_write_usage, 0);
+	if (argc)
+		usage_with_options(builtin_commit_graph_write_usage,
+				   builtin_commit_graph_write_options);
+	if (reachable && stdin_commits)
+		die(_("use at most one of --reachable and --stdin-commits"));
+
+	if (append)
+		flags |= COMMIT_GRAPH_APPEND;
+	if (changed_paths > 0)
+		flags |= COMMIT_GRAPH_CHANGED_PATHS;
+	else if (!changed_paths)
+		flags |= COMMIT_GRAPH_NO_CHANGED_PATHS;
+	if (isatty(2))
+		flags |= COMMIT_GRAPH_PROGRESS;
+
+	if (reachable)
+		return write_commit_graph_reachable(get_object_directory(), flags);
+
+	if (stdin_commits) {
+		struct strbuf buf = STRBUF_INIT;
+
+		while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+			unsigned char sha1[20];
+
+			if (get_sha1_hex(buf.buf, sha1))
+				die(_("not a commit id: '%s'"), buf.buf);
+			sha1_array_append(&commits, sha1);
+		}
+		strbuf_release(&buf);
+	} else
+		for_each_packed_object(add_packed_commit, &commits, 0);
+
+	ret = write_commit_graph(get_object_directory(), &commits, flags);
+	sha1_array_clear(&commits);
+	return ret;
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option builtin_commit_graph_options[] = {
+		OPT_END(),
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_commit_graph_options,
+			     builtin_commit_graph_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (argc > 0) {
+		if (!strcmp(argv[0], "write"))
+			return graph_write(argc, argv, prefix);
+		if (!strcmp(argv[0], "verify") && argc == 1)
+			return verify_commit_graph(get_object_directory());
+	}
+
+	usage_with_options(builtin_commit_graph_usage,
+			   builtin_commit_graph_options);
+}
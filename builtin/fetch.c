@@ -31,6 +31,7 @@ enum {
 
 static int fetch_prune_config = -1; /* unspecified */
 static int prune = -1; /* unspecified */
+static int fetch_write_commit_graph;
 #define PRUNE_BY_DEFAULT 0 /* do we prune by default? */
 
 static int all, append, dry_run, force, keep, multiple, update_head_ok, verbosity;
@@ -67,6 +68,11 @@ static int git_fetch_config(const char *k, const char *v, void *cb)
 		fetch_prune_config = git_config_bool(k, v);
 		return 0;
 	}
+
+	if (!strcmp(k, "fetch.writecommitgraph")) {
+		fetch_write_commit_graph = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -788,6 +794,20 @@ static int prune_refs(struct refspec *refs, int ref_count, struct ref *ref_map,
 	if (4 < i && !strncmp(".git", url + i - 3, 4))
 		url_len = i - 3;
 
+	if (!dry_run && stale_refs) {
+		struct string_list refnames = STRING_LIST_INIT_NODUP;
+		struct strbuf err = STRBUF_INIT;
+
+		/* Remove the packed refs in one go before the loose ones. */
+		for (ref = stale_refs; ref; ref = ref->next)
+			string_list_append(&refnames, ref->name);
+		string_list_sort(&refnames);
+		if (repack_without_refs(&refnames, &err))
+			result |= error("%s", err.buf);
+		strbuf_release(&err);
+		string_list_clear(&refnames, 0);
+	}
+
 	for (ref = stale_refs; ref; ref = ref->next) {
 		if (!dry_run)
 			result |= delete_ref(ref->name, NULL, 0);
@@ -1212,6 +1232,15 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	list.strdup_strings = 1;
 	string_list_clear(&list, 0);
 
+	if (!result && !dry_run && fetch_write_commit_graph) {
+		struct argv_array argv_commit_graph = ARGV_ARRAY_INIT;
+
+		argv_array_pushl(&argv_commit_graph, "commit-graph", "write",
+				 "--reachable", "--append", NULL);
+		run_command_v_opt(argv_commit_graph.argv, RUN_GIT_CMD);
+		argv_array_clear(&argv_commit_graph);
+	}
+
 	argv_array_pushl(&argv_gc_auto, "gc", "--auto", NULL);
 	if (verbosity < 0)
 		argv_array_push(&argv_gc_auto, "--quiet");
@@ -836,6 +836,36 @@ struct grab_ref_cbdata {
 	int grab_cnt;
 };
 
+/*
+ * Return the longest string that every refname matched by one of the
+ * patterns starts with, so that only that part of the refs needs to
+ * be read.  A pattern matches a refname either as a prefix ending at
+ * a '/' or as a wildmatch, so its part before the first special
+ * character has to match literally in both cases.
+ */
+static char *common_pattern_prefix(const char **pattern)
+{
+	struct strbuf prefix = STRBUF_INIT;
+	int first = 1;
+
+	for (; *pattern; pattern++) {
+		const char *p = *pattern;
+		size_t len = strcspn(p, "?*[\\");
+
+		if (first) {
+			strbuf_add(&prefix, p, len);
+			first = 0;
+		} else {
+			size_t i = 0;
+
+			while (i < prefix.len && i < len && prefix.buf[i] == p[i])
+				i++;
+			strbuf_setlen(&prefix, i);
+		}
+	}
+	return strbuf_detach(&prefix, NULL);
+}
+
 /*
  * A call-back given to for_each_ref().  Filter refs and keep them for
  * later object processing.
@@ -1072,6 +1102,7 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	int maxcount = 0, quote_style = 0;
 	struct refinfo **refs;
 	struct grab_ref_cbdata cbdata;
+	char *pattern_prefix;
 
 	struct option opts[] = {
 		OPT_BIT('s', "shell", &quote_style,
@@ -1111,7 +1142,9 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.grab_pattern = argv;
-	for_each_rawref(grab_single_ref, &cbdata);
+	pattern_prefix = common_pattern_prefix(argv);
+	for_each_rawref_in(pattern_prefix, grab_single_ref, &cbdata);
+	free(pattern_prefix);
 	refs = cbdata.grab_array;
 	num_refs = cbdata.grab_cnt;
 
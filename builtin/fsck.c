@@ -32,6 +32,7 @@ static int write_lost_and_found;
 static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
+static int verify_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -617,9 +618,20 @@ static struct option fsck_opts[] = {
 	OPT_BOOL(0, "lost-found", &write_lost_and_found,
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
+	OPT_INTEGER(0, "threads", &verify_threads,
+		    N_("use <n> threads to verify packs")),
 	OPT_END(),
 };
 
+static int fsck_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "pack.threads")) {
+		verify_threads = git_config_int(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_fsck(int argc, const char **argv, const char *prefix)
 {
 	int i, heads;
@@ -628,8 +640,18 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	errors_found = 0;
 	check_replace_refs = 0;
 
+	git_config(fsck_config, NULL);
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 
+	if (verify_threads < 0)
+		die(_("invalid number of threads specified (%d)"),
+		    verify_threads);
+#ifdef NO_PTHREADS
+	if (verify_threads > 1)
+		warning(_("no threads support, ignoring --threads"));
+	verify_threads = 1;
+#endif
+
 	if (show_progress == -1)
 		show_progress = isatty(2);
 	if (verbose)
@@ -671,7 +693,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 		for (p = packed_git; p; p = p->next) {
 			/* verify gives error messages itself */
 			if (verify_pack(p, fsck_obj_buffer,
-					progress, count))
+					progress, count, verify_threads))
 				errors_found |= ERROR_PACK;
 			count += p->num_objects;
 		}
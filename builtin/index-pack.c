@@ -13,7 +13,7 @@
 #include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--[no-]rev-index] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -1371,6 +1371,7 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1422,6 +1423,19 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_name) {
+		if (final_rev_name != curr_rev_name) {
+			if (!final_rev_name) {
+				snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+					 get_object_directory(), sha1_to_hex(sha1));
+				final_rev_name = name;
+			}
+			if (move_temp_to_file(curr_rev_name, final_rev_name))
+				die(_("cannot store reverse index file"));
+		} else
+			chmod(final_rev_name, 0444);
+	}
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1465,6 +1479,13 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1597,10 +1618,11 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_index, *curr_rev = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1640,6 +1662,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				verify = 1;
 				show_stat = 1;
 				stat_only = 1;
+			} else if (!strcmp(arg, "--rev-index")) {
+				opts.flags |= WRITE_REV;
+			} else if (!strcmp(arg, "--no-rev-index")) {
+				opts.flags &= ~WRITE_REV;
 			} else if (!strcmp(arg, "--keep")) {
 				keep_msg = "";
 			} else if (starts_with(arg, "--keep=")) {
@@ -1706,6 +1732,15 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		strbuf_addstr(&index_name_buf, ".idx");
 		index_name = index_name_buf.buf;
 	}
+	if ((opts.flags & WRITE_REV) && pack_name) {
+		size_t len;
+		if (!strip_suffix(pack_name, ".pack", &len))
+			die(_("packfile name '%s' does not end with '.pack'"),
+			    pack_name);
+		strbuf_add(&rev_name_buf, pack_name, len);
+		strbuf_addstr(&rev_name_buf, ".rev");
+		rev_name = rev_name_buf.buf;
+	}
 	if (keep_msg && !keep_name && pack_name) {
 		size_t len;
 		if (!strip_suffix(pack_name, ".pack", &len))
@@ -1754,22 +1789,29 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if ((opts.flags & WRITE_REV) && !verify)
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects,
+					  pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
 	free(objects);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
 
 	/*
 	 * Let the caller know this pack is not self contained
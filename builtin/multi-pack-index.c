@@ -0,0 +1,34 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index (write | verify)"),
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	const char *object_dir;
+	struct option builtin_multi_pack_index_options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_multi_pack_index_options,
+			     builtin_multi_pack_index_usage, 0);
+	if (argc != 1)
+		usage_with_options(builtin_multi_pack_index_usage,
+				   builtin_multi_pack_index_options);
+
+	object_dir = get_object_directory();
+	if (!strcmp(argv[0], "write"))
+		return write_midx_file(object_dir);
+	if (!strcmp(argv[0], "verify"))
+		return verify_midx_file(object_dir);
+
+	die(_("unrecognized verb: %s"), argv[0]);
+}
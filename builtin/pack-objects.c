@@ -23,6 +23,7 @@
 #include "reachable.h"
 #include "sha1-array.h"
 #include "argv-array.h"
+#include "delta-islands.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -37,6 +38,18 @@ static const char *pack_usage[] = {
  */
 static struct packing_data to_pack;
 
+#define IN_PACK(obj) oe_in_pack(&to_pack, obj)
+#define SIZE(obj) oe_size(&to_pack, obj)
+#define SET_SIZE(obj, size) oe_set_size(&to_pack, obj, size)
+#define DELTA_SIZE(obj) oe_delta_size(&to_pack, obj)
+#define SET_DELTA_SIZE(obj, size) oe_set_delta_size(&to_pack, obj, size)
+#define DELTA(obj) oe_delta(&to_pack, obj)
+#define DELTA_CHILD(obj) oe_delta_child(&to_pack, obj)
+#define DELTA_SIBLING(obj) oe_delta_sibling(&to_pack, obj)
+#define SET_DELTA(obj, val) oe_set_delta(&to_pack, obj, val)
+#define SET_DELTA_CHILD(obj, val) oe_set_delta_child(&to_pack, obj, val)
+#define SET_DELTA_SIBLING(obj, val) oe_set_delta_sibling(&to_pack, obj, val)
+
 static struct pack_idx_entry **written_list;
 static uint32_t nr_result, nr_written;
 
@@ -63,10 +76,11 @@ static int pack_compression_seen;
 
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index = 1;
 static int write_bitmap_index;
+static int use_delta_islands;
 static uint16_t write_bitmap_options;
 
 static unsigned long delta_cache_size = 0;
@@ -107,12 +121,12 @@ static void *get_delta(struct object_entry *entry)
 	buf = read_sha1_file(entry->idx.sha1, &type, &size);
 	if (!buf)
 		die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-	base_buf = read_sha1_file(entry->delta->idx.sha1, &type, &base_size);
+	base_buf = read_sha1_file(DELTA(entry)->idx.sha1, &type, &base_size);
 	if (!base_buf)
-		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
+		die("unable to read %s", sha1_to_hex(DELTA(entry)->idx.sha1));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
-	if (!delta_buf || delta_size != entry->delta_size)
+	if (!delta_buf || delta_size != DELTA_SIZE(entry))
 		die("delta size changed");
 	free(buf);
 	free(base_buf);
@@ -244,8 +258,8 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	struct git_istream *st = NULL;
 
 	if (!usable_delta) {
-		if (entry->type == OBJ_BLOB &&
-		    entry->size > big_file_threshold &&
+		if (oe_type(entry) == OBJ_BLOB &&
+		    SIZE(entry) > big_file_threshold &&
 		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
 			buf = NULL;
 		else {
@@ -261,15 +275,15 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		entry->delta_data = NULL;
 		entry->z_delta_size = 0;
 	} else if (entry->delta_data) {
-		size = entry->delta_size;
+		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
 		entry->delta_data = NULL;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
 		buf = get_delta(entry);
-		size = entry->delta_size;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		size = DELTA_SIZE(entry);
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
@@ -292,7 +306,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 * encoding of the relative offset for the delta
 		 * base from this object's position in the pack.
 		 */
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -318,7 +332,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
@@ -344,25 +358,26 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 static unsigned long write_reuse_object(struct sha1file *f, struct object_entry *entry,
 					unsigned long limit, int usable_delta)
 {
-	struct packed_git *p = entry->in_pack;
+	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
-	off_t offset;
-	enum object_type type = entry->type;
+	uint32_t nr;
+	off_t offset, next;
+	enum object_type type = oe_type(entry);
 	unsigned long datalen;
 	unsigned char header[10], dheader[10];
 	unsigned hdrlen;
 
-	if (entry->delta)
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+	if (DELTA(entry))
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
-	hdrlen = encode_in_pack_object_header(type, entry->size, header);
+	hdrlen = encode_in_pack_object_header(type, SIZE(entry), header);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (find_pack_revindex(p, offset, &nr, &next))
+		die("bad pack offset for %s", sha1_to_hex(entry->idx.sha1));
+	datalen = next - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen, nr)) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
@@ -372,14 +387,14 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	datalen -= entry->in_pack_header_size;
 
 	if (!pack_to_stdout && p->index_version == 1 &&
-	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
+	    check_pack_inflate(p, &w_curs, offset, datalen, SIZE(entry))) {
 		error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -398,7 +413,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 		reused_delta++;
 	} else {
@@ -437,28 +452,28 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		limit = pack_size_limit - write_offset;
 
-	if (!entry->delta)
+	if (!DELTA(entry))
 		usable_delta = 0;	/* no delta */
 	else if (!pack_size_limit)
 	       usable_delta = 1;	/* unlimited packfile */
-	else if (entry->delta->idx.offset == (off_t)-1)
+	else if (DELTA(entry)->idx.offset == (off_t)-1)
 		usable_delta = 0;	/* base was written to another pack */
-	else if (entry->delta->idx.offset)
+	else if (DELTA(entry)->idx.offset)
 		usable_delta = 1;	/* base already exists in this pack */
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
 	if (!reuse_object)
 		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
+	else if (!IN_PACK(entry))
 		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+	else if (oe_type(entry) == OBJ_REF_DELTA || oe_type(entry) == OBJ_OFS_DELTA)
 				/* check_object() decided it for us ... */
 		to_reuse = usable_delta;
 				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
+	else if (oe_type(entry) != entry->in_pack_type)
 		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
+	else if (DELTA(entry))
 		to_reuse = 0;	/* we want to pack afresh */
 	else
 		to_reuse = 1;	/* we have it in-pack undeltified,
@@ -510,12 +525,12 @@ static enum write_one_status write_one(struct sha1file *f,
 	}
 
 	/* if we are deltified, write out base object first. */
-	if (e->delta) {
+	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
-		switch (write_one(f, e->delta, offset)) {
+		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
-			e->delta = NULL;
+			SET_DELTA(e, NULL);
 			break;
 		default:
 			break;
@@ -577,34 +592,34 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 			/* add this node... */
 			add_to_write_order(wo, endp, e);
 			/* all its siblings... */
-			for (s = e->delta_sibling; s; s = s->delta_sibling) {
+			for (s = DELTA_SIBLING(e); s; s = DELTA_SIBLING(s)) {
 				add_to_write_order(wo, endp, s);
 			}
 		}
 		/* drop down a level to add left subtree nodes if possible */
-		if (e->delta_child) {
+		if (DELTA_CHILD(e)) {
 			add_to_order = 1;
-			e = e->delta_child;
+			e = DELTA_CHILD(e);
 		} else {
 			add_to_order = 0;
 			/* our sibling might have some children, it is next */
-			if (e->delta_sibling) {
-				e = e->delta_sibling;
+			if (DELTA_SIBLING(e)) {
+				e = DELTA_SIBLING(e);
 				continue;
 			}
 			/* go back to our parent node */
-			e = e->delta;
-			while (e && !e->delta_sibling) {
+			e = DELTA(e);
+			while (e && !DELTA_SIBLING(e)) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				e = e->delta;
+				e = DELTA(e);
 			}
 			if (!e) {
 				/* done- we hit our original root node */
 				return;
 			}
 			/* pass it off to sibling at this level */
-			e = e->delta_sibling;
+			e = DELTA_SIBLING(e);
 		}
 	};
 }
@@ -615,7 +630,7 @@ static void add_family_to_write_order(struct object_entry **wo,
 {
 	struct object_entry *root;
 
-	for (root = e; root->delta; root = root->delta)
+	for (root = e; DELTA(root); root = DELTA(root))
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
@@ -630,8 +645,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		objects[i].tagged = 0;
 		objects[i].filled = 0;
-		objects[i].delta_child = NULL;
-		objects[i].delta_sibling = NULL;
+		SET_DELTA_CHILD(&objects[i], NULL);
+		SET_DELTA_SIBLING(&objects[i], NULL);
 	}
 
 	/*
@@ -641,11 +656,11 @@ static struct object_entry **compute_write_order(void)
 	 */
 	for (i = to_pack.nr_objects; i > 0;) {
 		struct object_entry *e = &objects[--i];
-		if (!e->delta)
+		if (!DELTA(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling = e->delta->delta_child;
-		e->delta->delta_child = e;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
+		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
 	/*
@@ -676,8 +691,8 @@ static struct object_entry **compute_write_order(void)
 	 * And then all remaining commits and tags.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_COMMIT &&
-		    objects[i].type != OBJ_TAG)
+		if (oe_type(&objects[i]) != OBJ_COMMIT &&
+		    oe_type(&objects[i]) != OBJ_TAG)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -686,7 +701,7 @@ static struct object_entry **compute_write_order(void)
 	 * And then all the trees.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_TREE)
+		if (oe_type(&objects[i]) != OBJ_TREE)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -705,14 +720,151 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct sha1file *f)
+/*
+ * When only some of the objects of the reused pack are sent, those
+ * after a gap are written earlier in our output than they are in the
+ * pack.  Each chunk records, from the offset "original" in the pack on,
+ * by how much they moved, so that the OFS_DELTA of an object can be
+ * pointed back at its base.
+ */
+struct reused_chunk {
+	off_t original;
+	off_t difference;
+};
+
+static struct reused_chunk *reused_chunks;
+static int reused_chunks_nr;
+static int reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t offset)
+{
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == offset)
+		return;
+
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = offset;
+	reused_chunks_nr++;
+}
+
+/*
+ * Binary search to find the chunk that "where" is in. Note that we're not
+ * looking for an exact match, just the first chunk that starts at or
+ * before "where".
+ */
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
+
+	while (lo < hi) {
+		int mi = lo + ((hi - lo) / 2);
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	/*
+	 * The first chunk starts at zero, so we can't have gone below
+	 * there.
+	 */
+	if (!lo)
+		return 0;
+	return reused_chunks[lo - 1].difference;
+}
+
+/*
+ * Copy the object at pos in the reused pack to f, which is at *out_pos,
+ * rewriting the distance to its base if it is an OFS_DELTA and objects
+ * were left out between the two.
+ */
+static void write_reused_pack_one(struct pack_revindex *revindex, size_t pos,
+				  struct sha1file *f, off_t *out_pos,
+				  struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	enum object_type type;
+	unsigned long size;
+
+	offset = pack_pos_to_offset(revindex, pos);
+	next = pack_pos_to_offset(revindex, pos + 1);
+
+	record_reused_object(offset, offset - *out_pos);
+
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	assert(type >= 0);
+
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		off_t fixup;
+
+		unsigned char header[10];
+		unsigned len;
+
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur,
+					     type, offset);
+		assert(base_offset != 0);
+
+		/* Objects between it and its base were left out... */
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char ofs_header[10];
+			unsigned i, ofs_len;
+			off_t ofs = offset - base_offset - fixup;
+
+			len = encode_in_pack_object_header(OBJ_OFS_DELTA, size,
+							   header);
+
+			i = sizeof(ofs_header) - 1;
+			ofs_header[i] = ofs & 127;
+			while (ofs >>= 7)
+				ofs_header[--i] = 128 | (--ofs & 127);
+
+			ofs_len = sizeof(ofs_header) - i;
+
+			sha1write(f, header, len);
+			sha1write(f, ofs_header + sizeof(ofs_header) - ofs_len,
+				  ofs_len);
+			copy_pack_data(f, reuse_packfile, w_curs, cur,
+				       next - cur);
+			*out_pos += len + ofs_len + (next - cur);
+			return;
+		}
+
+		/* ...otherwise it can be written verbatim */
+	}
+
+	copy_pack_data(f, reuse_packfile, w_curs, offset, next - offset);
+	*out_pos += next - offset;
+}
+
+/*
+ * Send the run of whole bitmap words at the start of the reused pack
+ * with plain reads, and return the number of words sent.
+ */
+static size_t write_reused_pack_verbatim(struct pack_revindex *revindex,
+					 struct sha1file *f, off_t *out_pos)
 {
 	unsigned char buffer[8192];
 	off_t to_write, total;
+	size_t pos = 0;
+	uint32_t nr;
 	int fd;
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	while (pos < reuse_packfile_bitmap->word_alloc &&
+	       reuse_packfile_bitmap->words[pos] == (eword_t)~0)
+		pos++;
+	if (!pos)
+		return 0;
+
+	nr = pos * BITS_IN_WORD;
+	if (nr > reuse_packfile->num_objects)
+		nr = reuse_packfile->num_objects;
 
 	fd = git_open_noatime(reuse_packfile->pack_name);
 	if (fd < 0)
@@ -722,10 +874,8 @@ static off_t write_reused_pack(struct sha1file *f)
 	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
 		die_errno("unable to seek in reused packfile");
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - 20;
-
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	total = to_write = pack_pos_to_offset(revindex, nr) -
+		sizeof(struct pack_header);
 
 	while (to_write) {
 		int read_pack = xread(fd, buffer, sizeof(buffer));
@@ -747,15 +897,48 @@ static off_t write_reused_pack(struct sha1file *f)
 		 * smooth progress meter, and at the end it matches the true
 		 * answer.
 		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
+		written = nr * (((double)(total - to_write)) / total);
 		display_progress(progress_state, written);
 	}
 
 	close(fd);
-	written = reuse_packfile_objects;
+	written = nr;
 	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+	*out_pos += total;
+	return pos;
+}
+
+static off_t write_reused_pack(struct sha1file *f)
+{
+	struct pack_revindex *revindex;
+	struct pack_window *w_curs = NULL;
+	off_t out_pos = sizeof(struct pack_header);
+	size_t i;
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
+	revindex = revindex_for_pack(reuse_packfile);
+
+	i = write_reused_pack_verbatim(revindex, f, &out_pos);
+
+	for (; i < reuse_packfile_bitmap->word_alloc; ++i) {
+		eword_t word = reuse_packfile_bitmap->words[i];
+		size_t pos = (i * BITS_IN_WORD);
+		uint32_t offset;
+
+		for (offset = 0; offset < BITS_IN_WORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(revindex, pos + offset, f,
+					      &out_pos, &w_curs);
+			display_progress(progress_state, ++written);
+		}
+	}
+
+	unuse_pack(&w_curs);
+	return out_pos - sizeof(struct pack_header);
 }
 
 static void write_pack_file(void)
@@ -844,7 +1027,8 @@ static void write_pack_file(void)
 
 			if (write_bitmap_index) {
 				bitmap_writer_set_checksum(sha1);
-				bitmap_writer_build_type_index(written_list, nr_written);
+				bitmap_writer_build_type_index(
+					&to_pack, written_list, nr_written);
 			}
 
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
@@ -993,14 +1177,13 @@ static void create_object_entry(const unsigned char *sha1,
 
 	entry = packlist_alloc(&to_pack, sha1, index_pos);
 	entry->hash = hash;
-	if (type)
-		entry->type = type;
+	oe_set_type(entry, type);
 	if (exclude)
 		entry->preferred_base = 1;
 	else
 		nr_result++;
 	if (found_pack) {
-		entry->in_pack = found_pack;
+		oe_set_in_pack(&to_pack, entry, found_pack);
 		entry->in_pack_offset = found_offset;
 	}
 
@@ -1325,13 +1508,16 @@ static void cleanup_preferred_base(void)
 
 static void check_object(struct object_entry *entry)
 {
-	if (entry->in_pack) {
-		struct packed_git *p = entry->in_pack;
+	unsigned long canonical_size;
+	enum object_type type;
+
+	if (IN_PACK(entry)) {
+		struct packed_git *p = IN_PACK(entry);
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
 		unsigned long used, used_0;
-		unsigned long avail;
+		unsigned long avail, in_pack_size;
 		off_t ofs;
 		unsigned char *buf, c;
 
@@ -1342,10 +1528,11 @@ static void check_object(struct object_entry *entry)
 		 * since non-delta representations could still be reused.
 		 */
 		used = unpack_object_header_buffer(buf, avail,
-						   &entry->in_pack_type,
-						   &entry->size);
+						   &type, &in_pack_size);
 		if (used == 0)
 			goto give_up;
+		entry->in_pack_type = type;
+		SET_SIZE(entry, in_pack_size);
 
 		/*
 		 * Determine if this is a delta and if so whether we can
@@ -1355,9 +1542,9 @@ static void check_object(struct object_entry *entry)
 		switch (entry->in_pack_type) {
 		default:
 			/* Not a delta hence we've already got all we need. */
-			entry->type = entry->in_pack_type;
+			oe_set_type(entry, entry->in_pack_type);
 			entry->in_pack_header_size = used;
-			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
+			if (oe_type(entry) < OBJ_COMMIT || oe_type(entry) > OBJ_BLOB)
 				goto give_up;
 			unuse_pack(&w_curs);
 			return;
@@ -1390,17 +1577,17 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t nr;
+				if (find_pack_revindex(p, ofs, &nr, NULL))
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p, nr);
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(entry->idx.sha1, base_entry->idx.sha1)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1411,24 +1598,24 @@ static void check_object(struct object_entry *entry)
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
 			 */
-			entry->type = entry->in_pack_type;
-			entry->delta = base_entry;
-			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			oe_set_type(entry, entry->in_pack_type);
+			SET_DELTA(entry, base_entry);
+			SET_DELTA_SIZE(entry, in_pack_size);
+			SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
+			SET_DELTA_CHILD(base_entry, entry);
 			unuse_pack(&w_curs);
 			return;
 		}
 
-		if (entry->type) {
+		if (oe_type(entry)) {
 			/*
 			 * This must be a delta and we already know what the
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
-			entry->size = get_size_from_delta(p, &w_curs,
-					entry->in_pack_offset + entry->in_pack_header_size);
-			if (entry->size == 0)
+			SET_SIZE(entry, get_size_from_delta(p, &w_curs,
+					entry->in_pack_offset + entry->in_pack_header_size));
+			if (SIZE(entry) == 0)
 				goto give_up;
 			unuse_pack(&w_curs);
 			return;
@@ -1443,7 +1630,10 @@ static void check_object(struct object_entry *entry)
 		unuse_pack(&w_curs);
 	}
 
-	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+	type = sha1_object_info(entry->idx.sha1, &canonical_size);
+	oe_set_type(entry, type);
+	if (type >= 0)
+		SET_SIZE(entry, canonical_size);
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1458,12 +1648,12 @@ static int pack_offset_sort(const void *_a, const void *_b)
 	const struct object_entry *b = *(struct object_entry **)_b;
 
 	/* avoid filesystem trashing with loose objects */
-	if (!a->in_pack && !b->in_pack)
+	if (!IN_PACK(a) && !IN_PACK(b))
 		return hashcmp(a->idx.sha1, b->idx.sha1);
 
-	if (a->in_pack < b->in_pack)
+	if (IN_PACK(a) < IN_PACK(b))
 		return -1;
-	if (a->in_pack > b->in_pack)
+	if (IN_PACK(a) > IN_PACK(b))
 		return 1;
 	return a->in_pack_offset < b->in_pack_offset ? -1 :
 			(a->in_pack_offset > b->in_pack_offset);
@@ -1482,7 +1672,7 @@ static void get_object_details(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
 		check_object(entry);
-		if (big_file_threshold < entry->size)
+		if (big_file_threshold < SIZE(entry))
 			entry->no_try_delta = 1;
 	}
 
@@ -1503,9 +1693,9 @@ static int type_size_sort(const void *_a, const void *_b)
 	const struct object_entry *a = *(struct object_entry **)_a;
 	const struct object_entry *b = *(struct object_entry **)_b;
 
-	if (a->type > b->type)
+	if (oe_type(a) > oe_type(b))
 		return -1;
-	if (a->type < b->type)
+	if (oe_type(a) < oe_type(b))
 		return 1;
 	if (a->hash > b->hash)
 		return -1;
@@ -1515,9 +1705,14 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
-	if (a->size > b->size)
+	if (use_delta_islands) {
+		int cmp = island_delta_cmp(a->idx.sha1, b->idx.sha1);
+		if (cmp)
+			return cmp;
+	}
+	if (SIZE(a) > SIZE(b))
 		return -1;
-	if (a->size < b->size)
+	if (SIZE(a) < SIZE(b))
 		return 1;
 	return a < b ? -1 : (a > b);  /* newest first */
 }
@@ -1581,7 +1776,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	void *delta_buf;
 
 	/* Don't bother doing diffs between different types */
-	if (trg_entry->type != src_entry->type)
+	if (oe_type(trg_entry) != oe_type(src_entry))
 		return -1;
 
 	/*
@@ -1592,31 +1787,36 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * it, we will still save the transfer cost, as we already know
 	 * the other side has it and we won't send src_entry at all.
 	 */
-	if (reuse_delta && trg_entry->in_pack &&
-	    trg_entry->in_pack == src_entry->in_pack &&
+	if (reuse_delta && IN_PACK(trg_entry) &&
+	    IN_PACK(trg_entry) == IN_PACK(src_entry) &&
 	    !src_entry->preferred_base &&
 	    trg_entry->in_pack_type != OBJ_REF_DELTA &&
 	    trg_entry->in_pack_type != OBJ_OFS_DELTA)
 		return 0;
 
+	/* Don't make trg depend on a base some of its islands lack. */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
 		return 0;
 
 	/* Now some size filtering heuristics. */
-	trg_size = trg_entry->size;
-	if (!trg_entry->delta) {
+	trg_size = SIZE(trg_entry);
+	if (!DELTA(trg_entry)) {
 		max_size = trg_size/2 - 20;
 		ref_depth = 1;
 	} else {
-		max_size = trg_entry->delta_size;
+		max_size = DELTA_SIZE(trg_entry);
 		ref_depth = trg->depth;
 	}
 	max_size = (uint64_t)max_size * (max_depth - src->depth) /
 						(max_depth - ref_depth + 1);
 	if (max_size == 0)
 		return 0;
-	src_size = src_entry->size;
+	src_size = SIZE(src_entry);
 	sizediff = src_size < trg_size ? trg_size - src_size : 0;
 	if (sizediff >= max_size)
 		return 0;
@@ -1677,9 +1877,9 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (!delta_buf)
 		return 0;
 
-	if (trg_entry->delta) {
+	if (DELTA(trg_entry)) {
 		/* Prefer only shallower same-sized deltas. */
-		if (delta_size == trg_entry->delta_size &&
+		if (delta_size == DELTA_SIZE(trg_entry) &&
 		    src->depth + 1 >= trg->depth) {
 			free(delta_buf);
 			return 0;
@@ -1694,7 +1894,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	free(trg_entry->delta_data);
 	cache_lock();
 	if (trg_entry->delta_data) {
-		delta_cache_size -= trg_entry->delta_size;
+		delta_cache_size -= DELTA_SIZE(trg_entry);
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
@@ -1706,8 +1906,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		free(delta_buf);
 	}
 
-	trg_entry->delta = src_entry;
-	trg_entry->delta_size = delta_size;
+	SET_DELTA(trg_entry, src_entry);
+	SET_DELTA_SIZE(trg_entry, delta_size);
 	trg->depth = src->depth + 1;
 
 	return 1;
@@ -1715,13 +1915,13 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 {
-	struct object_entry *child = me->delta_child;
+	struct object_entry *child = DELTA_CHILD(me);
 	unsigned int m = n;
 	while (child) {
 		unsigned int c = check_delta_limit(child, n + 1);
 		if (m < c)
 			m = c;
-		child = child->delta_sibling;
+		child = DELTA_SIBLING(child);
 	}
 	return m;
 }
@@ -1732,7 +1932,7 @@ static unsigned long free_unpacked(struct unpacked *n)
 	free_delta_index(n->index);
 	n->index = NULL;
 	if (n->data) {
-		freed_mem += n->entry->size;
+		freed_mem += SIZE(n->entry);
 		free(n->data);
 		n->data = NULL;
 	}
@@ -1741,8 +1941,25 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
+struct thread_params;
+
+#ifndef NO_PTHREADS
+static int claim_delta_work(struct thread_params *me,
+			    struct object_entry ***list, unsigned *list_size);
+#else
+#define claim_delta_work(me, list, list_size)	0
+#endif
+
+/*
+ * Search for deltas among the *list_size objects of list.  When called
+ * from a delta search thread, "me" is not NULL, and more work is
+ * claimed from the scheduler once the list is exhausted; the window is
+ * kept, so that the objects just before the new work can still be used
+ * as delta bases.
+ */
 static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
+			int window, int depth, unsigned *processed,
+			struct thread_params *me)
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
@@ -1756,7 +1973,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		int j, max_depth, best_base = -1;
 
 		progress_lock();
-		if (!*list_size) {
+		if (!*list_size &&
+		    !(me && claim_delta_work(me, &list, list_size))) {
 			progress_unlock();
 			break;
 		}
@@ -1791,7 +2009,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * otherwise they would become too deep.
 		 */
 		max_depth = depth;
-		if (entry->delta_child) {
+		if (DELTA_CHILD(entry)) {
 			max_depth -= check_delta_limit(entry, 0);
 			if (max_depth <= 0)
 				goto next;
@@ -1829,19 +2047,31 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * between writes at that moment.
 		 */
 		if (entry->delta_data && !pack_to_stdout) {
-			entry->z_delta_size = do_compress(&entry->delta_data,
-							  entry->delta_size);
-			cache_lock();
-			delta_cache_size -= entry->delta_size;
-			delta_cache_size += entry->z_delta_size;
-			cache_unlock();
+			unsigned long size;
+
+			size = do_compress(&entry->delta_data, DELTA_SIZE(entry));
+			if (size < (1U << OE_Z_DELTA_BITS)) {
+				entry->z_delta_size = size;
+				cache_lock();
+				delta_cache_size -= DELTA_SIZE(entry);
+				delta_cache_size += entry->z_delta_size;
+				cache_unlock();
+			} else {
+				/* no room to remember its size: recompute it */
+				free(entry->delta_data);
+				entry->delta_data = NULL;
+				entry->z_delta_size = 0;
+				cache_lock();
+				delta_cache_size -= DELTA_SIZE(entry);
+				cache_unlock();
+			}
 		}
 
 		/* if we made n a delta, and if n is already at max
 		 * depth, leaving it in the window is pointless.  we
 		 * should evict it first.
 		 */
-		if (entry->delta && max_depth <= n->depth)
+		if (DELTA(entry) && max_depth <= n->depth)
 			continue;
 
 		/*
@@ -1849,7 +2079,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * currently deltified object, to keep it longer.  It will
 		 * be the first base object to be attempted next.
 		 */
-		if (entry->delta) {
+		if (DELTA(entry)) {
 			struct unpacked swap = array[best_base];
 			int dist = (window + idx - best_base) % window;
 			int dst = best_base;
@@ -1888,29 +2118,43 @@ static void try_to_free_from_threads(size_t size)
 static try_to_free_t old_try_to_free_routine;
 
 /*
- * The main thread waits on the condition that (at least) one of the workers
- * has stopped working (which is indicated in the .working member of
- * struct thread_params).
- * When a work thread has completed its work, it sets .working to 0 and
- * signals the main thread and waits on the condition that .data_ready
- * becomes 1.
+ * The delta search is scheduled by work stealing.  The sorted list is cut
+ * into units, on "path" boundaries when the paths are not too large, and
+ * each thread is dealt a contiguous run of units.  A thread works
+ * through its own units from the front, keeping its window from one
+ * unit to the next so that deltas can still cross the boundaries; once
+ * it runs out, it steals the back half of the units left to the thread
+ * with the most of them.  All of this happens under progress_lock(),
+ * which find_deltas() takes for each object anyway.
  */
 
+struct delta_unit {
+	unsigned start;
+	unsigned nr;
+};
+
 struct thread_params {
 	pthread_t thread;
 	struct object_entry **list;
-	unsigned list_size;
 	unsigned remaining;
 	int window;
 	int depth;
-	int working;
-	int data_ready;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
 	unsigned *processed;
+
+	/* our units are delta_units[unit_next..unit_end-1] */
+	unsigned unit_next;
+	unsigned unit_end;
+
+	/* for GIT_TRACE_PERFORMANCE */
+	uint64_t busy;
+	unsigned nr_objects;
+	unsigned nr_steals;
 };
 
-static pthread_cond_t progress_cond;
+static struct object_entry **delta_list;
+static struct delta_unit *delta_units;
+static struct thread_params *delta_threads;
+static int nr_delta_threads;
 
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
@@ -1920,47 +2164,93 @@ static void init_threaded_search(void)
 	init_recursive_mutex(&read_mutex);
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
 	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
 
 static void cleanup_threaded_search(void)
 {
 	set_try_to_free_routine(old_try_to_free_routine);
-	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&read_mutex);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
 
-static void *threaded_find_deltas(void *arg)
+/*
+ * Cut list into units of about unit_size objects, ending them on a
+ * "path" boundary unless the path goes on for another unit_size.
+ */
+static unsigned cut_delta_units(struct object_entry **list, unsigned list_size,
+				unsigned unit_size, struct delta_unit *units)
 {
-	struct thread_params *me = arg;
+	unsigned nr = 0, start = 0;
 
-	while (me->remaining) {
-		find_deltas(me->list, &me->remaining,
-			    me->window, me->depth, me->processed);
+	while (start < list_size) {
+		unsigned end = start + unit_size;
+		unsigned limit = end + unit_size;
 
-		progress_lock();
-		me->working = 0;
-		pthread_cond_signal(&progress_cond);
-		progress_unlock();
+		if (end >= list_size) {
+			end = list_size;
+		} else {
+			while (end < list_size && end < limit &&
+			       list[end]->hash &&
+			       list[end]->hash == list[end-1]->hash)
+				end++;
+			if (end == limit && end < list_size &&
+			    list[end]->hash == list[end-1]->hash)
+				end = start + unit_size;
+		}
+		units[nr].start = start;
+		units[nr].nr = end - start;
+		nr++;
+		start = end;
+	}
+	return nr;
+}
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		pthread_mutex_lock(&me->mutex);
-		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
-		me->data_ready = 0;
-		pthread_mutex_unlock(&me->mutex);
+/* Called with progress_lock() held. */
+static int claim_delta_work(struct thread_params *me,
+			    struct object_entry ***list, unsigned *list_size)
+{
+	struct delta_unit *unit;
+
+	if (me->unit_next >= me->unit_end) {
+		struct thread_params *victim = NULL;
+		unsigned nr;
+		int i;
+
+		for (i = 0; i < nr_delta_threads; i++) {
+			struct thread_params *p = &delta_threads[i];
+			if (p->unit_next < p->unit_end &&
+			    (!victim || victim->unit_end - victim->unit_next <
+					p->unit_end - p->unit_next))
+				victim = p;
+		}
+		if (!victim)
+			return 0;
+
+		nr = (victim->unit_end - victim->unit_next + 1) / 2;
+		me->unit_end = victim->unit_end;
+		me->unit_next = victim->unit_end - nr;
+		victim->unit_end = me->unit_next;
+		me->nr_steals++;
 	}
-	/* leave ->working 1 so that this doesn't get more work assigned */
+
+	unit = &delta_units[me->unit_next++];
+	*list = delta_list + unit->start;
+	*list_size = unit->nr;
+	me->nr_objects += unit->nr;
+	return 1;
+}
+
+static void *threaded_find_deltas(void *arg)
+{
+	struct thread_params *me = arg;
+	uint64_t start = getnanotime();
+
+	find_deltas(me->list, &me->remaining,
+		    me->window, me->depth, me->processed, me);
+
+	me->busy = getnanotime() - start;
 	return NULL;
 }
 
@@ -1968,133 +2258,81 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
 	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	unsigned unit_size, nr_units, per_thread;
+	uint64_t start, elapsed;
+	int i, ret;
 
 	init_threaded_search();
 
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		find_deltas(list, &list_size, window, depth, processed, NULL);
 		cleanup_threaded_search();
 		return;
 	}
 	if (progress > pack_to_stdout)
 		fprintf(stderr, "Delta compression using up to %d threads.\n",
 				delta_search_threads);
-	p = xcalloc(delta_search_threads, sizeof(*p));
-
-	/* Partition the work amongst work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		unsigned sub_size = list_size / (delta_search_threads - i);
-
-		/* don't use too small segments or no deltas will be found */
-		if (sub_size < 2*window && i+1 < delta_search_threads)
-			sub_size = 0;
 
+	/*
+	 * Cut enough units for the work to be stolen in small pieces,
+	 * but not so small that a thread cannot fill its window.
+	 */
+	unit_size = list_size / (delta_search_threads * 16);
+	if (unit_size < 2 * window)
+		unit_size = 2 * window;
+	delta_list = list;
+	delta_units = xmalloc(sizeof(*delta_units) *
+			      (list_size / unit_size + 1));
+	nr_units = cut_delta_units(list, list_size, unit_size, delta_units);
+
+	nr_delta_threads = delta_search_threads;
+	if (nr_delta_threads > nr_units)
+		nr_delta_threads = nr_units;
+	delta_threads = p = xcalloc(nr_delta_threads, sizeof(*p));
+
+	/* Deal each thread a contiguous run of units. */
+	per_thread = nr_units / nr_delta_threads;
+	for (i = 0; i < nr_delta_threads; i++) {
 		p[i].window = window;
 		p[i].depth = depth;
 		p[i].processed = processed;
-		p[i].working = 1;
-		p[i].data_ready = 0;
-
-		/* try to split chunks on "path" boundaries */
-		while (sub_size && sub_size < list_size &&
-		       list[sub_size]->hash &&
-		       list[sub_size]->hash == list[sub_size-1]->hash)
-			sub_size++;
-
-		p[i].list = list;
-		p[i].list_size = sub_size;
-		p[i].remaining = sub_size;
-
-		list += sub_size;
-		list_size -= sub_size;
+		p[i].unit_next = i * per_thread;
+		p[i].unit_end = i + 1 < nr_delta_threads ?
+			(i + 1) * per_thread : nr_units;
 	}
 
-	/* Start work threads. */
-	for (i = 0; i < delta_search_threads; i++) {
-		if (!p[i].list_size)
-			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
-		pthread_cond_init(&p[i].cond, NULL);
+	start = getnanotime();
+	for (i = 0; i < nr_delta_threads; i++) {
 		ret = pthread_create(&p[i].thread, NULL,
 				     threaded_find_deltas, &p[i]);
 		if (ret)
 			die("unable to create thread: %s", strerror(ret));
-		active_threads++;
 	}
+	for (i = 0; i < nr_delta_threads; i++)
+		pthread_join(p[i].thread, NULL);
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		progress_lock();
-		for (;;) {
-			for (i = 0; !target && i < delta_search_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
-		}
-
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		progress_unlock();
-
-		pthread_mutex_lock(&target->mutex);
-		target->data_ready = 1;
-		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
-
-		if (!sub_size) {
-			pthread_join(target->thread, NULL);
-			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
-			active_threads--;
-		}
+	elapsed = getnanotime() - start;
+	for (i = 0; i < nr_delta_threads; i++) {
+		trace_performance(p[i].busy,
+				  "delta search thread %d: busy, %u objects, %u steals",
+				  i, p[i].nr_objects, p[i].nr_steals);
+		trace_performance(elapsed - p[i].busy,
+				  "delta search thread %d: idle", i);
 	}
+	trace_performance(elapsed, "delta search on %d threads",
+			  nr_delta_threads);
+
 	cleanup_threaded_search();
+	free(delta_units);
+	delta_units = NULL;
+	delta_list = NULL;
 	free(p);
+	delta_threads = NULL;
+	nr_delta_threads = 0;
 }
 
 #else
-#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
+#define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p, NULL)
 #endif
 
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
@@ -2135,13 +2373,13 @@ static void prepare_pack(int window, int depth)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = to_pack.objects + i;
 
-		if (entry->delta)
+		if (DELTA(entry))
 			/* This happens if we decided to reuse existing
 			 * delta from a pack.  "reuse_delta &&" is implied.
 			 */
 			continue;
 
-		if (entry->size < 50)
+		if (SIZE(entry) < 50)
 			continue;
 
 		if (entry->no_try_delta)
@@ -2149,11 +2387,11 @@ static void prepare_pack(int window, int depth)
 
 		if (!entry->preferred_base) {
 			nr_deltas++;
-			if (entry->type < 0)
+			if (oe_type(entry) < 0)
 				die("unable to get type of object %s",
 				    sha1_to_hex(entry->idx.sha1));
 		} else {
-			if (entry->type < 0) {
+			if (oe_type(entry) < 0) {
 				/*
 				 * This object is not found, but we
 				 * don't have to include it anyway.
@@ -2217,6 +2455,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index = git_config_bool(k, v);
 		return 0;
@@ -2232,6 +2477,8 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.island"))
+		return island_config(k, v);
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2239,6 +2486,13 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2282,6 +2536,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj,
@@ -2294,6 +2551,19 @@ static void show_object(struct object *obj,
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		struct object_entry *ent;
+		const char *p;
+		unsigned depth = *name ? 1 : 0;
+
+		for (p = name; *p; p++)
+			if (*p == '/')
+				depth++;
+		ent = packlist_find(&to_pack, obj->sha1, NULL);
+		if (ent && depth > oe_tree_depth(&to_pack, ent))
+			oe_set_tree_depth(&to_pack, ent, depth);
+	}
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2469,7 +2739,7 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
@@ -2686,6 +2956,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
 		OPT_END(),
 	};
 
@@ -2764,7 +3036,18 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
 		unpack_unreachable_expiration = 0;
 
-	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow())
+	if (use_delta_islands && !use_internal_rev_list)
+		die("--delta-islands needs the objects to pack from a revision walk.");
+	/*
+	 * Islands are passed on from children to parents, so the walk must
+	 * show every child first whatever the commit dates say.
+	 */
+	if (use_delta_islands)
+		argv_array_push(&rp, "--topo-order");
+
+	/* the islands are computed while walking the objects */
+	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow() ||
+	    use_delta_islands)
 		use_bitmap_index = 0;
 
 	if (pack_to_stdout || !rev_list_all)
@@ -2774,6 +3057,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	prepare_packed_git();
+	prepare_packing_data(&to_pack);
+
+	if (use_delta_islands) {
+		load_delta_islands(progress);
+		to_pack.tree_depth = xcalloc(to_pack.nr_alloc + 1,
+					     sizeof(*to_pack.tree_depth));
+	}
 
 	if (progress)
 		progress_state = start_progress(_("Counting objects"), 0);
@@ -2788,6 +3078,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		for_each_ref(add_ref_tag, NULL);
 	stop_progress(&progress_state);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
 	if (non_empty && !nr_result)
 		return 0;
 	if (nr_result)
@@ -313,6 +313,24 @@ static int should_expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
 	return 0;
 }
 
+/*
+ * Entries that are neither older than expire_total nor than
+ * expire_unreachable are kept, unless --stale-fix or deleting a
+ * single entry means that each has to be looked at.
+ */
+static time_t reflog_expiry_keep_since(void *cb_data)
+{
+	struct expire_reflog_policy_cb *cb = cb_data;
+	time_t since;
+
+	if (cb->cmd.stalefix || cb->cmd.recno)
+		return 0;
+	since = cb->cmd.expire_total;
+	if (since < cb->cmd.expire_unreachable)
+		since = cb->cmd.expire_unreachable;
+	return since ? since : 1;
+}
+
 static int push_tip_to_list(const char *refname, const unsigned char *sha1,
 			    int flags, void *cb_data)
 {
@@ -597,6 +615,7 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 			status |= reflog_expire(e->reflog, e->sha1, flags,
 						reflog_expiry_prepare,
 						should_expire_reflog_ent,
+						reflog_expiry_keep_since,
 						reflog_expiry_cleanup,
 						&cb);
 			free(e);
@@ -615,6 +634,7 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 		status |= reflog_expire(ref, sha1, flags,
 					reflog_expiry_prepare,
 					should_expire_reflog_ent,
+					reflog_expiry_keep_since,
 					reflog_expiry_cleanup,
 					&cb);
 	}
@@ -691,6 +711,7 @@ static int cmd_reflog_delete(int argc, const char **argv, const char *prefix)
 		status |= reflog_expire(ref, sha1, flags,
 					reflog_expiry_prepare,
 					should_expire_reflog_ent,
+					reflog_expiry_keep_since,
 					reflog_expiry_cleanup,
 					&cb);
 		free(ref);
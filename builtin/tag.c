@@ -17,6 +17,7 @@
 #include "gpg-interface.h"
 #include "sha1-array.h"
 #include "column.h"
+#include "commit-graph.h"
 
 static const char * const git_tag_usage[] = {
 	N_("git tag [-a | -s | -u <key-id>] [-f] [-m <msg> | -F <file>] <tagname> [<head>]"),
@@ -91,9 +92,13 @@ enum contains_result {
 /*
  * Test whether the candidate or one of its parents is contained in the list.
  * Do not recurse to find out, though, but return -1 if inconclusive.
+ *
+ * A candidate whose generation number is below "cutoff", the lowest
+ * generation among the wanted commits, cannot reach any of them.
  */
 static enum contains_result contains_test(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	/* was it previously marked as containing a want commit? */
 	if (candidate->object.flags & TMP_MARK)
@@ -110,6 +115,11 @@ static enum contains_result contains_test(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	if (candidate->generation < cutoff) {
+		candidate->object.flags |= UNINTERESTING;
+		return 0;
+	}
+
 	return -1;
 }
 
@@ -140,7 +150,17 @@ static enum contains_result contains(struct commit *candidate,
 		const struct commit_list *want)
 {
 	struct stack stack = { 0, 0, NULL };
-	int result = contains_test(candidate, want);
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	const struct commit_list *p;
+	int result;
+
+	for (p = want; p; p = p->next) {
+		uint32_t generation = commit_graph_generation(p->item);
+		if (generation < cutoff)
+			cutoff = generation;
+	}
+
+	result = contains_test(candidate, want, cutoff);
 
 	if (result != CONTAINS_UNKNOWN)
 		return result;
@@ -159,7 +179,7 @@ static enum contains_result contains(struct commit *candidate,
 		 * If we just popped the stack, parents->item has been marked,
 		 * therefore contains_test will return a meaningful 0 or 1.
 		 */
-		else switch (contains_test(parents->item, want)) {
+		else switch (contains_test(parents->item, want, cutoff)) {
 		case CONTAINS_YES:
 			commit->object.flags |= TMP_MARK;
 			stack.nr--;
@@ -173,7 +193,7 @@ static enum contains_result contains(struct commit *candidate,
 		}
 	}
 	free(stack.stack);
-	return contains_test(candidate, want);
+	return contains_test(candidate, want, cutoff);
 }
 
 static void show_tag_lines(const unsigned char *sha1, int lines)
@@ -6,11 +6,13 @@
 #define VERIFY_PACK_VERBOSE 01
 #define VERIFY_PACK_STAT_ONLY 02
 
-static int verify_one_pack(const char *path, unsigned int flags)
+static int verify_one_pack(const char *path, unsigned int flags,
+			   const char *threads)
 {
 	struct child_process index_pack = CHILD_PROCESS_INIT;
-	const char *argv[] = {"index-pack", NULL, NULL, NULL };
+	const char *argv[] = {"index-pack", NULL, NULL, NULL, NULL };
 	struct strbuf arg = STRBUF_INIT;
+	struct strbuf threads_arg = STRBUF_INIT;
 	int verbose = flags & VERIFY_PACK_VERBOSE;
 	int stat_only = flags & VERIFY_PACK_STAT_ONLY;
 	int err;
@@ -31,6 +33,10 @@ static int verify_one_pack(const char *path, unsigned int flags)
 	    !ends_with(arg.buf, ".pack"))
 		strbuf_addstr(&arg, ".pack");
 	argv[2] = arg.buf;
+	if (threads) {
+		strbuf_addf(&threads_arg, "--threads=%s", threads);
+		argv[3] = threads_arg.buf;
+	}
 
 	index_pack.argv = argv;
 	index_pack.git_cmd = 1;
@@ -46,12 +52,13 @@ static int verify_one_pack(const char *path, unsigned int flags)
 		}
 	}
 	strbuf_release(&arg);
+	strbuf_release(&threads_arg);
 
 	return err;
 }
 
 static const char * const verify_pack_usage[] = {
-	N_("git verify-pack [-v | --verbose] [-s | --stat-only] <pack>..."),
+	N_("git verify-pack [-v | --verbose] [-s | --stat-only] [--threads=<n>] <pack>..."),
 	NULL
 };
 
@@ -59,12 +66,15 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix)
 {
 	int err = 0;
 	unsigned int flags = 0;
+	const char *threads = NULL;
 	int i;
 	const struct option verify_pack_options[] = {
 		OPT_BIT('v', "verbose", &flags, N_("verbose"),
 			VERIFY_PACK_VERBOSE),
 		OPT_BIT('s', "stat-only", &flags, N_("show statistics only"),
 			VERIFY_PACK_STAT_ONLY),
+		OPT_STRING(0, "threads", &threads, N_("n"),
+			   N_("use <n> threads to resolve deltas")),
 		OPT_END()
 	};
 
@@ -74,7 +84,7 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix)
 	if (argc < 1)
 		usage_with_options(verify_pack_usage, verify_pack_options);
 	for (i = 0; i < argc; i++) {
-		if (verify_one_pack(argv[i], flags))
+		if (verify_one_pack(argv[i], flags, threads))
 			err = 1;
 	}
 
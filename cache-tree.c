@@ -42,7 +42,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -69,7 +69,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -123,7 +123,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -293,14 +293,25 @@ static int update_one(struct cache_tree *it,
 		 */
 		sublen = slash - (path + baselen);
 		sub = find_subtree(it, path + baselen, sublen, 1);
-		if (!sub->cache_tree)
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    pathlen == baselen + sublen + 1) {
+			/* a sparse directory entry is the whole subtree */
+			cache_tree_free(&sub->cache_tree);
 			sub->cache_tree = cache_tree();
-		subcnt = update_one(sub->cache_tree,
-				    cache + i, entries - i,
-				    path,
-				    baselen + sublen + 1,
-				    &subskip,
-				    flags);
+			sub->cache_tree->entry_count = 1;
+			hashcpy(sub->cache_tree->sha1, ce->sha1);
+			subcnt = 1;
+			subskip = 0;
+		} else {
+			if (!sub->cache_tree)
+				sub->cache_tree = cache_tree();
+			subcnt = update_one(sub->cache_tree,
+					    cache + i, entries - i,
+					    path,
+					    baselen + sublen + 1,
+					    &subskip,
+					    flags);
+		}
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
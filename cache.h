@@ -77,6 +77,12 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/*
+ * A sparse directory entry of a sparse index (see sparse-index.h)
+ * stands for a whole tree and has a bare S_IFDIR mode.
+ */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -178,6 +184,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21)
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -297,8 +304,12 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define RESOLVE_UNDO_CHANGED	(1 << 4)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
+#define UNTRACKED_CHANGED	(1 << 7)
+#define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
+struct ewah_bitmap;
+struct untracked_cache;
 struct index_state {
 	struct cache_entry **cache;
 	unsigned int version;
@@ -306,12 +317,17 @@ struct index_state {
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
 	struct split_index *split_index;
+	struct untracked_cache *untracked;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
+	uint64_t fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
 };
 
 extern struct index_state the_index;
@@ -331,6 +347,7 @@ extern void free_name_hash(struct index_state *istate);
 
 #define read_cache() read_index(&the_index)
 #define read_cache_from(path) read_index_from(&the_index, (path))
+#define read_cache_sparse() read_index_sparse(&the_index)
 #define read_cache_preload(pathspec) read_index_preload(&the_index, (pathspec))
 #define is_cache_unborn() is_index_unborn(&the_index)
 #define read_cache_unmerged() read_index_unmerged(&the_index)
@@ -497,6 +514,14 @@ extern int read_index_preload(struct index_state *, const struct pathspec *paths
 extern int do_read_index(struct index_state *istate, const char *path,
 			 int must_exist); /* for testting only! */
 extern int read_index_from(struct index_state *, const char *path);
+/*
+ * Read the index without expanding its sparse directories, for callers
+ * that only look paths up with index_name_pos().  index_name_pos()
+ * does not look inside sparse directories: call expand_to_path() (see
+ * sparse-index.h) first for a path that may be inside one.  A later
+ * read_index() expands the index as usual.
+ */
+extern int read_index_sparse(struct index_state *);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
 #define COMMIT_LOCK		(1 << 0)
@@ -542,6 +567,8 @@ extern void *read_blob_data_from_index(struct index_state *, const char *, unsig
 #define CE_MATCH_IGNORE_MISSING		0x08
 /* enable stat refresh */
 #define CE_MATCH_REFRESH		0x10
+/* lstat() even if CE_FSMONITOR_VALID is true */
+#define CE_MATCH_IGNORE_FSMONITOR	0x20
 extern int ie_match_stat(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 extern int ie_modified(const struct index_state *, const struct cache_entry *, struct stat *, unsigned int);
 
@@ -564,6 +591,20 @@ extern void fill_stat_data(struct stat_data *sd, struct stat *st);
  */
 extern int match_stat_data(const struct stat_data *sd, struct stat *st);
 
+/*
+ * Return 1 if sd was recorded so close to istate's timestamp that a
+ * change in the same second may have gone unnoticed.
+ */
+extern int is_racy_stat(const struct index_state *istate,
+			const struct stat_data *sd);
+
+/*
+ * Like match_stat_data(), but also consider the data changed if it
+ * is racy.
+ */
+extern int match_stat_data_racy(const struct index_state *istate,
+				const struct stat_data *sd, struct stat *st);
+
 extern void fill_stat_cache_info(struct cache_entry *ce, struct stat *st);
 
 #define REFRESH_REALLY		0x0001	/* ignore_valid */
@@ -605,6 +646,7 @@ extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
 extern unsigned long big_file_threshold;
+extern unsigned long delta_stream_buffer_size;
 extern unsigned long pack_size_limit_cfg;
 
 /*
@@ -618,8 +660,16 @@ extern unsigned long pack_size_limit_cfg;
 extern int check_replace_refs;
 
 extern int fsync_object_files;
+extern int fsync_ref_files;
 extern int core_preload_index;
+extern int core_multi_pack_index;
+extern int core_commit_graph;
+extern const char *core_fsmonitor;
+extern int core_loose_object_cache;
+extern int core_reflog_index;
+extern int core_batch_ref_updates;
 extern int core_apply_sparse_checkout;
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -681,7 +731,9 @@ extern char *notes_ref_name;
 extern int grafts_replace_parents;
 
 #define GIT_REPO_VERSION 0
+#define GIT_REPO_VERSION_READ 1
 extern int repository_format_version;
+extern int repository_format_ref_tables;
 extern int check_repository_format(void);
 
 #define MTIME_CHANGED	0x0001
@@ -1165,6 +1217,17 @@ struct checkout {
 #define TEMPORARY_FILENAME_LENGTH 25
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
 
+/*
+ * Pieces of checkout_entry() shared with parallel-checkout.c: open the
+ * file to write ce to at path, fstat() it after writing when that can
+ * stand for lstat(), and record the stat data (from st, or from lstat()
+ * when st is NULL) in the index.
+ */
+extern int open_output_fd(char *path, const struct cache_entry *ce, int to_tempfile);
+extern int fstat_output(int fd, const struct checkout *state, struct stat *st);
+extern void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+				  struct stat *st);
+
 struct cache_def {
 	struct strbuf path;
 	int flags;
@@ -1184,8 +1247,10 @@ extern int has_dirs_only_path(const char *name, int len, int prefix_len);
 extern void schedule_dir_for_removal(const char *name, int len);
 extern void remove_scheduled_dirs(void);
 
+struct loose_object_cache;
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
+	struct loose_object_cache *loose_cache;
 	char *name;
 	char base[FLEX_ARRAY]; /* more */
 } *alt_odb_list;
@@ -1219,7 +1284,9 @@ extern struct packed_git {
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
+	int index;		/* for pack-objects.c */
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -1262,6 +1329,25 @@ extern void close_pack_windows(struct packed_git *);
 extern void unuse_pack(struct pack_window **);
 extern void free_pack_by_name(const char *);
 extern void clear_delta_base_cache(void);
+/*
+ * Make the delta base cache safe to use from several threads at once;
+ * call before starting them, and disable it again once they are done.
+ * enable_obj_read_lock() and disable_obj_read_lock() do this.
+ */
+extern void enable_delta_base_cache_locking(void);
+extern void disable_delta_base_cache_locking(void);
+
+/*
+ * Allow reading objects from several threads at once: after
+ * enable_obj_read_lock(), read_sha1_file(), sha1_object_info() and
+ * unpack_entry() serialize their use of the object database state
+ * under a lock, which they drop while inflating.  Callers that access
+ * pack data directly must hold it with obj_read_lock().
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
 extern struct packed_git *add_packed_git(const char *, int, int);
 
 /*
@@ -1290,6 +1376,24 @@ extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsig
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Return the offset of the base of the OFS_DELTA or REF_DELTA entry at
+ * delta_obj_offset, whose header ends at *curpos, and step *curpos over
+ * the base reference.  Returns 0 if the base is invalid or not in p.
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
+/*
+ * Inflate the delta data of the OFS_DELTA or REF_DELTA entry at
+ * obj_offset in p, storing its size in *delta_size and the offset of
+ * its base (which lives in the same pack) in *base_offset.  Returns
+ * NULL if the entry is not a delta or cannot be read.
+ */
+extern void *read_packed_delta(struct packed_git *p, off_t obj_offset,
+			       unsigned long *delta_size, off_t *base_offset);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -1518,6 +1622,9 @@ extern int git_config_get_bool(const char *key, int *dest);
 extern int git_config_get_bool_or_int(const char *key, int *is_bool, int *dest);
 extern int git_config_get_maybe_bool(const char *key, int *dest);
 extern int git_config_get_pathname(const char *key, const char **dest);
+extern int git_config_get_untracked_cache(void);
+extern int git_config_get_fsmonitor(void);
+extern int git_config_get_index_threads(int *dest);
 
 struct key_value_info {
 	const char *filename;
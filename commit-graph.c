@@ -0,0 +1,1008 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "commit.h"
+#include "refs.h"
+#include "progress.h"
+#include "sha1-array.h"
+#include "commit-graph.h"
+#include "bloom.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			256 * 4 + 20)
+
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_EXTRAEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+
+#define GRAPH_DATA_WIDTH 36
+#define GRAPH_BLOOM_DATA_HEADER_SIZE 12
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+/* object flag used while collecting the commits to write */
+#define GRAPH_COMMIT_SEEN (1u<<15)
+
+static struct commit_graph *commit_graph;
+static int prepare_commit_graph_run_once;
+
+char *get_commit_graph_filename(const char *object_dir)
+{
+	return xstrfmt("%s/info/commit-graph", object_dir);
+}
+
+static inline uint64_t get_be64_split(const unsigned char *p)
+{
+	return (((uint64_t)get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *g;
+	struct stat st;
+	unsigned char *data;
+	size_t len, chunk_end;
+	uint32_t i, num_chunks;
+	size_t bloom_indexes_len = 0;
+	int fd;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = len;
+
+	if (get_be32(data) != COMMIT_GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      get_be32(data), COMMIT_GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != COMMIT_GRAPH_VERSION) {
+		error("commit-graph version %X does not match version %X",
+		      data[4], COMMIT_GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != COMMIT_GRAPH_HASH_VERSION) {
+		error("commit-graph hash version %X does not match version %X",
+		      data[5], COMMIT_GRAPH_HASH_VERSION);
+		goto cleanup_fail;
+	}
+	num_chunks = data[6];
+
+	chunk_end = len - 20;
+	if (GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH > chunk_end) {
+		error("commit-graph chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *entry = data + GRAPH_HEADER_SIZE +
+					     i * GRAPH_CHUNKLOOKUP_WIDTH;
+		uint32_t chunk_id = get_be32(entry);
+		uint64_t chunk_offset = get_be64_split(entry + 4);
+		uint64_t next_offset = get_be64_split(entry + 4 + GRAPH_CHUNKLOOKUP_WIDTH);
+
+		if (chunk_offset > next_offset || next_offset > chunk_end) {
+			error("commit-graph improper chunk offset %08"PRIx64,
+			      chunk_offset);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (next_offset - chunk_offset < 256 * 4) {
+				error("commit-graph OID fanout is too small");
+				goto cleanup_fail;
+			}
+			g->chunk_oid_fanout = (const uint32_t *)(data + chunk_offset);
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			g->chunk_oid_lookup = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			g->chunk_commit_data = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_EXTRAEDGES:
+			g->chunk_extra_edges = data + chunk_offset;
+			g->num_extra_edges = (next_offset - chunk_offset) / 4;
+			break;
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			g->chunk_bloom_indexes = data + chunk_offset;
+			bloom_indexes_len = next_offset - chunk_offset;
+			break;
+		case GRAPH_CHUNKID_BLOOMDATA:
+			g->chunk_bloom_data = data + chunk_offset;
+			g->bloom_data_len = next_offset - chunk_offset;
+			break;
+		default:
+			/* Unknown chunks are ignored for forward compatibility. */
+			break;
+		}
+	}
+
+	if (!g->chunk_oid_fanout || !g->chunk_oid_lookup ||
+	    !g->chunk_commit_data) {
+		error("commit-graph is missing a required chunk");
+		goto cleanup_fail;
+	}
+
+	g->num_commits = ntohl(g->chunk_oid_fanout[255]);
+	if (g->chunk_oid_lookup + (size_t)g->num_commits * 20 > data + chunk_end ||
+	    g->chunk_commit_data + (size_t)g->num_commits * GRAPH_DATA_WIDTH >
+	    data + chunk_end) {
+		error("commit-graph is too small for %"PRIu32" commits",
+		      g->num_commits);
+		goto cleanup_fail;
+	}
+
+	if (g->chunk_bloom_indexes && g->chunk_bloom_data) {
+		if (bloom_indexes_len != (size_t)g->num_commits * 4 ||
+		    g->bloom_data_len < GRAPH_BLOOM_DATA_HEADER_SIZE) {
+			warning("commit-graph changed-path Bloom filters are "
+				"malformed; ignoring them");
+			g->chunk_bloom_indexes = NULL;
+			g->chunk_bloom_data = NULL;
+		} else {
+			g->bloom_filter_settings = xmalloc(sizeof(*g->bloom_filter_settings));
+			g->bloom_filter_settings->hash_version = get_be32(g->chunk_bloom_data);
+			g->bloom_filter_settings->num_hashes = get_be32(g->chunk_bloom_data + 4);
+			g->bloom_filter_settings->bits_per_entry = get_be32(g->chunk_bloom_data + 8);
+			g->chunk_bloom_data += GRAPH_BLOOM_DATA_HEADER_SIZE;
+			g->bloom_data_len -= GRAPH_BLOOM_DATA_HEADER_SIZE;
+			if (g->bloom_filter_settings->hash_version != 1) {
+				/* filters we cannot query are merely not used */
+				free(g->bloom_filter_settings);
+				g->bloom_filter_settings = NULL;
+				g->chunk_bloom_indexes = NULL;
+				g->chunk_bloom_data = NULL;
+			}
+		}
+	} else {
+		g->chunk_bloom_indexes = NULL;
+		g->chunk_bloom_data = NULL;
+	}
+
+	return g;
+
+cleanup_fail:
+	close_commit_graph(g);
+	return NULL;
+}
+
+void close_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	munmap(g->data, g->data_len);
+	free(g->bloom_filter_settings);
+	free(g);
+}
+
+static int count_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+static int count_replace_ref(const char *refname, const unsigned char *sha1,
+			     int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The graph records the parents found in the commit objects; it can
+ * not be trusted when grafts, a shallow file or replacement objects
+ * rewrite history.
+ */
+static int commit_graph_compatible(void)
+{
+	lookup_commit_graft(null_sha1); /* loads grafts and shallow */
+	if (is_repository_shallow())
+		return 0;
+	if (for_each_commit_graft(count_graft, NULL))
+		return 0;
+	if (check_replace_refs && for_each_replace_ref(count_replace_ref, NULL))
+		return 0;
+	return 1;
+}
+
+static int prepare_commit_graph(void)
+{
+	char *graph_name;
+
+	if (prepare_commit_graph_run_once)
+		return !!commit_graph;
+	prepare_commit_graph_run_once = 1;
+
+	if (!core_commit_graph || !commit_graph_compatible())
+		return 0;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return !!commit_graph;
+}
+
+int commit_graph_available(void)
+{
+	return prepare_commit_graph();
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(g->chunk_oid_fanout[*sha1]);
+	lo = *sha1 ? ntohl(g->chunk_oid_fanout[*sha1 - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(g->chunk_oid_lookup + (size_t)mi * 20, sha1);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32, pos);
+
+	c = lookup_commit(g->chunk_oid_lookup + (size_t)pos * 20);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + (size_t)pos * 20));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
+				   uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data +
+					   (size_t)GRAPH_DATA_WIDTH * pos;
+
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_data + 28) >> 2;
+}
+
+static int fill_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t pos)
+{
+	uint32_t edge_value;
+	const unsigned char *commit_data = g->chunk_commit_data +
+					   (size_t)GRAPH_DATA_WIDTH * pos;
+	struct commit_list **pptr;
+	uint64_t date_high, date_low;
+
+	item->object.parsed = 1;
+	fill_commit_graph_info(item, g, pos);
+
+	item->tree = lookup_tree(commit_data);
+
+	date_high = get_be32(commit_data + 28) & 0x3;
+	date_low = get_be32(commit_data + 32);
+	item->date = (time_t)((date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + 20);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + 24);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		pptr = insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	edge_value &= GRAPH_EDGE_LAST_MASK;
+	do {
+		uint32_t parent;
+
+		if (edge_value >= g->num_extra_edges)
+			die("commit-graph extra edge list is truncated");
+		parent = get_be32(g->chunk_extra_edges + (size_t)4 * edge_value++);
+		pptr = insert_parent_or_die(g, parent & GRAPH_EDGE_LAST_MASK, pptr);
+		if (parent & GRAPH_LAST_EDGE)
+			break;
+	} while (1);
+
+	return 1;
+}
+
+static int find_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t *pos)
+{
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+		*pos = item->graph_pos;
+		return 1;
+	}
+	return bsearch_graph(g, item->object.sha1, pos);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (item->object.parsed)
+		return 1;
+	if (!prepare_commit_graph())
+		return 0;
+	/* shallow boundaries may be registered after the graph was loaded */
+	if (lookup_commit_graft(item->object.sha1))
+		return 0;
+	if (!find_commit_in_graph(item, commit_graph, &pos))
+		return 0;
+	return fill_commit_in_graph(item, commit_graph, pos);
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph())
+		return;
+	if (lookup_commit_graft(item->object.sha1))
+		return;
+	if (bsearch_graph(commit_graph, item->object.sha1, &pos))
+		fill_commit_graph_info(item, commit_graph, pos);
+}
+
+const struct bloom_filter_settings *commit_graph_bloom_filter_settings(void)
+{
+	if (!prepare_commit_graph())
+		return NULL;
+	return commit_graph->bloom_filter_settings;
+}
+
+static int graph_bloom_filter(struct commit_graph *g, uint32_t pos,
+			      struct bloom_filter *filter)
+{
+	uint32_t start, end;
+
+	end = get_be32(g->chunk_bloom_indexes + (size_t)4 * pos);
+	start = pos ? get_be32(g->chunk_bloom_indexes + (size_t)4 * (pos - 1)) : 0;
+	if (start > end || end > g->bloom_data_len)
+		return 0;
+	filter->data = (unsigned char *)g->chunk_bloom_data + start;
+	filter->len = end - start;
+	return 1;
+}
+
+int load_commit_graph_bloom_filter(struct commit *item,
+				   struct bloom_filter *filter)
+{
+	uint32_t pos;
+
+	if (!prepare_commit_graph() || !commit_graph->bloom_filter_settings)
+		return 0;
+	if (!find_commit_in_graph(item, commit_graph, &pos))
+		return 0;
+	return graph_bloom_filter(commit_graph, pos, filter);
+}
+
+uint32_t commit_graph_generation(struct commit *item)
+{
+	if (item->generation == GENERATION_NUMBER_INFINITY &&
+	    item->graph_pos == COMMIT_NOT_FROM_GRAPH &&
+	    !item->object.parsed)
+		parse_commit_in_graph(item);
+	return item->generation;
+}
+
+struct write_commit_graph_context {
+	struct commit **commits;
+	int nr, alloc;
+	int num_extra_edges;
+	struct progress *progress;
+
+	struct bloom_filter *bloom_filters;
+	uint64_t total_bloom_filter_size;
+	struct bloom_filter_settings bloom_settings;
+};
+
+static void add_commit(struct write_commit_graph_context *ctx,
+		       struct commit *c)
+{
+	if (c->object.flags & GRAPH_COMMIT_SEEN)
+		return;
+	c->object.flags |= GRAPH_COMMIT_SEEN;
+	ALLOC_GROW(ctx->commits, ctx->nr + 1, ctx->alloc);
+	ctx->commits[ctx->nr++] = c;
+}
+
+/*
+ * Grow the list of commits to its closure under "is a parent of", so
+ * that every parent of a commit in the graph is in the graph, too.
+ * Commits from an existing graph are already closed.
+ */
+static void close_reachable(struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		struct commit *c = ctx->commits[i];
+		struct commit_list *parent;
+
+		display_progress(ctx->progress, i + 1);
+		if (parse_commit(c))
+			die("unable to parse commit %s", sha1_to_hex(c->object.sha1));
+		for (parent = c->parents; parent; parent = parent->next)
+			add_commit(ctx, parent->item);
+	}
+}
+
+static void compute_generation_numbers(struct write_commit_graph_context *ctx)
+{
+	struct commit_list *stack = NULL;
+	int i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		if (ctx->commits[i]->generation != GENERATION_NUMBER_INFINITY &&
+		    ctx->commits[i]->generation != GENERATION_NUMBER_ZERO)
+			continue;
+
+		commit_list_insert(ctx->commits[i], &stack);
+		while (stack) {
+			struct commit *current = stack->item;
+			struct commit_list *parent;
+			int all_parents_computed = 1;
+			uint32_t max_generation = 0;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				uint32_t gen = parent->item->generation;
+
+				if (gen == GENERATION_NUMBER_INFINITY ||
+				    gen == GENERATION_NUMBER_ZERO) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &stack);
+					break;
+				}
+				if (gen > max_generation)
+					max_generation = gen;
+			}
+
+			if (all_parents_computed) {
+				if (max_generation >= GENERATION_NUMBER_MAX)
+					max_generation = GENERATION_NUMBER_MAX - 1;
+				current->generation = max_generation + 1;
+				pop_commit(&stack);
+			}
+		}
+	}
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static uint32_t graph_position(struct write_commit_graph_context *ctx,
+			       struct commit *c)
+{
+	int lo = 0, hi = ctx->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(ctx->commits[mi]->object.sha1, c->object.sha1);
+
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	die("BUG: parent %s is missing from the commit-graph",
+	    sha1_to_hex(c->object.sha1));
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct write_commit_graph_context *ctx)
+{
+	int i, num_extra_edges = 0;
+
+	for (i = 0; i < ctx->nr; i++) {
+		struct commit *c = ctx->commits[i];
+		struct commit_list *parent = c->parents;
+		uint64_t date = (uint64_t)c->date;
+		uint32_t packed;
+
+		sha1write(f, c->tree->object.sha1, 20);
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else {
+			sha1write_be32(f, graph_position(ctx, parent->item));
+			parent = parent->next;
+		}
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (!parent->next)
+			sha1write_be32(f, graph_position(ctx, parent->item));
+		else {
+			sha1write_be32(f, GRAPH_EXTRA_EDGES_NEEDED | num_extra_edges);
+			for (; parent; parent = parent->next)
+				num_extra_edges++;
+		}
+
+		packed = (c->generation << 2) | ((date >> 32) & 0x3);
+		sha1write_be32(f, packed);
+		sha1write_be32(f, (uint32_t)date);
+	}
+}
+
+static void write_graph_chunk_extra_edges(struct sha1file *f,
+					  struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		struct commit_list *parent = ctx->commits[i]->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t pos = graph_position(ctx, parent->item);
+			if (!parent->next)
+				pos |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, pos);
+		}
+	}
+}
+
+static void compute_bloom_filters(struct write_commit_graph_context *ctx,
+				  unsigned flags)
+{
+	const struct bloom_filter_settings *old_settings;
+	struct progress *progress = NULL;
+	int i, reuse;
+
+	old_settings = commit_graph_bloom_filter_settings();
+	reuse = old_settings &&
+		old_settings->hash_version == ctx->bloom_settings.hash_version &&
+		old_settings->num_hashes == ctx->bloom_settings.num_hashes &&
+		old_settings->bits_per_entry == ctx->bloom_settings.bits_per_entry;
+
+	if (flags & COMMIT_GRAPH_PROGRESS)
+		progress = start_progress(_("Computing changed paths"), ctx->nr);
+
+	ctx->bloom_filters = xcalloc(ctx->nr, sizeof(*ctx->bloom_filters));
+	for (i = 0; i < ctx->nr; i++) {
+		struct bloom_filter *filter = &ctx->bloom_filters[i];
+		struct bloom_filter old;
+
+		if (reuse && load_commit_graph_bloom_filter(ctx->commits[i], &old)) {
+			filter->len = old.len;
+			filter->data = xmemdupz(old.data, old.len);
+		} else
+			compute_bloom_filter(ctx->commits[i], filter,
+					     &ctx->bloom_settings);
+		ctx->total_bloom_filter_size += filter->len;
+		display_progress(progress, i + 1);
+	}
+	stop_progress(&progress);
+}
+
+static void write_graph_chunk_bloom_indexes(struct sha1file *f,
+					    struct write_commit_graph_context *ctx)
+{
+	uint64_t end = 0;
+	int i;
+
+	for (i = 0; i < ctx->nr; i++) {
+		end += ctx->bloom_filters[i].len;
+		sha1write_be32(f, (uint32_t)end);
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct sha1file *f,
+					 struct write_commit_graph_context *ctx)
+{
+	int i;
+
+	sha1write_be32(f, ctx->bloom_settings.hash_version);
+	sha1write_be32(f, ctx->bloom_settings.num_hashes);
+	sha1write_be32(f, ctx->bloom_settings.bits_per_entry);
+	for (i = 0; i < ctx->nr; i++)
+		sha1write(f, ctx->bloom_filters[i].data,
+			  ctx->bloom_filters[i].len);
+}
+
+static int want_bloom_filters(unsigned flags)
+{
+	if (flags & COMMIT_GRAPH_NO_CHANGED_PATHS)
+		return 0;
+	if (flags & COMMIT_GRAPH_CHANGED_PATHS)
+		return 1;
+	return !!commit_graph_bloom_filter_settings();
+}
+
+static void write_chunk_header(struct sha1file *f, uint32_t id, uint64_t offset)
+{
+	sha1write_be32(f, id);
+	sha1write_be32(f, offset >> 32);
+	sha1write_be32(f, offset & 0xffffffff);
+}
+
+int write_commit_graph(const char *object_dir, struct sha1_array *commits,
+		       unsigned flags)
+{
+	struct write_commit_graph_context ctx;
+	struct bloom_filter_settings default_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct sha1file *f;
+	uint64_t offset;
+	char *graph_name;
+	int i, j, fd, num_chunks;
+
+	if (!commit_graph_compatible())
+		return 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.bloom_settings = default_settings;
+	if (flags & COMMIT_GRAPH_PROGRESS)
+		ctx.progress = start_progress(_("Collecting commits"), 0);
+
+	if ((flags & COMMIT_GRAPH_APPEND) && prepare_commit_graph()) {
+		for (i = 0; i < commit_graph->num_commits; i++) {
+			struct commit *c = lookup_commit(commit_graph->chunk_oid_lookup +
+							 (size_t)i * 20);
+			if (!c)
+				die("commit-graph names a non-commit: %s",
+				    sha1_to_hex(commit_graph->chunk_oid_lookup +
+						(size_t)i * 20));
+			c->graph_pos = i;
+			add_commit(&ctx, c);
+		}
+	}
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = lookup_commit_reference_gently(commits->sha1[i], 1);
+		if (c)
+			add_commit(&ctx, c);
+	}
+
+	close_reachable(&ctx);
+	stop_progress(&ctx.progress);
+
+	for (i = 0; i < ctx.nr; i++)
+		ctx.commits[i]->object.flags &= ~GRAPH_COMMIT_SEEN;
+
+	if (!ctx.nr) {
+		free(ctx.commits);
+		return 0;
+	}
+	if (ctx.nr >= GRAPH_PARENT_NONE)
+		die("too many commits to write graph");
+
+	qsort(ctx.commits, ctx.nr, sizeof(*ctx.commits), commit_sha1_cmp);
+	compute_generation_numbers(&ctx);
+
+	for (i = 0; i < ctx.nr; i++) {
+		struct commit_list *parent = ctx.commits[i]->parents;
+		int nr_parents = commit_list_count(parent);
+		if (nr_parents > 2)
+			ctx.num_extra_edges += nr_parents - 1;
+	}
+
+	if (want_bloom_filters(flags)) {
+		compute_bloom_filters(&ctx, flags);
+		if (ctx.total_bloom_filter_size > 0xffffffff)
+			die("changed-path Bloom filters are too large to write");
+	}
+
+	graph_name = get_commit_graph_filename(object_dir);
+	if (safe_create_leading_directories(graph_name))
+		die_errno("unable to create leading directories of %s", graph_name);
+
+	strbuf_addf(&tmp_file, "%s/info/tmp_graph_XXXXXX", object_dir);
+	fd = git_mkstemp_mode(tmp_file.buf, 0444);
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file.buf);
+	f = sha1fd(fd, tmp_file.buf);
+
+	num_chunks = 3;
+	if (ctx.num_extra_edges)
+		num_chunks++;
+	if (ctx.bloom_filters)
+		num_chunks += 2;
+
+	sha1write_be32(f, COMMIT_GRAPH_SIGNATURE);
+	sha1write_u8(f, COMMIT_GRAPH_VERSION);
+	sha1write_u8(f, COMMIT_GRAPH_HASH_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base commit-graph files */
+
+	offset = GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	write_chunk_header(f, GRAPH_CHUNKID_OIDFANOUT, offset);
+	offset += 256 * 4;
+	write_chunk_header(f, GRAPH_CHUNKID_OIDLOOKUP, offset);
+	offset += (uint64_t)ctx.nr * 20;
+	write_chunk_header(f, GRAPH_CHUNKID_DATA, offset);
+	offset += (uint64_t)ctx.nr * GRAPH_DATA_WIDTH;
+	if (ctx.num_extra_edges) {
+		write_chunk_header(f, GRAPH_CHUNKID_EXTRAEDGES, offset);
+		offset += (uint64_t)ctx.num_extra_edges * 4;
+	}
+	if (ctx.bloom_filters) {
+		write_chunk_header(f, GRAPH_CHUNKID_BLOOMINDEXES, offset);
+		offset += (uint64_t)ctx.nr * 4;
+		write_chunk_header(f, GRAPH_CHUNKID_BLOOMDATA, offset);
+		offset += GRAPH_BLOOM_DATA_HEADER_SIZE + ctx.total_bloom_filter_size;
+	}
+	write_chunk_header(f, 0, offset);
+
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < ctx.nr && ctx.commits[j]->object.sha1[0] == i)
+			j++;
+		sha1write_be32(f, j);
+	}
+	for (i = 0; i < ctx.nr; i++)
+		sha1write(f, ctx.commits[i]->object.sha1, 20);
+	write_graph_chunk_data(f, &ctx);
+	write_graph_chunk_extra_edges(f, &ctx);
+	if (ctx.bloom_filters) {
+		write_graph_chunk_bloom_indexes(f, &ctx);
+		write_graph_chunk_bloom_data(f, &ctx);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno("unable to make temporary commit-graph readable");
+	if (rename(tmp_file.buf, graph_name))
+		die_errno("unable to rename temporary commit-graph to '%s'",
+			  graph_name);
+
+	free(graph_name);
+	if (ctx.bloom_filters) {
+		for (i = 0; i < ctx.nr; i++)
+			free(ctx.bloom_filters[i].data);
+		free(ctx.bloom_filters);
+	}
+	free(ctx.commits);
+	strbuf_release(&tmp_file);
+	return 0;
+}
+
+static int add_ref_to_list(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	struct sha1_array *list = cb_data;
+	sha1_array_append(list, sha1);
+	return 0;
+}
+
+int write_commit_graph_reachable(const char *object_dir, unsigned flags)
+{
+	struct sha1_array list = SHA1_ARRAY_INIT;
+	int ret;
+
+	for_each_ref(add_ref_to_list, &list);
+	ret = write_commit_graph(object_dir, &list, flags);
+	sha1_array_clear(&list);
+	return ret;
+}
+
+/*
+ * Decode the parent positions of the commit at "pos" into *parents,
+ * returning how many there are.
+ */
+static int read_graph_parents(struct commit_graph *g, uint32_t pos,
+			      uint32_t **parents, int *alloc)
+{
+	const unsigned char *commit_data = g->chunk_commit_data +
+					   (size_t)GRAPH_DATA_WIDTH * pos;
+	uint32_t edge_value;
+	int nr = 0;
+
+	edge_value = get_be32(commit_data + 20);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return nr;
+	ALLOC_GROW(*parents, nr + 1, *alloc);
+	(*parents)[nr++] = edge_value;
+
+	edge_value = get_be32(commit_data + 24);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return nr;
+	if (!(edge_value & GRAPH_EXTRA_EDGES_NEEDED)) {
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = edge_value;
+		return nr;
+	}
+
+	edge_value &= GRAPH_EDGE_LAST_MASK;
+	while (edge_value < g->num_extra_edges) {
+		uint32_t parent = get_be32(g->chunk_extra_edges + (size_t)4 * edge_value++);
+
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = parent & GRAPH_EDGE_LAST_MASK;
+		if (parent & GRAPH_LAST_EDGE)
+			break;
+	}
+	return nr;
+}
+
+static int graph_report_errors;
+
+static void graph_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	graph_report_errors = 1;
+	va_start(ap, fmt);
+	vreportf("error: ", fmt, ap);
+	va_end(ap);
+}
+
+int verify_commit_graph(const char *object_dir)
+{
+	struct commit_graph *g;
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	char *graph_name;
+	uint32_t i, *parents = NULL;
+	int alloc_parents = 0;
+
+	graph_name = get_commit_graph_filename(object_dir);
+	g = load_commit_graph_one(graph_name);
+	if (!g) {
+		int missing = access(graph_name, F_OK) && errno == ENOENT;
+		free(graph_name);
+		return missing ? 0 : 1;
+	}
+	free(graph_name);
+	graph_report_errors = 0;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, g->data + g->data_len - 20))
+		graph_report("the commit-graph file has incorrect checksum and is likely corrupt");
+
+	for (i = 1; i < 256; i++)
+		if (ntohl(g->chunk_oid_fanout[i - 1]) > ntohl(g->chunk_oid_fanout[i]))
+			graph_report("commit-graph fanout values out of order");
+
+	for (i = 1; i < g->num_commits; i++)
+		if (hashcmp(g->chunk_oid_lookup + (size_t)(i - 1) * 20,
+			    g->chunk_oid_lookup + (size_t)i * 20) >= 0)
+			graph_report("commit-graph has incorrect OID order: %s then %s",
+				      sha1_to_hex(g->chunk_oid_lookup + (size_t)(i - 1) * 20),
+				      sha1_to_hex(g->chunk_oid_lookup + (size_t)i * 20));
+
+	if (g->chunk_bloom_indexes) {
+		uint32_t prev = 0;
+		for (i = 0; i < g->num_commits; i++) {
+			uint32_t end = get_be32(g->chunk_bloom_indexes + (size_t)4 * i);
+			if (end < prev || end > g->bloom_data_len) {
+				graph_report("commit-graph Bloom filter index for commit %s is out of range",
+					     sha1_to_hex(g->chunk_oid_lookup + (size_t)i * 20));
+				break;
+			}
+			prev = end;
+		}
+	}
+
+	for (i = 0; i < g->num_commits && !graph_report_errors; i++) {
+		const unsigned char *oid = g->chunk_oid_lookup + (size_t)i * 20;
+		const unsigned char *data = g->chunk_commit_data +
+					    (size_t)GRAPH_DATA_WIDTH * i;
+		struct commit odb_commit;
+		struct commit_list *op;
+		uint32_t max_generation = 0, generation;
+		uint64_t date;
+		int j, nr_parents;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		buf = read_sha1_file(oid, &type, &size);
+		if (!buf || type != OBJ_COMMIT) {
+			graph_report("failed to read commit %s from the object database",
+				     sha1_to_hex(oid));
+			free(buf);
+			continue;
+		}
+		memset(&odb_commit, 0, sizeof(odb_commit));
+		hashcpy(odb_commit.object.sha1, oid);
+		odb_commit.graph_pos = COMMIT_NOT_FROM_GRAPH;
+		odb_commit.generation = GENERATION_NUMBER_INFINITY;
+		if (parse_commit_buffer(&odb_commit, buf, size))
+			graph_report("failed to parse commit %s", sha1_to_hex(oid));
+		free(buf);
+
+		if (!odb_commit.tree ||
+		    hashcmp(odb_commit.tree->object.sha1, data))
+			graph_report("root tree OID for commit %s in commit-graph is %s != %s",
+				     sha1_to_hex(oid), sha1_to_hex(data),
+				     odb_commit.tree ?
+				     sha1_to_hex(odb_commit.tree->object.sha1) : "none");
+
+		nr_parents = read_graph_parents(g, i, &parents, &alloc_parents);
+		for (op = odb_commit.parents, j = 0;
+		     op && j < nr_parents; op = op->next, j++) {
+			const unsigned char *pdata;
+
+			if (parents[j] >= g->num_commits) {
+				graph_report("commit-graph has invalid parent position for commit %s",
+					     sha1_to_hex(oid));
+				break;
+			}
+			if (hashcmp(g->chunk_oid_lookup + (size_t)parents[j] * 20,
+				    op->item->object.sha1))
+				graph_report("commit-graph parent for %s is %s != %s",
+					     sha1_to_hex(oid),
+					     sha1_to_hex(g->chunk_oid_lookup + (size_t)parents[j] * 20),
+					     sha1_to_hex(op->item->object.sha1));
+			pdata = g->chunk_commit_data + (size_t)GRAPH_DATA_WIDTH * parents[j];
+			generation = get_be32(pdata + 28) >> 2;
+			if (generation > max_generation)
+				max_generation = generation;
+		}
+		if (op || j < nr_parents)
+			graph_report("commit-graph parent list for commit %s has the wrong length",
+				     sha1_to_hex(oid));
+
+		if (max_generation == GENERATION_NUMBER_MAX)
+			max_generation--;
+		generation = get_be32(data + 28) >> 2;
+		if (generation != max_generation + 1)
+			graph_report("commit-graph generation for commit %s is %"PRIu32" != %"PRIu32,
+				     sha1_to_hex(oid), generation, max_generation + 1);
+
+		date = ((uint64_t)(get_be32(data + 28) & 0x3) << 32) | get_be32(data + 32);
+		if (date != (uint64_t)odb_commit.date)
+			graph_report("commit date for commit %s in commit-graph is %"PRIuMAX" != %"PRIuMAX,
+				     sha1_to_hex(oid), (uintmax_t)date,
+				     (uintmax_t)odb_commit.date);
+
+		free_commit_list(odb_commit.parents);
+	}
+
+	free(parents);
+	close_commit_graph(g);
+	return graph_report_errors;
+}
@@ -0,0 +1,114 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file, objects/info/commit-graph, records for each
+ * commit its root tree, parents, commit date and topological generation
+ * number, so that walking history does not need to inflate and parse
+ * every commit object.  See Documentation/technical/commit-graph-format.txt.
+ */
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_HASH_VERSION 1 /* SHA-1 */
+
+/*
+ * A commit that is not in the commit-graph has an infinite generation
+ * number: nothing is known about it, so it may reach anything.  Commits
+ * in the graph have a generation between 1 and GENERATION_NUMBER_MAX,
+ * and the generation of a commit is greater than that of each of its
+ * parents (or equal to it, once capped at GENERATION_NUMBER_MAX).  So if
+ * A can reach B, then gen(A) >= gen(B).
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GENERATION_NUMBER_ZERO 0
+
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+
+struct commit;
+struct sha1_array;
+struct bloom_filter;
+struct bloom_filter_settings;
+
+struct commit_graph {
+	unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_commits;
+
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_extra_edges;
+	size_t num_extra_edges;
+
+	/* optional changed-path Bloom filters, see bloom.h */
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+	struct bloom_filter_settings *bloom_filter_settings;
+};
+
+extern char *get_commit_graph_filename(const char *object_dir);
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void close_commit_graph(struct commit_graph *g);
+
+/*
+ * Fill in the tree, parents, date and generation of an unparsed
+ * commit from the commit-graph.  Returns 1 and marks the commit as
+ * parsed if the graph knows it, 0 otherwise (the caller should then
+ * parse the commit object as usual).
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the graph position and generation number of a commit that
+ * was parsed from its object buffer, if the graph knows it.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/*
+ * Return the generation number of a commit, consulting the graph if
+ * the commit has not been parsed yet.  GENERATION_NUMBER_INFINITY when
+ * the commit is not in the graph.
+ */
+extern uint32_t commit_graph_generation(struct commit *item);
+
+/* Has a usable commit-graph been loaded for this repository? */
+extern int commit_graph_available(void);
+
+/*
+ * The settings of the changed-path Bloom filters in the commit-graph,
+ * or NULL if there is no commit-graph or it has no filters.
+ */
+extern const struct bloom_filter_settings *commit_graph_bloom_filter_settings(void);
+
+/*
+ * Point *filter at the changed-path Bloom filter of the commit, which
+ * remains owned by the commit-graph.  Returns 1 on success, 0 if the
+ * commit has no filter in the commit-graph.
+ */
+extern int load_commit_graph_bloom_filter(struct commit *item,
+					  struct bloom_filter *filter);
+
+#define COMMIT_GRAPH_APPEND (1 << 0)
+#define COMMIT_GRAPH_PROGRESS (1 << 1)
+#define COMMIT_GRAPH_CHANGED_PATHS (1 << 2)
+#define COMMIT_GRAPH_NO_CHANGED_PATHS (1 << 3)
+
+/*
+ * Write a commit-graph holding the given commits and everything they
+ * reach.  With COMMIT_GRAPH_APPEND, the commits of the existing graph
+ * are kept and the walk stops at them, so that only new history needs
+ * to be visited.  Changed-path Bloom filters are written with
+ * COMMIT_GRAPH_CHANGED_PATHS, or when the existing graph has them,
+ * unless COMMIT_GRAPH_NO_CHANGED_PATHS is given.
+ */
+extern int write_commit_graph(const char *object_dir,
+			      struct sha1_array *commits, unsigned flags);
+extern int write_commit_graph_reachable(const char *object_dir, unsigned flags);
+
+extern int verify_commit_graph(const char *object_dir);
+
+#endif
@@ -17,6 +17,8 @@ struct commit {
 	struct object object;
 	void *util;
 	unsigned int index;
+	uint32_t graph_pos;
+	uint32_t generation;
 	time_t date;
 	struct commit_list *parents;
 	struct tree *tree;
@@ -378,6 +380,7 @@ extern void print_commit_list(struct commit_list *list,
 extern void check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
@@ -76,6 +76,10 @@ struct itimerval {
 };
 #define ITIMER_REAL 0
 
+struct utsname {
+	char sysname[16];
+};
+
 /*
  * sanitize preprocessor namespace polluted by Windows headers defining
  * macros which collide with git local versions
@@ -125,6 +129,8 @@ static inline pid_t getpgid(pid_t pid)
 { return pid == 0 ? getpid() : pid; }
 static inline pid_t tcgetpgrp(int fd)
 { return getpid(); }
+static inline int uname(struct utsname *buf)
+{ strcpy(buf->sysname, "Windows"); return 0; }
 
 /*
  * simple adaptors
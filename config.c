@@ -790,6 +790,13 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.deltastreambuffersize")) {
+		delta_stream_buffer_size = git_config_ulong(var, value);
+		if (!delta_stream_buffer_size)
+			delta_stream_buffer_size = 1;
+		return 0;
+	}
+
 	if (!strcmp(var, "core.packedgitlimit")) {
 		packed_git_limit = git_config_ulong(var, value);
 		return 0;
@@ -876,11 +883,41 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.fsyncreffiles")) {
+		fsync_ref_files = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.preloadindex")) {
 		core_preload_index = git_config_bool(var, value);
 		return 0;
 	}
 
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.commitgraph")) {
+		core_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectcache")) {
+		core_loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.reflogindex")) {
+		core_reflog_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.batchrefupdates")) {
+		core_batch_ref_updates = git_config_int(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
@@ -1594,6 +1631,67 @@ int git_config_get_pathname(const char *key, const char **dest)
 	return ret;
 }
 
+/*
+ * Returns 1 or 0 if core.untrackedCache asks for the untracked cache
+ * to be added to or removed from the index, and -1 if the index
+ * should be left alone ("keep", the default).
+ */
+int git_config_get_untracked_cache(void)
+{
+	int val = -1;
+	const char *v;
+
+	if (!git_config_get_maybe_bool("core.untrackedcache", &val))
+		return val;
+
+	if (!git_config_get_value("core.untrackedcache", &v)) {
+		if (!strcasecmp(v, "keep"))
+			return -1;
+		error("unknown core.untrackedCache value '%s'; "
+		      "using 'keep' default value", v);
+	}
+	return -1;
+}
+
+int git_config_get_fsmonitor(void)
+{
+	if (git_config_get_pathname("core.fsmonitor", &core_fsmonitor))
+		core_fsmonitor = getenv("GIT_FSMONITOR_TEST");
+
+	if (core_fsmonitor && !*core_fsmonitor)
+		core_fsmonitor = NULL;
+
+	return !!core_fsmonitor;
+}
+
+/*
+ * Returns 0 and stores the number of threads to read the index with
+ * in *dest when index.threads is set (0 meaning "as many as there are
+ * CPUs"), or 1 when it is not.
+ */
+int git_config_get_index_threads(int *dest)
+{
+	int is_bool, val;
+
+	val = git_env_ulong("GIT_TEST_INDEX_THREADS", 0);
+	if (val) {
+		*dest = val;
+		return 0;
+	}
+
+	if (!git_config_get_bool_or_int("index.threads", &is_bool, &val)) {
+		if (is_bool)
+			*dest = val ? 0 : 1;
+		else if (val < 0)
+			*dest = 0;
+		else
+			*dest = val;
+		return 0;
+	}
+
+	return 1;
+}
+
 NORETURN
 void git_die_config_linenr(const char *key, const char *filename, int linenr)
 {
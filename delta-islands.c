@@ -0,0 +1,340 @@
+#include "cache.h"
+#include "commit.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "string-list.h"
+#include "progress.h"
+#include "khash.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+/*
+ * The islands of an object, one bit per island.  Objects usually share
+ * the bitmap of the commit or tree they were reached from; it is copied
+ * when one of them is found to be in more islands.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+/* in 32-bit words */
+static uint32_t island_bitmap_size;
+
+/* object name to struct island_bitmap */
+static khash_sha1 *island_marks;
+
+static regex_t *island_regexes;
+static int island_regexes_nr, island_regexes_alloc;
+
+/* island names; util points to the marks collected for each */
+static struct string_list islands = STRING_LIST_INIT_DUP;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t bytes = island_bitmap_size * sizeof(uint32_t);
+	struct island_bitmap *b = xcalloc(1, sizeof(*b) + bytes);
+
+	if (old)
+		memcpy(b->bits, old->bits, bytes);
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *dst,
+			     const struct island_bitmap *src)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		dst->bits[i] |= src->bits[i];
+}
+
+/* Whether every island of self is an island of super. */
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *b, uint32_t i)
+{
+	b->bits[i / 32] |= (uint32_t)1 << (i % 32);
+}
+
+static struct island_bitmap *get_island_marks(const unsigned char *sha1)
+{
+	khiter_t pos = kh_get_sha1(island_marks, sha1);
+
+	if (pos >= kh_end(island_marks))
+		return NULL;
+	return kh_value(island_marks, pos);
+}
+
+/* Add the islands of marks to those of obj. */
+static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int ret;
+
+	pos = kh_put_sha1(island_marks, obj->sha1, &ret);
+	if (ret) {
+		/* first time we see it: share the bitmap */
+		marks->refcount++;
+		kh_value(island_marks, pos) = marks;
+		return;
+	}
+
+	b = kh_value(island_marks, pos);
+	if (island_bitmap_is_subset(marks, b))
+		return;
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		kh_value(island_marks, pos) = b;
+	}
+	island_bitmap_or(b, marks);
+}
+
+int island_config(const char *var, const char *value)
+{
+	struct strbuf re = STRBUF_INIT;
+	int ret;
+
+	if (!value)
+		return config_error_nonbool(var);
+
+	/* the expressions match from the start of the refname */
+	if (*value != '^')
+		strbuf_addch(&re, '^');
+	strbuf_addstr(&re, value);
+
+	ALLOC_GROW(island_regexes, island_regexes_nr + 1, island_regexes_alloc);
+	ret = regcomp(&island_regexes[island_regexes_nr], re.buf, REG_EXTENDED);
+	strbuf_release(&re);
+	if (ret)
+		return error("failed to load island regex for '%s': %s",
+			     var, value);
+	island_regexes_nr++;
+	return 0;
+}
+
+static int find_island_for_ref(const char *refname, const unsigned char *sha1,
+			       int flags, void *data)
+{
+	regmatch_t matches[16];
+	struct strbuf name = STRBUF_INIT;
+	struct string_list_item *island;
+	struct object_array *objects;
+	unsigned char peeled[20];
+	struct object *obj;
+	int i, m;
+
+	/* later expressions take precedence, as for other config */
+	for (i = island_regexes_nr - 1; i >= 0; i--)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (i < 0)
+		return 0;
+
+	/* the island is named after what the groups matched */
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (name.len)
+			strbuf_addch(&name, '-');
+		strbuf_add(&name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	if (!peel_ref(refname, peeled))
+		sha1 = peeled;
+	obj = parse_object(sha1);
+	if (!obj) {
+		strbuf_release(&name);
+		return 0;
+	}
+
+	island = string_list_insert(&islands, name.buf);
+	if (!island->util)
+		island->util = xcalloc(1, sizeof(struct object_array));
+	objects = island->util;
+	add_object_array(obj, NULL, objects);
+
+	strbuf_release(&name);
+	return 0;
+}
+
+void load_delta_islands(int progress)
+{
+	int i;
+
+	island_marks = kh_init_sha1();
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (islands.nr + 31) / 32;
+	for (i = 0; i < islands.nr; i++) {
+		struct object_array *objects = islands.items[i].util;
+		int j;
+
+		for (j = 0; j < objects->nr; j++) {
+			struct object *obj = objects->objects[j].item;
+			struct island_bitmap *b = get_island_marks(obj->sha1);
+
+			if (!b) {
+				int ret;
+				khiter_t pos = kh_put_sha1(island_marks,
+							   obj->sha1, &ret);
+				b = island_bitmap_new(NULL);
+				kh_value(island_marks, pos) = b;
+			}
+			island_bitmap_set(b, i);
+		}
+		free(objects->objects);
+		free(objects);
+		islands.items[i].util = NULL;
+	}
+
+	if (progress)
+		fprintf(stderr, _("Marked %d islands, done.\n"), islands.nr);
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks;
+	struct commit_list *p;
+
+	if (!island_marks)
+		return;
+	marks = get_island_marks(commit->object.sha1);
+	if (!marks)
+		return;
+
+	parse_commit(commit);
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+static struct packing_data *tree_depth_pack;
+
+static int tree_depth_compare(const void *a, const void *b)
+{
+	const struct object_entry *ea = *(const struct object_entry **)a;
+	const struct object_entry *eb = *(const struct object_entry **)b;
+
+	return oe_tree_depth(tree_depth_pack, ea) -
+		oe_tree_depth(tree_depth_pack, eb);
+}
+
+void resolve_tree_islands(int progress, struct packing_data *to_pack)
+{
+	struct progress *progress_state = NULL;
+	struct object_entry **todo;
+	int nr = 0;
+	int i;
+
+	if (!island_marks)
+		return;
+
+	/*
+	 * Go from the top of the trees down, so that the islands of a
+	 * tree are complete before they are passed on to its entries.
+	 */
+	todo = xmalloc(to_pack->nr_objects * sizeof(*todo));
+	for (i = 0; i < to_pack->nr_objects; i++)
+		if (oe_type(&to_pack->objects[i]) == OBJ_TREE)
+			todo[nr++] = &to_pack->objects[i];
+	tree_depth_pack = to_pack;
+	qsort(todo, nr, sizeof(*todo), tree_depth_compare);
+
+	if (progress)
+		progress_state = start_progress(_("Propagating island marks"), nr);
+
+	for (i = 0; i < nr; i++) {
+		struct object_entry *ent = todo[i];
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		display_progress(progress_state, i + 1);
+
+		marks = get_island_marks(ent->idx.sha1);
+		if (!marks)
+			continue;
+
+		buf = read_sha1_file(ent->idx.sha1, &type, &size);
+		if (!buf || type != OBJ_TREE)
+			die("unable to read tree %s", sha1_to_hex(ent->idx.sha1));
+
+		init_tree_desc(&desc, buf, size);
+		while (tree_entry(&desc, &entry)) {
+			struct object *obj;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			obj = lookup_object(entry.sha1);
+			if (!obj)
+				continue;
+			set_island_marks(obj, marks);
+		}
+		free(buf);
+	}
+
+	stop_progress(&progress_state);
+	free(todo);
+	tree_depth_pack = NULL;
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	if (!island_marks)
+		return 1;
+
+	trg_marks = get_island_marks(trg);
+	if (!trg_marks)
+		return 1;
+	src_marks = get_island_marks(src);
+	if (!src_marks)
+		return 0;
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
+
+int island_delta_cmp(const unsigned char *a, const unsigned char *b)
+{
+	struct island_bitmap *a_marks, *b_marks;
+	int a_in_b, b_in_a;
+
+	if (!island_marks)
+		return 0;
+
+	a_marks = get_island_marks(a);
+	b_marks = get_island_marks(b);
+	if (!a_marks || !b_marks)
+		return !a_marks - !b_marks;
+
+	a_in_b = island_bitmap_is_subset(a_marks, b_marks);
+	b_in_a = island_bitmap_is_subset(b_marks, a_marks);
+	if (a_in_b == b_in_a)
+		return 0;
+	return a_in_b ? 1 : -1;
+}
@@ -0,0 +1,48 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct commit;
+struct packing_data;
+
+/*
+ * Delta islands: the refs are put into groups ("islands") by the
+ * pack.island regular expressions, each object is marked with the
+ * islands it is reachable from, and pack-objects only makes an object
+ * a delta against a base that is in all of its islands.  A fork that
+ * only fetches its own refs can then always reuse the deltas of a pack
+ * shared by several forks.
+ */
+
+/* Handle pack.island; returns -1 if the expression does not compile. */
+extern int island_config(const char *var, const char *value);
+
+/* Mark the objects the refs point at with their islands. */
+extern void load_delta_islands(int progress);
+
+/*
+ * Pass the islands of commit on to its parents and its tree.  Call
+ * this on each commit of a walk with topo_order set, children first.
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/*
+ * Pass the islands of the trees of to_pack on to their entries, using
+ * the tree depths recorded in to_pack->tree_depth.
+ */
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/*
+ * Whether trg may be stored as a delta against src: src must be in all
+ * of the islands of trg.  An object in no island can be a delta
+ * against anything, but is never used as a base.
+ */
+extern int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+/*
+ * Compare for sorting: an object in all of the islands of the other
+ * one sorts first, so that it is in the window when the other one
+ * looks for a base.
+ */
+extern int island_delta_cmp(const unsigned char *a, const unsigned char *b);
+
+#endif
@@ -3328,9 +3328,12 @@ void diff_setup_done(struct diff_options *options)
 			 * so it is safe for us to do this here.  Also
 			 * it does not smudge active_cache or active_nr
 			 * when it fails, so we do not have to worry about
-			 * cleaning it up ourselves either.
+			 * cleaning it up ourselves either.  Only paths
+			 * are looked up in it, see reuse_worktree_file();
+			 * paths inside sparse directories are not checked
+			 * out and would not be reused anyway.
 			 */
-			read_cache();
+			read_cache_sparse();
 	}
 	if (options->abbrev <= 0 || 40 < options->abbrev)
 		options->abbrev = 40; /* full */
@@ -13,6 +13,7 @@
 #include "wildmatch.h"
 #include "pathspec.h"
 #include "utf8.h"
+#include "varint.h"
 
 struct path_simplify {
 	int len;
@@ -32,8 +33,22 @@ enum path_treatment {
 	path_untracked
 };
 
+/*
+ * Support data structure for our opendir/readdir/closedir wrappers
+ */
+struct cached_dir {
+	DIR *fdir;
+	struct untracked_cache_dir *untracked;
+	int nr_files;
+	int nr_dirs;
+
+	struct dirent *de;
+	const char *file;
+	struct untracked_cache_dir *ucd;
+};
+
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
-	const char *path, int len,
+	const char *path, int len, struct untracked_cache_dir *untracked,
 	int check_only, const struct path_simplify *simplify);
 static int get_dtype(struct dirent *de, const char *path, int len);
 
@@ -510,7 +525,8 @@ void add_exclude(const char *string, const char *base,
 	x->el = el;
 }
 
-static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
+static void *read_skip_worktree_file_from_index(const char *path, size_t *size,
+						struct sha1_stat *sha1_stat)
 {
 	int pos, len;
 	unsigned long sz;
@@ -529,6 +545,10 @@ static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
 		return NULL;
 	}
 	*size = xsize_t(sz);
+	if (sha1_stat) {
+		memset(&sha1_stat->stat, 0, sizeof(sha1_stat->stat));
+		hashcpy(sha1_stat->sha1, active_cache[pos]->sha1);
+	}
 	return data;
 }
 
@@ -573,11 +593,19 @@ static void trim_trailing_spaces(char *buf)
 		*last_space = '\0';
 }
 
-int add_excludes_from_file_to_list(const char *fname,
-				   const char *base,
-				   int baselen,
-				   struct exclude_list *el,
-				   int check_index)
+/*
+ * Given a file with name "fname", read it (either from disk, or from
+ * the index if "check_index" is non-zero), parse it and store the
+ * exclude rules in "el".
+ *
+ * If "sha1_stat" is not NULL, record the SHA-1 of the contents of
+ * the exclude file and the stat data of the file in it (only valid
+ * if add_excludes() returns zero).  If sha1_stat->valid is set on
+ * input, its contents are reused when the stat data still matches.
+ */
+static int add_excludes(const char *fname, const char *base, int baselen,
+			struct exclude_list *el, int check_index,
+			struct sha1_stat *sha1_stat)
 {
 	struct stat st;
 	int fd, i, lineno = 1;
@@ -591,7 +619,8 @@ int add_excludes_from_file_to_list(const char *fname,
 		if (0 <= fd)
 			close(fd);
 		if (!check_index ||
-		    (buf = read_skip_worktree_file_from_index(fname, &size)) == NULL)
+		    (buf = read_skip_worktree_file_from_index(fname, &size,
+							      sha1_stat)) == NULL)
 			return -1;
 		if (size == 0) {
 			free(buf);
@@ -604,6 +633,11 @@ int add_excludes_from_file_to_list(const char *fname,
 	} else {
 		size = xsize_t(st.st_size);
 		if (size == 0) {
+			if (sha1_stat) {
+				fill_stat_data(&sha1_stat->stat, &st);
+				hashcpy(sha1_stat->sha1, EMPTY_BLOB_SHA1_BIN);
+				sha1_stat->valid = 1;
+			}
 			close(fd);
 			return 0;
 		}
@@ -613,8 +647,24 @@ int add_excludes_from_file_to_list(const char *fname,
 			close(fd);
 			return -1;
 		}
-		buf[size++] = '\n';
 		close(fd);
+		if (sha1_stat) {
+			int pos;
+			if (sha1_stat->valid &&
+			    !match_stat_data_racy(&the_index, &sha1_stat->stat, &st))
+				; /* no content change, sha1_stat->sha1 still good */
+			else if (check_index &&
+				 (pos = cache_name_pos(fname, strlen(fname))) >= 0 &&
+				 !ce_stage(active_cache[pos]) &&
+				 ce_uptodate(active_cache[pos]) &&
+				 !would_convert_to_git(fname))
+				hashcpy(sha1_stat->sha1, active_cache[pos]->sha1);
+			else
+				hash_sha1_file(buf, size, "blob", sha1_stat->sha1);
+			fill_stat_data(&sha1_stat->stat, &st);
+			sha1_stat->valid = 1;
+		}
+		buf[size++] = '\n';
 	}
 
 	el->filebuf = buf;
@@ -638,6 +688,13 @@ int add_excludes_from_file_to_list(const char *fname,
 	return 0;
 }
 
+int add_excludes_from_file_to_list(const char *fname, const char *base,
+				   int baselen, struct exclude_list *el,
+				   int check_index)
+{
+	return add_excludes(fname, base, baselen, el, check_index, NULL);
+}
+
 struct exclude_list *add_exclude_list(struct dir_struct *dir,
 				      int group_type, const char *src)
 {
@@ -655,14 +712,29 @@ struct exclude_list *add_exclude_list(struct dir_struct *dir,
 /*
  * Used to set up core.excludesfile and .git/info/exclude lists.
  */
-void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+static void add_excludes_from_file_1(struct dir_struct *dir, const char *fname,
+				     struct sha1_stat *sha1_stat)
 {
 	struct exclude_list *el;
+
+	/*
+	 * Catch setup_standard_excludes() being called before
+	 * dir->untracked is set; it does not record the SHA-1 of the
+	 * exclude files then.
+	 */
+	if (!dir->untracked)
+		dir->unmanaged_exclude_files++;
 	el = add_exclude_list(dir, EXC_FILE, fname);
-	if (add_excludes_from_file_to_list(fname, "", 0, el, 0) < 0)
+	if (add_excludes(fname, "", 0, el, 0, sha1_stat) < 0)
 		die("cannot use %s as an exclude file", fname);
 }
 
+void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+{
+	dir->unmanaged_exclude_files++; /* see validate_untracked_cache() */
+	add_excludes_from_file_1(dir, fname, NULL);
+}
+
 int match_basename(const char *basename, int basenamelen,
 		   const char *pattern, int prefix, int patternlen,
 		   int flags)
@@ -828,6 +900,117 @@ static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
 	return NULL;
 }
 
+/*
+ * Find the subdirectory "name" (of length "len", maybe with a
+ * trailing slash) of "dir" in the untracked cache.  Returns its
+ * position in dir->dirs, or -1 - the position to insert it at.
+ */
+static int untracked_dir_pos(struct untracked_cache_dir *dir,
+			     const char *name, int len)
+{
+	int first, last;
+
+	if (len && name[len - 1] == '/')
+		len--;
+	first = 0;
+	last = dir->dirs_nr;
+	while (last > first) {
+		int cmp, next = (last + first) >> 1;
+		struct untracked_cache_dir *d = dir->dirs[next];
+		cmp = strncmp(name, d->name, len);
+		if (!cmp && d->name[len])
+			cmp = -1;
+		if (!cmp)
+			return next;
+		if (cmp < 0) {
+			last = next;
+			continue;
+		}
+		first = next+1;
+	}
+	return -first-1;
+}
+
+static struct untracked_cache_dir *find_untracked(struct untracked_cache_dir *dir,
+						  const char *name, int len)
+{
+	int pos = untracked_dir_pos(dir, name, len);
+	return pos < 0 ? NULL : dir->dirs[pos];
+}
+
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *dir,
+						    const char *name, int len)
+{
+	struct untracked_cache_dir *d;
+	int pos;
+
+	if (!dir)
+		return NULL;
+	pos = untracked_dir_pos(dir, name, len);
+	if (pos >= 0)
+		return dir->dirs[pos];
+	pos = -pos-1;
+
+	if (len && name[len - 1] == '/')
+		len--;
+	uc->dir_created++;
+	d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+
+	ALLOC_GROW(dir->dirs, dir->dirs_nr + 1, dir->dirs_alloc);
+	memmove(dir->dirs + pos + 1, dir->dirs + pos,
+		(dir->dirs_nr - pos) * sizeof(*dir->dirs));
+	dir->dirs_nr++;
+	dir->dirs[pos] = d;
+	return d;
+}
+
+static void add_untracked(struct untracked_cache_dir *dir, const char *name)
+{
+	if (!dir)
+		return;
+	ALLOC_GROW(dir->untracked, dir->untracked_nr + 1,
+		   dir->untracked_alloc);
+	dir->untracked[dir->untracked_nr++] = xstrdup(name);
+}
+
+static void clear_untracked(struct untracked_cache_dir *dir)
+{
+	int i;
+
+	dir->valid = 0;
+	for (i = 0; i < dir->untracked_nr; i++)
+		free(dir->untracked[i]);
+	dir->untracked_nr = 0;
+}
+
+static void do_invalidate_gitignore(struct untracked_cache_dir *dir)
+{
+	int i;
+
+	clear_untracked(dir);
+	for (i = 0; i < dir->dirs_nr; i++)
+		do_invalidate_gitignore(dir->dirs[i]);
+}
+
+/* An exclude file that applies to "dir" and all below it changed */
+static void invalidate_gitignore(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	uc->gitignore_invalidated++;
+	do_invalidate_gitignore(dir);
+}
+
+/* The entries of "dir" changed, either on disk or in the index */
+static void invalidate_directory(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	uc->dir_invalidated++;
+	clear_untracked(dir);
+}
+
 /*
  * Loads the per-directory exclude list for the substring of base
  * which has a char length of baselen.
@@ -837,6 +1020,7 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 	struct exclude_list_group *group;
 	struct exclude_list *el;
 	struct exclude_stack *stk = NULL;
+	struct untracked_cache_dir *untracked;
 	int current;
 
 	group = &dir->exclude_list_group[EXC_DIRS];
@@ -874,8 +1058,14 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 	/* Read from the parent directories and push them down. */
 	current = stk ? stk->baselen : -1;
 	strbuf_setlen(&dir->basebuf, current < 0 ? 0 : current);
+	if (dir->untracked)
+		untracked = stk ? stk->ucd : dir->untracked->root;
+	else
+		untracked = NULL;
+
 	while (current < baselen) {
 		const char *cp;
+		struct sha1_stat sha1_stat;
 
 		stk = xcalloc(1, sizeof(*stk));
 		if (current < 0) {
@@ -886,10 +1076,15 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 			if (!cp)
 				die("oops in prep_exclude");
 			cp++;
+			untracked =
+				lookup_untracked(dir->untracked, untracked,
+						 base + current,
+						 cp - base - current);
 		}
 		stk->prev = dir->exclude_stack;
 		stk->baselen = cp - base;
 		stk->exclude_ix = group->nr;
+		stk->ucd = untracked;
 		el = add_exclude_list(dir, EXC_DIRS, NULL);
 		strbuf_add(&dir->basebuf, base + current, stk->baselen - current);
 		assert(stk->baselen == dir->basebuf.len);
@@ -912,7 +1107,16 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 		}
 
 		/* Try to read per-directory file */
-		if (dir->exclude_per_dir) {
+		hashclr(sha1_stat.sha1);
+		sha1_stat.valid = 0;
+		if (dir->exclude_per_dir &&
+		    /*
+		     * If the untracked cache knows that the entries of
+		     * this directory did not change and that it had no
+		     * exclude file, there is no need to look for one.
+		     */
+		    (!untracked || !untracked->valid ||
+		     !is_null_sha1(untracked->exclude_sha1))) {
 			/*
 			 * dir->basebuf gets reused by the traversal, but we
 			 * need fname to remain unchanged to ensure the src
@@ -925,8 +1129,13 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 			strbuf_addbuf(&sb, &dir->basebuf);
 			strbuf_addstr(&sb, dir->exclude_per_dir);
 			el->src = strbuf_detach(&sb, NULL);
-			add_excludes_from_file_to_list(el->src, el->src,
-						       stk->baselen, el, 1);
+			add_excludes(el->src, el->src, stk->baselen, el, 1,
+				     untracked ? &sha1_stat : NULL);
+		}
+		if (untracked &&
+		    hashcmp(sha1_stat.sha1, untracked->exclude_sha1)) {
+			invalidate_gitignore(dir->untracked, untracked);
+			hashcpy(untracked->exclude_sha1, sha1_stat.sha1);
 		}
 		dir->exclude_stack = stk;
 		current = stk->baselen;
@@ -1107,7 +1316,8 @@ static enum exist_status directory_exists_in_index(const char *dirname, int len)
  *  (c) otherwise, we recurse into it.
  */
 static enum path_treatment treat_directory(struct dir_struct *dir,
-	const char *dirname, int len, int exclude,
+	struct untracked_cache_dir *untracked,
+	const char *dirname, int len, int baselen, int exclude,
 	const struct path_simplify *simplify)
 {
 	/* The "len-1" is to strip the final '/' */
@@ -1134,7 +1344,10 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return exclude ? path_excluded : path_untracked;
 
-	return read_directory_recursive(dir, dirname, len, 1, simplify);
+	untracked = lookup_untracked(dir->untracked, untracked,
+				     dirname + baselen, len - baselen);
+	return read_directory_recursive(dir, dirname, len,
+					untracked, 1, simplify);
 }
 
 /*
@@ -1250,7 +1463,9 @@ static int get_dtype(struct dirent *de, const char *path, int len)
 }
 
 static enum path_treatment treat_one_path(struct dir_struct *dir,
+					  struct untracked_cache_dir *untracked,
 					  struct strbuf *path,
+					  int baselen,
 					  const struct path_simplify *simplify,
 					  int dtype, struct dirent *de)
 {
@@ -1302,22 +1517,64 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 		return path_none;
 	case DT_DIR:
 		strbuf_addch(path, '/');
-		return treat_directory(dir, path->buf, path->len, exclude,
-			simplify);
+		return treat_directory(dir, untracked, path->buf, path->len,
+				       baselen, exclude, simplify);
 	case DT_REG:
 	case DT_LNK:
 		return exclude ? path_excluded : path_untracked;
 	}
 }
 
+/*
+ * This is the cache hit side of treat_path(): "cdir" holds a name
+ * from the untracked cache instead of a directory entry.
+ */
+static enum path_treatment treat_path_fast(struct dir_struct *dir,
+					   struct untracked_cache_dir *untracked,
+					   struct cached_dir *cdir,
+					   struct strbuf *path,
+					   int baselen,
+					   const struct path_simplify *simplify)
+{
+	strbuf_setlen(path, baselen);
+	if (!cdir->ucd) {
+		strbuf_addstr(path, cdir->file);
+		return path_untracked;
+	}
+	strbuf_addstr(path, cdir->ucd->name);
+	/* treat_one_path() does this before it calls treat_directory() */
+	strbuf_addch(path, '/');
+	if (cdir->ucd->check_only)
+		/*
+		 * check_only is set when treat_directory() had to look
+		 * into a directory that is not in the index.  Ask the
+		 * same question again; its answer is not recorded in
+		 * the parent, whose mtime does not change when files
+		 * deeper down come and go.
+		 */
+		return read_directory_recursive(dir, path->buf, path->len,
+						cdir->ucd, 1, simplify);
+	/*
+	 * We got path_recurse the last time, because the directory
+	 * is in the index.  Otherwise the index changed and the
+	 * parent would have been invalidated.
+	 */
+	return path_recurse;
+}
+
 static enum path_treatment treat_path(struct dir_struct *dir,
-				      struct dirent *de,
+				      struct untracked_cache_dir *untracked,
+				      struct cached_dir *cdir,
 				      struct strbuf *path,
 				      int baselen,
 				      const struct path_simplify *simplify)
 {
 	int dtype;
+	struct dirent *de = cdir->de;
 
+	if (!de)
+		return treat_path_fast(dir, untracked, cdir, path,
+				       baselen, simplify);
 	if (is_dot_or_dotdot(de->d_name) || !strcmp(de->d_name, ".git"))
 		return path_none;
 	strbuf_setlen(path, baselen);
@@ -1326,7 +1583,118 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_none;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, simplify, dtype, de);
+	return treat_one_path(dir, untracked, path, baselen, simplify, dtype, de);
+}
+
+static int valid_cached_dir(struct dir_struct *dir,
+			    struct untracked_cache_dir *untracked,
+			    struct strbuf *path,
+			    int check_only)
+{
+	struct stat st;
+
+	if (!untracked)
+		return 0;
+
+	if (!dir->untracked->use_fsmonitor || !untracked->valid) {
+		if (stat(path->len ? path->buf : ".", &st)) {
+			invalidate_directory(dir->untracked, untracked);
+			memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
+			return 0;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
+			if (untracked->valid)
+				invalidate_directory(dir->untracked, untracked);
+			fill_stat_data(&untracked->stat_data, &st);
+		}
+	}
+	if (untracked->valid && untracked->check_only != !!check_only)
+		invalidate_directory(dir->untracked, untracked);
+
+	/*
+	 * prep_exclude() will be called on this directory anyway, but
+	 * much later in last_exclude_matching(), if at all.  Call it
+	 * now: it invalidates the directory if its exclude file, or
+	 * that of one of its parents, changed, and records its SHA-1
+	 * if we are about to read the directory.  Its next calls on
+	 * this directory are nearly no-ops.
+	 */
+	if (path->len && path->buf[path->len - 1] != '/') {
+		strbuf_addch(path, '/');
+		prep_exclude(dir, path->buf, path->len);
+		strbuf_setlen(path, path->len - 1);
+	} else
+		prep_exclude(dir, path->buf, path->len);
+
+	/* prep_exclude() may have invalidated this entry */
+	return untracked->valid;
+}
+
+static int open_cached_dir(struct cached_dir *cdir,
+			   struct dir_struct *dir,
+			   struct untracked_cache_dir *untracked,
+			   struct strbuf *path,
+			   int check_only)
+{
+	int i;
+
+	memset(cdir, 0, sizeof(*cdir));
+	cdir->untracked = untracked;
+	if (valid_cached_dir(dir, untracked, path, check_only))
+		return 0;
+	if (untracked) {
+		/*
+		 * The directory is read afresh; the subdirectories that
+		 * are still there are found again.
+		 */
+		clear_untracked(untracked);
+		for (i = 0; i < untracked->dirs_nr; i++)
+			untracked->dirs[i]->recurse = 0;
+	}
+	cdir->fdir = opendir(path->len ? path->buf : ".");
+	if (dir->untracked)
+		dir->untracked->dir_opened++;
+	if (!cdir->fdir)
+		return -1;
+	return 0;
+}
+
+static int read_cached_dir(struct cached_dir *cdir)
+{
+	if (cdir->fdir) {
+		cdir->de = readdir(cdir->fdir);
+		if (!cdir->de)
+			return -1;
+		return 0;
+	}
+	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
+		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs++];
+		if (d->recurse) {
+			cdir->ucd = d;
+			return 0;
+		}
+	}
+	cdir->ucd = NULL;
+	if (cdir->nr_files < cdir->untracked->untracked_nr) {
+		cdir->file = cdir->untracked->untracked[cdir->nr_files++];
+		return 0;
+	}
+	return -1;
+}
+
+static void close_cached_dir(struct cached_dir *cdir)
+{
+	if (cdir->fdir)
+		closedir(cdir->fdir);
+	/*
+	 * We have gone through this directory and recorded what it
+	 * has.  Mark it valid.
+	 */
+	if (cdir->untracked) {
+		cdir->untracked->valid = 1;
+		cdir->untracked->recurse = 1;
+	}
 }
 
 /*
@@ -1342,38 +1710,49 @@ static enum path_treatment treat_path(struct dir_struct *dir,
  */
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
+				    struct untracked_cache_dir *untracked,
 				    int check_only,
 				    const struct path_simplify *simplify)
 {
-	DIR *fdir;
+	struct cached_dir cdir;
 	enum path_treatment state, subdir_state, dir_state = path_none;
-	struct dirent *de;
 	struct strbuf path = STRBUF_INIT;
 
 	strbuf_add(&path, base, baselen);
 
-	fdir = opendir(path.len ? path.buf : ".");
-	if (!fdir)
+	if (open_cached_dir(&cdir, dir, untracked, &path, check_only))
 		goto out;
 
-	while ((de = readdir(fdir)) != NULL) {
+	if (untracked)
+		untracked->check_only = !!check_only;
+
+	while (!read_cached_dir(&cdir)) {
 		/* check how the file or directory should be treated */
-		state = treat_path(dir, de, &path, baselen, simplify);
+		state = treat_path(dir, untracked, &cdir, &path, baselen, simplify);
 		if (state > dir_state)
 			dir_state = state;
 
 		/* recurse into subdir if instructed by treat_path */
 		if (state == path_recurse) {
-			subdir_state = read_directory_recursive(dir, path.buf,
-				path.len, check_only, simplify);
+			struct untracked_cache_dir *ud;
+			ud = lookup_untracked(dir->untracked, untracked,
+					      path.buf + baselen,
+					      path.len - baselen);
+			subdir_state =
+				read_directory_recursive(dir, path.buf, path.len,
+							 ud, check_only, simplify);
 			if (subdir_state > dir_state)
 				dir_state = subdir_state;
 		}
 
 		if (check_only) {
 			/* abort early if maximum state has been reached */
-			if (dir_state == path_untracked)
+			if (dir_state == path_untracked) {
+				if (cdir.fdir && state == path_untracked &&
+				    path.buf[path.len - 1] != '/')
+					add_untracked(untracked, path.buf + baselen);
 				break;
+			}
 			/* skip the dir_add_* part */
 			continue;
 		}
@@ -1391,15 +1770,22 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 			break;
 
 		case path_untracked:
-			if (!(dir->flags & DIR_SHOW_IGNORED))
-				dir_add_name(dir, path.buf, path.len);
+			if (dir->flags & DIR_SHOW_IGNORED)
+				break;
+			dir_add_name(dir, path.buf, path.len);
+			/*
+			 * Untracked directories are found again through
+			 * their own untracked_cache_dir.
+			 */
+			if (cdir.fdir && path.buf[path.len - 1] != '/')
+				add_untracked(untracked, path.buf + baselen);
 			break;
 
 		default:
 			break;
 		}
 	}
-	closedir(fdir);
+	close_cached_dir(&cdir);
  out:
 	strbuf_release(&path);
 
@@ -1469,7 +1855,7 @@ static int treat_leading_path(struct dir_struct *dir,
 			break;
 		if (simplify_away(sb.buf, sb.len, simplify))
 			break;
-		if (treat_one_path(dir, &sb, simplify,
+		if (treat_one_path(dir, NULL, &sb, baselen, simplify,
 				   DT_DIR, NULL) == path_none)
 			break; /* do not recurse into it */
 		if (len <= baselen) {
@@ -1482,9 +1868,99 @@ static int treat_leading_path(struct dir_struct *dir,
 	return rc;
 }
 
+static const char *get_ident_string(void)
+{
+	static struct strbuf sb = STRBUF_INIT;
+	struct utsname uts;
+
+	if (sb.len)
+		return sb.buf;
+	if (uname(&uts) < 0)
+		die_errno(_("failed to get kernel name and information"));
+	strbuf_addf(&sb, "Location %s, system %s", get_git_work_tree(),
+		    uts.sysname);
+	return sb.buf;
+}
+
+static int ident_in_untracked(const struct untracked_cache *uc)
+{
+	return !strcmp(uc->ident.buf, get_ident_string());
+}
+
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+						      int base_len,
+						      const struct pathspec *pathspec)
+{
+	struct untracked_cache *uc = dir->untracked;
+
+	if (!uc || getenv("GIT_DISABLE_UNTRACKED_CACHE"))
+		return NULL;
+
+	/*
+	 * We only support $GIT_DIR/info/exclude and core.excludesfile
+	 * as the global exclude files.  Any other addition (e.g. from
+	 * the command line) disables the cache.  This also catches
+	 * setup_standard_excludes() being called before
+	 * dir->untracked was set.
+	 */
+	if (dir->unmanaged_exclude_files)
+		return NULL;
+
+	/*
+	 * Only the whole-tree walk of "git status" is cached; a
+	 * pathspec would need more work in treat_leading_path().
+	 */
+	if (base_len || (pathspec && pathspec->nr))
+		return NULL;
+
+	/*
+	 * Different flags give different results.  Without
+	 * DIR_SHOW_OTHER_DIRECTORIES, treat_directory() would also
+	 * depend on .git files for resolve_gitlink_ref(), which we do
+	 * not cache.  Ignored files are not cached either.
+	 */
+	if (dir->flags != uc->dir_flags ||
+	    !(dir->flags & DIR_SHOW_OTHER_DIRECTORIES) ||
+	    (dir->flags & (DIR_SHOW_IGNORED | DIR_SHOW_IGNORED_TOO |
+			   DIR_COLLECT_IGNORED)))
+		return NULL;
+
+	/* The exclude file name is part of the exclude state */
+	if (!dir->exclude_per_dir || !uc->exclude_per_dir ||
+	    strcmp(dir->exclude_per_dir, uc->exclude_per_dir))
+		return NULL;
+
+	/* EXC_CMDL is not considered in the cache */
+	if (dir->exclude_list_group[EXC_CMDL].nr)
+		return NULL;
+
+	if (!ident_in_untracked(uc)) {
+		warning(_("Untracked cache is disabled on this system or location."));
+		return NULL;
+	}
+
+	if (!uc->root)
+		uc->root = xcalloc(1, sizeof(*uc->root));
+
+	/* Validate $GIT_DIR/info/exclude and core.excludesfile */
+	if (hashcmp(dir->ss_info_exclude.sha1, uc->ss_info_exclude.sha1)) {
+		invalidate_gitignore(uc, uc->root);
+		uc->ss_info_exclude = dir->ss_info_exclude;
+	}
+	if (hashcmp(dir->ss_excludes_file.sha1, uc->ss_excludes_file.sha1)) {
+		invalidate_gitignore(uc, uc->root);
+		uc->ss_excludes_file = dir->ss_excludes_file;
+	}
+
+	/* Make sure this directory is not dropped when writing the cache */
+	uc->root->recurse = 1;
+	return uc->root;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const struct pathspec *pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	/*
 	 * Check out create_simplify()
@@ -1508,11 +1984,35 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const stru
 	 * create_simplify().
 	 */
 	simplify = create_simplify(pathspec ? pathspec->_raw : NULL);
+	untracked = validate_untracked_cache(dir, len, pathspec);
+	if (!untracked)
+		/*
+		 * make sure the untracked cache code paths, e.g. in
+		 * prep_exclude(), are disabled
+		 */
+		dir->untracked = NULL;
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, untracked, 0, simplify);
 	free_simplify(simplify);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
+	if (dir->untracked) {
+		static struct trace_key trace_untracked_stats = TRACE_KEY_INIT(UNTRACKED_STATS);
+		trace_printf_key(&trace_untracked_stats,
+				 "node creation: %u\n"
+				 "gitignore invalidation: %u\n"
+				 "directory invalidation: %u\n"
+				 "opendir: %u\n",
+				 dir->untracked->dir_created,
+				 dir->untracked->gitignore_invalidated,
+				 dir->untracked->dir_invalidated,
+				 dir->untracked->dir_opened);
+		if (dir->untracked == the_index.untracked &&
+		    (dir->untracked->dir_opened ||
+		     dir->untracked->gitignore_invalidated ||
+		     dir->untracked->dir_invalidated))
+			the_index.cache_changed |= UNTRACKED_CHANGED;
+	}
 	return dir->nr;
 }
 
@@ -1677,9 +2177,11 @@ void setup_standard_excludes(struct dir_struct *dir)
 	if (!excludes_file)
 		excludes_file = xdg_config_home("ignore");
 	if (!access_or_warn(path, R_OK, 0))
-		add_excludes_from_file(dir, path);
+		add_excludes_from_file_1(dir, path,
+					 dir->untracked ? &dir->ss_info_exclude : NULL);
 	if (excludes_file && !access_or_warn(excludes_file, R_OK, 0))
-		add_excludes_from_file(dir, excludes_file);
+		add_excludes_from_file_1(dir, excludes_file,
+					 dir->untracked ? &dir->ss_excludes_file : NULL);
 }
 
 int remove_path(const char *name)
@@ -1731,3 +2233,369 @@ void clear_directory(struct dir_struct *dir)
 	}
 	strbuf_release(&dir->basebuf);
 }
+
+static void free_untracked(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	if (!ucd)
+		return;
+	for (i = 0; i < ucd->dirs_nr; i++)
+		free_untracked(ucd->dirs[i]);
+	for (i = 0; i < ucd->untracked_nr; i++)
+		free(ucd->untracked[i]);
+	free(ucd->untracked);
+	free(ucd->dirs);
+	free(ucd);
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked(uc->root);
+	strbuf_release(&uc->ident);
+	free((char *)uc->exclude_per_dir);
+	free(uc);
+}
+
+/*
+ * The untracked cache is stored in the index extension "UNTR":
+ *
+ *   ident NUL
+ *   SHA-1 of $GIT_DIR/info/exclude
+ *   SHA-1 of core.excludesfile
+ *   varint dir_flags
+ *   exclude_per_dir NUL
+ *
+ * followed by the directories that were gone through, depth-first
+ * starting at the root, if there are any.  Each one is
+ *
+ *   varint number of untracked entries
+ *   varint number of subdirectories
+ *   varint flags (UC_VALID, UC_CHECK_ONLY, UC_HAS_EXCLUDE_SHA1)
+ *   name NUL
+ *   untracked entries, each NUL terminated
+ *   stat data (nine 32-bit numbers) if UC_VALID
+ *   SHA-1 of its exclude file if UC_HAS_EXCLUDE_SHA1
+ *
+ * All numbers are in network byte order.
+ */
+#define UC_VALID		(1 << 0)
+#define UC_CHECK_ONLY		(1 << 1)
+#define UC_HAS_EXCLUDE_SHA1	(1 << 2)
+
+static void write_varint(struct strbuf *out, uintmax_t value)
+{
+	unsigned char buf[16];
+	strbuf_add(out, buf, encode_varint(value, buf));
+}
+
+static void write_stat_data(struct strbuf *out, const struct stat_data *sd)
+{
+	uint32_t data[9];
+
+	data[0] = htonl(sd->sd_ctime.sec);
+	data[1] = htonl(sd->sd_ctime.nsec);
+	data[2] = htonl(sd->sd_mtime.sec);
+	data[3] = htonl(sd->sd_mtime.nsec);
+	data[4] = htonl(sd->sd_dev);
+	data[5] = htonl(sd->sd_ino);
+	data[6] = htonl(sd->sd_uid);
+	data[7] = htonl(sd->sd_gid);
+	data[8] = htonl(sd->sd_size);
+	strbuf_add(out, data, sizeof(data));
+}
+
+static void write_one_dir(struct strbuf *out, struct untracked_cache_dir *ucd,
+			  const struct index_state *istate)
+{
+	int i, dirs_nr = 0, untracked_nr = 0;
+	unsigned flags = 0;
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			dirs_nr++;
+	/*
+	 * A directory that was modified since the index was last
+	 * written may have been modified again in the same second
+	 * after we read it, without a change to its stat data.  Like
+	 * racily clean index entries, do not trust it next time.
+	 */
+	if (ucd->valid && !is_racy_stat(istate, &ucd->stat_data)) {
+		flags |= UC_VALID;
+		untracked_nr = ucd->untracked_nr;
+	}
+	if (ucd->check_only)
+		flags |= UC_CHECK_ONLY;
+	if (!is_null_sha1(ucd->exclude_sha1))
+		flags |= UC_HAS_EXCLUDE_SHA1;
+
+	write_varint(out, untracked_nr);
+	write_varint(out, dirs_nr);
+	write_varint(out, flags);
+	strbuf_add(out, ucd->name, strlen(ucd->name) + 1);
+	for (i = 0; i < untracked_nr; i++)
+		strbuf_add(out, ucd->untracked[i],
+			   strlen(ucd->untracked[i]) + 1);
+	if (flags & UC_VALID)
+		write_stat_data(out, &ucd->stat_data);
+	if (flags & UC_HAS_EXCLUDE_SHA1)
+		strbuf_add(out, ucd->exclude_sha1, 20);
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			write_one_dir(out, ucd->dirs[i], istate);
+}
+
+void write_untracked_extension(struct strbuf *out,
+			       const struct index_state *istate)
+{
+	struct untracked_cache *uc = istate->untracked;
+
+	strbuf_add(out, uc->ident.buf, uc->ident.len + 1);
+	strbuf_add(out, uc->ss_info_exclude.sha1, 20);
+	strbuf_add(out, uc->ss_excludes_file.sha1, 20);
+	write_varint(out, uc->dir_flags);
+	strbuf_addstr(out, uc->exclude_per_dir);
+	strbuf_addch(out, '\0');
+	if (uc->root && uc->root->recurse)
+		write_one_dir(out, uc->root, istate);
+}
+
+struct read_data {
+	const unsigned char *data;
+	const unsigned char *end;
+};
+
+static int read_varint(struct read_data *rd, unsigned int *value)
+{
+	const unsigned char *p = rd->data;
+	uintmax_t v;
+
+	while (p < rd->end && (*p & 0x80))
+		p++;
+	if (p >= rd->end)
+		return -1;
+	v = decode_varint(&rd->data);
+	if (v > UINT_MAX)
+		return -1;
+	*value = v;
+	return 0;
+}
+
+static const char *read_string(struct read_data *rd)
+{
+	const char *s = (const char *)rd->data;
+	const unsigned char *eos = memchr(rd->data, '\0', rd->end - rd->data);
+
+	if (!eos)
+		return NULL;
+	rd->data = eos + 1;
+	return s;
+}
+
+static int read_stat_data(struct read_data *rd, struct stat_data *sd)
+{
+	uint32_t data[9];
+
+	if (rd->end - rd->data < sizeof(data))
+		return -1;
+	memcpy(data, rd->data, sizeof(data));
+	rd->data += sizeof(data);
+	sd->sd_ctime.sec = ntohl(data[0]);
+	sd->sd_ctime.nsec = ntohl(data[1]);
+	sd->sd_mtime.sec = ntohl(data[2]);
+	sd->sd_mtime.nsec = ntohl(data[3]);
+	sd->sd_dev = ntohl(data[4]);
+	sd->sd_ino = ntohl(data[5]);
+	sd->sd_uid = ntohl(data[6]);
+	sd->sd_gid = ntohl(data[7]);
+	sd->sd_size = ntohl(data[8]);
+	return 0;
+}
+
+static int read_sha1(struct read_data *rd, unsigned char *sha1)
+{
+	if (rd->end - rd->data < 20)
+		return -1;
+	hashcpy(sha1, rd->data);
+	rd->data += 20;
+	return 0;
+}
+
+static struct untracked_cache_dir *read_one_dir(struct read_data *rd)
+{
+	struct untracked_cache_dir *ucd;
+	unsigned int untracked_nr, dirs_nr, flags, i;
+	const char *name;
+
+	if (read_varint(rd, &untracked_nr) ||
+	    read_varint(rd, &dirs_nr) ||
+	    read_varint(rd, &flags) ||
+	    !(name = read_string(rd)) ||
+	    untracked_nr > rd->end - rd->data ||
+	    dirs_nr > rd->end - rd->data)
+		return NULL;
+
+	ucd = xcalloc(1, sizeof(*ucd) + strlen(name) + 1);
+	strcpy(ucd->name, name);
+	ucd->valid = !!(flags & UC_VALID);
+	ucd->check_only = !!(flags & UC_CHECK_ONLY);
+	ucd->recurse = 1;
+
+	ALLOC_GROW(ucd->untracked, untracked_nr, ucd->untracked_alloc);
+	for (i = 0; i < untracked_nr; i++) {
+		const char *untracked = read_string(rd);
+		if (!untracked)
+			goto corrupt;
+		ucd->untracked[ucd->untracked_nr++] = xstrdup(untracked);
+	}
+	if (((flags & UC_VALID) && read_stat_data(rd, &ucd->stat_data)) ||
+	    ((flags & UC_HAS_EXCLUDE_SHA1) && read_sha1(rd, ucd->exclude_sha1)))
+		goto corrupt;
+
+	ALLOC_GROW(ucd->dirs, dirs_nr, ucd->dirs_alloc);
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *d = read_one_dir(rd);
+		if (!d ||
+		    (i && strcmp(ucd->dirs[i - 1]->name, d->name) >= 0)) {
+			free_untracked(d);
+			goto corrupt;
+		}
+		ucd->dirs[ucd->dirs_nr++] = d;
+	}
+	return ucd;
+
+corrupt:
+	free_untracked(ucd);
+	return NULL;
+}
+
+static struct untracked_cache *new_untracked_cache(void)
+{
+	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
+
+	strbuf_init(&uc->ident, 100);
+	uc->exclude_per_dir = xstrdup(".gitignore");
+	/* the flags wt_status_collect_untracked() uses by default */
+	uc->dir_flags = DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
+	return uc;
+}
+
+/*
+ * Returns NULL if the extension is corrupt; the cache is then simply
+ * rebuilt.
+ */
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	struct untracked_cache *uc;
+	struct read_data rd;
+	const char *ident, *exclude_per_dir;
+
+	rd.data = data;
+	rd.end = rd.data + sz;
+	uc = new_untracked_cache();
+	if (!(ident = read_string(&rd)) ||
+	    read_sha1(&rd, uc->ss_info_exclude.sha1) ||
+	    read_sha1(&rd, uc->ss_excludes_file.sha1) ||
+	    read_varint(&rd, &uc->dir_flags) ||
+	    !(exclude_per_dir = read_string(&rd)))
+		goto corrupt;
+	strbuf_addstr(&uc->ident, ident);
+	free((char *)uc->exclude_per_dir);
+	uc->exclude_per_dir = xstrdup(exclude_per_dir);
+
+	if (rd.data < rd.end) {
+		uc->root = read_one_dir(&rd);
+		if (!uc->root || rd.data != rd.end)
+			goto corrupt;
+	}
+	return uc;
+
+corrupt:
+	free_untracked_cache(uc);
+	return NULL;
+}
+
+void add_untracked_cache(struct index_state *istate)
+{
+	if (istate->untracked &&
+	    ident_in_untracked(istate->untracked))
+		return;
+	free_untracked_cache(istate->untracked);
+	istate->untracked = new_untracked_cache();
+	strbuf_addstr(&istate->untracked->ident, get_ident_string());
+	istate->cache_changed |= UNTRACKED_CHANGED;
+}
+
+void remove_untracked_cache(struct index_state *istate)
+{
+	if (!istate->untracked)
+		return;
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	istate->cache_changed |= UNTRACKED_CHANGED;
+}
+
+/*
+ * Normally invalidating the directory that an entry was added to or
+ * removed from is enough.  When untracked directories are shown as
+ * "foo/bar/" however, a change deep down can change how the
+ * directories above it are shown: if "foo/bar/file" becomes
+ * untracked, "foo" may now be an untracked directory, and if it was
+ * the last untracked file in "foo", "foo/" is no longer shown.  With
+ * DIR_SHOW_OTHER_DIRECTORIES we therefore invalidate all the way up
+ * to the root.
+ */
+static int invalidate_one_component(struct untracked_cache *uc,
+				    struct untracked_cache_dir *dir,
+				    const char *path)
+{
+	const char *rest = strchr(path, '/');
+
+	if (rest) {
+		struct untracked_cache_dir *d =
+			find_untracked(dir, path, rest - path);
+		if (d && !invalidate_one_component(uc, d, rest + 1))
+			return 0;
+	}
+	invalidate_directory(uc, dir);
+	return uc->dir_flags & DIR_SHOW_OTHER_DIRECTORIES;
+}
+
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	invalidate_one_component(istate->untracked, istate->untracked->root,
+				 path);
+	istate->cache_changed |= UNTRACKED_CHANGED;
+}
+
+/*
+ * "path" changed on disk and may be a directory, e.g. one renamed
+ * into place: drop what we know about it and everything below it.
+ */
+void untracked_cache_invalidate_tree(struct index_state *istate,
+				     const char *path)
+{
+	struct untracked_cache_dir *d;
+	const char *p = path;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	d = istate->untracked->root;
+	while (d && *p) {
+		const char *rest = strchrnul(p, '/');
+
+		d = find_untracked(d, p, rest - p);
+		p = *rest ? rest + 1 : rest;
+	}
+	if (d && d != istate->untracked->root) {
+		istate->untracked->dir_invalidated++;
+		do_invalidate_gitignore(d);
+	}
+	untracked_cache_invalidate_path(istate, path);
+}
@@ -66,6 +66,7 @@ struct exclude_stack {
 	struct exclude_stack *prev; /* the struct exclude_stack for the parent directory */
 	int baselen;
 	int exclude_ix; /* index of exclude_list within EXC_DIRS exclude_list_group */
+	struct untracked_cache_dir *ucd;
 };
 
 struct exclude_list_group {
@@ -73,6 +74,74 @@ struct exclude_list_group {
 	struct exclude_list *el;
 };
 
+struct sha1_stat {
+	struct stat_data stat;
+	unsigned char sha1[20];
+	int valid;
+};
+
+/*
+ * Untracked cache
+ *
+ * What read_directory() finds in a directory depends only on
+ *
+ *  - the entries of the directory itself,
+ *  - the index,
+ *  - the dir_struct flags and the check_only flag of
+ *    read_directory_recursive(),
+ *  - $GIT_DIR/info/exclude and core.excludesfile, and
+ *  - the per-directory exclude files of the directory and of all
+ *    its parents.
+ *
+ * The first is checked with the stat data of the directory, whose
+ * mtime changes whenever an entry is added to or removed from it.
+ * Changes to the index invalidate the directory of the path that
+ * changed (see untracked_cache_invalidate_path()).  The exclude
+ * files are checked with the SHA-1 of their contents.
+ */
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	struct stat_data stat_data;
+	unsigned int untracked_alloc, dirs_nr, dirs_alloc;
+	unsigned int untracked_nr;
+	unsigned int check_only : 1;
+	/* all data except 'dirs' in this struct are good */
+	unsigned int valid : 1;
+	/* read_directory() went through this directory the last time */
+	unsigned int recurse : 1;
+	/* null SHA-1 means this directory does not have an exclude file */
+	unsigned char exclude_sha1[20];
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	struct sha1_stat ss_info_exclude;
+	struct sha1_stat ss_excludes_file;
+	const char *exclude_per_dir;
+	/*
+	 * The location and system the cache was written on; directory
+	 * mtimes cannot be trusted elsewhere.
+	 */
+	struct strbuf ident;
+	/*
+	 * dir_struct#flags must match dir_flags or the untracked
+	 * cache is ignored.
+	 */
+	unsigned dir_flags;
+	struct untracked_cache_dir *root;
+	/*
+	 * Set when the filesystem monitor reports all changes to the
+	 * cached directories; valid ones need not be checked with stat().
+	 */
+	int use_fsmonitor;
+	/* Statistics */
+	int dir_created;
+	int gitignore_invalidated;
+	int dir_invalidated;
+	int dir_opened;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -120,6 +189,12 @@ struct dir_struct {
 	struct exclude_stack *exclude_stack;
 	struct exclude *exclude;
 	struct strbuf basebuf;
+
+	/* Enable untracked file cache if set */
+	struct untracked_cache *untracked;
+	struct sha1_stat ss_info_exclude;
+	struct sha1_stat ss_excludes_file;
+	unsigned unmanaged_exclude_files;
 };
 
 /*
@@ -208,6 +283,15 @@ extern int git_fnmatch(const struct pathspec_item *item,
 		       const char *pattern, const char *string,
 		       int prefix);
 
+extern void untracked_cache_invalidate_path(struct index_state *, const char *);
+extern void untracked_cache_invalidate_tree(struct index_state *, const char *);
+
+extern void free_untracked_cache(struct untracked_cache *);
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, const struct index_state *istate);
+extern void add_untracked_cache(struct index_state *istate);
+extern void remove_untracked_cache(struct index_state *istate);
+
 static inline int ce_path_match(const struct cache_entry *ce,
 				const struct pathspec *pathspec,
 				char *seen)
@@ -2,6 +2,7 @@
 #include "blob.h"
 #include "dir.h"
 #include "streaming.h"
+#include "parallel-checkout.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -92,7 +93,7 @@ static void *read_blob_entry(const struct cache_entry *ce, unsigned long *size)
 	return NULL;
 }
 
-static int open_output_fd(char *path, const struct cache_entry *ce, int to_tempfile)
+int open_output_fd(char *path, const struct cache_entry *ce, int to_tempfile)
 {
 	int symlink = (ce->ce_mode & S_IFMT) != S_IFREG;
 	if (to_tempfile) {
@@ -104,7 +105,7 @@ static int open_output_fd(char *path, const struct cache_entry *ce, int to_tempf
 	}
 }
 
-static int fstat_output(int fd, const struct checkout *state, struct stat *st)
+int fstat_output(int fd, const struct checkout *state, struct stat *st)
 {
 	/* use fstat() only when path == ce->name */
 	if (fstat_is_reliable() &&
@@ -209,15 +210,25 @@ static int write_entry(struct cache_entry *ce,
 	}
 
 finish:
+	update_ce_after_write(state, ce, fstat_done ? &st : NULL);
+	return 0;
+}
+
+void update_ce_after_write(const struct checkout *state, struct cache_entry *ce,
+			   struct stat *st)
+{
+	struct stat lst;
+
 	if (state->refresh_cache) {
 		assert(state->istate);
-		if (!fstat_done)
-			lstat(ce->name, &st);
-		fill_stat_cache_info(ce, &st);
+		if (!st) {
+			lstat(ce->name, &lst);
+			st = &lst;
+		}
+		fill_stat_cache_info(ce, st);
 		ce->ce_flags |= CE_UPDATE_IN_BASE;
 		state->istate->cache_changed |= CE_ENTRY_CHANGED;
 	}
-	return 0;
 }
 
 /*
@@ -290,5 +301,7 @@ int checkout_entry(struct cache_entry *ce,
 		return 0;
 
 	create_directories(path.buf, path.len, state);
+	if (!enqueue_checkout(ce, path.buf))
+		return 0;
 	return write_entry(ce, path.buf, state, 0);
 }
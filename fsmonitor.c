@@ -0,0 +1,316 @@
+#include "cache.h"
+#include "dir.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "strbuf.h"
+
+#define INDEX_EXTENSION_VERSION	(1)
+#define HOOK_INTERFACE_VERSION	(1)
+
+struct trace_key trace_fsmonitor = TRACE_KEY_INIT(FSMONITOR);
+
+static void fsmonitor_ewah_callback(size_t pos, void *is)
+{
+	struct index_state *istate = (struct index_state *)is;
+	struct cache_entry *ce = istate->cache[pos];
+
+	ce->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+int read_fsmonitor_extension(struct index_state *istate, const void *data,
+	unsigned long sz)
+{
+	const char *index = data;
+	uint32_t hdr_version;
+	uint32_t ewah_size;
+	struct ewah_bitmap *fsmonitor_dirty;
+	int ret;
+
+	if (sz < sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + 8)
+		return error("corrupt fsmonitor extension (too short)");
+
+	hdr_version = get_be32(index);
+	index += sizeof(uint32_t);
+	if (hdr_version != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor version %d", hdr_version);
+
+	istate->fsmonitor_last_update = ((uint64_t)get_be32(index) << 32) |
+					get_be32(index + sizeof(uint32_t));
+	index += sizeof(uint64_t);
+
+	ewah_size = get_be32(index);
+	index += sizeof(uint32_t);
+
+	/* ewah_read_mmap() trusts the word count it reads: check it here */
+	if (ewah_size > sz - (index - (const char *)data) ||
+	    ewah_size < 12 ||
+	    (uint64_t)get_be32(index + sizeof(uint32_t)) * 8 + 12 > ewah_size)
+		return error("corrupt fsmonitor extension (bad ewah size)");
+
+	fsmonitor_dirty = ewah_new();
+	ret = ewah_read_mmap(fsmonitor_dirty, index, ewah_size);
+	if (ret != ewah_size) {
+		ewah_free(fsmonitor_dirty);
+		return error("failed to parse ewah bitmap reading fsmonitor index extension");
+	}
+	istate->fsmonitor_dirty = fsmonitor_dirty;
+
+	trace_printf_key(&trace_fsmonitor, "read fsmonitor extension successful");
+	return 0;
+}
+
+void fill_fsmonitor_bitmap(struct index_state *istate)
+{
+	int i;
+
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = ewah_new();
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_FSMONITOR_VALID))
+			ewah_set(istate->fsmonitor_dirty, i);
+}
+
+static int write_strbuf(void *out, const void *buf, size_t len)
+{
+	strbuf_add(out, buf, len);
+	return len;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t hdr_version;
+	uint32_t tm[2];
+	uint32_t ewah_start;
+	uint32_t ewah_size = 0;
+	int fixup = 0;
+
+	put_be32(&hdr_version, INDEX_EXTENSION_VERSION);
+	strbuf_add(sb, &hdr_version, sizeof(uint32_t));
+
+	put_be32(&tm[0], (uint32_t)(istate->fsmonitor_last_update >> 32));
+	put_be32(&tm[1], (uint32_t)istate->fsmonitor_last_update);
+	strbuf_add(sb, tm, sizeof(tm));
+
+	fixup = sb->len;
+	strbuf_add(sb, &ewah_size, sizeof(uint32_t)); /* we'll fix this up later */
+
+	ewah_start = sb->len;
+	ewah_serialize_to(istate->fsmonitor_dirty, write_strbuf, sb);
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+
+	/* fix up size field */
+	put_be32(&ewah_size, sb->len - ewah_start);
+	memcpy(sb->buf + fixup, &ewah_size, sizeof(uint32_t));
+
+	trace_printf_key(&trace_fsmonitor, "write fsmonitor extension successful");
+}
+
+/*
+ * The token handed to the hook is the wall-clock time of the last
+ * query in nanoseconds; it is compared with the time of filesystem
+ * events, so getnanotime() and its drifting offset will not do.
+ */
+static uint64_t fsmonitor_now(void)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL))
+		return 0;
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+/*
+ * Call the query-fsmonitor hook passing the time of the last saved results.
+ */
+static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *query_result)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	char ver[64];
+	char date[64];
+	const char *argv[4];
+
+	if (!(argv[0] = core_fsmonitor))
+		return -1;
+
+	snprintf(ver, sizeof(ver), "%d", version);
+	snprintf(date, sizeof(date), "%"PRIuMAX, (uintmax_t)last_update);
+	argv[1] = ver;
+	argv[2] = date;
+	argv[3] = NULL;
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.dir = get_git_work_tree();
+
+	return capture_command(&cp, query_result, 1024);
+}
+
+/*
+ * A path reported by the hook may be a file or a directory.  What is
+ * below a directory must be checked again as well: renaming or
+ * removing a directory may only be reported for the directory itself.
+ */
+static void fsmonitor_refresh_callback(struct index_state *istate, const char *path)
+{
+	int len = strlen(path);
+	char *name;
+	int pos;
+
+	while (len && path[len - 1] == '/')
+		len--;
+	if (!len)
+		return;
+	name = xmemdupz(path, len);
+
+	trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
+	pos = index_name_pos(istate, name, len);
+	if (pos >= 0) {
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+	} else {
+		for (pos = -pos - 1; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (ce_namelen(ce) <= len ||
+			    ce->name[len] != '/' ||
+			    memcmp(ce->name, name, len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
+	}
+
+	/*
+	 * Mark the untracked cache dirty even if it wasn't found in the index
+	 * as it could be a new untracked file.
+	 */
+	untracked_cache_invalidate_tree(istate, name);
+	free(name);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf query_result = STRBUF_INIT;
+	int query_success = 0;
+	size_t bol; /* beginning of line */
+	uint64_t last_update;
+	char *buf;
+	int i;
+
+	if (!core_fsmonitor || istate->fsmonitor_has_run_once)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	trace_printf_key(&trace_fsmonitor, "refresh fsmonitor");
+	/*
+	 * This could be racy so save the date/time now and query_fsmonitor
+	 * should be inclusive to ensure we don't miss potential changes.
+	 */
+	last_update = fsmonitor_now();
+
+	/*
+	 * If we have a last update time, call query_fsmonitor for the set of
+	 * changes since that time, else assume everything is possibly dirty
+	 * and check it all.
+	 */
+	if (istate->fsmonitor_last_update) {
+		query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
+			istate->fsmonitor_last_update, &query_result);
+		trace_printf_key(&trace_fsmonitor, "fsmonitor process '%s' returned %s",
+			core_fsmonitor, query_success ? "success" : "failure");
+	}
+
+	/* a fsmonitor process can return '/' to indicate all entries are invalid */
+	if (query_success && query_result.buf[0] != '/') {
+		/* Mark all entries returned by the monitor as dirty */
+		buf = query_result.buf;
+		bol = 0;
+		for (i = 0; i < query_result.len; i++) {
+			if (buf[i] != '\0')
+				continue;
+			fsmonitor_refresh_callback(istate, buf + bol);
+			bol = i + 1;
+		}
+		if (bol < query_result.len)
+			fsmonitor_refresh_callback(istate, buf + bol);
+		if (query_result.len)
+			istate->cache_changed |= FSMONITOR_CHANGED;
+	} else {
+		/* Mark all entries invalid */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+		/* and do not trust the untracked cache without lstat() */
+		if (istate->untracked) {
+			remove_untracked_cache(istate);
+			add_untracked_cache(istate);
+		}
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+	strbuf_release(&query_result);
+
+	/* Now that we've updated istate, save the last_update time */
+	istate->fsmonitor_last_update = last_update;
+}
+
+void add_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (!istate->fsmonitor_last_update) {
+		trace_printf_key(&trace_fsmonitor, "add fsmonitor");
+		istate->cache_changed |= FSMONITOR_CHANGED;
+		istate->fsmonitor_last_update = fsmonitor_now();
+
+		/* reset the fsmonitor state */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+
+		/*
+		 * reset the untracked cache: the directories it holds
+		 * were last checked before the time we just recorded
+		 */
+		if (istate->untracked) {
+			remove_untracked_cache(istate);
+			add_untracked_cache(istate);
+		}
+	}
+}
+
+void remove_fsmonitor(struct index_state *istate)
+{
+	if (istate->fsmonitor_last_update) {
+		trace_printf_key(&trace_fsmonitor, "remove fsmonitor");
+		istate->cache_changed |= FSMONITOR_CHANGED;
+		istate->fsmonitor_last_update = 0;
+	}
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	int i;
+	int fsmonitor_enabled = git_config_get_fsmonitor();
+
+	if (istate->fsmonitor_dirty) {
+		if (fsmonitor_enabled &&
+		    istate->fsmonitor_dirty->bit_size <= istate->cache_nr) {
+			/* Mark all entries valid */
+			for (i = 0; i < istate->cache_nr; i++)
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+
+			/* Mark all previously saved entries as dirty */
+			ewah_each_bit(istate->fsmonitor_dirty, fsmonitor_ewah_callback, istate);
+
+			/* Now mark the untracked cache for fsmonitor usage */
+			if (istate->untracked)
+				istate->untracked->use_fsmonitor = 1;
+		}
+
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+
+	if (fsmonitor_enabled)
+		add_fsmonitor(istate);
+	else
+		remove_fsmonitor(istate);
+}
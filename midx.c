@@ -0,0 +1,565 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "pack.h"
+#include "dir.h"
+#include "midx.h"
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + MIDX_CHUNKLOOKUP_WIDTH + 20)
+
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+static inline uint64_t get_be64_split(const unsigned char *p)
+{
+	return (((uint64_t)get_be32(p)) << 32) | get_be32(p + 4);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct stat st;
+	unsigned char *data;
+	size_t len, chunk_end;
+	uint32_t i, num_chunks;
+	const char *name, *names_end = NULL;
+	char *midx_name;
+	int fd;
+
+	midx_name = get_midx_filename(object_dir);
+	fd = git_open_noatime(midx_name);
+	if (fd < 0) {
+		free(midx_name);
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		error("failed to read %s: %s", midx_name, strerror(errno));
+		close(fd);
+		free(midx_name);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < MIDX_MIN_SIZE) {
+		error("multi-pack-index file %s is too small", midx_name);
+		close(fd);
+		free(midx_name);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = xcalloc(1, sizeof(*m) + strlen(object_dir) + 1);
+	strcpy(m->object_dir, object_dir);
+	m->data = data;
+	m->data_len = len;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature 0x%08x does not match signature 0x%08x",
+		      get_be32(data), MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index version %d not recognized", data[4]);
+		goto cleanup_fail;
+	}
+	if (data[5] != MIDX_HASH_VERSION) {
+		error("multi-pack-index hash version %d not recognized", data[5]);
+		goto cleanup_fail;
+	}
+	num_chunks = data[6];
+	m->num_packs = get_be32(data + 8);
+
+	chunk_end = len - 20;
+	if (MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH > chunk_end) {
+		error("multi-pack-index chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *entry = data + MIDX_HEADER_SIZE +
+					     i * MIDX_CHUNKLOOKUP_WIDTH;
+		uint32_t chunk_id = get_be32(entry);
+		uint64_t chunk_offset = get_be64_split(entry + 4);
+		uint64_t next_offset = get_be64_split(entry + 4 + MIDX_CHUNKLOOKUP_WIDTH);
+		uint64_t chunk_size;
+
+		if (chunk_offset > next_offset || next_offset > chunk_end) {
+			error("multi-pack-index chunk 0x%08x has an invalid offset",
+			      chunk_id);
+			goto cleanup_fail;
+		}
+		chunk_size = next_offset - chunk_offset;
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = data + chunk_offset;
+			names_end = (const char *)data + next_offset;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (chunk_size < 256 * 4) {
+				error("multi-pack-index OID fanout is too small");
+				goto cleanup_fail;
+			}
+			m->chunk_oid_fanout = (const uint32_t *)(data + chunk_offset);
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = data + chunk_offset;
+			m->num_large_offsets = chunk_size / 8;
+			break;
+		default:
+			/* Unknown chunks are ignored for forward compatibility. */
+			break;
+		}
+	}
+
+	if (!m->chunk_pack_names) {
+		error("multi-pack-index missing required pack-name chunk");
+		goto cleanup_fail;
+	}
+	if (!m->chunk_oid_fanout) {
+		error("multi-pack-index missing required OID fanout chunk");
+		goto cleanup_fail;
+	}
+	if (!m->chunk_oid_lookup) {
+		error("multi-pack-index missing required OID lookup chunk");
+		goto cleanup_fail;
+	}
+	if (!m->chunk_object_offsets) {
+		error("multi-pack-index missing required object offsets chunk");
+		goto cleanup_fail;
+	}
+
+	m->num_objects = ntohl(m->chunk_oid_fanout[255]);
+	if (m->chunk_oid_lookup + (size_t)m->num_objects * 20 > data + chunk_end ||
+	    m->chunk_object_offsets + (size_t)m->num_objects * MIDX_OFFSET_WIDTH >
+	    data + chunk_end) {
+		error("multi-pack-index is too small for %"PRIu32" objects",
+		      m->num_objects);
+		goto cleanup_fail;
+	}
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		const char *end = memchr(name, '\0', names_end - name);
+
+		if (!end) {
+			error("multi-pack-index pack-name chunk is too short");
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = name;
+		if (i && strcmp(m->pack_names[i - 1], name) >= 0) {
+			error("multi-pack-index pack names out of order: '%s' before '%s'",
+			      m->pack_names[i - 1], name);
+			goto cleanup_fail;
+		}
+		name = end + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+cleanup_fail:
+	free(midx_name);
+	close_midx(m);
+	return NULL;
+}
+
+void close_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap(m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+int prepare_midx_packs(struct multi_pack_index *m)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	uint32_t i;
+
+	if (m->packs_ready)
+		return 0;
+	if (!m->packs)
+		m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+
+	strbuf_addf(&path, "%s/pack/", m->object_dir);
+	dirlen = path.len;
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+		size_t len;
+
+		if (m->packs[i])
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, m->pack_names[i]);
+		len = path.len;
+		if (!strip_suffix_mem(path.buf, &len, ".idx"))
+			break;
+		strbuf_setlen(&path, len);
+		strbuf_addstr(&path, ".pack");
+
+		for (p = packed_git; p; p = p->next)
+			if (!strcmp(p->pack_name, path.buf))
+				break;
+		if (!p)
+			break;
+		m->packs[i] = p;
+	}
+	strbuf_release(&path);
+
+	if (i < m->num_packs)
+		return -1;
+	m->packs_ready = 1;
+	return 0;
+}
+
+int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+		 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(m->chunk_oid_fanout[*sha1]);
+	lo = *sha1 ? ntohl(m->chunk_oid_fanout[*sha1 - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->chunk_oid_lookup + (size_t)mi * 20, sha1);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+					    uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+	return m->chunk_oid_lookup + (size_t)n * 20;
+}
+
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t n)
+{
+	return get_be32(m->chunk_object_offsets + (size_t)n * MIDX_OFFSET_WIDTH);
+}
+
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t n)
+{
+	const unsigned char *offset_data;
+	uint32_t offset32;
+
+	offset_data = m->chunk_object_offsets + (size_t)n * MIDX_OFFSET_WIDTH;
+	offset32 = get_be32(offset_data + 4);
+
+	if (!(offset32 & MIDX_LARGE_OFFSET_NEEDED))
+		return offset32;
+
+	offset32 &= ~MIDX_LARGE_OFFSET_NEEDED;
+	if (!m->chunk_large_offsets || offset32 >= m->num_large_offsets)
+		die("multi-pack-index large offset out of bounds");
+	return get_be64_split(m->chunk_large_offsets + (size_t)offset32 * 8);
+}
+
+struct pack_midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+
+	/* Of several copies of an object, prefer the youngest pack. */
+	if (a->pack_mtime > b->pack_mtime)
+		return -1;
+	if (a->pack_mtime < b->pack_mtime)
+		return 1;
+	return a->pack_int_id < b->pack_int_id ? -1 :
+	       a->pack_int_id > b->pack_int_id;
+}
+
+struct midx_pack_info {
+	char *name;
+	struct packed_git *p;
+};
+
+static int midx_pack_info_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack_info *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+static void write_chunk_header(struct sha1file *f, uint32_t id, uint64_t offset)
+{
+	sha1write_be32(f, id);
+	sha1write_be32(f, offset >> 32);
+	sha1write_be32(f, offset & 0xffffffff);
+}
+
+int write_midx_file(const char *object_dir)
+{
+	struct midx_pack_info *info = NULL;
+	struct pack_midx_entry *entries = NULL;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr_entries = 0, alloc_entries = 0;
+	uint32_t nr_objects = 0, nr_large = 0, i, j;
+	struct strbuf prefix = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct packed_git *p;
+	struct sha1file *f;
+	uint64_t offset;
+	size_t names_len = 0;
+	int fd, nr_chunks;
+	char *midx_name;
+
+	prepare_packed_git();
+	strbuf_addf(&prefix, "%s/pack/", object_dir);
+	for (p = packed_git; p; p = p->next) {
+		const char *base;
+		size_t len;
+
+		if (!skip_prefix(p->pack_name, prefix.buf, &base) ||
+		    strchr(base, '/'))
+			continue;
+		if (open_pack_index(p)) {
+			warning("failed to open pack-index '%s'", p->pack_name);
+			continue;
+		}
+		len = strlen(base);
+		if (!strip_suffix_mem(base, &len, ".pack"))
+			continue;
+		ALLOC_GROW(info, nr_packs + 1, alloc_packs);
+		info[nr_packs].name = xstrfmt("%.*s.idx", (int)len, base);
+		info[nr_packs].p = p;
+		names_len += len + strlen(".idx") + 1;
+		nr_packs++;
+	}
+	strbuf_release(&prefix);
+
+	midx_name = get_midx_filename(object_dir);
+	if (!nr_packs) {
+		unlink_or_warn(midx_name);
+		free(midx_name);
+		return 0;
+	}
+	qsort(info, nr_packs, sizeof(*info), midx_pack_info_cmp);
+
+	for (i = 0; i < nr_packs; i++) {
+		p = info[i].p;
+		ALLOC_GROW(entries, nr_entries + p->num_objects, alloc_entries);
+		for (j = 0; j < p->num_objects; j++) {
+			struct pack_midx_entry *e = &entries[nr_entries++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->pack_int_id = i;
+			e->pack_mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, j);
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), midx_entry_cmp);
+
+	/* Keep only the preferred copy of each object. */
+	for (i = 0; i < nr_entries; i++) {
+		if (nr_objects &&
+		    !hashcmp(entries[nr_objects - 1].sha1, entries[i].sha1))
+			continue;
+		entries[nr_objects++] = entries[i];
+		if (entries[i].offset > 0x7fffffff)
+			nr_large++;
+	}
+
+	strbuf_addf(&tmp_file, "%s/pack/tmp_midx_XXXXXX", object_dir);
+	fd = git_mkstemp_mode(tmp_file.buf, 0444);
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file.buf);
+	f = sha1fd(fd, tmp_file.buf);
+
+	nr_chunks = nr_large ? 5 : 4;
+	names_len = (names_len + 3) & ~3;
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_HASH_VERSION);
+	sha1write_u8(f, nr_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, nr_packs);
+
+	offset = MIDX_HEADER_SIZE + (nr_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	write_chunk_header(f, MIDX_CHUNKID_PACKNAMES, offset);
+	offset += names_len;
+	write_chunk_header(f, MIDX_CHUNKID_OIDFANOUT, offset);
+	offset += 256 * 4;
+	write_chunk_header(f, MIDX_CHUNKID_OIDLOOKUP, offset);
+	offset += (uint64_t)nr_objects * 20;
+	write_chunk_header(f, MIDX_CHUNKID_OBJECTOFFSETS, offset);
+	offset += (uint64_t)nr_objects * MIDX_OFFSET_WIDTH;
+	if (nr_large) {
+		write_chunk_header(f, MIDX_CHUNKID_LARGEOFFSETS, offset);
+		offset += (uint64_t)nr_large * 8;
+	}
+	write_chunk_header(f, 0, offset);
+
+	/* PNAM: NUL-terminated pack-index names, padded to a 4-byte boundary */
+	offset = 0;
+	for (i = 0; i < nr_packs; i++) {
+		size_t len = strlen(info[i].name) + 1;
+		sha1write(f, info[i].name, len);
+		offset += len;
+	}
+	while (offset++ < names_len)
+		sha1write_u8(f, 0);
+
+	/* OIDF */
+	for (i = 0, j = 0; i < 256; i++) {
+		while (j < nr_objects && entries[j].sha1[0] == i)
+			j++;
+		sha1write_be32(f, j);
+	}
+
+	/* OIDL */
+	for (i = 0; i < nr_objects; i++)
+		sha1write(f, entries[i].sha1, 20);
+
+	/* OOFF */
+	for (i = 0, j = 0; i < nr_objects; i++) {
+		sha1write_be32(f, entries[i].pack_int_id);
+		if (entries[i].offset > 0x7fffffff)
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | j++);
+		else
+			sha1write_be32(f, entries[i].offset);
+	}
+
+	/* LOFF */
+	for (i = 0; i < nr_objects; i++) {
+		if (entries[i].offset > 0x7fffffff) {
+			sha1write_be32(f, (uint64_t)entries[i].offset >> 32);
+			sha1write_be32(f, entries[i].offset & 0xffffffff);
+		}
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno("unable to make temporary multi-pack-index readable");
+	if (rename(tmp_file.buf, midx_name))
+		die_errno("unable to rename temporary multi-pack-index to '%s'",
+			  midx_name);
+
+	for (i = 0; i < nr_packs; i++)
+		free(info[i].name);
+	free(info);
+	free(entries);
+	free(midx_name);
+	strbuf_release(&tmp_file);
+	return 0;
+}
+
+int verify_midx_file(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	uint32_t i;
+	int errors = 0;
+
+	m = load_multi_pack_index(object_dir);
+	if (!m) {
+		char *midx_name = get_midx_filename(object_dir);
+		int missing = access(midx_name, F_OK) && errno == ENOENT;
+		free(midx_name);
+		return missing ? 0 : 1;
+	}
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - 20))
+		errors |= error("incorrect checksum in multi-pack-index");
+
+	for (i = 1; i < 256; i++)
+		if (ntohl(m->chunk_oid_fanout[i - 1]) > ntohl(m->chunk_oid_fanout[i]))
+			errors |= error("oid fanout out of order: fanout[%d] > fanout[%d]",
+					i - 1, i);
+
+	for (i = 1; i < m->num_objects; i++)
+		if (hashcmp(nth_midxed_object_sha1(m, i - 1),
+			    nth_midxed_object_sha1(m, i)) >= 0)
+			errors |= error("oid lookup out of order: oid[%"PRIu32"] >= oid[%"PRIu32"]",
+					i - 1, i);
+
+	prepare_packed_git();
+	if (prepare_midx_packs(m)) {
+		errors |= error("multi-pack-index refers to packs that are missing");
+		goto out;
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *oid = nth_midxed_object_sha1(m, i);
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, i);
+		off_t m_offset, p_offset;
+		struct packed_git *p;
+
+		if (pack_int_id >= m->num_packs) {
+			errors |= error("bad pack-int-id: %"PRIu32" (%"PRIu32" total packs)",
+					pack_int_id, m->num_packs);
+			continue;
+		}
+		p = m->packs[pack_int_id];
+		if (open_pack_index(p)) {
+			errors |= error("failed to open pack-index '%s'", p->pack_name);
+			continue;
+		}
+		m_offset = nth_midxed_offset(m, i);
+		p_offset = find_pack_entry_one(oid, p);
+		if (m_offset != p_offset)
+			errors |= error("incorrect object offset for oid[%"PRIu32"] = %s: %"PRIuMAX" != %"PRIuMAX,
+					i, sha1_to_hex(oid),
+					(uintmax_t)m_offset, (uintmax_t)p_offset);
+	}
+
+out:
+	close_midx(m);
+	return !!errors;
+}
+
+void clear_midx_file(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+
+	if (remove_path(midx_name))
+		warning("failed to remove %s", midx_name);
+	free(midx_name);
+}
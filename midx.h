@@ -0,0 +1,68 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * A multi-pack index maps every object in the local packs to the pack
+ * and offset at which it can be found, so that a lookup costs a single
+ * binary search no matter how many packs the repository has.  See
+ * Documentation/technical/pack-format.txt for the on-disk layout.
+ */
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_HASH_VERSION 1 /* SHA-1 */
+
+struct multi_pack_index {
+	unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	size_t num_large_offsets;
+
+	const char **pack_names;
+
+	/*
+	 * The installed packed_git for each pack the index covers; only
+	 * filled in (and only trusted by lookups) when every one of them
+	 * could be found, see prepare_midx_packs().
+	 */
+	struct packed_git **packs;
+	unsigned packs_ready:1;
+
+	char object_dir[FLEX_ARRAY];
+};
+
+extern char *get_midx_filename(const char *object_dir);
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir);
+extern void close_midx(struct multi_pack_index *m);
+
+/*
+ * Match the packs named by the index against the installed packed_git
+ * list and mark the matching packs as covered by it.  Returns 0 when
+ * every pack was found, -1 (leaving no pack marked) otherwise.
+ */
+extern int prepare_midx_packs(struct multi_pack_index *m);
+
+/*
+ * If the object named sha1 is in the index, store its position in
+ * *pos and return 1; otherwise return 0.
+ */
+extern int bsearch_midx(const unsigned char *sha1, struct multi_pack_index *m,
+			uint32_t *pos);
+extern const unsigned char *nth_midxed_object_sha1(struct multi_pack_index *m,
+						   uint32_t n);
+extern uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t n);
+extern off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t n);
+
+extern int write_midx_file(const char *object_dir);
+extern int verify_midx_file(const char *object_dir);
+extern void clear_midx_file(const char *object_dir);
+
+#endif
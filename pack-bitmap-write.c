@@ -48,11 +48,16 @@ void bitmap_writer_show_progress(int show)
 /**
  * Build the initial type index for the packfile
  */
-void bitmap_writer_build_type_index(struct pack_idx_entry **index,
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
 				    uint32_t index_nr)
 {
 	uint32_t i;
 
+	if (!to_pack->in_pack_pos)
+		to_pack->in_pack_pos = xcalloc(to_pack->nr_alloc,
+					       sizeof(*to_pack->in_pack_pos));
+
 	writer.commits = ewah_new();
 	writer.trees = ewah_new();
 	writer.blobs = ewah_new();
@@ -62,14 +67,14 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 		struct object_entry *entry = (struct object_entry *)index[i];
 		enum object_type real_type;
 
-		entry->in_pack_pos = i;
+		oe_set_in_pack_pos(to_pack, entry, i);
 
-		switch (entry->type) {
+		switch (oe_type(entry)) {
 		case OBJ_COMMIT:
 		case OBJ_TREE:
 		case OBJ_BLOB:
 		case OBJ_TAG:
-			real_type = entry->type;
+			real_type = oe_type(entry);
 			break;
 
 		default:
@@ -96,7 +101,7 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 
 		default:
 			die("Missing type information for %s (%d/%d)",
-			    sha1_to_hex(entry->idx.sha1), real_type, entry->type);
+			    sha1_to_hex(entry->idx.sha1), real_type, oe_type(entry));
 		}
 	}
 }
@@ -145,7 +150,7 @@ static uint32_t find_object_pos(const unsigned char *sha1)
 			"(object %s is missing)", sha1_to_hex(sha1));
 	}
 
-	return entry->in_pack_pos;
+	return oe_in_pack_pos(writer.to_pack, entry);
 }
 
 static void show_object(struct object *object, const struct name_path *path,
@@ -466,7 +471,9 @@ static const unsigned char *sha1_access(size_t pos, void *table)
 
 static void write_selected_commits_v1(struct sha1file *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      uint32_t *commit_positions,
+				      off_t *offsets)
 {
 	int i;
 
@@ -479,6 +486,9 @@ static void write_selected_commits_v1(struct sha1file *f,
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
 
+		commit_positions[i] = commit_pos;
+		offsets[i] = f->total + f->offset;
+
 		sha1write_be32(f, commit_pos);
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
@@ -487,6 +497,58 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+static uint32_t *lookup_table_positions;
+
+static int lookup_table_cmp(const void *_a, const void *_b)
+{
+	uint32_t a = lookup_table_positions[*(uint32_t *)_a];
+	uint32_t b = lookup_table_positions[*(uint32_t *)_b];
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Write one row per selected commit, in the order of the pack index, so
+ * that a reader can find the bitmap of a commit without reading the
+ * entries before it.
+ */
+static void write_lookup_table(struct sha1file *f,
+			       uint32_t *commit_positions,
+			       off_t *offsets)
+{
+	uint32_t *table, *table_inv;
+	uint32_t i;
+
+	table = xmalloc(writer.selected_nr * sizeof(*table));
+	table_inv = xmalloc(writer.selected_nr * sizeof(*table_inv));
+
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	lookup_table_positions = commit_positions;
+	qsort(table, writer.selected_nr, sizeof(*table), lookup_table_cmp);
+	lookup_table_positions = NULL;
+
+	/* table_inv[i] is the row of the i-th selected commit */
+	for (i = 0; i < writer.selected_nr; i++)
+		table_inv[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *selected = &writer.selected[table[i]];
+		uint32_t xor_row = BITMAP_NO_XOR_ROW;
+
+		if (selected->xor_offset)
+			xor_row = table_inv[table[i] - selected->xor_offset];
+
+		sha1write_be32(f, commit_positions[table[i]]);
+		sha1write_be32(f, (uint32_t)((uint64_t)offsets[table[i]] >> 32));
+		sha1write_be32(f, (uint32_t)offsets[table[i]]);
+		sha1write_be32(f, xor_row);
+	}
+
+	free(table);
+	free(table_inv);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -514,6 +576,8 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct sha1file *f;
+	uint32_t *commit_positions;
+	off_t *offsets;
 
 	struct bitmap_disk_header header;
 
@@ -534,11 +598,20 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+
+	commit_positions = xmalloc(writer.selected_nr * sizeof(*commit_positions));
+	offsets = xmalloc(writer.selected_nr * sizeof(*offsets));
+	write_selected_commits_v1(f, index, index_nr, commit_positions, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, commit_positions, offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
 
+	free(commit_positions);
+	free(offsets);
+
 	sha1close(f, NULL, CSUM_FSYNC);
 
 	if (adjust_shared_perm(tmp_file))
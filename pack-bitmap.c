@@ -36,13 +36,6 @@ static struct bitmap_index {
 	/* reverse index for the packfile */
 	struct pack_revindex *reverse_index;
 
-	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
-	 */
-	uint32_t reuse_objects;
-
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
 	size_t map_size; /* size of the mmaped buffer */
@@ -69,6 +62,12 @@ static struct bitmap_index {
 	/* Name-hash cache (or NULL if not present). */
 	uint32_t *hashes;
 
+	/*
+	 * Lookup table (or NULL if not present).  When there is one, the
+	 * bitmaps of the commits are only read when they are looked up.
+	 */
+	const unsigned char *table_lookup;
+
 	/*
 	 * Extended index.
 	 *
@@ -148,21 +147,32 @@ static int load_bitmap_header(struct bitmap_index *index)
 	if (index->version != 1)
 		return error("Unsupported version for bitmap index file (%d)", index->version);
 
+	index->entry_count = ntohl(header->entry_count);
+
 	/* Parse known bitmap format options */
 	{
 		uint32_t flags = ntohs(header->options);
+		unsigned char *end = index->map + index->map_size - 20;
 
 		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
-			unsigned char *end = index->map + index->map_size - 20;
 			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			end = (unsigned char *)index->hashes;
+		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			size_t table_size = (size_t)index->entry_count *
+				BITMAP_LOOKUP_TABLE_ROW_WIDTH;
+
+			if (table_size > end - index->map - sizeof(*header))
+				return error("Corrupted bitmap index file (too short to fit lookup table)");
+			index->table_lookup = end - table_size;
 		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -252,6 +262,139 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+static inline uint32_t lookup_table_commit_pos(uint32_t row)
+{
+	return get_be32(bitmap_git.table_lookup +
+			row * BITMAP_LOOKUP_TABLE_ROW_WIDTH);
+}
+
+static inline off_t lookup_table_offset(uint32_t row)
+{
+	const unsigned char *p = bitmap_git.table_lookup +
+		row * BITMAP_LOOKUP_TABLE_ROW_WIDTH + 4;
+
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static inline uint32_t lookup_table_xor_row(uint32_t row)
+{
+	return get_be32(bitmap_git.table_lookup +
+			row * BITMAP_LOOKUP_TABLE_ROW_WIDTH + 12);
+}
+
+/* Find the row of the lookup table for sha1; the rows are in .idx order. */
+static int lookup_table_find(const unsigned char *sha1, uint32_t *row)
+{
+	uint32_t lo = 0, hi = bitmap_git.entry_count;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t commit_pos = lookup_table_commit_pos(mi);
+		const unsigned char *mi_sha1;
+		int cmp;
+
+		if (commit_pos >= bitmap_git.pack->num_objects)
+			return error("Corrupted bitmap lookup table");
+		mi_sha1 = nth_packed_object_sha1(bitmap_git.pack, commit_pos);
+		cmp = hashcmp(sha1, mi_sha1);
+		if (!cmp) {
+			*row = mi;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+/*
+ * Read the bitmap of the given row of the lookup table, and those of the
+ * chain of bitmaps it is XORed with that were not read yet.
+ */
+static struct stored_bitmap *load_bitmap_for_row(uint32_t row)
+{
+	struct stored_bitmap *base = NULL;
+	uint32_t *chain = NULL;
+	uint32_t chain_nr = 0, chain_alloc = 0;
+
+	for (;;) {
+		const unsigned char *sha1;
+		khiter_t pos;
+
+		if (row >= bitmap_git.entry_count ||
+		    chain_nr > bitmap_git.entry_count ||
+		    lookup_table_commit_pos(row) >= bitmap_git.pack->num_objects) {
+			error("Corrupted bitmap lookup table");
+			goto out;
+		}
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+					      lookup_table_commit_pos(row));
+		pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+		if (pos < kh_end(bitmap_git.bitmaps)) {
+			base = kh_value(bitmap_git.bitmaps, pos);
+			break;
+		}
+
+		ALLOC_GROW(chain, chain_nr + 1, chain_alloc);
+		chain[chain_nr++] = row;
+
+		row = lookup_table_xor_row(row);
+		if (row == BITMAP_NO_XOR_ROW)
+			break;
+	}
+
+	/* from the base of the chain up */
+	while (chain_nr) {
+		uint32_t commit_pos;
+		const unsigned char *sha1;
+		struct ewah_bitmap *bitmap;
+		int flags;
+
+		row = chain[--chain_nr];
+		commit_pos = lookup_table_commit_pos(row);
+		bitmap_git.map_pos = lookup_table_offset(row);
+		if (bitmap_git.map_pos + 6 > bitmap_git.map_size ||
+		    read_be32(bitmap_git.map, &bitmap_git.map_pos) != commit_pos) {
+			error("Corrupted bitmap lookup table");
+			base = NULL;
+			goto out;
+		}
+		read_u8(bitmap_git.map, &bitmap_git.map_pos); /* xor offset */
+		flags = read_u8(bitmap_git.map, &bitmap_git.map_pos);
+
+		bitmap = read_bitmap_1(&bitmap_git);
+		if (!bitmap) {
+			base = NULL;
+			goto out;
+		}
+
+		sha1 = nth_packed_object_sha1(bitmap_git.pack, commit_pos);
+		base = store_bitmap(&bitmap_git, bitmap, sha1, base, flags);
+		if (!base)
+			goto out;
+	}
+
+out:
+	free(chain);
+	return base;
+}
+
+/* Return the stored bitmap of the commit sha1, or NULL if it has none. */
+static struct stored_bitmap *find_stored_bitmap(const unsigned char *sha1)
+{
+	khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	uint32_t row;
+
+	if (pos < kh_end(bitmap_git.bitmaps))
+		return kh_value(bitmap_git.bitmaps, pos);
+
+	if (!bitmap_git.table_lookup || lookup_table_find(sha1, &row))
+		return NULL;
+	return load_bitmap_for_row(row);
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	char *idx_name;
@@ -323,7 +466,8 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	/* with a lookup table, the entries are read as they are needed */
+	if (!bitmap_git.table_lookup && load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -449,7 +593,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct stored_bitmap *st;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -457,9 +601,8 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
+	st = find_stored_bitmap(sha1);
+	if (st) {
 		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
 		return 0;
 	}
@@ -513,10 +656,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->sha1);
+			struct stored_bitmap *st = find_stored_bitmap(object->sha1);
 
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+			if (st) {
 				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
 
 				if (base == NULL)
@@ -616,9 +758,6 @@ static void show_objects_for_type(
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
 	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
@@ -626,7 +765,7 @@ static void show_objects_for_type(
 
 		for (offset = 0; offset < BITS_IN_WORD; ++offset) {
 			const unsigned char *sha1;
-			struct revindex_entry *entry;
+			uint32_t nr;
 			uint32_t hash = 0;
 
 			if ((word >> offset) == 0)
@@ -634,16 +773,15 @@ static void show_objects_for_type(
 
 			offset += ewah_bit_ctz64(word >> offset);
 
-			if (pos + offset < bitmap_git.reuse_objects)
-				continue;
-
-			entry = &bitmap_git.reverse_index->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+			nr = pack_pos_to_index(bitmap_git.reverse_index, pos + offset);
+			sha1 = nth_packed_object_sha1(bitmap_git.pack, nr);
 
 			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
+				hash = ntohl(bitmap_git.hashes[nr]);
 
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+			show_reach(sha1, object_type, 0, hash, bitmap_git.pack,
+				   pack_pos_to_offset(bitmap_git.reverse_index,
+						      pos + offset));
 		}
 
 		pos += BITS_IN_WORD;
@@ -756,64 +894,112 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	return 0;
 }
 
+/*
+ * Mark the object at pos in the bitmapped pack as reused if it can be
+ * copied from the pack as it is: either it is a whole object, or the
+ * base of its delta comes earlier in the pack and is reused too.
+ */
+static void try_partial_reuse(size_t pos, struct bitmap *reuse,
+			      struct pack_window **w_curs)
+{
+	struct packed_git *pack = bitmap_git.pack;
+	off_t offset, cur, base_offset;
+	unsigned long size;
+	enum object_type type;
+	int base_pos;
+
+	offset = cur = pack_pos_to_offset(bitmap_git.reverse_index, pos);
+	type = unpack_object_header(pack, w_curs, &cur, &size);
+
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		base_offset = get_delta_base(pack, w_curs, &cur, type, offset);
+		if (!base_offset)
+			return;
+		base_pos = find_revindex_position(bitmap_git.reverse_index,
+						  base_offset);
+		/*
+		 * The receiver must get the base too.  As we go through
+		 * the pack in order, this only finds it if it comes
+		 * first; a REF_DELTA against a later object is left to
+		 * the regular code.
+		 */
+		if (base_pos < 0 || base_pos >= pos ||
+		    !bitmap_get(reuse, base_pos))
+			return;
+	} else if (type < 0) {
+		return;
+	}
+
+	bitmap_set(reuse, pos);
+}
+
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 				       uint32_t *entries,
-				       off_t *up_to)
+				       struct bitmap **reuse_out)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
-
 	struct bitmap *result = bitmap_git.result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
+	uint32_t objects_nr;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
-
-		reuse_objects += BITS_IN_WORD;
-	}
-
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	objects_nr = bitmap_git.pack->num_objects;
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+	/* Don't mark objects not in the packfile */
+	if (i > objects_nr / BITS_IN_WORD)
+		i = objects_nr / BITS_IN_WORD;
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
+	reuse = bitmap_new();
+	if (reuse->word_alloc < i + 1) {
+		reuse->words = ewah_realloc(reuse->words,
+					    (i + 1) * sizeof(eword_t));
+		reuse->word_alloc = i + 1;
 	}
-#endif
+	memset(reuse->words, 0xFF, i * sizeof(eword_t));
+	memset(reuse->words + i, 0,
+	       (reuse->word_alloc - i) * sizeof(eword_t));
 
-	if (!reuse_objects)
-		return -1;
+	/*
+	 * Past the run of whole words, pick the wanted objects one by
+	 * one; pack-objects closes the gaps between them by rewriting
+	 * the offsets of their OFS_DELTA bases.
+	 */
+	for (; i < result->word_alloc; ++i) {
+		eword_t word = result->words[i];
+		size_t pos = (i * BITS_IN_WORD);
+		uint32_t offset;
 
-	if (reuse_objects >= bitmap_git.pack->num_objects) {
-		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git.pack;
-		return 0;
+		for (offset = 0; offset < BITS_IN_WORD; ++offset) {
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			if (pos + offset >= objects_nr)
+				goto done;
+			try_partial_reuse(pos + offset, reuse, &w_curs);
+		}
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git.result) * REUSE_PERCENT;
+done:
+	unuse_pack(&w_curs);
 
-	if (reuse_objects < reuse_threshold)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
+	}
 
-	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.reverse_index->revindex[reuse_objects].offset;
+	/*
+	 * Drop any reused objects from the result, since they will not
+	 * need to be handled separately.
+	 */
+	bitmap_and_not(result, reuse);
 	*packfile = bitmap_git.pack;
-
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -936,7 +1122,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct stored_bitmap *st;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -950,10 +1136,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->sha1);
+	st = find_stored_bitmap(root->sha1);
 
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+	if (st) {
 		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
 
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
@@ -1037,20 +1222,26 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
+	/* every bitmap is looked at below, so read them all at once */
+	if (bitmap_git.table_lookup) {
+		for (i = 0; i < bitmap_git.entry_count; i++)
+			if (!load_bitmap_for_row(i))
+				return -1;
+	}
+
 	num_objects = bitmap_git.pack->num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git.reverse_index->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+				pack_pos_to_index(bitmap_git.reverse_index, i));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
-			reposition[i] = oe->in_pack_pos + 1;
+			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
 	}
 
 	rebuild = bitmap_new();
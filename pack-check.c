@@ -2,6 +2,7 @@
 #include "pack.h"
 #include "pack-revindex.h"
 #include "progress.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -28,7 +29,11 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 
 	do {
 		unsigned long avail;
-		void *data = use_pack(p, w_curs, offset, &avail);
+		void *data;
+
+		obj_read_lock();
+		data = use_pack(p, w_curs, offset, &avail);
+		obj_read_unlock();
 		if (avail > len)
 			avail = len;
 		data_crc = crc32(data_crc, data, avail);
@@ -42,12 +47,196 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+struct verify_state {
+	struct packed_git *p;
+	struct idx_entry *entries;
+	verify_fn fn;
+	struct progress *progress;
+	uint32_t base_count;
+	uint32_t done;
+};
+
+#ifndef NO_PTHREADS
+static int verify_use_threads;
+static pthread_mutex_t verify_mutex;
+
+static inline void verify_lock(void)
+{
+	if (verify_use_threads)
+		pthread_mutex_lock(&verify_mutex);
+}
+
+static inline void verify_unlock(void)
+{
+	if (verify_use_threads)
+		pthread_mutex_unlock(&verify_mutex);
+}
+#else
+#define verify_lock()
+#define verify_unlock()
+#endif
+
+/*
+ * Check the CRC and the object name of the i-th object (in pack
+ * order), and hand it to the callback.  Several threads may run this
+ * on different objects at once; the callback and the progress meter
+ * are serialized under verify_lock().
+ */
+static int verify_entry(struct verify_state *state,
+			struct pack_window **w_curs, uint32_t i)
+{
+	struct packed_git *p = state->p;
+	struct idx_entry *entries = state->entries;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	int err = 0;
+
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			err = error("index CRC mismatch for object %s "
+				    "from %s at offset %"PRIuMAX"",
+				    sha1_to_hex(entries[i].sha1),
+				    p->pack_name, (uintmax_t)offset);
+	}
+	data = unpack_entry(p, entries[i].offset, &type, &size);
+	if (!data)
+		err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+			    sha1_to_hex(entries[i].sha1), p->pack_name,
+			    (uintmax_t)entries[i].offset);
+	else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
+		err = error("packed %s from %s is corrupt",
+			    sha1_to_hex(entries[i].sha1), p->pack_name);
+	else if (state->fn) {
+		int eaten = 0;
+		verify_lock();
+		state->fn(entries[i].sha1, type, size, data, &eaten);
+		verify_unlock();
+		if (eaten)
+			data = NULL;
+	}
+	free(data);
+
+	verify_lock();
+	if (((state->base_count + ++state->done) & 1023) == 0)
+		display_progress(state->progress,
+				 state->base_count + state->done);
+	verify_unlock();
+	return err;
+}
+
+#ifndef NO_PTHREADS
+struct verify_range {
+	pthread_t thread;
+	struct verify_state *state;
+	uint32_t start, end;
+	int err;
+};
+
+static void *verify_range_thread(void *data)
+{
+	struct verify_range *range = data;
+	struct pack_window *w_curs = NULL;
+	uint32_t i;
+
+	for (i = range->start; i < range->end; i++)
+		range->err |= verify_entry(range->state, &w_curs, i);
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+/*
+ * Split the objects into nr_threads runs of consecutive objects,
+ * each covering about the same number of bytes of the pack, and
+ * verify the runs in parallel, each thread with its own window
+ * into the pack.
+ */
+static int verify_entries_threaded(struct verify_state *state, int nr_threads)
+{
+	struct packed_git *p = state->p;
+	uint32_t nr_objects = p->num_objects;
+	off_t pack_end = state->entries[nr_objects].offset;
+	struct verify_range *range;
+	uint32_t i = 0;
+	int t, err = 0;
+
+	range = xcalloc(nr_threads, sizeof(*range));
+	for (t = 0; t < nr_threads; t++) {
+		off_t limit = pack_end / nr_threads * (t + 1);
+
+		range[t].state = state;
+		range[t].start = i;
+		if (t == nr_threads - 1)
+			i = nr_objects;
+		else
+			while (i < nr_objects && state->entries[i].offset < limit)
+				i++;
+		range[t].end = i;
+	}
+
+	enable_obj_read_lock();
+	pthread_mutex_init(&verify_mutex, NULL);
+	verify_use_threads = 1;
+
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_create(&range[t].thread, NULL,
+					 verify_range_thread, &range[t]);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (t = 0; t < nr_threads; t++) {
+		pthread_join(range[t].thread, NULL);
+		err |= range[t].err;
+	}
+
+	verify_use_threads = 0;
+	pthread_mutex_destroy(&verify_mutex);
+	disable_obj_read_lock();
+	free(range);
+	return err;
+}
+#endif
+
+static int verify_entries(struct verify_state *state,
+			  struct pack_window **w_curs, int nr_threads)
+{
+	uint32_t nr_objects = state->p->num_objects;
+	uint32_t i;
+	int err = 0;
+
+#ifndef NO_PTHREADS
+	if (!nr_threads) {
+		/* not worth the trouble for a small pack */
+		nr_threads = online_cpus();
+		if (nr_threads > nr_objects / 1024)
+			nr_threads = nr_objects / 1024;
+	}
+	if (nr_threads > nr_objects)
+		nr_threads = nr_objects;
+	if (nr_threads > 1) {
+		unuse_pack(w_curs);
+		return verify_entries_threaded(state, nr_threads);
+	}
+#endif
+	for (i = 0; i < nr_objects; i++)
+		err |= verify_entry(state, w_curs, i);
+	return err;
+}
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
+	struct verify_state state;
 	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
 	git_SHA_CTX ctx;
@@ -101,41 +290,15 @@ static int verify_packfile(struct packed_git *p,
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		enum object_type type;
-		unsigned long size;
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    sha1_to_hex(entries[i].sha1),
-					    p->pack_name, (uintmax_t)offset);
-		}
-		data = unpack_entry(p, entries[i].offset, &type, &size);
-		if (!data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    sha1_to_hex(entries[i].sha1), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			fn(entries[i].sha1, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
-		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
+	state.p = p;
+	state.entries = entries;
+	state.fn = fn;
+	state.progress = progress;
+	state.base_count = base_count;
+	state.done = 0;
+	err |= verify_entries(&state, w_curs, nr_threads);
 
-	}
-	display_progress(progress, base_count + i);
+	display_progress(progress, base_count + nr_objects);
 	free(entries);
 
 	return err;
@@ -165,7 +328,8 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -174,8 +338,10 @@ int verify_pack(struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
+	err |= verify_pack_revindex(p);
 
 	return err;
 }
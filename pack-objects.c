@@ -93,12 +93,22 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 	if (pdata->nr_objects >= pdata->nr_alloc) {
 		pdata->nr_alloc = (pdata->nr_alloc  + 1024) * 3 / 2;
 		REALLOC_ARRAY(pdata->objects, pdata->nr_alloc);
+		if (!pdata->in_pack_by_idx)
+			REALLOC_ARRAY(pdata->in_pack, pdata->nr_alloc);
+		if (pdata->tree_depth)
+			REALLOC_ARRAY(pdata->tree_depth, pdata->nr_alloc);
 	}
 
 	new_entry = pdata->objects + pdata->nr_objects++;
 
 	memset(new_entry, 0, sizeof(*new_entry));
 	hashcpy(new_entry->idx.sha1, sha1);
+	new_entry->size_valid = 1;
+	new_entry->delta_size_valid = 1;
+	if (!pdata->in_pack_by_idx)
+		pdata->in_pack[pdata->nr_objects - 1] = NULL;
+	if (pdata->tree_depth)
+		pdata->tree_depth[pdata->nr_objects - 1] = 0;
 
 	if (pdata->index_size * 3 <= pdata->nr_objects * 4)
 		rehash_objects(pdata);
@@ -107,3 +117,95 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 	return new_entry;
 }
+
+/*
+ * Number the packs we know of for object_entry.in_pack_idx; 0 stands
+ * for "not in a pack".  With too many of them, use pdata->in_pack.
+ */
+void prepare_packing_data(struct packing_data *pdata)
+{
+	struct packed_git *p;
+	unsigned int nr = 1;
+
+	for (p = packed_git; p; p = p->next)
+		nr++;
+	if (nr >= (1U << OE_IN_PACK_BITS)) {
+		for (p = packed_git; p; p = p->next)
+			p->index = 0;
+	} else {
+		pdata->in_pack_by_idx = xmalloc(nr * sizeof(*pdata->in_pack_by_idx));
+		pdata->in_pack_by_idx_nr = nr;
+		pdata->in_pack_by_idx[0] = NULL;
+		for (nr = 1, p = packed_git; p; p = p->next, nr++) {
+			p->index = nr;
+			pdata->in_pack_by_idx[nr] = p;
+		}
+	}
+
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&pdata->lock, NULL);
+#endif
+}
+
+/*
+ * A pack that was not numbered by prepare_packing_data(), e.g. one
+ * that appeared since: switch to one pack pointer per object.
+ */
+void oe_set_in_pack_slow(struct packing_data *pdata, struct object_entry *e,
+			 struct packed_git *p)
+{
+	if (pdata->in_pack_by_idx) {
+		uint32_t i;
+
+		pdata->in_pack = xmalloc(pdata->nr_alloc * sizeof(*pdata->in_pack));
+		for (i = 0; i < pdata->nr_objects; i++)
+			pdata->in_pack[i] = pdata->in_pack_by_idx[pdata->objects[i].in_pack_idx];
+		free(pdata->in_pack_by_idx);
+		pdata->in_pack_by_idx = NULL;
+		pdata->in_pack_by_idx_nr = 0;
+	}
+	pdata->in_pack[e - pdata->objects] = p;
+}
+
+static inline void packing_data_lock(struct packing_data *pdata)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&pdata->lock);
+#endif
+}
+
+static inline void packing_data_unlock(struct packing_data *pdata)
+{
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&pdata->lock);
+#endif
+}
+
+unsigned long oe_get_large_size(struct packing_data *pdata, uint32_t pos)
+{
+	unsigned long size;
+
+	packing_data_lock(pdata);
+	size = pdata->large_sizes[pos];
+	packing_data_unlock(pdata);
+	return size;
+}
+
+/*
+ * Store a size that does not fit in an object_entry, at pos if reuse
+ * is set (the entry already has a slot), or in a new slot.  Returns
+ * the slot.
+ */
+uint32_t oe_set_large_size(struct packing_data *pdata, int reuse, uint32_t pos,
+			   unsigned long size)
+{
+	packing_data_lock(pdata);
+	if (!reuse) {
+		ALLOC_GROW(pdata->large_sizes, pdata->large_sizes_nr + 1,
+			   pdata->large_sizes_alloc);
+		pos = pdata->large_sizes_nr++;
+	}
+	pdata->large_sizes[pos] = size;
+	packing_data_unlock(pdata);
+	return pos;
+}
@@ -1,32 +1,61 @@
 #ifndef PACK_OBJECTS_H
 #define PACK_OBJECTS_H
 
+#include "thread-utils.h"
+
+#define OE_SIZE_BITS		31
+#define OE_DELTA_SIZE_BITS	31
+#define OE_Z_DELTA_BITS		20
+#define OE_IN_PACK_BITS		10
+#define OE_TYPE_BITS		3
+
+/*
+ * An object_entry is kept for every object pack-objects looks at, so
+ * it is laid out to be small.  Use the oe_*() accessors below instead
+ * of the fields that end with an underscore or an "idx":
+ *
+ *  - The delta base, first child and next sibling are the 1-based
+ *    positions of the entries in packing_data->objects (0 for none).
+ *
+ *  - The pack the object comes from is the position of the pack in
+ *    packing_data->in_pack_by_idx, or, when there are too many packs
+ *    for OE_IN_PACK_BITS, is kept in packing_data->in_pack instead.
+ *
+ *  - A size or delta size that does not fit in its bits is kept in
+ *    packing_data->large_sizes, and the bits hold its position there
+ *    (then size_valid or delta_size_valid is 0).
+ *
+ *  - A compressed delta that does not fit in z_delta_size is not
+ *    cached.
+ */
 struct object_entry {
 	struct pack_idx_entry idx;
-	unsigned long size;	/* uncompressed size */
-	struct packed_git *in_pack;	/* already in pack */
-	off_t in_pack_offset;
-	struct object_entry *delta;	/* delta base object */
-	struct object_entry *delta_child; /* deltified objects who bases me */
-	struct object_entry *delta_sibling; /* other deltified objects who
-					     * uses the same base as me
-					     */
 	void *delta_data;	/* cached delta (uncompressed) */
-	unsigned long delta_size;	/* delta data size (uncompressed) */
-	unsigned long z_delta_size;	/* delta data size (compressed) */
-	enum object_type type;
-	enum object_type in_pack_type;	/* could be delta */
+	off_t in_pack_offset;
 	uint32_t hash;			/* name hint hash */
-	unsigned int in_pack_pos;
-	unsigned char in_pack_header_size;
+	unsigned size_:OE_SIZE_BITS;	/* uncompressed size */
+	unsigned size_valid:1;
+	uint32_t delta_idx;	/* delta base object */
+	uint32_t delta_child_idx; /* deltified objects who bases me */
+	uint32_t delta_sibling_idx; /* other deltified objects who
+				     * uses the same base as me
+				     */
+	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
+	unsigned delta_size_valid:1;
+	unsigned z_delta_size:OE_Z_DELTA_BITS; /* delta data size (compressed) */
+	unsigned in_pack_idx:OE_IN_PACK_BITS;	/* already in pack */
 	unsigned preferred_base:1; /*
 				    * we do not pack this, but is available
 				    * to be used as the base object to delta
 				    * objects against.
 				    */
 	unsigned no_try_delta:1;
+	unsigned type_:OE_TYPE_BITS;
+	unsigned type_valid:1;
+	unsigned in_pack_type:OE_TYPE_BITS;	/* could be delta */
 	unsigned tagged:1; /* near the very tip of refs */
 	unsigned filled:1; /* assigned write-order */
+	unsigned in_pack_header_size:8;
 };
 
 struct packing_data {
@@ -35,8 +64,33 @@ struct packing_data {
 
 	int32_t *index;
 	uint32_t index_size;
+
+	/* set by bitmap_writer_build_type_index() */
+	uint32_t *in_pack_pos;
+
+	/* allocated when using delta islands, see delta-islands.h */
+	unsigned int *tree_depth;
+
+	/*
+	 * Only one of these is used: in_pack_by_idx, indexed by
+	 * object_entry.in_pack_idx, as long as all packs fit in it,
+	 * and in_pack, indexed like objects, after that.
+	 */
+	struct packed_git **in_pack_by_idx;
+	uint32_t in_pack_by_idx_nr;
+	struct packed_git **in_pack;
+
+	unsigned long *large_sizes;
+	uint32_t large_sizes_nr, large_sizes_alloc;
+
+#ifndef NO_PTHREADS
+	/* protects large_sizes for the delta search threads */
+	pthread_mutex_t lock;
+#endif
 };
 
+void prepare_packing_data(struct packing_data *pdata);
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const unsigned char *sha1,
 				    uint32_t index_pos);
@@ -45,6 +99,171 @@ struct object_entry *packlist_find(struct packing_data *pdata,
 				   const unsigned char *sha1,
 				   uint32_t *index_pos);
 
+/* the out-of-line parts of the accessors below */
+void oe_set_in_pack_slow(struct packing_data *pdata, struct object_entry *e,
+			 struct packed_git *p);
+unsigned long oe_get_large_size(struct packing_data *pdata, uint32_t pos);
+uint32_t oe_set_large_size(struct packing_data *pdata, int reuse, uint32_t pos,
+			   unsigned long size);
+
+static inline uint32_t oe_pos(const struct packing_data *pdata,
+			      const struct object_entry *e)
+{
+	return e ? (e - pdata->objects) + 1 : 0;
+}
+
+static inline struct object_entry *oe_at(const struct packing_data *pdata,
+					 uint32_t pos)
+{
+	return pos ? &pdata->objects[pos - 1] : NULL;
+}
+
+static inline struct object_entry *oe_delta(const struct packing_data *pdata,
+					    const struct object_entry *e)
+{
+	return oe_at(pdata, e->delta_idx);
+}
+
+static inline void oe_set_delta(const struct packing_data *pdata,
+				struct object_entry *e,
+				struct object_entry *delta)
+{
+	e->delta_idx = oe_pos(pdata, delta);
+}
+
+static inline struct object_entry *oe_delta_child(const struct packing_data *pdata,
+						  const struct object_entry *e)
+{
+	return oe_at(pdata, e->delta_child_idx);
+}
+
+static inline void oe_set_delta_child(const struct packing_data *pdata,
+				      struct object_entry *e,
+				      struct object_entry *child)
+{
+	e->delta_child_idx = oe_pos(pdata, child);
+}
+
+static inline struct object_entry *oe_delta_sibling(const struct packing_data *pdata,
+						    const struct object_entry *e)
+{
+	return oe_at(pdata, e->delta_sibling_idx);
+}
+
+static inline void oe_set_delta_sibling(const struct packing_data *pdata,
+					struct object_entry *e,
+					struct object_entry *sibling)
+{
+	e->delta_sibling_idx = oe_pos(pdata, sibling);
+}
+
+static inline enum object_type oe_type(const struct object_entry *e)
+{
+	return e->type_valid ? e->type_ : OBJ_BAD;
+}
+
+static inline void oe_set_type(struct object_entry *e, enum object_type type)
+{
+	if (type >= OBJ_ANY)
+		die("BUG: object type %d does not fit in an object_entry", type);
+	e->type_valid = type >= 0;
+	e->type_ = type >= 0 ? type : 0;
+}
+
+static inline struct packed_git *oe_in_pack(const struct packing_data *pdata,
+					    const struct object_entry *e)
+{
+	if (pdata->in_pack_by_idx)
+		return pdata->in_pack_by_idx[e->in_pack_idx];
+	return pdata->in_pack[e - pdata->objects];
+}
+
+static inline void oe_set_in_pack(struct packing_data *pdata,
+				  struct object_entry *e,
+				  struct packed_git *p)
+{
+	if (pdata->in_pack_by_idx && !p) {
+		e->in_pack_idx = 0;
+		return;
+	}
+	if (pdata->in_pack_by_idx && p->index > 0 &&
+	    p->index < pdata->in_pack_by_idx_nr &&
+	    pdata->in_pack_by_idx[p->index] == p) {
+		e->in_pack_idx = p->index;
+		return;
+	}
+	oe_set_in_pack_slow(pdata, e, p);
+}
+
+static inline uint32_t oe_in_pack_pos(const struct packing_data *pdata,
+				      const struct object_entry *e)
+{
+	return pdata->in_pack_pos[e - pdata->objects];
+}
+
+static inline void oe_set_in_pack_pos(const struct packing_data *pdata,
+				      const struct object_entry *e,
+				      uint32_t pos)
+{
+	pdata->in_pack_pos[e - pdata->objects] = pos;
+}
+
+static inline unsigned int oe_tree_depth(const struct packing_data *pdata,
+					 const struct object_entry *e)
+{
+	return pdata->tree_depth ? pdata->tree_depth[e - pdata->objects] : 0;
+}
+
+static inline void oe_set_tree_depth(const struct packing_data *pdata,
+				     const struct object_entry *e,
+				     unsigned int depth)
+{
+	pdata->tree_depth[e - pdata->objects] = depth;
+}
+
+static inline unsigned long oe_size(struct packing_data *pdata,
+				    const struct object_entry *e)
+{
+	if (e->size_valid)
+		return e->size_;
+	return oe_get_large_size(pdata, e->size_);
+}
+
+static inline void oe_set_size(struct packing_data *pdata,
+			       struct object_entry *e,
+			       unsigned long size)
+{
+	if (size < 1UL << OE_SIZE_BITS) {
+		e->size_ = size;
+		e->size_valid = 1;
+		return;
+	}
+	e->size_ = oe_set_large_size(pdata, !e->size_valid, e->size_, size);
+	e->size_valid = 0;
+}
+
+static inline unsigned long oe_delta_size(struct packing_data *pdata,
+					  const struct object_entry *e)
+{
+	if (e->delta_size_valid)
+		return e->delta_size_;
+	return oe_get_large_size(pdata, e->delta_size_);
+}
+
+static inline void oe_set_delta_size(struct packing_data *pdata,
+				     struct object_entry *e,
+				     unsigned long size)
+{
+	if (size < 1UL << OE_DELTA_SIZE_BITS) {
+		e->delta_size_ = size;
+		e->delta_size_valid = 1;
+		return;
+	}
+	e->delta_size_ = oe_set_large_size(pdata, !e->delta_size_valid,
+					   e->delta_size_, size);
+	e->delta_size_valid = 0;
+}
+
 static inline uint32_t pack_name_hash(const char *name)
 {
 	uint32_t c, hash = 0;
@@ -14,6 +14,11 @@
  * ordered by offset, so if you know the offset of an object, next offset
  * is where its packed representation ends and the index_nr can be used to
  * get the object sha1 from the main index.
+ *
+ * When the pack comes with a .rev file we mmap that instead and look up
+ * offsets through the .idx on demand, which saves short-lived processes
+ * from building and sorting the whole array just to look at a few
+ * objects.
  */
 
 static struct pack_revindex *pack_revindex;
@@ -196,6 +201,60 @@ static void create_pack_revindex(struct pack_revindex *rix)
 	sort_revindex(rix->revindex, num_ent, p->pack_size);
 }
 
+static int load_pack_revindex(struct pack_revindex *rix)
+{
+	struct packed_git *p = rix->p;
+	struct strbuf name = STRBUF_INIT;
+	const unsigned char *map;
+	size_t len, map_size;
+	struct stat st;
+	int fd, ret = -1;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		return -1;
+	strbuf_add(&name, p->pack_name, len);
+	strbuf_addstr(&name, ".rev");
+
+	fd = git_open_noatime(name.buf);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	map_size = xsize_t(st.st_size);
+	if (map_size != RIDX_HEADER_SIZE + (size_t)p->num_objects * 4 + 40) {
+		close(fd);
+		error("reverse-index file %s has wrong size", name.buf);
+		goto out;
+	}
+	map = xmmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(map) != RIDX_SIGNATURE)
+		error("reverse-index file %s has unknown signature", name.buf);
+	else if (get_be32(map + 4) != RIDX_VERSION)
+		error("reverse-index file %s has unsupported version %"PRIu32,
+		      name.buf, get_be32(map + 4));
+	else if (get_be32(map + 8) != 1)
+		error("reverse-index file %s has unsupported hash id %"PRIu32,
+		      name.buf, get_be32(map + 8));
+	else if (hashcmp(map + map_size - 40,
+			 (const unsigned char *)p->index_data + p->index_size - 40))
+		error("reverse-index file %s does not match its pack", name.buf);
+	else {
+		rix->revindex_map = map;
+		rix->revindex_map_size = map_size;
+		rix->revindex_data = (const uint32_t *)(map + RIDX_HEADER_SIZE);
+		ret = 0;
+		goto out;
+	}
+	munmap((void *)map, map_size);
+out:
+	strbuf_release(&name);
+	return ret;
+}
+
 struct pack_revindex *revindex_for_pack(struct packed_git *p)
 {
 	int num;
@@ -209,23 +268,53 @@ struct pack_revindex *revindex_for_pack(struct packed_git *p)
 		die("internal error: pack revindex fubar");
 
 	rix = &pack_revindex[num];
-	if (!rix->revindex)
+	if (!rix->revindex && !rix->revindex_data &&
+	    load_pack_revindex(rix) < 0)
 		create_pack_revindex(rix);
 
 	return rix;
 }
 
+uint32_t pack_pos_to_index(struct pack_revindex *pridx, uint32_t pos)
+{
+	uint32_t nr;
+
+	if (!pridx->revindex_data)
+		return pridx->revindex[pos].nr;
+
+	nr = get_be32(pridx->revindex_data + pos);
+	if (nr >= pridx->p->num_objects)
+		die("reverse-index for %s is corrupt (position %"PRIu32")",
+		    pridx->p->pack_name, nr);
+	return nr;
+}
+
+off_t pack_pos_to_offset(struct pack_revindex *pridx, uint32_t pos)
+{
+	struct packed_git *p = pridx->p;
+
+	if (!pridx->revindex_data)
+		return pridx->revindex[pos].offset;
+
+	/* This knows the pack format -- the 20-byte trailer
+	 * follows immediately after the last object data.
+	 */
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, pack_pos_to_index(pridx, pos));
+}
+
 int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
 {
 	int lo = 0;
 	int hi = pridx->p->num_objects + 1;
-	struct revindex_entry *revindex = pridx->revindex;
 
 	do {
 		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
+		off_t mi_ofs = pack_pos_to_offset(pridx, mi);
+		if (mi_ofs == ofs) {
 			return mi;
-		} else if (ofs < revindex[mi].offset)
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
@@ -235,13 +324,57 @@ int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
 	return -1;
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+int find_pack_revindex(struct packed_git *p, off_t ofs,
+		       uint32_t *nr, off_t *next)
 {
 	struct pack_revindex *pridx = revindex_for_pack(p);
 	int pos = find_revindex_position(pridx, ofs);
 
 	if (pos < 0)
-		return NULL;
+		return -1;
 
-	return pridx->revindex + pos;
+	*nr = pack_pos_to_index(pridx, pos);
+	if (next)
+		*next = pack_pos_to_offset(pridx, pos + 1);
+	return 0;
+}
+
+int verify_pack_revindex(struct packed_git *p)
+{
+	struct pack_revindex *pridx;
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	const unsigned char *map;
+	off_t prev = 0;
+	uint32_t i;
+	int err = 0;
+
+	if (open_pack_index(p))
+		return error("packfile %s index not opened", p->pack_name);
+	pridx = revindex_for_pack(p);
+	if (!pridx->revindex_data)
+		return 0;
+	map = pridx->revindex_map;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, map, pridx->revindex_map_size - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, map + pridx->revindex_map_size - 20))
+		return error("reverse-index for %s SHA1 mismatch",
+			     p->pack_name);
+
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t nr = get_be32(pridx->revindex_data + i);
+		off_t ofs;
+
+		if (nr >= p->num_objects)
+			return error("reverse-index for %s has invalid "
+				     "position %"PRIu32, p->pack_name, nr);
+		ofs = nth_packed_object_offset(p, nr);
+		if (i && ofs <= prev)
+			err = error("reverse-index for %s is out of order "
+				    "at position %"PRIu32, p->pack_name, i);
+		prev = ofs;
+	}
+	return err;
 }
@@ -1,6 +1,22 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/*
+ * A "pack-<sha1>.rev" file stores the reverse index of its pack on disk:
+ *
+ *   - a 12-byte header: the signature "RIDX", a 4-byte version (1) and
+ *     a 4-byte hash id (1 for SHA-1);
+ *
+ *   - one 4-byte network-order index position for each object in the
+ *     pack, sorted by the offset of that object in the pack;
+ *
+ *   - the 20-byte checksum of the pack and a 20-byte checksum of all of
+ *     the above.
+ */
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
 struct revindex_entry {
 	off_t offset;
 	unsigned int nr;
@@ -8,12 +24,45 @@ struct revindex_entry {
 
 struct pack_revindex {
 	struct packed_git *p;
+
+	/* built in-core when the pack has no usable .rev file */
 	struct revindex_entry *revindex;
+
+	/* otherwise the positions come straight from the mapped .rev */
+	const void *revindex_map;
+	size_t revindex_map_size;
+	const uint32_t *revindex_data;
 };
 
 struct pack_revindex *revindex_for_pack(struct packed_git *p);
+
+/*
+ * Return the position in pack order of the object starting at "ofs",
+ * or -1 if no object starts there.
+ */
 int find_revindex_position(struct pack_revindex *pridx, off_t ofs);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Translate a position in pack order into the position of the object
+ * in the .idx file, or into its offset in the pack.  For the offset,
+ * "pos" may be num_objects, which yields the offset of the trailer so
+ * that the size of the last object can be computed.
+ */
+uint32_t pack_pos_to_index(struct pack_revindex *pridx, uint32_t pos);
+off_t pack_pos_to_offset(struct pack_revindex *pridx, uint32_t pos);
+
+/*
+ * Find the object starting at "ofs" in "p"; on success store its .idx
+ * position in "nr" and, if "next" is non-NULL, the offset at which its
+ * packed representation ends.  Returns -1 if no object starts there.
+ */
+int find_pack_revindex(struct packed_git *p, off_t ofs,
+		       uint32_t *nr, off_t *next);
+
+/*
+ * Check the checksum and ordering of the .rev file of "p", if it has
+ * one.  Returns 0 when there is nothing wrong.
+ */
+int verify_pack_revindex(struct packed_git *p);
 
 #endif
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -176,6 +177,62 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+struct rev_entry {
+	off_t offset;
+	uint32_t nr;
+};
+
+static int rev_entry_cmp(const void *a_, const void *b_)
+{
+	const struct rev_entry *a = a_, *b = b_;
+
+	return (a->offset < b->offset) ? -1 : (a->offset != b->offset);
+}
+
+/*
+ * Write the reverse index of a pack, mapping pack order to index
+ * order.  The objects array must already be sorted by SHA1 (as
+ * write_idx_file leaves it), and sha1 is the pack checksum.
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, const unsigned char *sha1)
+{
+	struct sha1file *f;
+	struct rev_entry *pack_order;
+	uint32_t i;
+	int fd;
+
+	pack_order = xmalloc(nr_objects * sizeof(*pack_order));
+	for (i = 0; i < nr_objects; i++) {
+		pack_order[i].offset = objects[i]->offset;
+		pack_order[i].nr = i;
+	}
+	qsort(pack_order, nr_objects, sizeof(*pack_order), rev_entry_cmp);
+
+	if (!rev_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmp_file);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	sha1write_be32(f, RIDX_SIGNATURE);
+	sha1write_be32(f, RIDX_VERSION);
+	sha1write_be32(f, 1);
+	for (i = 0; i < nr_objects; i++)
+		sha1write_be32(f, pack_order[i].nr);
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(pack_order);
+	return rev_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -342,7 +399,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -353,6 +410,13 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written,
+					      sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse-index file readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 	free_pack_by_name(name_buffer->buf);
 
@@ -361,6 +425,13 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse-index file");
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -368,4 +439,5 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	strbuf_setlen(name_buffer, basename_len);
 
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
 }
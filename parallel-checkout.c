@@ -0,0 +1,310 @@
+#include "cache.h"
+#include "convert.h"
+#include "progress.h"
+#include "thread-utils.h"
+#include "parallel-checkout.h"
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/* left to checkout_entry(), e.g. a large blob to stream */
+	PC_ITEM_SERIAL,
+	/* another entry got to the same file first */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED
+};
+
+struct pc_item {
+	struct cache_entry *ce;
+	char *path;
+	struct stream_filter *filter;
+	enum pc_item_status status;
+	int open_errno; /* for PC_ITEM_FAILED, 0 if the write failed */
+	int fstat_done;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	int active;
+	int workers;
+	int threshold;
+	struct pc_item *items;
+	size_t nr, alloc;
+
+	/* shared with the worker threads */
+	size_t next;
+	const struct checkout *state;
+	struct progress *progress;
+	unsigned *cnt;
+} pc;
+
+#ifndef NO_PTHREADS
+static int pc_use_threads;
+static pthread_mutex_t pc_mutex;
+
+static inline void pc_lock(void)
+{
+	if (pc_use_threads)
+		pthread_mutex_lock(&pc_mutex);
+}
+
+static inline void pc_unlock(void)
+{
+	if (pc_use_threads)
+		pthread_mutex_unlock(&pc_mutex);
+}
+#else
+#define pc_lock()
+#define pc_unlock()
+#endif
+
+void init_parallel_checkout(void)
+{
+#ifndef NO_PTHREADS
+	if (pc.active)
+		return;
+
+	if (git_config_get_int("checkout.workers", &pc.workers))
+		pc.workers = 1;
+	else if (pc.workers < 1)
+		pc.workers = online_cpus();
+	if (git_config_get_int("checkout.thresholdforparallelism",
+			       &pc.threshold))
+		pc.threshold = 100;
+
+	pc.active = pc.workers > 1;
+#endif
+}
+
+size_t parallel_checkout_queued(void)
+{
+	return pc.nr;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const char *path)
+{
+	struct stream_filter *filter;
+	struct pc_item *item;
+
+	if (!pc.active || !S_ISREG(ce->ce_mode))
+		return -1;
+
+	/*
+	 * The attributes are looked up here, in the main thread.  The
+	 * conversions that can be streamed (ident, end-of-line) can
+	 * be applied by a worker; the others are left to the caller.
+	 */
+	filter = get_stream_filter(ce->name, ce->sha1);
+	if (!filter)
+		return -1;
+
+	ALLOC_GROW(pc.items, pc.nr + 1, pc.alloc);
+	item = &pc.items[pc.nr++];
+	memset(item, 0, sizeof(*item));
+	item->ce = ce;
+	item->path = xstrdup(path);
+	item->filter = filter;
+	return 0;
+}
+
+/* Run all of src through the filter, appending the result to dst. */
+static int filter_buffer(struct stream_filter *filter,
+			 const char *src, size_t len, struct strbuf *dst)
+{
+	for (;;) {
+		size_t isize = len, osize, avail;
+
+		strbuf_grow(dst, len + 8192);
+		avail = osize = strbuf_avail(dst);
+		if (stream_filter(filter, len ? src : NULL, &isize,
+				  dst->buf + dst->len, &osize))
+			return -1;
+		strbuf_setlen(dst, dst->len + avail - osize);
+		if (len) {
+			src += len - isize;
+			len = isize;
+		} else if (avail == osize) {
+			/* drained */
+			return 0;
+		}
+	}
+}
+
+static void write_item(struct pc_item *item)
+{
+	struct cache_entry *ce = item->ce;
+	enum object_type type;
+	unsigned long size;
+	ssize_t wrote;
+	void *data;
+	int fd;
+
+	/* large blobs are streamed by write_entry() instead */
+	type = sha1_object_info(ce->sha1, &size);
+	if (type != OBJ_BLOB || size > big_file_threshold) {
+		item->status = PC_ITEM_SERIAL;
+		return;
+	}
+
+	data = read_sha1_file(ce->sha1, &type, &size);
+	if (!data || type != OBJ_BLOB) {
+		free(data);
+		item->status = PC_ITEM_SERIAL;
+		return;
+	}
+
+	if (!is_null_stream_filter(item->filter)) {
+		struct strbuf buf = STRBUF_INIT;
+
+		if (filter_buffer(item->filter, data, size, &buf)) {
+			strbuf_release(&buf);
+			free(data);
+			item->status = PC_ITEM_SERIAL;
+			return;
+		}
+		free(data);
+		size = buf.len;
+		data = strbuf_detach(&buf, NULL);
+	}
+
+	fd = open_output_fd(item->path, ce, 0);
+	if (fd < 0) {
+		item->open_errno = errno;
+		item->status = errno == EEXIST ?
+			PC_ITEM_COLLIDED : PC_ITEM_FAILED;
+		free(data);
+		return;
+	}
+	wrote = write_in_full(fd, data, size);
+	item->fstat_done = fstat_output(fd, pc.state, &item->st);
+	close(fd);
+	free(data);
+
+	if (wrote != size) {
+		unlink(item->path);
+		item->status = PC_ITEM_FAILED;
+		return;
+	}
+	item->status = PC_ITEM_WRITTEN;
+}
+
+static void write_items(void)
+{
+	for (;;) {
+		struct pc_item *item;
+
+		pc_lock();
+		if (pc.next >= pc.nr) {
+			pc_unlock();
+			return;
+		}
+		item = &pc.items[pc.next++];
+		pc_unlock();
+
+		write_item(item);
+
+		if (item->status == PC_ITEM_WRITTEN) {
+			pc_lock();
+			display_progress(pc.progress, ++*pc.cnt);
+			pc_unlock();
+		}
+	}
+}
+
+#ifndef NO_PTHREADS
+static void *checkout_thread(void *data)
+{
+	write_items();
+	return NULL;
+}
+
+static void write_items_threaded(int nr_threads)
+{
+	pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+	int t;
+
+	enable_obj_read_lock();
+	pthread_mutex_init(&pc_mutex, NULL);
+	pc_use_threads = 1;
+
+	for (t = 0; t < nr_threads; t++) {
+		int ret = pthread_create(&threads[t], NULL,
+					 checkout_thread, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+
+	pc_use_threads = 0;
+	pthread_mutex_destroy(&pc_mutex);
+	disable_obj_read_lock();
+	free(threads);
+}
+#endif
+
+int run_parallel_checkout(const struct checkout *state,
+			  struct progress *progress, unsigned *cnt)
+{
+	int nr_threads = pc.workers;
+	int errs = 0;
+	size_t i;
+
+	if (!pc.active)
+		return 0;
+	/* the entries left over go through checkout_entry() below */
+	pc.active = 0;
+
+	pc.next = 0;
+	pc.state = state;
+	pc.progress = progress;
+	pc.cnt = cnt;
+
+	if (nr_threads > pc.nr)
+		nr_threads = pc.nr;
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 && pc.nr >= pc.threshold)
+		write_items_threaded(nr_threads);
+	else
+#endif
+		write_items();
+
+	for (i = 0; i < pc.nr; i++) {
+		struct pc_item *item = &pc.items[i];
+
+		switch (item->status) {
+		case PC_ITEM_WRITTEN:
+			update_ce_after_write(state, item->ce,
+					      item->fstat_done ? &item->st : NULL);
+			continue;
+		case PC_ITEM_FAILED:
+			if (item->open_errno)
+				errs |= error("unable to create file %s (%s)",
+					      item->path,
+					      strerror(item->open_errno));
+			else
+				errs |= error("unable to write file %s",
+					      item->path);
+			break;
+		default:
+			/*
+			 * Check out in index order what a worker left
+			 * over.  A collided entry finds the file of the
+			 * other one in place, and replaces it as it
+			 * would have without parallel checkout.
+			 */
+			errs |= checkout_entry(item->ce, state, NULL);
+			break;
+		}
+		display_progress(progress, ++*cnt);
+	}
+
+	for (i = 0; i < pc.nr; i++) {
+		free(pc.items[i].path);
+		if (pc.items[i].filter)
+			free_stream_filter(pc.items[i].filter);
+	}
+	free(pc.items);
+	memset(&pc, 0, sizeof(pc));
+	return errs != 0;
+}
@@ -0,0 +1,40 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct progress;
+
+/*
+ * Parallel checkout: while it is active, checkout_entry() still checks
+ * the path, removes what is in the way and creates the leading
+ * directories, but instead of writing a regular file it queues it.
+ * run_parallel_checkout() then reads, converts and writes the queued
+ * files on checkout.workers threads.
+ */
+
+/*
+ * Start queueing entries if checkout.workers asks for more than one
+ * worker.
+ */
+extern void init_parallel_checkout(void);
+
+/* Number of entries queued so far. */
+extern size_t parallel_checkout_queued(void);
+
+/*
+ * Queue ce, to be written to path.  Returns -1 (and queues nothing)
+ * when parallel checkout is not active or ce cannot be written by a
+ * worker, e.g. because it is not a regular file or needs a smudge
+ * filter; the caller then writes it itself.
+ */
+extern int enqueue_checkout(struct cache_entry *ce, const char *path);
+
+/*
+ * Write the queued entries and record their stat data, advancing the
+ * progress meter from *cnt; entries the workers could not write are
+ * checked out with checkout_entry() afterwards.  Stops queueing and
+ * returns non-zero if any entry failed.
+ */
+extern int run_parallel_checkout(const struct checkout *state,
+				 struct progress *progress, unsigned *cnt);
+
+#endif
@@ -93,7 +93,8 @@ static void replace_dir(struct strbuf *buf, int len, const char *newdir)
 
 static const char *common_list[] = {
 	"/branches", "/hooks", "/info", "!/logs", "/lost-found",
-	"/objects", "/refs", "/remotes", "/worktrees", "/rr-cache", "/svn",
+	"/objects", "/refs", "/reftable", "/remotes", "/worktrees", "/rr-cache",
+	"/svn",
 	"config", "!gc.pid", "packed-refs", "shallow",
 	NULL
 };
@@ -104,6 +105,7 @@ static void update_common_dir(struct strbuf *buf, int git_dir_len)
 	const char **p;
 
 	if (is_dir_file(base, "logs", "HEAD") ||
+	    is_dir_file(base, "logs/.index", "HEAD") ||
 	    is_dir_file(base, "info", "sparse-checkout"))
 		return;	/* keep this in $GIT_DIR */
 	for (p = common_list; *p; p++) {
@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "pathspec.h"
 #include "dir.h"
+#include "fsmonitor.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -29,6 +30,7 @@ struct thread_data {
 	struct index_state *index;
 	struct pathspec pathspec;
 	int offset, nr;
+	int fsmonitor_changed;
 };
 
 static void *preload_thread(void *_data)
@@ -53,6 +55,8 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_uptodate(ce))
 			continue;
+		if (ce->ce_flags & CE_FSMONITOR_VALID)
+			continue;
 		if (!ce_path_match(ce, &p->pathspec, NULL))
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
@@ -62,6 +66,11 @@ static void *preload_thread(void *_data)
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
+		/* index->cache_changed is updated after the threads are done */
+		if (core_fsmonitor) {
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+			p->fsmonitor_changed = 1;
+		}
 	} while (--nr > 0);
 	cache_def_clear(&cache);
 	return NULL;
@@ -79,6 +88,8 @@ static void preload_index(struct index_state *index,
 	threads = index->cache_nr / THREAD_COST;
 	if (threads < 2)
 		return;
+	/* ask the filesystem monitor before the threads look at its bits */
+	refresh_fsmonitor(index);
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
 	offset = 0;
@@ -99,6 +110,8 @@ static void preload_index(struct index_state *index,
 		struct thread_data *p = data+i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
+		if (p->fsmonitor_changed)
+			index->cache_changed |= FSMONITOR_CHANGED;
 	}
 }
 #endif
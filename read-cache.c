@@ -18,6 +18,10 @@
 #include "split-index.h"
 #include "sigchain.h"
 #include "utf8.h"
+#include "fsmonitor.h"
+#include "ewah/ewok.h"
+#include "thread-utils.h"
+#include "sparse-index.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 					       unsigned int options);
@@ -39,11 +43,17 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
-		 SPLIT_INDEX_ORDERED)
+		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED | \
+		 FSMONITOR_CHANGED)
 
 struct index_state the_index;
 static const char *alternate_index_output;
@@ -79,6 +89,7 @@ void rename_index_entry_at(struct index_state *istate, int nr, const char *new_n
 	memcpy(new->name, new_name, namelen + 1);
 
 	cache_tree_invalidate_path(istate, old->name);
+	untracked_cache_invalidate_path(istate, old->name);
 	remove_index_entry_at(istate, nr);
 	add_index_entry(istate, new, ADD_CACHE_OK_TO_ADD|ADD_CACHE_OK_TO_REPLACE);
 }
@@ -150,8 +161,12 @@ void fill_stat_cache_info(struct cache_entry *ce, struct stat *st)
 	if (assume_unchanged)
 		ce->ce_flags |= CE_VALID;
 
-	if (S_ISREG(st->st_mode))
+	if (S_ISREG(st->st_mode)) {
 		ce_mark_uptodate(ce);
+		/* the callers mark the index itself changed */
+		if (core_fsmonitor)
+			ce->ce_flags |= CE_FSMONITOR_VALID;
+	}
 }
 
 static int ce_compare_data(const struct cache_entry *ce, struct stat *st)
@@ -270,20 +285,34 @@ static int ce_match_stat_basic(const struct cache_entry *ce, struct stat *st)
 	return changed;
 }
 
-static int is_racy_timestamp(const struct index_state *istate,
-			     const struct cache_entry *ce)
+int is_racy_stat(const struct index_state *istate,
+		 const struct stat_data *sd)
 {
-	return (!S_ISGITLINK(ce->ce_mode) &&
-		istate->timestamp.sec &&
+	return (istate->timestamp.sec &&
 #ifdef USE_NSEC
 		 /* nanosecond timestamped files can also be racy! */
-		(istate->timestamp.sec < ce->ce_stat_data.sd_mtime.sec ||
-		 (istate->timestamp.sec == ce->ce_stat_data.sd_mtime.sec &&
-		  istate->timestamp.nsec <= ce->ce_stat_data.sd_mtime.nsec))
+		(istate->timestamp.sec < sd->sd_mtime.sec ||
+		 (istate->timestamp.sec == sd->sd_mtime.sec &&
+		  istate->timestamp.nsec <= sd->sd_mtime.nsec))
 #else
-		istate->timestamp.sec <= ce->ce_stat_data.sd_mtime.sec
+		istate->timestamp.sec <= sd->sd_mtime.sec
 #endif
-		 );
+		);
+}
+
+static int is_racy_timestamp(const struct index_state *istate,
+			     const struct cache_entry *ce)
+{
+	return (!S_ISGITLINK(ce->ce_mode) &&
+		is_racy_stat(istate, &ce->ce_stat_data));
+}
+
+int match_stat_data_racy(const struct index_state *istate,
+			 const struct stat_data *sd, struct stat *st)
+{
+	if (is_racy_stat(istate, sd))
+		return MTIME_CHANGED;
+	return match_stat_data(sd, st);
 }
 
 int ie_match_stat(const struct index_state *istate,
@@ -538,6 +567,7 @@ int remove_file_from_index(struct index_state *istate, const char *path)
 	if (pos < 0)
 		pos = -pos-1;
 	cache_tree_invalidate_path(istate, path);
+	untracked_cache_invalidate_path(istate, path);
 	while (pos < istate->cache_nr && !strcmp(istate->cache[pos]->name, path))
 		remove_index_entry_at(istate, pos);
 	return 0;
@@ -973,6 +1003,8 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 	if (!(option & ADD_CACHE_KEEP_CACHE_TREE))
 		cache_tree_invalidate_path(istate, ce->name);
 	pos = index_name_stage_pos(istate, ce->name, ce_namelen(ce), ce_stage(ce));
+	if (pos < 0)
+		untracked_cache_invalidate_path(istate, ce->name);
 
 	/* existing match? Just replace it. */
 	if (pos >= 0) {
@@ -1061,10 +1093,14 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	int ignore_valid = options & CE_MATCH_IGNORE_VALID;
 	int ignore_skip_worktree = options & CE_MATCH_IGNORE_SKIP_WORKTREE;
 	int ignore_missing = options & CE_MATCH_IGNORE_MISSING;
+	int ignore_fsmonitor = options & CE_MATCH_IGNORE_FSMONITOR;
 
 	if (!refresh || ce_uptodate(ce))
 		return ce;
 
+	if (!ignore_fsmonitor)
+		refresh_fsmonitor(istate);
+
 	/*
 	 * CE_VALID or CE_SKIP_WORKTREE means the user promised us
 	 * that the change to the work tree does not matter and told
@@ -1078,6 +1114,14 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	/*
+	 * CE_FSMONITOR_VALID means the filesystem monitor did not
+	 * see the file change since its stat data was last checked.
+	 */
+	if (!ignore_fsmonitor && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (has_symlink_leading_path(ce->name, ce_namelen(ce))) {
 		if (ignore_missing)
@@ -1115,8 +1159,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1169,7 +1215,8 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	int first = 1;
 	int in_porcelain = (flags & REFRESH_IN_PORCELAIN);
 	unsigned int options = (CE_MATCH_REFRESH |
-				(really ? CE_MATCH_IGNORE_VALID : 0) |
+				(really ? CE_MATCH_IGNORE_VALID |
+					  CE_MATCH_IGNORE_FSMONITOR : 0) |
 				(not_new ? CE_MATCH_IGNORE_MISSING : 0));
 	const char *modified_fmt;
 	const char *deleted_fmt;
@@ -1372,6 +1419,19 @@ static int read_index_extension(struct index_state *istate,
 		if (read_link_extension(istate, data, sz))
 			return -1;
 		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_FSMONITOR:
+		read_fsmonitor_extension(istate, data, sz);
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		istate->sparse_index = 1;
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1428,14 +1488,22 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       int new_block)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
+	/*
+	 * The first entry of a block strips all of the previous name,
+	 * which a reader that starts at the block has never seen.
+	 */
+	if (new_block)
+		strbuf_reset(name);
+	else if (name->len < len)
 		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	else
+		strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1444,7 +1512,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    int new_block)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1478,7 +1547,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, new_block);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1510,16 +1579,395 @@ static void check_ce_order(struct index_state *istate)
 	}
 }
 
+/*
+ * The end of index entries (EOIE) extension is written last, so that
+ * it can be found at a fixed place before the entries are parsed.  It
+ * holds where the extensions start and a hash of their headers.
+ */
+#define EOIE_SIZE (4 + 20) /* <4-byte offset> + <20-byte hash> */
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE) /* <4-byte signature> + <4-byte length> + EOIE_SIZE */
+
+/*
+ * The index entry offset table (IEOT) extension records where blocks
+ * of entries start.  With index v4, the first entry of each block does
+ * not share a prefix with the last entry of the previous block.
+ */
+#define IEOT_VERSION	(1)
+
+struct index_entry_offset
+{
+	/* starting byte offset into index file, count of index entries in this block */
+	int offset, nr;
+};
+
+struct index_entry_offset_table
+{
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+/*
+ * Mostly randomly chosen minimum number of entries per thread.  Parsing
+ * fewer entries than this is not worth starting a thread for.
+ */
+#define THREAD_COST		(10000)
+
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap, int offset, int nr,
+					    unsigned long start_offset,
+					    struct strbuf *previous_name)
+{
+	int i;
+	unsigned long src_offset = start_offset;
+
+	for (i = offset; i < offset + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      i == offset);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	return src_offset - start_offset;
+}
+
+static unsigned long load_all_cache_entries(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	unsigned long consumed;
+
+	if (istate->version == 4)
+		previous_name = &previous_name_buf;
+	else
+		previous_name = NULL;
+
+	consumed = load_cache_entry_block(istate, mmap, 0, istate->cache_nr,
+					  src_offset, previous_name);
+	strbuf_release(&previous_name_buf);
+	return consumed;
+}
+
+/*
+ * Read the extensions starting at src_offset; returns -1 if one of them
+ * is corrupt.
+ */
+static int read_index_extensions(struct index_state *istate,
+				 const char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *)mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * Returns the offset of the first extension if the index ends with a
+ * valid EOIE extension, 0 otherwise.
+ */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *index, *eoie;
+	uint32_t extsize;
+	unsigned long offset, src_offset, eoie_offset;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	/* ensure we have an index big enough to contain an EOIE extension */
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+
+	/* validate the extension signature */
+	index = eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(index) != CACHE_EXT_ENDOFINDEXENTRIES)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/* validate the extension size */
+	extsize = get_be32(index);
+	if (extsize != EOIE_SIZE)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * Validate the offset we're going to look for the first extension
+	 * signature is after the index header and before the eoie extension.
+	 */
+	eoie_offset = eoie - mmap;
+	offset = get_be32(index);
+	if (offset < sizeof(struct cache_header) || offset > eoie_offset)
+		return 0;
+	index += sizeof(uint32_t);
+
+	/*
+	 * The hash is computed over the extension types and their sizes (but
+	 * not their contents).  E.g. if we have "TREE" extension that is N-bytes
+	 * long, "REUC" extension that is M-bytes long, followed by "EOIE",
+	 * then the hash would be:
+	 *
+	 * SHA-1("TREE" + <binary representation of N> +
+	 *	 "REUC" + <binary representation of M>)
+	 */
+	git_SHA1_Init(&c);
+	src_offset = offset;
+	while (src_offset < eoie_offset) {
+		if (eoie_offset - src_offset < 8)
+			return 0;
+		extsize = get_be32(mmap + src_offset + 4);
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8;
+		if (extsize > eoie_offset - src_offset)
+			return 0;
+		src_offset += extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)index))
+		return 0;
+
+	return offset;
+}
+
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							    size_t mmap_size,
+							    unsigned long offset)
+{
+	const char *index = NULL;
+	uint32_t extsize, ext_version;
+	struct index_entry_offset_table *ieot;
+	int i, nr;
+
+	/* find the IEOT extension; read_eoie_extension() checked the sizes */
+	while (offset <= mmap_size - 20 - 8) {
+		extsize = get_be32(mmap + offset + 4);
+		if (CACHE_EXT((mmap + offset)) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = mmap + offset + 4 + 4;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!index)
+		return NULL;
+	if (extsize < sizeof(uint32_t)) {
+		error("invalid IEOT extension size %"PRIu32, extsize);
+		return NULL;
+	}
+
+	/* validate the version is IEOT_VERSION */
+	ext_version = get_be32(index);
+	if (ext_version != IEOT_VERSION) {
+		error("invalid IEOT version %d", ext_version);
+		return NULL;
+	}
+	index += sizeof(uint32_t);
+
+	/* extension size - version bytes / bytes per entry */
+	nr = (extsize - sizeof(uint32_t)) / (sizeof(uint32_t) + sizeof(uint32_t));
+	if (!nr) {
+		error("invalid number of IEOT entries %d", nr);
+		return NULL;
+	}
+	ieot = xmalloc(sizeof(struct index_entry_offset_table)
+		       + (nr * sizeof(struct index_entry_offset)));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		ieot->entries[i].offset = get_be32(index);
+		index += sizeof(uint32_t);
+		ieot->entries[i].nr = get_be32(index);
+		index += sizeof(uint32_t);
+	}
+
+	return ieot;
+}
+
+static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	int i;
+
+	/* version */
+	put_be32(&buffer, IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* ieot */
+	for (i = 0; i < ieot->nr; i++) {
+
+		/* offset */
+		put_be32(&buffer, ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+		/* count */
+		put_be32(&buffer, ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+	}
+}
+
+/*
+ * Check that the blocks of the table cover all the entries, one after
+ * the other, between the header and the extensions.
+ */
+static int verify_ieot(struct index_state *istate,
+		       struct index_entry_offset_table *ieot,
+		       unsigned long extension_offset)
+{
+	int i, nr = 0;
+	unsigned long offset = sizeof(struct cache_header);
+
+	for (i = 0; i < ieot->nr; i++) {
+		if (ieot->entries[i].nr <= 0 ||
+		    ieot->entries[i].offset < offset ||
+		    ieot->entries[i].offset >= extension_offset)
+			return 0;
+		offset = ieot->entries[i].offset + 1;
+		nr += ieot->entries[i].nr;
+	}
+	return ieot->entries[0].offset == sizeof(struct cache_header) &&
+		nr == istate->cache_nr;
+}
+
+#ifndef NO_PTHREADS
+struct load_index_extensions
+{
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+	int ret;
+};
+
+static void *load_index_extensions(void *_data)
+{
+	struct load_index_extensions *p = _data;
+
+	p->ret = read_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->src_offset);
+	return NULL;
+}
+
+struct load_cache_entries_thread_data
+{
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* starting index into the ieot array */
+	int ieot_blocks;	/* count of ieot entries to process */
+	int offset;		/* position in the index of the first entry */
+	unsigned long consumed;	/* return # of bytes in index file processed */
+};
+
+/*
+ * A thread proc to run the create_from_disk() function on a block of
+ * index entries.  The blocks do not share v4 name prefixes, so each
+ * of them can be parsed without the entries before it.
+ */
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_thread_data *p = _data;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i, offset = p->offset;
+
+	previous_name = (p->istate->version == 4) ? &previous_name_buf : NULL;
+
+	/* iterate across all ieot blocks assigned to this thread */
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		p->consumed += load_cache_entry_block(p->istate, p->mmap,
+			offset, p->ieot->entries[i].nr,
+			p->ieot->entries[i].offset, previous_name);
+		offset += p->ieot->entries[i].nr;
+	}
+	strbuf_release(&previous_name_buf);
+	return NULL;
+}
+
+static unsigned long load_cache_entries_threaded(struct index_state *istate,
+						 const char *mmap,
+						 int nr_threads,
+						 struct index_entry_offset_table *ieot)
+{
+	int i, offset, ieot_blocks, ieot_start;
+	struct load_cache_entries_thread_data *data;
+	unsigned long consumed = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	offset = ieot_start = 0;
+	ieot_blocks = DIV_ROUND_UP(ieot->nr, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int j;
+
+		if (ieot_start + ieot_blocks > ieot->nr)
+			ieot_blocks = ieot->nr - ieot_start;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = ieot_start;
+		p->ieot_blocks = ieot_blocks;
+		p->offset = offset;
+
+		/* determine the index of the first entry of the next thread */
+		for (j = p->ieot_start; j < p->ieot_start + p->ieot_blocks; j++)
+			offset += ieot->entries[j].nr;
+		ieot_start += ieot_blocks;
+
+		if (pthread_create(&p->pthread, NULL, load_cache_entries_thread, p))
+			die("unable to create load_cache_entries thread");
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+
+		if (pthread_join(p->pthread, NULL))
+			die("unable to join load_cache_entries thread");
+		consumed += p->consumed;
+	}
+
+	free(data);
+	return consumed;
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+#ifndef NO_PTHREADS
+	int nr_threads;
+	unsigned long extension_offset = 0;
+	struct load_index_extensions p;
+	struct index_entry_offset_table *ieot = NULL;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1556,45 +2004,80 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+#ifndef NO_PTHREADS
+	if (git_config_get_index_threads(&nr_threads))
+		nr_threads = 0;
 
-		src_offset += consumed;
+	/* by default, use one thread per THREAD_COST entries up to the CPU count */
+	if (!nr_threads) {
+		int cpus = online_cpus();
+
+		nr_threads = istate->cache_nr / THREAD_COST;
+		if (nr_threads > cpus)
+			nr_threads = cpus;
 	}
-	strbuf_release(&previous_name_buf);
+
+	/*
+	 * The EOIE extension tells where the extensions start: load them
+	 * on a thread of their own while the entries are being parsed.
+	 */
+	if (nr_threads > 1)
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		int err;
+
+		p.istate = istate;
+		p.mmap = mmap;
+		p.mmap_size = mmap_size;
+		p.src_offset = extension_offset;
+		p.ret = 0;
+		err = pthread_create(&p.pthread, NULL, load_index_extensions, &p);
+		if (err)
+			die(_("unable to create load_index_extensions thread: %s"), strerror(err));
+
+		nr_threads--;
+	}
+
+	/*
+	 * The IEOT extension tells where blocks of entries start: parse
+	 * them in parallel.
+	 */
+	if (extension_offset && nr_threads > 1) {
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
+		if (ieot && !verify_ieot(istate, ieot, extension_offset)) {
+			free(ieot);
+			ieot = NULL;
+		}
+	}
+
+	if (ieot) {
+		src_offset += load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+		free(ieot);
+	} else {
+		src_offset += load_all_cache_entries(istate, mmap, src_offset);
+	}
+#else
+	src_offset += load_all_cache_entries(istate, mmap, src_offset);
+#endif
+
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+#ifndef NO_PTHREADS
+	if (extension_offset) {
+		int ret = pthread_join(p.pthread, NULL);
+		if (ret)
+			die(_("unable to join load_index_extensions thread: %s"), strerror(ret));
+		if (p.ret < 0 || src_offset != extension_offset)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
+		munmap(mmap, mmap_size);
+		return istate->cache_nr;
 	}
+#endif
+	if (read_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1603,7 +2086,22 @@ unmap:
 	die("index file corrupt");
 }
 
-int read_index_from(struct index_state *istate, const char *path)
+static void tweak_untracked_cache(struct index_state *istate)
+{
+	switch (git_config_get_untracked_cache()) {
+	case -1: /* keep: do nothing */
+		break;
+	case 0:
+		remove_untracked_cache(istate);
+		break;
+	case 1:
+		if (get_git_work_tree())
+			add_untracked_cache(istate);
+		break;
+	}
+}
+
+static int read_index_sparse_from(struct index_state *istate, const char *path)
 {
 	struct split_index *split_index;
 	int ret;
@@ -1613,9 +2111,11 @@ int read_index_from(struct index_state *istate, const char *path)
 		return istate->cache_nr;
 
 	ret = do_read_index(istate, path, 0);
+	tweak_untracked_cache(istate);
 	split_index = istate->split_index;
 	if (!split_index || is_null_sha1(split_index->base_sha1)) {
 		check_ce_order(istate);
+		tweak_fsmonitor(istate);
 		return ret;
 	}
 
@@ -1634,9 +2134,27 @@ int read_index_from(struct index_state *istate, const char *path)
 		    sha1_to_hex(split_index->base->sha1));
 	merge_base_index(istate);
 	check_ce_order(istate);
+	tweak_fsmonitor(istate);
 	return ret;
 }
 
+int read_index_from(struct index_state *istate, const char *path)
+{
+	int ret = read_index_sparse_from(istate, path);
+
+	/* the index may have been read by read_index_sparse() before */
+	if (ret >= 0 && istate->sparse_index && command_requires_full_index) {
+		ensure_full_index(istate);
+		ret = istate->cache_nr;
+	}
+	return ret;
+}
+
+int read_index_sparse(struct index_state *istate)
+{
+	return read_index_sparse_from(istate, get_index_file());
+}
+
 int is_index_unborn(struct index_state *istate)
 {
 	return (!istate->cache_nr && !istate->timestamp.sec);
@@ -1667,6 +2185,13 @@ int discard_index(struct index_state *istate)
 	istate->cache = NULL;
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_has_run_once = 0;
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->sparse_index = 0;
 	return 0;
 }
 
@@ -1718,11 +2243,15 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
-				  unsigned int ext, unsigned int sz)
+static int write_index_ext_header(git_SHA_CTX *context, git_SHA_CTX *eoie_context,
+				  int fd, unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -1954,16 +2483,46 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_context,
+				 unsigned long offset)
+{
+	uint32_t buffer;
+	unsigned char hash[20];
+
+	/* offset */
+	put_be32(&buffer, offset);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	/* hash */
+	git_SHA1_Final(hash, eoie_context);
+	strbuf_add(sb, hash, 20);
+}
+
+/*
+ * Where the next byte given to ce_write() will land in the file, or -1.
+ */
+static off_t ce_write_offset(int fd)
+{
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	if (offset < 0)
+		return -1;
+	return offset + write_buffer_len;
+}
+
 static int do_write_index(struct index_state *istate, int newfd,
 			  int strip_extensions)
 {
-	git_SHA_CTX c;
+	git_SHA_CTX c, eoie_ctx, *eoie_c = NULL;
 	struct cache_header hdr;
 	int i, err, removed, extended, hdr_version;
 	struct cache_entry **cache = istate->cache;
 	int entries = istate->cache_nr;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int nr_threads, ieot_entries = 0, nr = 0;
+	off_t offset = 0, block_offset = 0;
+	struct index_entry_offset_table *ieot = NULL;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1997,11 +2556,70 @@ static int do_write_index(struct index_state *istate, int newfd,
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	/*
+	 * Only record where the entries and the extensions start when
+	 * index.threads asks for it: older versions of git complain
+	 * about extensions they do not know.
+	 */
+	if (!git_config_get_index_threads(&nr_threads) && nr_threads != 1) {
+		int ieot_blocks;
+
+		/*
+		 * Make the default number of blocks match the default
+		 * number of threads that will load them, leaving room for
+		 * the thread that loads the extensions.
+		 */
+		if (!nr_threads) {
+			int cpus = online_cpus();
+
+			ieot_blocks = istate->cache_nr / THREAD_COST;
+			if (ieot_blocks > cpus - 1)
+				ieot_blocks = cpus - 1;
+		} else {
+			ieot_blocks = nr_threads;
+			if (ieot_blocks > istate->cache_nr)
+				ieot_blocks = istate->cache_nr;
+		}
+
+		if (ieot_blocks > 1) {
+			ieot = xcalloc(1, sizeof(struct index_entry_offset_table)
+				       + (ieot_blocks * sizeof(struct index_entry_offset)));
+			ieot_entries = DIV_ROUND_UP(entries - removed, ieot_blocks);
+		}
+
+		git_SHA1_Init(&eoie_ctx);
+		eoie_c = &eoie_ctx;
+		block_offset = ce_write_offset(newfd);
+		if (block_offset < 0) {
+			free(ieot);
+			return -1;
+		}
+	}
+
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && nr >= ieot_entries) {
+			ieot->entries[ieot->nr].nr = nr;
+			ieot->entries[ieot->nr].offset = block_offset;
+			ieot->nr++;
+			/*
+			 * Start a new block that does not share a name
+			 * prefix with the previous one, so that it can be
+			 * parsed on its own: the first entry strips all
+			 * of the previous name.
+			 */
+			if (previous_name)
+				previous_name->buf[0] = '\0';
+			block_offset = ce_write_offset(newfd);
+			if (block_offset < 0) {
+				free(ieot);
+				return -1;
+			}
+			nr = 0;
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_sha1(ce->sha1)) {
@@ -2012,20 +2630,57 @@ static int do_write_index(struct index_state *istate, int newfd,
 				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
 			if (allow)
 				warning(msg, ce->name);
-			else
+			else {
+				free(ieot);
 				return error(msg, ce->name);
+			}
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
+		if (ce_write_entry(&c, newfd, ce, previous_name) < 0) {
+			free(ieot);
 			return -1;
+		}
+		nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
+	if (eoie_c) {
+		if (ieot && nr) {
+			ieot->entries[ieot->nr].nr = nr;
+			ieot->entries[ieot->nr].offset = block_offset;
+			ieot->nr++;
+		}
+		offset = ce_write_offset(newfd);
+		if (offset < 0) {
+			free(ieot);
+			return -1;
+		}
+	}
+
+	/*
+	 * The offset table comes first so that it is found quickly; it
+	 * is written even with strip_extensions, to load a shared index
+	 * in parallel too.
+	 */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		if (err)
+			return -1;
+	}
+
 	/* Write extension data here */
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2036,7 +2691,7 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2046,13 +2701,62 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
 			return -1;
 	}
+	if (!strip_extensions && istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate);
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		/* write_locked_index() fills it before splitting the index */
+		if (!istate->fsmonitor_dirty)
+			fill_fsmonitor_bitmap(istate);
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+
+	if (!strip_extensions && istate->sparse_index) {
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_SPARSE_DIRECTORIES, 0) < 0;
+		if (err)
+			return -1;
+	}
+
+	/*
+	 * The EOIE extension must be the last one before the checksum,
+	 * so that it can be found before the entries are read.
+	 */
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, eoie_c, offset);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
 
 	if (ce_flush(&c, newfd, istate->sha1) || fstat(newfd, &st))
 		return -1;
@@ -2077,7 +2781,21 @@ static int commit_locked_index(struct lock_file *lk)
 static int do_write_locked_index(struct index_state *istate, struct lock_file *lock,
 				 unsigned flags)
 {
-	int ret = do_write_index(istate, lock->fd, 0);
+	struct index_state full;
+	int ret;
+
+	/*
+	 * With index.sparse, the directories out of the sparse checkout
+	 * are written as single entries; we keep working on all entries.
+	 */
+	if (convert_to_sparse(istate, &full)) {
+		if (istate->fsmonitor_last_update)
+			fill_fsmonitor_bitmap(istate);
+		ret = do_write_index(istate, lock->fd, 0);
+		restore_full_index(istate, &full);
+	} else {
+		ret = do_write_index(istate, lock->fd, 0);
+	}
 	if (ret)
 		return ret;
 	assert((flags & (COMMIT_LOCK | CLOSE_LOCK)) !=
@@ -2159,6 +2877,13 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 {
 	struct split_index *si = istate->split_index;
 
+	/* a command that kept sparse directories may not write them out */
+	if (istate->sparse_index && (si || !sparse_index_enabled()))
+		ensure_full_index(istate);
+
+	if (istate->fsmonitor_last_update)
+		fill_fsmonitor_bitmap(istate);
+
 	if (!si || alternate_index_output ||
 	    (istate->cache_changed & ~EXTMASK)) {
 		if (si)
@@ -0,0 +1,856 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "varint.h"
+#include "ref-table.h"
+
+/*
+ * A ref table consists of a header, a sequence of ref blocks, an
+ * optional index block, and a footer:
+ *
+ *   header:  "RTBL" <be32 version>
+ *   block:   <type byte> <be24 length> <records> <be24 restart>* <be16 nr>
+ *   footer:  <be32 index offset (high)> <be32 index offset (low)> "RTBL"
+ *            <SHA-1 of everything before it>
+ *
+ * See Documentation/technical/ref-table.txt for the details.
+ */
+#define REF_TABLE_SIGNATURE "RTBL"
+#define REF_TABLE_VERSION 1
+#define REF_TABLE_HEADER_SIZE 8
+#define REF_TABLE_FOOTER_SIZE (4 + 4 + 4 + 20)
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_INDEX 'i'
+#define BLOCK_HEADER_SIZE 4
+#define BLOCK_MAX_LEN 0xffffff
+#define BLOCK_SIZE 4096
+#define RESTART_INTERVAL 16
+
+struct ref_table {
+	char *name;
+	unsigned char *map;
+	size_t size;
+	/* The ref blocks occupy [REF_TABLE_HEADER_SIZE, ref_end). */
+	size_t ref_end;
+	/* The offset of the index block, or 0 if there is none. */
+	size_t index_offset;
+};
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 16;
+	p[1] = v >> 8;
+	p[2] = v;
+}
+
+/*
+ * decode_varint() trusts its input to be terminated; make sure that
+ * it is before letting it loose on a mapped table.
+ */
+static int get_varint(const unsigned char **pos, const unsigned char *end,
+		      uintmax_t *value)
+{
+	const unsigned char *p = *pos;
+
+	while (p < end && (*p & 128))
+		p++;
+	if (p >= end || p - *pos >= 10)
+		return -1;
+	*value = decode_varint(pos);
+	return 0;
+}
+
+static struct ref_table *open_ref_table(const char *dir, const char *name)
+{
+	struct ref_table *table;
+	const unsigned char *footer;
+	struct stat st;
+	char *path;
+	int fd;
+
+	path = xstrfmt("%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		int save_errno = errno;
+		if (errno != ENOENT)
+			error("unable to open ref table %s: %s",
+			      path, strerror(errno));
+		free(path);
+		errno = save_errno;
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		error("unable to stat ref table %s: %s", path, strerror(errno));
+		close(fd);
+		free(path);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (xsize_t(st.st_size) < REF_TABLE_HEADER_SIZE + REF_TABLE_FOOTER_SIZE) {
+		error("ref table %s is too small", path);
+		close(fd);
+		free(path);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	table = xcalloc(1, sizeof(*table));
+	table->name = xstrdup(name);
+	table->size = xsize_t(st.st_size);
+	table->map = xmmap(NULL, table->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer = table->map + table->size - REF_TABLE_FOOTER_SIZE;
+	if (memcmp(table->map, REF_TABLE_SIGNATURE, 4) ||
+	    memcmp(footer + 8, REF_TABLE_SIGNATURE, 4)) {
+		error("ref table %s has a bad signature", path);
+		goto corrupt;
+	}
+	if (get_be32(table->map + 4) != REF_TABLE_VERSION) {
+		error("ref table %s has unknown version %"PRIu32,
+		      path, get_be32(table->map + 4));
+		goto corrupt;
+	}
+	table->index_offset = ((uint64_t)get_be32(footer) << 32) |
+			      get_be32(footer + 4);
+	table->ref_end = table->size - REF_TABLE_FOOTER_SIZE;
+	if (table->index_offset) {
+		if (table->index_offset < REF_TABLE_HEADER_SIZE ||
+		    table->index_offset >= table->ref_end) {
+			error("ref table %s has a bad index offset", path);
+			goto corrupt;
+		}
+		table->ref_end = table->index_offset;
+	}
+	free(path);
+	return table;
+
+corrupt:
+	munmap(table->map, table->size);
+	free(table->name);
+	free(table);
+	free(path);
+	errno = EINVAL;
+	return NULL;
+}
+
+static void close_ref_table(struct ref_table *table)
+{
+	munmap(table->map, table->size);
+	free(table->name);
+	free(table);
+}
+
+struct table_block {
+	size_t offset, len;
+	const unsigned char *records, *restarts;
+	unsigned nr_restarts;
+};
+
+/*
+ * Read the header and trailer of the block of the given type at
+ * offset, which must end before limit.
+ */
+static int read_block(struct ref_table *table, size_t offset, size_t limit,
+		      int type, struct table_block *block)
+{
+	const unsigned char *p = table->map + offset;
+
+	if (offset + BLOCK_HEADER_SIZE + 2 > limit || *p != type)
+		return error("ref table %s: no block at offset %"PRIuMAX,
+			     table->name, (uintmax_t)offset);
+	block->offset = offset;
+	block->len = get_be24(p + 1);
+	if (block->len < BLOCK_HEADER_SIZE + 2 || block->len > limit - offset)
+		return error("ref table %s: bad block length at offset %"PRIuMAX,
+			     table->name, (uintmax_t)offset);
+	block->nr_restarts = get_be16(p + block->len - 2);
+	if (!block->nr_restarts ||
+	    3 * block->nr_restarts + 2 > block->len - BLOCK_HEADER_SIZE)
+		return error("ref table %s: bad restart count at offset %"PRIuMAX,
+			     table->name, (uintmax_t)offset);
+	block->records = p + BLOCK_HEADER_SIZE;
+	block->restarts = p + block->len - 2 - 3 * block->nr_restarts;
+	return 0;
+}
+
+/*
+ * Decode the key and value type of the record at *pos, whose
+ * predecessor in the block had the key that key still holds.
+ */
+static int decode_key(const unsigned char **pos, const unsigned char *end,
+		      struct strbuf *key, unsigned *type)
+{
+	uintmax_t prefix_len, suffix;
+
+	if (get_varint(pos, end, &prefix_len) ||
+	    get_varint(pos, end, &suffix) ||
+	    prefix_len > key->len ||
+	    (suffix >> 2) > end - *pos)
+		return -1;
+	strbuf_setlen(key, prefix_len);
+	strbuf_add(key, *pos, suffix >> 2);
+	*pos += suffix >> 2;
+	*type = suffix & 3;
+	return 0;
+}
+
+/*
+ * Return the position from which a linear scan for the first record
+ * of block whose key is not less than target has to start: the last
+ * restart point whose key is not greater than target (or the first
+ * one).  Restart records have no shared prefix, so the scan can start
+ * there with an empty key.
+ */
+static const unsigned char *find_restart(struct ref_table *table,
+					 struct table_block *block,
+					 const char *target)
+{
+	struct strbuf key = STRBUF_INIT;
+	const unsigned char *base = table->map + block->offset;
+	unsigned lo = 0, hi = block->nr_restarts;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		const unsigned char *pos = base + get_be24(block->restarts + 3 * mid);
+		unsigned type;
+
+		strbuf_reset(&key);
+		if (pos < block->records || pos >= block->restarts ||
+		    decode_key(&pos, block->restarts, &key, &type)) {
+			/* let the linear scan report the corruption */
+			hi = mid;
+			continue;
+		}
+		if (strcmp(key.buf, target) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	strbuf_release(&key);
+	if (!lo)
+		return block->records;
+	return base + get_be24(block->restarts + 3 * (lo - 1));
+}
+
+/* An iterator over the records of a single table. */
+struct table_iter {
+	struct ref_table *table;
+	struct table_block block;
+	const unsigned char *pos;
+	int valid;
+	struct ref_table_record rec;
+};
+
+static int table_iter_advance(struct table_iter *it)
+{
+	const unsigned char *end = it->block.restarts;
+	unsigned type;
+
+	while (it->pos >= end) {
+		size_t next = it->block.offset + it->block.len;
+
+		if (next >= it->table->ref_end) {
+			it->valid = 0;
+			return 0;
+		}
+		if (read_block(it->table, next, it->table->ref_end,
+			       BLOCK_TYPE_REF, &it->block))
+			return -1;
+		it->pos = it->block.records;
+		end = it->block.restarts;
+		strbuf_reset(&it->rec.name);
+	}
+
+	if (decode_key(&it->pos, end, &it->rec.name, &type))
+		goto corrupt;
+	it->rec.type = type;
+	switch (type) {
+	case REF_TABLE_DELETION:
+		break;
+	case REF_TABLE_PEELED:
+		if (end - it->pos < 40)
+			goto corrupt;
+		hashcpy(it->rec.sha1, it->pos);
+		hashcpy(it->rec.peeled, it->pos + 20);
+		it->pos += 40;
+		break;
+	case REF_TABLE_VALUE:
+		if (end - it->pos < 20)
+			goto corrupt;
+		hashcpy(it->rec.sha1, it->pos);
+		hashclr(it->rec.peeled);
+		it->pos += 20;
+		break;
+	default:
+		goto corrupt;
+	}
+	it->valid = 1;
+	return 0;
+
+corrupt:
+	return error("ref table %s: corrupt record in block at offset %"PRIuMAX,
+		     it->table->name, (uintmax_t)it->block.offset);
+}
+
+/*
+ * Find the offset of the ref block that may contain target, using
+ * the index.  Return 0 if target sorts after every key of the table.
+ */
+static int find_ref_block(struct ref_table *table, const char *target,
+			  size_t *offset)
+{
+	struct table_block index;
+	struct strbuf key = STRBUF_INIT;
+	const unsigned char *pos;
+	int ret = 0;
+
+	*offset = 0;
+	if (read_block(table, table->index_offset,
+		       table->size - REF_TABLE_FOOTER_SIZE,
+		       BLOCK_TYPE_INDEX, &index))
+		return -1;
+	pos = find_restart(table, &index, target);
+	while (pos < index.restarts) {
+		uintmax_t block_offset;
+		unsigned type;
+
+		if (decode_key(&pos, index.restarts, &key, &type) ||
+		    get_varint(&pos, index.restarts, &block_offset)) {
+			ret = error("ref table %s: corrupt index", table->name);
+			break;
+		}
+		if (strcmp(key.buf, target) >= 0) {
+			*offset = block_offset;
+			break;
+		}
+	}
+	strbuf_release(&key);
+	return ret;
+}
+
+/*
+ * Position it at the first record of table whose name is not less
+ * than target.
+ */
+static int table_iter_seek(struct table_iter *it, struct ref_table *table,
+			   const char *target)
+{
+	size_t offset = REF_TABLE_HEADER_SIZE;
+
+	it->table = table;
+	it->valid = 0;
+	strbuf_reset(&it->rec.name);
+
+	if (table->ref_end <= REF_TABLE_HEADER_SIZE)
+		return 0; /* empty table */
+	if (table->index_offset) {
+		if (find_ref_block(table, target, &offset))
+			return -1;
+		if (!offset)
+			return 0;
+	}
+	if (read_block(table, offset, table->ref_end, BLOCK_TYPE_REF, &it->block))
+		return -1;
+	it->pos = find_restart(table, &it->block, target);
+
+	do {
+		if (table_iter_advance(it))
+			return -1;
+	} while (it->valid && strcmp(it->rec.name.buf, target) < 0);
+	return 0;
+}
+
+static void copy_record(struct ref_table_record *dst,
+			const struct ref_table_record *src)
+{
+	strbuf_reset(&dst->name);
+	strbuf_addbuf(&dst->name, &src->name);
+	dst->type = src->type;
+	hashcpy(dst->sha1, src->sha1);
+	hashcpy(dst->peeled, src->peeled);
+}
+
+struct ref_table_stack *ref_table_stack_read(const char *dir)
+{
+	struct strbuf list = STRBUF_INIT;
+	char *list_path = xstrfmt("%s/tables.list", dir);
+	struct ref_table_stack *stack = NULL;
+	int tries;
+
+	/*
+	 * A concurrent compaction may remove tables between our reading
+	 * the list and opening them; read the list again in that case.
+	 */
+	for (tries = 0; tries < 5; tries++) {
+		struct string_list names = STRING_LIST_INIT_NODUP;
+		int i, missing = 0;
+
+		strbuf_reset(&list);
+		if (strbuf_read_file(&list, list_path, 0) < 0) {
+			if (errno != ENOENT)
+				error("unable to read %s: %s",
+				      list_path, strerror(errno));
+			break;
+		}
+		stack = xcalloc(1, sizeof(*stack));
+		stack->dir = xstrdup(dir);
+		strbuf_rtrim(&list);
+		if (list.len)
+			string_list_split_in_place(&names, list.buf, '\n', -1);
+		for (i = 0; i < names.nr; i++) {
+			if (ref_table_stack_push(stack, names.items[i].string)) {
+				missing = (errno == ENOENT);
+				ref_table_stack_free(stack);
+				stack = NULL;
+				break;
+			}
+		}
+		string_list_clear(&names, 0);
+		if (stack || !missing)
+			break;
+	}
+	if (!stack && tries == 5)
+		error("unable to read a consistent stack of ref tables from %s",
+		      dir);
+	strbuf_release(&list);
+	free(list_path);
+	return stack;
+}
+
+int ref_table_stack_push(struct ref_table_stack *stack, const char *name)
+{
+	struct ref_table *table = open_ref_table(stack->dir, name);
+
+	if (!table)
+		return -1;
+	ALLOC_GROW(stack->tables, stack->nr + 1, stack->alloc);
+	stack->tables[stack->nr++] = table;
+	return 0;
+}
+
+void ref_table_stack_free(struct ref_table_stack *stack)
+{
+	int i;
+
+	if (!stack)
+		return;
+	for (i = 0; i < stack->nr; i++)
+		close_ref_table(stack->tables[i]);
+	free(stack->tables);
+	free(stack->dir);
+	free(stack);
+}
+
+const char *ref_table_name(struct ref_table_stack *stack, int i)
+{
+	return stack->tables[i]->name;
+}
+
+size_t ref_table_size(struct ref_table_stack *stack, int i)
+{
+	return stack->tables[i]->size;
+}
+
+int ref_table_stack_lookup(struct ref_table_stack *stack, const char *refname,
+			   struct ref_table_record *rec)
+{
+	struct table_iter it = { NULL };
+	int i, ret = 1;
+
+	strbuf_init(&it.rec.name, 0);
+	for (i = stack->nr - 1; i >= 0; i--) {
+		if (table_iter_seek(&it, stack->tables[i], refname)) {
+			ret = -1;
+			break;
+		}
+		if (!it.valid || strcmp(it.rec.name.buf, refname))
+			continue;
+		if (it.rec.type != REF_TABLE_DELETION) {
+			copy_record(rec, &it.rec);
+			ret = 0;
+		}
+		break;
+	}
+	strbuf_release(&it.rec.name);
+	return ret;
+}
+
+struct ref_table_merged_iter {
+	struct table_iter *iters;
+	int nr;
+	char *prefix;
+	int keep_deletions;
+};
+
+static struct ref_table_merged_iter *merged_iter(struct ref_table_stack *stack,
+						 int first, const char *prefix,
+						 int keep_deletions)
+{
+	struct ref_table_merged_iter *iter = xcalloc(1, sizeof(*iter));
+	int i;
+
+	iter->nr = stack->nr - first;
+	iter->iters = xcalloc(iter->nr, sizeof(*iter->iters));
+	iter->prefix = xstrdup(prefix);
+	iter->keep_deletions = keep_deletions;
+	for (i = 0; i < iter->nr; i++) {
+		strbuf_init(&iter->iters[i].rec.name, 0);
+		if (table_iter_seek(&iter->iters[i], stack->tables[first + i],
+				    prefix))
+			iter->iters[i].valid = -1;
+	}
+	return iter;
+}
+
+struct ref_table_merged_iter *ref_table_stack_iter(struct ref_table_stack *stack,
+						   const char *prefix)
+{
+	return merged_iter(stack, 0, prefix, 0);
+}
+
+int ref_table_merged_iter_next(struct ref_table_merged_iter *iter,
+			       struct ref_table_record *rec)
+{
+	while (1) {
+		struct table_iter *best = NULL;
+		int i;
+
+		/* The newest table wins among equal names. */
+		for (i = 0; i < iter->nr; i++) {
+			struct table_iter *it = &iter->iters[i];
+
+			if (it->valid < 0)
+				return -1;
+			if (!it->valid)
+				continue;
+			if (!best || strcmp(it->rec.name.buf, best->rec.name.buf) <= 0)
+				best = it;
+		}
+		if (!best || !starts_with(best->rec.name.buf, iter->prefix))
+			return 1;
+
+		copy_record(rec, &best->rec);
+		for (i = 0; i < iter->nr; i++) {
+			struct table_iter *it = &iter->iters[i];
+
+			if (it->valid && !strcmp(it->rec.name.buf, rec->name.buf) &&
+			    table_iter_advance(it))
+				return -1;
+		}
+		if (rec->type != REF_TABLE_DELETION || iter->keep_deletions)
+			return 0;
+	}
+}
+
+int ref_table_merged_iter_seek(struct ref_table_merged_iter *iter,
+			       const char *target)
+{
+	int i;
+
+	for (i = 0; i < iter->nr; i++) {
+		struct table_iter *it = &iter->iters[i];
+
+		if (it->valid < 0)
+			return -1;
+		if (table_iter_seek(it, it->table, target)) {
+			it->valid = -1;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void ref_table_merged_iter_free(struct ref_table_merged_iter *iter)
+{
+	int i;
+
+	if (!iter)
+		return;
+	for (i = 0; i < iter->nr; i++)
+		strbuf_release(&iter->iters[i].rec.name);
+	free(iter->iters);
+	free(iter->prefix);
+	free(iter);
+}
+
+/* Accumulates the records of one block while a table is written. */
+struct block_builder {
+	struct strbuf buf;
+	struct strbuf last_key;
+	uint32_t *restarts;
+	int nr_restarts, alloc_restarts;
+	int nr_records;
+};
+
+static void block_reset(struct block_builder *bb, int type)
+{
+	strbuf_reset(&bb->buf);
+	strbuf_addch(&bb->buf, type);
+	strbuf_addf(&bb->buf, "%c%c%c", 0, 0, 0);
+	strbuf_reset(&bb->last_key);
+	bb->nr_restarts = bb->nr_records = 0;
+}
+
+static void block_release(struct block_builder *bb)
+{
+	strbuf_release(&bb->buf);
+	strbuf_release(&bb->last_key);
+	free(bb->restarts);
+}
+
+/* Encode a record following the block's last key into out. */
+static void encode_record(struct block_builder *bb, struct strbuf *out,
+			  const char *key, unsigned type,
+			  const void *value, size_t value_len)
+{
+	unsigned char varint[16];
+	size_t prefix_len = 0, key_len = strlen(key);
+
+	if (bb->nr_records % RESTART_INTERVAL)
+		while (prefix_len < bb->last_key.len && prefix_len < key_len &&
+		       bb->last_key.buf[prefix_len] == key[prefix_len])
+			prefix_len++;
+	strbuf_reset(out);
+	strbuf_add(out, varint, encode_varint(prefix_len, varint));
+	strbuf_add(out, varint,
+		   encode_varint(((uintmax_t)(key_len - prefix_len) << 2) | type,
+				 varint));
+	strbuf_add(out, key + prefix_len, key_len - prefix_len);
+	strbuf_add(out, value, value_len);
+}
+
+/* The size of the block if record were added to it. */
+static size_t block_size_with(struct block_builder *bb, struct strbuf *record)
+{
+	int restarts = bb->nr_restarts + !(bb->nr_records % RESTART_INTERVAL);
+	return bb->buf.len + record->len + 3 * restarts + 2;
+}
+
+static void block_add(struct block_builder *bb, struct strbuf *record,
+		      const char *key)
+{
+	if (!(bb->nr_records % RESTART_INTERVAL)) {
+		ALLOC_GROW(bb->restarts, bb->nr_restarts + 1, bb->alloc_restarts);
+		bb->restarts[bb->nr_restarts++] = bb->buf.len;
+	}
+	strbuf_addbuf(&bb->buf, record);
+	strbuf_reset(&bb->last_key);
+	strbuf_addstr(&bb->last_key, key);
+	bb->nr_records++;
+}
+
+static void block_finish(struct block_builder *bb)
+{
+	unsigned char be[3];
+	int i;
+
+	if (bb->nr_restarts > 0xffff)
+		die("too many restart points in ref table block");
+	for (i = 0; i < bb->nr_restarts; i++) {
+		put_be24(be, bb->restarts[i]);
+		strbuf_add(&bb->buf, be, 3);
+	}
+	strbuf_addch(&bb->buf, bb->nr_restarts >> 8);
+	strbuf_addch(&bb->buf, bb->nr_restarts & 0xff);
+	if (bb->buf.len > BLOCK_MAX_LEN)
+		die("ref table block too large");
+	put_be24((unsigned char *)bb->buf.buf + 1, bb->buf.len);
+}
+
+struct ref_table_writer {
+	struct sha1file *f;
+	char *dir;
+	char *tmp_path;
+	uint32_t generation;
+	size_t offset;
+	struct block_builder block;
+	struct strbuf record;
+	/* The last key and the offset of each block written so far: */
+	struct string_list index;
+};
+
+struct ref_table_writer *ref_table_writer_begin(const char *dir,
+						uint32_t generation)
+{
+	struct ref_table_writer *writer = xcalloc(1, sizeof(*writer));
+	int fd;
+
+	writer->dir = xstrdup(dir);
+	writer->tmp_path = xstrfmt("%s/tmp_ref_table_XXXXXX", dir);
+	fd = git_mkstemp_mode(writer->tmp_path, 0444);
+	if (fd < 0)
+		die_errno("unable to create '%s'", writer->tmp_path);
+	writer->f = sha1fd(fd, writer->tmp_path);
+	writer->generation = generation;
+	sha1write(writer->f, REF_TABLE_SIGNATURE, 4);
+	sha1write_be32(writer->f, REF_TABLE_VERSION);
+	writer->offset = REF_TABLE_HEADER_SIZE;
+	strbuf_init(&writer->block.buf, BLOCK_SIZE);
+	strbuf_init(&writer->block.last_key, 0);
+	strbuf_init(&writer->record, 0);
+	writer->index.strdup_strings = 1;
+	block_reset(&writer->block, BLOCK_TYPE_REF);
+	return writer;
+}
+
+static void flush_block(struct ref_table_writer *writer)
+{
+	struct block_builder *bb = &writer->block;
+
+	if (!bb->nr_records)
+		return;
+	block_finish(bb);
+	string_list_append(&writer->index, bb->last_key.buf)->util =
+		(void *)(uintptr_t)writer->offset;
+	sha1write(writer->f, bb->buf.buf, bb->buf.len);
+	writer->offset += bb->buf.len;
+	block_reset(bb, BLOCK_TYPE_REF);
+}
+
+void ref_table_add(struct ref_table_writer *writer, const char *refname,
+		   enum ref_table_value type, const unsigned char *sha1,
+		   const unsigned char *peeled)
+{
+	struct block_builder *bb = &writer->block;
+	unsigned char value[40];
+	size_t value_len = 0;
+
+	if (bb->nr_records && strcmp(bb->last_key.buf, refname) >= 0)
+		die("BUG: ref table records out of order: %s", refname);
+	if (type != REF_TABLE_DELETION) {
+		hashcpy(value, sha1);
+		value_len = 20;
+	}
+	if (type == REF_TABLE_PEELED) {
+		hashcpy(value + 20, peeled);
+		value_len = 40;
+	}
+
+	encode_record(bb, &writer->record, refname, type, value, value_len);
+	if (bb->nr_records &&
+	    block_size_with(bb, &writer->record) > BLOCK_SIZE) {
+		flush_block(writer);
+		encode_record(bb, &writer->record, refname, type,
+			      value, value_len);
+	}
+	block_add(bb, &writer->record, refname);
+}
+
+int ref_table_writer_commit(struct ref_table_writer *writer,
+			    struct strbuf *name)
+{
+	struct block_builder *bb = &writer->block;
+	unsigned char sha1[20];
+	size_t index_offset = 0;
+	char *path;
+	int ret = 0;
+
+	flush_block(writer);
+	if (writer->index.nr > 1) {
+		int i;
+
+		index_offset = writer->offset;
+		block_reset(bb, BLOCK_TYPE_INDEX);
+		for (i = 0; i < writer->index.nr; i++) {
+			struct string_list_item *item = &writer->index.items[i];
+			unsigned char varint[16];
+			int len = encode_varint((uintptr_t)item->util, varint);
+
+			encode_record(bb, &writer->record, item->string, 0,
+				      varint, len);
+			block_add(bb, &writer->record, item->string);
+		}
+		block_finish(bb);
+		sha1write(writer->f, bb->buf.buf, bb->buf.len);
+	}
+	sha1write_be32(writer->f, (uint64_t)index_offset >> 32);
+	sha1write_be32(writer->f, index_offset & 0xffffffff);
+	sha1write(writer->f, REF_TABLE_SIGNATURE, 4);
+	sha1close(writer->f, sha1,
+		  CSUM_CLOSE | (fsync_ref_files ? CSUM_FSYNC : 0));
+
+	strbuf_addf(name, "%08"PRIx32"-%s.ref", writer->generation,
+		    sha1_to_hex(sha1));
+	path = xstrfmt("%s/%08"PRIx32"-%s.ref", writer->dir,
+		       writer->generation, sha1_to_hex(sha1));
+	if (adjust_shared_perm(writer->tmp_path))
+		ret = error("unable to make %s readable", writer->tmp_path);
+	else if (rename(writer->tmp_path, path))
+		ret = error("unable to rename %s to %s: %s",
+			    writer->tmp_path, path, strerror(errno));
+	if (ret)
+		unlink_or_warn(writer->tmp_path);
+	free(path);
+
+	block_release(bb);
+	strbuf_release(&writer->record);
+	string_list_clear(&writer->index, 0);
+	free(writer->tmp_path);
+	free(writer->dir);
+	free(writer);
+	return ret;
+}
+
+void ref_table_writer_abort(struct ref_table_writer *writer)
+{
+	close(sha1close(writer->f, NULL, 0));
+	unlink_or_warn(writer->tmp_path);
+	block_release(&writer->block);
+	strbuf_release(&writer->record);
+	string_list_clear(&writer->index, 0);
+	free(writer->tmp_path);
+	free(writer->dir);
+	free(writer);
+}
+
+uint32_t ref_table_next_generation(struct ref_table_stack *stack)
+{
+	if (!stack || !stack->nr)
+		return 1;
+	return strtoul(stack->tables[stack->nr - 1]->name, NULL, 16) + 1;
+}
+
+int ref_table_compaction_start(struct ref_table_stack *stack)
+{
+	int first = stack->nr - 1;
+	size_t merged;
+
+	if (first < 0)
+		return 0;
+	merged = stack->tables[first]->size;
+	while (first > 0 && stack->tables[first - 1]->size < 2 * merged) {
+		first--;
+		merged += stack->tables[first]->size;
+	}
+	return first;
+}
+
+int ref_table_compact(struct ref_table_stack *stack, int first,
+		      struct strbuf *name)
+{
+	struct ref_table_merged_iter *iter;
+	struct ref_table_record rec = REF_TABLE_RECORD_INIT;
+	struct ref_table_writer *writer;
+	uint32_t generation = ref_table_next_generation(stack) - 1;
+	int ret;
+
+	writer = ref_table_writer_begin(stack->dir, generation);
+	iter = merged_iter(stack, first, "", first > 0);
+	while (!(ret = ref_table_merged_iter_next(iter, &rec)))
+		ref_table_add(writer, rec.name.buf, rec.type,
+			      rec.sha1, rec.peeled);
+	ref_table_merged_iter_free(iter);
+	strbuf_release(&rec.name);
+
+	if (ret < 0) {
+		ref_table_writer_abort(writer);
+		return -1;
+	}
+	return ref_table_writer_commit(writer, name);
+}
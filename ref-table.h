@@ -0,0 +1,121 @@
+#ifndef REF_TABLE_H
+#define REF_TABLE_H
+
+/*
+ * Ref tables store packed references in sorted, prefix-compressed
+ * blocks with restart points and a block index, so that a single
+ * reference can be found with O(log n) I/O.  A repository keeps a
+ * stack of tables in $GIT_DIR/reftable/, listed oldest first in
+ * "tables.list"; newer tables override older ones, and deleting a
+ * reference appends a small table holding a deletion record for it.
+ * See Documentation/technical/ref-table.txt for the file format.
+ */
+
+#define REF_TABLE_DIR "reftable"
+#define REF_TABLE_LIST "reftable/tables.list"
+
+enum ref_table_value {
+	REF_TABLE_DELETION = 0,
+	REF_TABLE_VALUE = 1,
+	REF_TABLE_PEELED = 2
+};
+
+struct ref_table_record {
+	struct strbuf name;
+	enum ref_table_value type;
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+#define REF_TABLE_RECORD_INIT { STRBUF_INIT }
+
+struct ref_table;
+
+struct ref_table_stack {
+	char *dir;
+	struct ref_table **tables;
+	int nr, alloc;
+};
+
+/*
+ * Read the stack of tables listed in dir/tables.list.  Return NULL
+ * if there is no such file or one of its tables cannot be opened.
+ */
+extern struct ref_table_stack *ref_table_stack_read(const char *dir);
+
+/* Open the table called name in the stack's directory and push it. */
+extern int ref_table_stack_push(struct ref_table_stack *stack,
+				const char *name);
+extern void ref_table_stack_free(struct ref_table_stack *stack);
+
+/*
+ * Look up refname in the stack.  Return 0 and fill rec if it exists,
+ * 1 if it does not (or has been deleted), and -1 on error.
+ */
+extern int ref_table_stack_lookup(struct ref_table_stack *stack,
+				  const char *refname,
+				  struct ref_table_record *rec);
+
+/*
+ * Iterate over the live references of a stack whose names start
+ * with prefix, in strcmp() order of their names.
+ */
+struct ref_table_merged_iter;
+
+extern struct ref_table_merged_iter *ref_table_stack_iter(struct ref_table_stack *stack,
+							  const char *prefix);
+/* Return 0 and fill rec, 1 at the end of the iteration, -1 on error. */
+extern int ref_table_merged_iter_next(struct ref_table_merged_iter *iter,
+				      struct ref_table_record *rec);
+/*
+ * Skip ahead to the first reference whose name is not less than
+ * target.  Return 0 on success and -1 on error.
+ */
+extern int ref_table_merged_iter_seek(struct ref_table_merged_iter *iter,
+				      const char *target);
+extern void ref_table_merged_iter_free(struct ref_table_merged_iter *iter);
+
+/*
+ * Write a new table into the directory dir.  Records must be added
+ * in strcmp() order of their names.  ref_table_writer_commit() moves
+ * the table into place and appends its file name to name.
+ */
+struct ref_table_writer;
+
+extern struct ref_table_writer *ref_table_writer_begin(const char *dir,
+						       uint32_t generation);
+extern void ref_table_add(struct ref_table_writer *writer,
+			  const char *refname, enum ref_table_value type,
+			  const unsigned char *sha1,
+			  const unsigned char *peeled);
+extern int ref_table_writer_commit(struct ref_table_writer *writer,
+				   struct strbuf *name);
+extern void ref_table_writer_abort(struct ref_table_writer *writer);
+
+/* The file name and size of the i-th table of a stack. */
+extern const char *ref_table_name(struct ref_table_stack *stack, int i);
+extern size_t ref_table_size(struct ref_table_stack *stack, int i);
+
+/*
+ * Return the generation to give to a table that is appended to
+ * the stack.
+ */
+extern uint32_t ref_table_next_generation(struct ref_table_stack *stack);
+
+/*
+ * Return the index of the oldest table that should be merged with
+ * all newer ones to keep the table sizes of the stack growing
+ * geometrically from top to bottom, or stack->nr - 1 if the stack
+ * needs no compaction.
+ */
+extern int ref_table_compaction_start(struct ref_table_stack *stack);
+
+/*
+ * Merge the tables first..nr-1 of stack into a single new table
+ * whose name is appended to name.  Deletion records are dropped if
+ * the bottom of the stack is included.
+ */
+extern int ref_table_compact(struct ref_table_stack *stack, int first,
+			     struct strbuf *name);
+
+#endif
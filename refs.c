@@ -1,10 +1,12 @@
 #include "cache.h"
 #include "lockfile.h"
 #include "refs.h"
+#include "ref-table.h"
 #include "object.h"
 #include "tag.h"
 #include "dir.h"
 #include "string-list.h"
+#include "csum-file.h"
 
 struct ref_lock {
 	char *ref_name;
@@ -689,6 +691,70 @@ static struct ref_entry *current_ref;
 
 typedef int each_ref_entry_fn(struct ref_entry *entry, void *cb_data);
 
+/*
+ * The part of the reference namespace that an iteration covers: the
+ * references whose names start with prefix, except for those in the
+ * hierarchies listed in exclude (which may be NULL).
+ */
+struct ref_scope {
+	const char *prefix;
+	const struct string_list *exclude;
+};
+
+/*
+ * If refname (a reference, or a directory ending in '/') is one of
+ * the hierarchies listed in exclude or lies below it, return that
+ * entry of exclude; otherwise return NULL.
+ */
+static const char *ref_excluded(const struct string_list *exclude,
+				const char *refname)
+{
+	struct string_list_item *item;
+
+	if (!exclude)
+		return NULL;
+	for_each_string_list_item(item, exclude) {
+		const char *rest;
+
+		if (skip_prefix(refname, item->string, &rest) &&
+		    (!*rest || *rest == '/'))
+			return item->string;
+	}
+	return NULL;
+}
+
+/*
+ * Set key to a name that sorts after every reference below the
+ * hierarchy, but before anything else that sorts after it.
+ */
+static void skip_hierarchy_key(struct strbuf *key, const char *hierarchy)
+{
+	strbuf_reset(key);
+	strbuf_addstr(key, hierarchy);
+	strbuf_addch(key, '/' + 1);
+}
+
+/*
+ * Return the index of the first entry of dir whose name is not less
+ * than prefix.  If dir is the directory containing prefix, all of
+ * its entries that start with prefix follow from there on.  dir must
+ * be sorted.
+ */
+static int seek_ref_dir(struct ref_dir *dir, const char *prefix)
+{
+	int lo = 0, hi = dir->nr;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (strcmp(dir->entries[mid]->name, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 struct ref_entry_cb {
 	const char *base;
 	int trim;
@@ -729,8 +795,14 @@ static int do_one_ref(struct ref_entry *entry, void *cb_data)
  * that index range, sorting them before iterating.  This function
  * does not sort dir itself; it should be sorted beforehand.  fn is
  * called for all references, including broken ones.
+ *
+ * If scope is not NULL, the iteration stops at the first entry that
+ * does not start with scope->prefix (so offset must not be smaller
+ * than seek_ref_dir() of it), and excluded hierarchies are skipped
+ * without being read.
  */
 static int do_for_each_entry_in_dir(struct ref_dir *dir, int offset,
+				    const struct ref_scope *scope,
 				    each_ref_entry_fn fn, void *cb_data)
 {
 	int i;
@@ -738,10 +810,17 @@ static int do_for_each_entry_in_dir(struct ref_dir *dir, int offset,
 	for (i = offset; i < dir->nr; i++) {
 		struct ref_entry *entry = dir->entries[i];
 		int retval;
+		if (scope) {
+			if (!starts_with(entry->name, scope->prefix))
+				break;
+			if (ref_excluded(scope->exclude, entry->name))
+				continue;
+		}
 		if (entry->flag & REF_DIR) {
 			struct ref_dir *subdir = get_ref_dir(entry);
 			sort_ref_dir(subdir);
-			retval = do_for_each_entry_in_dir(subdir, 0, fn, cb_data);
+			retval = do_for_each_entry_in_dir(subdir, 0, scope,
+							  fn, cb_data);
 		} else {
 			retval = fn(entry, cb_data);
 		}
@@ -752,30 +831,50 @@ static int do_for_each_entry_in_dir(struct ref_dir *dir, int offset,
 }
 
 /*
- * Call fn for each reference in the union of dir1 and dir2, in order
- * by refname.  Recurse into subdirectories.  If a value entry appears
- * in both dir1 and dir2, then only process the version that is in
- * dir2.  The input dirs must already be sorted, but subdirs will be
- * sorted as needed.  fn is called for all references, including
- * broken ones.
+ * Return true iff entry i of dir is past the end of the iteration
+ * over scope.
+ */
+static int ref_dir_done(struct ref_dir *dir, int i,
+			const struct ref_scope *scope)
+{
+	return i == dir->nr || !starts_with(dir->entries[i]->name, scope->prefix);
+}
+
+/*
+ * Call fn for each reference of scope in the union of dir1 and dir2,
+ * in order by refname.  Recurse into subdirectories.  If a value
+ * entry appears in both dir1 and dir2, then only process the version
+ * that is in dir2.  The input dirs must already be sorted, but
+ * subdirs will be sorted as needed.  fn is called for all references,
+ * including broken ones.
  */
 static int do_for_each_entry_in_dirs(struct ref_dir *dir1,
 				     struct ref_dir *dir2,
+				     const struct ref_scope *scope,
 				     each_ref_entry_fn fn, void *cb_data)
 {
 	int retval;
-	int i1 = 0, i2 = 0;
+	int i1 = seek_ref_dir(dir1, scope->prefix);
+	int i2 = seek_ref_dir(dir2, scope->prefix);
 
 	assert(dir1->sorted == dir1->nr);
 	assert(dir2->sorted == dir2->nr);
 	while (1) {
 		struct ref_entry *e1, *e2;
 		int cmp;
-		if (i1 == dir1->nr) {
-			return do_for_each_entry_in_dir(dir2, i2, fn, cb_data);
+		while (i1 < dir1->nr &&
+		       ref_excluded(scope->exclude, dir1->entries[i1]->name))
+			i1++;
+		while (i2 < dir2->nr &&
+		       ref_excluded(scope->exclude, dir2->entries[i2]->name))
+			i2++;
+		if (ref_dir_done(dir1, i1, scope)) {
+			return do_for_each_entry_in_dir(dir2, i2, scope,
+							fn, cb_data);
 		}
-		if (i2 == dir2->nr) {
-			return do_for_each_entry_in_dir(dir1, i1, fn, cb_data);
+		if (ref_dir_done(dir2, i2, scope)) {
+			return do_for_each_entry_in_dir(dir1, i1, scope,
+							fn, cb_data);
 		}
 		e1 = dir1->entries[i1];
 		e2 = dir2->entries[i2];
@@ -788,7 +887,7 @@ static int do_for_each_entry_in_dirs(struct ref_dir *dir1,
 				sort_ref_dir(subdir1);
 				sort_ref_dir(subdir2);
 				retval = do_for_each_entry_in_dirs(
-						subdir1, subdir2, fn, cb_data);
+						subdir1, subdir2, scope, fn, cb_data);
 				i1++;
 				i2++;
 			} else if (!(e1->flag & REF_DIR) && !(e2->flag & REF_DIR)) {
@@ -813,7 +912,7 @@ static int do_for_each_entry_in_dirs(struct ref_dir *dir1,
 				struct ref_dir *subdir = get_ref_dir(e);
 				sort_ref_dir(subdir);
 				retval = do_for_each_entry_in_dir(
-						subdir, 0, fn, cb_data);
+						subdir, 0, scope, fn, cb_data);
 			} else {
 				retval = fn(e, cb_data);
 			}
@@ -824,18 +923,22 @@ static int do_for_each_entry_in_dirs(struct ref_dir *dir1,
 }
 
 /*
- * Load all of the refs from the dir into our in-memory cache. The hard work
- * of loading loose refs is done by get_ref_dir(), so we just need to recurse
- * through all of the sub-directories. We do not even need to care about
- * sorting, as traversal order does not matter to us.
+ * Load all of the refs of scope from the dir into our in-memory
+ * cache. The hard work of loading loose refs is done by get_ref_dir(),
+ * so we just need to recurse through the sub-directories in scope. We
+ * do not even need to care about sorting, as traversal order does not
+ * matter to us.
  */
-static void prime_ref_dir(struct ref_dir *dir)
+static void prime_ref_dir(struct ref_dir *dir, const struct ref_scope *scope)
 {
 	int i;
 	for (i = 0; i < dir->nr; i++) {
 		struct ref_entry *entry = dir->entries[i];
-		if (entry->flag & REF_DIR)
-			prime_ref_dir(get_ref_dir(entry));
+		if (!(entry->flag & REF_DIR) ||
+		    !starts_with(entry->name, scope->prefix) ||
+		    ref_excluded(scope->exclude, entry->name))
+			continue;
+		prime_ref_dir(get_ref_dir(entry), scope);
 	}
 }
 
@@ -941,7 +1044,7 @@ static int is_refname_available(const char *refname,
 
 		data.skip = skip;
 		sort_ref_dir(dir);
-		if (!do_for_each_entry_in_dir(dir, 0, nonmatching_ref_fn, &data))
+		if (!do_for_each_entry_in_dir(dir, 0, NULL, nonmatching_ref_fn, &data))
 			return 1;
 
 		report_refname_conflict(data.found, refname);
@@ -956,9 +1059,44 @@ static int is_refname_available(const char *refname,
 	return 1;
 }
 
+/* How much of the packed-refs file is known to be peeled: */
+enum packed_peeled { PEELED_NONE, PEELED_TAGS, PEELED_FULLY };
+
+struct packed_refs_backend;
+
 struct packed_ref_cache {
+	/*
+	 * The fully-parsed packed references, or NULL if nobody has
+	 * needed them yet.  See get_packed_ref_dir().
+	 */
 	struct ref_entry *root;
 
+	/* The ref_cache that owns this instance. */
+	struct ref_cache *ref_cache;
+
+	/* The storage format that the packed references are read from. */
+	const struct packed_refs_backend *backend;
+
+	/*
+	 * The mmapped contents of the packed-refs file, or NULL if the
+	 * file is missing or empty or has already been parsed into root.
+	 * records points at the first reference record (i.e., just past
+	 * the header line, if any).
+	 */
+	char *buf, *eof;
+	const char *records;
+
+	/* The traits announced by the header line: */
+	enum packed_peeled peeled;
+	unsigned sorted : 1;
+
+	/*
+	 * The stack of ref tables, if the packed references are stored
+	 * in $GIT_DIR/reftable/, or NULL once they have been read into
+	 * root.
+	 */
+	struct ref_table_stack *tables;
+
 	/*
 	 * Count of references to the data structure in this instance,
 	 * including the pointer from ref_cache::packed if any.  The
@@ -980,6 +1118,67 @@ struct packed_ref_cache {
 	struct stat_validity validity;
 };
 
+/*
+ * A storage format for packed references.  Everything that is built
+ * on a packed_ref_cache (the ref_dir tree, merging with the loose
+ * references, locking) is shared; a backend only knows how to read
+ * the references out of its files, and how to write them back.
+ */
+struct packed_refs_backend {
+	const char *name;
+
+	/*
+	 * The file (relative to $GIT_DIR) that is locked while the
+	 * packed references are rewritten, and whose stat data tells
+	 * whether a packed_ref_cache is stale.
+	 */
+	const char *file;
+
+	/* Prepare to read the packed references; fd is open on file. */
+	void (*open)(struct packed_ref_cache *packed_refs, const char *path,
+		     int fd);
+
+	/* Release whatever open() acquired. */
+	void (*release)(struct packed_ref_cache *packed_refs);
+
+	/*
+	 * Return true iff single references can be looked up without
+	 * reading all of them; read_ref() is only used if so.
+	 */
+	int (*can_bisect)(struct packed_ref_cache *packed_refs);
+	struct ref_entry *(*read_ref)(struct packed_ref_cache *packed_refs,
+				      const char *refname);
+
+	/*
+	 * Add the references of scope to dir, skipping over excluded
+	 * hierarchies.  Unless scope is everything (an empty prefix
+	 * and no exclusions), only used if can_bisect().
+	 */
+	void (*read_refs)(struct packed_ref_cache *packed_refs,
+			  const struct ref_scope *scope, struct ref_dir *dir);
+
+	/*
+	 * Replace the stored packed references with those in dir and
+	 * commit lock, which is held on file.
+	 */
+	int (*write_refs)(struct ref_dir *dir, struct lock_file *lock);
+
+	/*
+	 * Remove refnames, some of which are packed, from the packed
+	 * references.
+	 */
+	int (*delete_refs)(struct string_list *refnames, struct strbuf *err);
+
+	/*
+	 * Add the references in dir to the packed references, replacing
+	 * those of the same names.
+	 */
+	int (*add_refs)(struct ref_dir *dir, struct strbuf *err);
+};
+
+static const struct packed_refs_backend packed_refs_file_backend;
+static const struct packed_refs_backend packed_refs_table_backend;
+
 /*
  * Future: need to be in "struct repository"
  * when doing a full libification.
@@ -1014,7 +1213,9 @@ static void acquire_packed_ref_cache(struct packed_ref_cache *packed_refs)
 static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
-		free_ref_entry(packed_refs->root);
+		if (packed_refs->root)
+			free_ref_entry(packed_refs->root);
+		packed_refs->backend->release(packed_refs);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -1086,7 +1287,40 @@ static struct ref_cache *get_ref_cache(const char *submodule)
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
+
+/*
+ * Copy the line starting at *pos (including its LF, if any) into
+ * line and advance *pos past it.  Return EOF if *pos is already at
+ * eof.
+ */
+static int next_packed_line(struct strbuf *line, const char **pos,
+			    const char *eof)
+{
+	const char *eol;
+
+	if (*pos >= eof)
+		return EOF;
+	eol = memchr(*pos, '\n', eof - *pos);
+	eol = eol ? eol + 1 : eof;
+	strbuf_reset(line);
+	strbuf_add(line, *pos, eol - *pos);
+	*pos = eol;
+	return 0;
+}
+
+/*
+ * Interpret the traits of a "# pack-refs with:" header line; see
+ * read_packed_refs().
+ */
+static enum packed_peeled parse_peeled_trait(const char *traits)
+{
+	if (strstr(traits, " fully-peeled "))
+		return PEELED_FULLY;
+	else if (strstr(traits, " peeled "))
+		return PEELED_TAGS;
+	return PEELED_NONE;
+}
 
 /*
  * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
@@ -1125,7 +1359,45 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
 }
 
 /*
- * Read f, which is a packed-refs file, into dir.
+ * Parse a line of the form "^<sha1>\n", which records the peeled value
+ * of the reference on the preceding line.  Return 0 and write the
+ * SHA1 to sha1 on success.
+ */
+static int parse_peeled_line(struct strbuf *line, unsigned char *sha1)
+{
+	if (line->buf[0] != '^' ||
+	    line->len != PEELED_LINE_LENGTH ||
+	    line->buf[PEELED_LINE_LENGTH - 1] != '\n')
+		return -1;
+	return get_sha1_hex(line->buf + 1, sha1);
+}
+
+/*
+ * Create the ref_entry for a reference read from a packed-refs file
+ * whose header announced the given peeled trait.
+ */
+static struct ref_entry *create_packed_entry(const char *refname,
+					     unsigned char *sha1,
+					     enum packed_peeled peeled)
+{
+	struct ref_entry *entry;
+	int flag = REF_ISPACKED;
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("packed refname is dangerous: %s", refname);
+		hashclr(sha1);
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	entry = create_ref_entry(refname, sha1, flag, 0);
+	if (peeled == PEELED_FULLY ||
+	    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
+		entry->flag |= REF_KNOWS_PEELED;
+	return entry;
+}
+
+/*
+ * Read the packed-refs file contents between pos and eof into dir.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
  * more traits. We interpret the traits as follows:
@@ -1150,49 +1422,41 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are listed in strcmp() order of their names
+ *      and the header is the first line of the file.  This lets us
+ *      look up references by bisecting the mmapped file instead of
+ *      reading all of it (see find_packed_record()).  This trait is
+ *      only consulted when the header is the first line; we do not
+ *      need it to read the whole file.
  */
-static void read_packed_refs(FILE *f, struct ref_dir *dir)
+static void read_packed_refs(const char *pos, const char *eof,
+			     struct ref_dir *dir)
 {
 	struct ref_entry *last = NULL;
 	struct strbuf line = STRBUF_INIT;
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	enum packed_peeled peeled = PEELED_NONE;
 
-	while (strbuf_getwholeline(&line, f, '\n') != EOF) {
+	while (next_packed_line(&line, &pos, eof) != EOF) {
 		unsigned char sha1[20];
 		const char *refname;
 		const char *traits;
 
 		if (skip_prefix(line.buf, "# pack-refs with:", &traits)) {
-			if (strstr(traits, " fully-peeled "))
-				peeled = PEELED_FULLY;
-			else if (strstr(traits, " peeled "))
-				peeled = PEELED_TAGS;
+			peeled = parse_peeled_trait(traits);
 			/* perhaps other traits later as well */
 			continue;
 		}
 
 		refname = parse_ref_line(&line, sha1);
 		if (refname) {
-			int flag = REF_ISPACKED;
-
-			if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
-				if (!refname_is_safe(refname))
-					die("packed refname is dangerous: %s", refname);
-				hashclr(sha1);
-				flag |= REF_BAD_NAME | REF_ISBROKEN;
-			}
-			last = create_ref_entry(refname, sha1, flag, 0);
-			if (peeled == PEELED_FULLY ||
-			    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
-				last->flag |= REF_KNOWS_PEELED;
+			last = create_packed_entry(refname, sha1, peeled);
 			add_ref(dir, last);
 			continue;
 		}
-		if (last &&
-		    line.buf[0] == '^' &&
-		    line.len == PEELED_LINE_LENGTH &&
-		    line.buf[PEELED_LINE_LENGTH - 1] == '\n' &&
-		    !get_sha1_hex(line.buf + 1, sha1)) {
+		if (last && !parse_peeled_line(&line, sha1)) {
 			hashcpy(last->u.value.peeled, sha1);
 			/*
 			 * Regardless of what the file header said,
@@ -1206,41 +1470,408 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 	strbuf_release(&line);
 }
 
+/*
+ * mmap the packed-refs file open on fd into packed_refs and interpret
+ * its header line.  Where a mapped file cannot be replaced, read it
+ * into memory instead, as we keep it around across the commit of
+ * packed-refs.lock.
+ */
+static void packed_refs_file_open(struct packed_ref_cache *packed_refs,
+				  const char *path, int fd)
+{
+	struct strbuf line = STRBUF_INIT;
+	const char *pos, *traits;
+	struct stat st;
+	size_t size;
+
+	if (fstat(fd, &st) || st.st_size <= 0)
+		return;
+	size = xsize_t(st.st_size);
+#ifdef MMAP_PREVENTS_DELETE
+	packed_refs->buf = xmalloc(size);
+	if (read_in_full(fd, packed_refs->buf, size) != size)
+		die_errno("unable to read %s", path);
+#else
+	packed_refs->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+#endif
+	packed_refs->eof = packed_refs->buf + size;
+	packed_refs->records = pos = packed_refs->buf;
+
+	if (next_packed_line(&line, &pos, packed_refs->eof) != EOF &&
+	    skip_prefix(line.buf, "# pack-refs with:", &traits)) {
+		packed_refs->peeled = parse_peeled_trait(traits);
+		packed_refs->sorted = !!strstr(traits, " sorted ");
+		packed_refs->records = pos;
+	}
+	strbuf_release(&line);
+}
+
+/*
+ * Unmap (or free) the packed-refs file contents of *packed_refs, if
+ * any.
+ */
+static void packed_refs_file_release(struct packed_ref_cache *packed_refs)
+{
+	if (packed_refs->buf) {
+#ifdef MMAP_PREVENTS_DELETE
+		free(packed_refs->buf);
+#else
+		munmap(packed_refs->buf, packed_refs->eof - packed_refs->buf);
+#endif
+		packed_refs->buf = packed_refs->eof = NULL;
+		packed_refs->records = NULL;
+	}
+}
+
+static int packed_refs_file_can_bisect(struct packed_ref_cache *packed_refs)
+{
+	return packed_refs->sorted;
+}
+
+/*
+ * Compare the name of the reference recorded on the line starting
+ * at rec with refname, like strcmp().
+ */
+static int cmp_packed_record(const char *rec, const char *eof,
+			     const char *refname)
+{
+	const unsigned char *p, *end, *name = (const unsigned char *)refname;
+
+	end = memchr(rec, '\n', eof - rec);
+	if (!end)
+		end = (const unsigned char *)eof;
+	p = (const unsigned char *)rec + 41;
+	if (p > end)
+		p = end;
+
+	for (; p < end && *name; p++, name++)
+		if (*p != *name)
+			return *p - *name;
+	if (p < end)
+		return 1;
+	return *name ? -1 : 0;
+}
+
+/*
+ * Return the start of the line containing pos, looking back no
+ * further than bol.
+ */
+static const char *find_start_of_line(const char *bol, const char *pos)
+{
+	while (pos > bol && pos[-1] != '\n')
+		pos--;
+	return pos;
+}
+
+/*
+ * Return the start of the record following the one at rec, skipping
+ * its peeled line, if any.
+ */
+static const char *find_next_record(const char *rec, const char *eof)
+{
+	rec = memchr(rec, '\n', eof - rec);
+	if (!rec)
+		return eof;
+	rec++;
+	if (rec < eof && *rec == '^') {
+		rec = memchr(rec, '\n', eof - rec);
+		rec = rec ? rec + 1 : eof;
+	}
+	return rec;
+}
+
+/*
+ * Bisect the sorted packed-refs file for the first record whose
+ * refname is not less than refname.  Return its start, or eof if
+ * there is no such record.
+ */
+static const char *find_packed_record(struct packed_ref_cache *packed_ref_cache,
+				      const char *refname)
+{
+	const char *lo = packed_ref_cache->records;
+	const char *hi = packed_ref_cache->eof;
+
+	while (lo < hi) {
+		const char *mid = find_start_of_line(lo, lo + (hi - lo) / 2);
+
+		/* Land on the reference line, not on its peeled value: */
+		if (*mid == '^' && mid > lo)
+			mid = find_start_of_line(lo, mid - 1);
+		if (cmp_packed_record(mid, packed_ref_cache->eof, refname) < 0)
+			lo = find_next_record(mid, packed_ref_cache->eof);
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Parse the record at *pos (a reference line and optionally its
+ * peeled line) and advance *pos past it.  Return a new ref_entry, or
+ * NULL if the reference line is malformed.
+ */
+static struct ref_entry *read_packed_record(struct packed_ref_cache *packed_ref_cache,
+					    const char **pos, struct strbuf *line)
+{
+	const char *eof = packed_ref_cache->eof;
+	struct ref_entry *entry;
+	unsigned char sha1[20];
+	const char *refname;
+
+	if (next_packed_line(line, pos, eof) == EOF)
+		return NULL;
+	refname = parse_ref_line(line, sha1);
+	if (!refname)
+		return NULL;
+	entry = create_packed_entry(refname, sha1, packed_ref_cache->peeled);
+
+	if (*pos < eof && **pos == '^') {
+		next_packed_line(line, pos, eof);
+		if (!parse_peeled_line(line, sha1)) {
+			hashcpy(entry->u.value.peeled, sha1);
+			entry->flag |= REF_KNOWS_PEELED;
+		}
+	}
+	return entry;
+}
+
+static struct ref_entry *packed_refs_file_read_ref(struct packed_ref_cache *packed_ref_cache,
+						   const char *refname)
+{
+	struct ref_entry *entry = NULL;
+	struct strbuf line = STRBUF_INIT;
+	const char *pos = find_packed_record(packed_ref_cache, refname);
+
+	if (pos < packed_ref_cache->eof &&
+	    !cmp_packed_record(pos, packed_ref_cache->eof, refname))
+		entry = read_packed_record(packed_ref_cache, &pos, &line);
+	strbuf_release(&line);
+	return entry;
+}
+
+/*
+ * Read the packed references of scope into dir, bisecting the file
+ * to skip to the start of the scope and over excluded hierarchies.
+ * Unless scope is everything, the file must be sorted.
+ */
+static void packed_refs_file_read_refs(struct packed_ref_cache *packed_ref_cache,
+				       const struct ref_scope *scope,
+				       struct ref_dir *dir)
+{
+	struct strbuf line = STRBUF_INIT, key = STRBUF_INIT;
+	const char *pos, *eof = packed_ref_cache->eof;
+	size_t len = strlen(scope->prefix);
+
+	if (!packed_ref_cache->buf)
+		return;
+	if (!len && !scope->exclude) {
+		read_packed_refs(packed_ref_cache->buf, eof, dir);
+		return;
+	}
+
+	pos = find_packed_record(packed_ref_cache, scope->prefix);
+	while (pos < eof) {
+		struct ref_entry *entry;
+		const char *excluded;
+
+		if (eof - pos < 41 + len || memcmp(pos + 41, scope->prefix, len))
+			break;
+		if (scope->exclude) {
+			/* Look at the name before parsing the record: */
+			const char *eol = memchr(pos + 41, '\n', eof - pos - 41);
+
+			strbuf_reset(&key);
+			strbuf_add(&key, pos + 41, (eol ? eol : eof) - (pos + 41));
+			excluded = ref_excluded(scope->exclude, key.buf);
+			if (excluded) {
+				if (key.buf[strlen(excluded)] == '/') {
+					skip_hierarchy_key(&key, excluded);
+					pos = find_packed_record(packed_ref_cache,
+								 key.buf);
+				} else {
+					pos = find_next_record(pos, eof);
+				}
+				continue;
+			}
+		}
+		entry = read_packed_record(packed_ref_cache, &pos, &line);
+		if (entry)
+			add_ref(dir, entry);
+	}
+	strbuf_release(&key);
+	strbuf_release(&line);
+}
+
+/*
+ * Create a ref_entry for a reference read from a ref table.  Ref
+ * tables record the peeled value of every reference that has one.
+ */
+static struct ref_entry *create_table_entry(struct ref_table_record *rec)
+{
+	struct ref_entry *entry;
+
+	entry = create_packed_entry(rec->name.buf, rec->sha1, PEELED_FULLY);
+	if (rec->type == REF_TABLE_PEELED)
+		hashcpy(entry->u.value.peeled, rec->peeled);
+	return entry;
+}
+
+static void packed_refs_table_open(struct packed_ref_cache *packed_refs,
+				   const char *path, int fd)
+{
+	struct strbuf dir = STRBUF_INIT;
+
+	strbuf_add(&dir, path, strlen(path) - strlen("/tables.list"));
+	packed_refs->tables = ref_table_stack_read(dir.buf);
+	if (!packed_refs->tables)
+		die("unable to read the ref tables in %s", dir.buf);
+	strbuf_release(&dir);
+}
+
+static void packed_refs_table_release(struct packed_ref_cache *packed_refs)
+{
+	ref_table_stack_free(packed_refs->tables);
+	packed_refs->tables = NULL;
+}
+
+static int packed_refs_table_can_bisect(struct packed_ref_cache *packed_refs)
+{
+	return packed_refs->tables != NULL;
+}
+
+static struct ref_entry *packed_refs_table_read_ref(struct packed_ref_cache *packed_refs,
+						    const char *refname)
+{
+	struct ref_table_record rec = REF_TABLE_RECORD_INIT;
+	struct ref_entry *entry = NULL;
+
+	switch (ref_table_stack_lookup(packed_refs->tables, refname, &rec)) {
+	case 0:
+		entry = create_table_entry(&rec);
+		break;
+	case 1:
+		break;
+	default:
+		die("unable to look up %s in the ref tables", refname);
+	}
+	strbuf_release(&rec.name);
+	return entry;
+}
+
+static void packed_refs_table_read_refs(struct packed_ref_cache *packed_refs,
+					const struct ref_scope *scope,
+					struct ref_dir *dir)
+{
+	struct ref_table_record rec = REF_TABLE_RECORD_INIT;
+	struct ref_table_merged_iter *iter;
+	struct strbuf key = STRBUF_INIT;
+	int ret;
+
+	if (!packed_refs->tables)
+		return;
+	iter = ref_table_stack_iter(packed_refs->tables, scope->prefix);
+	while (!(ret = ref_table_merged_iter_next(iter, &rec))) {
+		const char *excluded = ref_excluded(scope->exclude, rec.name.buf);
+
+		if (!excluded) {
+			add_ref(dir, create_table_entry(&rec));
+			continue;
+		}
+		if (rec.name.buf[strlen(excluded)] == '/') {
+			skip_hierarchy_key(&key, excluded);
+			if (ref_table_merged_iter_seek(iter, key.buf)) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+	strbuf_release(&key);
+	if (ret < 0)
+		die("unable to read the ref tables");
+	ref_table_merged_iter_free(iter);
+	strbuf_release(&rec.name);
+}
+
+/*
+ * Return the backend in which the packed references of refs are
+ * stored.  Once there are ref tables, they take precedence over any
+ * packed-refs file.
+ */
+static const struct packed_refs_backend *packed_refs_backend_of(struct ref_cache *refs)
+{
+	const char *list = *refs->name
+		? git_path_submodule(refs->name, "%s", REF_TABLE_LIST)
+		: git_path("%s", REF_TABLE_LIST);
+
+	if (file_exists(list))
+		return &packed_refs_table_backend;
+	return &packed_refs_file_backend;
+}
+
+/*
+ * Return the backend in which the packed references of the main
+ * repository are to be written.
+ */
+static const struct packed_refs_backend *packed_refs_write_backend(void)
+{
+	if (repository_format_ref_tables)
+		return &packed_refs_table_backend;
+	return packed_refs_backend_of(&ref_cache);
+}
+
 /*
  * Get the packed_ref_cache for the specified ref_cache, creating it
- * if necessary.
+ * if necessary.  The backend only opens its files here; they are
+ * read as needed by the lookup functions below.
  */
 static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 {
+	const struct packed_refs_backend *backend = packed_refs_backend_of(refs);
 	const char *packed_refs_file;
 
 	if (*refs->name)
-		packed_refs_file = git_path_submodule(refs->name, "packed-refs");
+		packed_refs_file = git_path_submodule(refs->name, "%s", backend->file);
 	else
-		packed_refs_file = git_path("packed-refs");
+		packed_refs_file = git_path("%s", backend->file);
 
 	if (refs->packed &&
-	    !stat_validity_check(&refs->packed->validity, packed_refs_file))
+	    (refs->packed->backend != backend ||
+	     !stat_validity_check(&refs->packed->validity, packed_refs_file)))
 		clear_packed_ref_cache(refs);
 
 	if (!refs->packed) {
-		FILE *f;
+		int fd;
 
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
+		refs->packed->ref_cache = refs;
+		refs->packed->backend = backend;
 		acquire_packed_ref_cache(refs->packed);
-		refs->packed->root = create_dir_entry(refs, "", 0, 0);
-		f = fopen(packed_refs_file, "r");
-		if (f) {
-			stat_validity_update(&refs->packed->validity, fileno(f));
-			read_packed_refs(f, get_ref_dir(refs->packed->root));
-			fclose(f);
+		fd = open(packed_refs_file, O_RDONLY);
+		if (fd >= 0) {
+			stat_validity_update(&refs->packed->validity, fd);
+			backend->open(refs->packed, packed_refs_file, fd);
+			close(fd);
 		}
 	}
 	return refs->packed;
 }
 
+/*
+ * Return the tree of all packed references, reading all of them
+ * into it if that has not happened yet.  Callers that are going to
+ * modify the packed references must use this.
+ */
 static struct ref_dir *get_packed_ref_dir(struct packed_ref_cache *packed_ref_cache)
 {
+	if (!packed_ref_cache->root) {
+		struct ref_scope everything = { "", NULL };
+
+		packed_ref_cache->root =
+			create_dir_entry(packed_ref_cache->ref_cache, "", 0, 0);
+		packed_ref_cache->backend->read_refs(packed_ref_cache, &everything,
+						     get_ref_dir(packed_ref_cache->root));
+		packed_ref_cache->backend->release(packed_ref_cache);
+	}
 	return get_ref_dir(packed_ref_cache->root);
 }
 
@@ -1249,6 +1880,58 @@ static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 	return get_packed_ref_dir(get_packed_ref_cache(refs));
 }
 
+/*
+ * Return true iff the references in packed_ref_cache can (still) be
+ * looked up without reading all of them.
+ */
+static int can_bisect_packed_refs(struct packed_ref_cache *packed_ref_cache)
+{
+	return !packed_ref_cache->root &&
+		packed_ref_cache->backend->can_bisect(packed_ref_cache);
+}
+
+/*
+ * Read the packed references of scope, and return them in a new
+ * top-level directory entry that the caller must free.  Only valid
+ * if can_bisect_packed_refs().
+ */
+static struct ref_entry *read_packed_refs_scope(struct packed_ref_cache *packed_ref_cache,
+						const struct ref_scope *scope)
+{
+	struct ref_entry *root;
+
+	root = create_dir_entry(packed_ref_cache->ref_cache, "", 0, 0);
+	packed_ref_cache->backend->read_refs(packed_ref_cache, scope,
+					     get_ref_dir(root));
+	return root;
+}
+
+/*
+ * Return a copy of the ref_entry for refname from the packed
+ * references of refs, or NULL if there is no such packed reference.
+ * The caller must free the entry.
+ */
+static struct ref_entry *get_packed_ref(struct ref_cache *refs,
+					const char *refname)
+{
+	struct packed_ref_cache *packed_ref_cache = get_packed_ref_cache(refs);
+	struct ref_entry *entry;
+
+	if (can_bisect_packed_refs(packed_ref_cache))
+		return packed_ref_cache->backend->read_ref(packed_ref_cache,
+							   refname);
+
+	entry = find_ref(get_packed_ref_dir(packed_ref_cache), refname);
+	if (entry) {
+		struct ref_entry *copy = create_ref_entry(entry->name,
+							  entry->u.value.sha1,
+							  entry->flag, 0);
+		hashcpy(copy->u.value.peeled, entry->u.value.peeled);
+		entry = copy;
+	}
+	return entry;
+}
+
 void add_packed_ref(const char *refname, const unsigned char *sha1)
 {
 	struct packed_ref_cache *packed_ref_cache =
@@ -1367,14 +2050,13 @@ static struct ref_dir *get_loose_refs(struct ref_cache *refs)
 static int resolve_gitlink_packed_ref(struct ref_cache *refs,
 				      const char *refname, unsigned char *sha1)
 {
-	struct ref_entry *ref;
-	struct ref_dir *dir = get_packed_refs(refs);
+	struct ref_entry *ref = get_packed_ref(refs, refname);
 
-	ref = find_ref(dir, refname);
 	if (ref == NULL)
 		return -1;
 
 	hashcpy(sha1, ref->u.value.sha1);
+	free_ref_entry(ref);
 	return 0;
 }
 
@@ -1435,15 +2117,6 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
 	return retval;
 }
 
-/*
- * Return the ref_entry for the given refname from the packed
- * references.  If it does not exist, return NULL.
- */
-static struct ref_entry *get_packed_ref(const char *refname)
-{
-	return find_ref(get_packed_refs(&ref_cache), refname);
-}
-
 /*
  * A loose ref file doesn't exist; check for a packed ref.  The
  * options are forwarded from resolve_safe_unsafe().
@@ -1459,9 +2132,10 @@ static int resolve_missing_loose_ref(const char *refname,
 	 * The loose reference file does not exist; check for a packed
 	 * reference.
 	 */
-	entry = get_packed_ref(refname);
+	entry = get_packed_ref(&ref_cache, refname);
 	if (entry) {
 		hashcpy(sha1, entry->u.value.sha1);
+		free_ref_entry(entry);
 		if (flags)
 			*flags |= REF_ISPACKED;
 		return 0;
@@ -1813,12 +2487,15 @@ int peel_ref(const char *refname, unsigned char *sha1)
 	 * have REF_KNOWS_PEELED.
 	 */
 	if (flag & REF_ISPACKED) {
-		struct ref_entry *r = get_packed_ref(refname);
+		struct ref_entry *r = get_packed_ref(&ref_cache, refname);
 		if (r) {
+			int ret = 0;
 			if (peel_entry(r, 0))
-				return -1;
-			hashcpy(sha1, r->u.value.peeled);
-			return 0;
+				ret = -1;
+			else
+				hashcpy(sha1, r->u.value.peeled);
+			free_ref_entry(r);
+			return ret;
 		}
 	}
 
@@ -1878,20 +2555,30 @@ void warn_dangling_symrefs(FILE *fp, const char *msg_fmt, const struct string_li
 }
 
 /*
- * Call fn for each reference in the specified ref_cache, omitting
- * references not in the containing_dir of base.  fn is called for all
- * references, including broken ones.  If fn ever returns a non-zero
- * value, stop the iteration and return that value; otherwise, return
- * 0.
+ * Call fn for each reference in the specified ref_cache whose name
+ * starts with base, except for those in the hierarchies listed in
+ * exclude (see ref_excluded()).  Only the loose references in the
+ * directories that can hold such references are read, and the packed
+ * references are read only from the start of base on and skipping
+ * excluded hierarchies, as far as the packed storage allows.  fn is
+ * called for all references, including broken ones.  If fn ever
+ * returns a non-zero value, stop the iteration and return that value;
+ * otherwise, return 0.
  */
 static int do_for_each_entry(struct ref_cache *refs, const char *base,
+			     const struct string_list *exclude,
 			     each_ref_entry_fn fn, void *cb_data)
 {
 	struct packed_ref_cache *packed_ref_cache;
+	struct ref_entry *packed_slice = NULL;
 	struct ref_dir *loose_dir;
 	struct ref_dir *packed_dir;
+	struct ref_scope scope;
 	int retval = 0;
 
+	scope.prefix = base ? base : "";
+	scope.exclude = exclude;
+
 	/*
 	 * We must make sure that all loose refs are read before accessing the
 	 * packed-refs file; this avoids a race condition in which loose refs
@@ -1901,49 +2588,61 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 	 * disk.
 	 */
 	loose_dir = get_loose_refs(refs);
-	if (base && *base) {
-		loose_dir = find_containing_dir(loose_dir, base, 0);
+	if (*scope.prefix) {
+		loose_dir = find_containing_dir(loose_dir, scope.prefix, 0);
 	}
 	if (loose_dir)
-		prime_ref_dir(loose_dir);
+		prime_ref_dir(loose_dir, &scope);
 
 	packed_ref_cache = get_packed_ref_cache(refs);
 	acquire_packed_ref_cache(packed_ref_cache);
-	packed_dir = get_packed_ref_dir(packed_ref_cache);
-	if (base && *base) {
-		packed_dir = find_containing_dir(packed_dir, base, 0);
+	if ((*scope.prefix || exclude) &&
+	    can_bisect_packed_refs(packed_ref_cache)) {
+		packed_slice = read_packed_refs_scope(packed_ref_cache, &scope);
+		packed_dir = get_ref_dir(packed_slice);
+	} else {
+		packed_dir = get_packed_ref_dir(packed_ref_cache);
+	}
+	if (*scope.prefix) {
+		packed_dir = find_containing_dir(packed_dir, scope.prefix, 0);
 	}
 
 	if (packed_dir && loose_dir) {
 		sort_ref_dir(packed_dir);
 		sort_ref_dir(loose_dir);
 		retval = do_for_each_entry_in_dirs(
-				packed_dir, loose_dir, fn, cb_data);
+				packed_dir, loose_dir, &scope, fn, cb_data);
 	} else if (packed_dir) {
 		sort_ref_dir(packed_dir);
 		retval = do_for_each_entry_in_dir(
-				packed_dir, 0, fn, cb_data);
+				packed_dir, seek_ref_dir(packed_dir, scope.prefix),
+				&scope, fn, cb_data);
 	} else if (loose_dir) {
 		sort_ref_dir(loose_dir);
 		retval = do_for_each_entry_in_dir(
-				loose_dir, 0, fn, cb_data);
+				loose_dir, seek_ref_dir(loose_dir, scope.prefix),
+				&scope, fn, cb_data);
 	}
 
+	if (packed_slice)
+		free_ref_entry(packed_slice);
 	release_packed_ref_cache(packed_ref_cache);
 	return retval;
 }
 
 /*
  * Call fn for each reference in the specified ref_cache for which the
- * refname begins with base.  If trim is non-zero, then trim that many
- * characters off the beginning of each refname before passing the
- * refname to fn.  flags can be DO_FOR_EACH_INCLUDE_BROKEN to include
- * broken references in the iteration.  If fn ever returns a non-zero
- * value, stop the iteration and return that value; otherwise, return
- * 0.
+ * refname begins with base, skipping the hierarchies listed in
+ * exclude.  If trim is non-zero, then trim that many characters off
+ * the beginning of each refname before passing the refname to fn.
+ * flags can be DO_FOR_EACH_INCLUDE_BROKEN to include broken
+ * references in the iteration.  If fn ever returns a non-zero value,
+ * stop the iteration and return that value; otherwise, return 0.
  */
-static int do_for_each_ref(struct ref_cache *refs, const char *base,
-			   each_ref_fn fn, int trim, int flags, void *cb_data)
+static int do_for_each_ref_excluding(struct ref_cache *refs, const char *base,
+				     const struct string_list *exclude,
+				     each_ref_fn fn, int trim, int flags,
+				     void *cb_data)
 {
 	struct ref_entry_cb data;
 	data.base = base;
@@ -1957,7 +2656,14 @@ static int do_for_each_ref(struct ref_cache *refs, const char *base,
 	if (ref_paranoia)
 		data.flags |= DO_FOR_EACH_INCLUDE_BROKEN;
 
-	return do_for_each_entry(refs, base, do_one_ref, &data);
+	return do_for_each_entry(refs, base, exclude, do_one_ref, &data);
+}
+
+static int do_for_each_ref(struct ref_cache *refs, const char *base,
+			   each_ref_fn fn, int trim, int flags, void *cb_data)
+{
+	return do_for_each_ref_excluding(refs, base, NULL, fn, trim, flags,
+					 cb_data);
 }
 
 static int do_head_ref(const char *submodule, each_ref_fn fn, void *cb_data)
@@ -2110,6 +2816,12 @@ int for_each_rawref(each_ref_fn fn, void *cb_data)
 			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
 }
 
+int for_each_rawref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	return do_for_each_ref(&ref_cache, prefix, fn, 0,
+			       DO_FOR_EACH_INCLUDE_BROKEN, cb_data);
+}
+
 const char *prettify_refname(const char *name)
 {
 	return name + (
@@ -2428,13 +3140,155 @@ static int write_packed_entry_fn(struct ref_entry *entry, void *cb_data)
 	return 0;
 }
 
+/*
+ * Write the packed references in dir to the packed-refs file locked
+ * by lock, and commit it.
+ */
+static int packed_refs_file_write_refs(struct ref_dir *dir,
+				       struct lock_file *lock)
+{
+	FILE *out;
+
+	out = fdopen_lock_file(lock, "w");
+	if (!out)
+		die_errno("unable to fdopen packed-refs descriptor");
+
+	fprintf_or_die(out, "%s", PACKED_REFS_HEADER);
+	do_for_each_entry_in_dir(dir, 0, NULL, write_packed_entry_fn, out);
+	if (fsync_ref_files) {
+		if (fflush(out))
+			die_errno("unable to write packed-refs file");
+		fsync_or_die(fileno(out), lock->filename.buf);
+	}
+
+	return commit_lock_file(lock);
+}
+
+/*
+ * An each_ref_entry_fn that adds the entry to a ref table.
+ */
+static int write_table_entry_fn(struct ref_entry *entry, void *cb_data)
+{
+	enum peel_status peel_status = peel_entry(entry, 0);
+
+	if (peel_status != PEEL_PEELED && peel_status != PEEL_NON_TAG)
+		error("internal error: %s is not a valid packed reference!",
+		      entry->name);
+	ref_table_add(cb_data, entry->name,
+		      peel_status == PEEL_PEELED ? REF_TABLE_PEELED : REF_TABLE_VALUE,
+		      entry->u.value.sha1, entry->u.value.peeled);
+	return 0;
+}
+
+/*
+ * Replace the list of ref tables, locked by lock, with names and
+ * commit it.  Then remove the tables that are no longer listed, and
+ * the packed-refs file that the tables replace.
+ */
+static int commit_ref_table_list(struct lock_file *lock,
+				 struct string_list *names,
+				 struct string_list *old_names)
+{
+	struct string_list_item *item;
+	struct strbuf list = STRBUF_INIT;
+	int ret = 0;
+
+	for_each_string_list_item(item, names)
+		strbuf_addf(&list, "%s\n", item->string);
+	if (write_in_full(lock->fd, list.buf, list.len) != list.len ||
+	    (fsync_ref_files && fsync(lock->fd) < 0) ||
+	    commit_lock_file(lock)) {
+		int save_errno = errno;
+		rollback_lock_file(lock);
+		strbuf_release(&list);
+		errno = save_errno;
+		return -1;
+	}
+	strbuf_release(&list);
+
+	for_each_string_list_item(item, old_names) {
+		if (unsorted_string_list_has_string(names, item->string))
+			continue;
+		unlink_or_warn(git_path("%s/%s", REF_TABLE_DIR, item->string));
+	}
+	if (unlink(git_path("packed-refs")) && errno != ENOENT)
+		ret = error("unable to remove %s: %s",
+			    git_path("packed-refs"), strerror(errno));
+	return ret;
+}
+
+/*
+ * Read the names of the tables listed in the tables.list file.
+ */
+static void read_ref_table_names(struct string_list *names)
+{
+	struct strbuf list = STRBUF_INIT;
+	struct string_list_item *item;
+	struct string_list lines = STRING_LIST_INIT_NODUP;
+
+	if (strbuf_read_file(&list, git_path("%s", REF_TABLE_LIST), 0) < 0) {
+		if (errno != ENOENT)
+			die_errno("unable to read %s", git_path("%s", REF_TABLE_LIST));
+		return;
+	}
+	strbuf_rtrim(&list);
+	if (list.len)
+		string_list_split_in_place(&lines, list.buf, '\n', -1);
+	for_each_string_list_item(item, &lines)
+		string_list_append(names, item->string);
+	string_list_clear(&lines, 0);
+	strbuf_release(&list);
+}
+
+/*
+ * Write the packed references in dir into a single new ref table,
+ * which replaces all existing ones.
+ */
+static int packed_refs_table_write_refs(struct ref_dir *dir,
+					struct lock_file *lock)
+{
+	struct string_list old_names = STRING_LIST_INIT_DUP;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct ref_table_writer *writer;
+	struct strbuf name = STRBUF_INIT;
+	uint32_t generation;
+	int ret;
+
+	read_ref_table_names(&old_names);
+	generation = old_names.nr
+		? strtoul(old_names.items[old_names.nr - 1].string, NULL, 16) + 1
+		: 1;
+	writer = ref_table_writer_begin(git_path("%s", REF_TABLE_DIR),
+					generation);
+	do_for_each_entry_in_dir(dir, 0, NULL, write_table_entry_fn, writer);
+	ret = ref_table_writer_commit(writer, &name);
+	if (!ret) {
+		string_list_append(&names, name.buf);
+		ret = commit_ref_table_list(lock, &names, &old_names);
+	} else {
+		rollback_lock_file(lock);
+	}
+	string_list_clear(&names, 0);
+	string_list_clear(&old_names, 0);
+	strbuf_release(&name);
+	return ret;
+}
+
+/* The backend that packlock is held for: */
+static const struct packed_refs_backend *packlock_backend;
+
 /* This should return a meaningful errno on failure */
 int lock_packed_refs(int flags)
 {
 	struct packed_ref_cache *packed_ref_cache;
+	const struct packed_refs_backend *backend = packed_refs_write_backend();
+	const char *path = git_path("%s", backend->file);
 
-	if (hold_lock_file_for_update(&packlock, git_path("packed-refs"), flags) < 0)
+	if (safe_create_leading_directories_const(path) != SCLD_OK)
 		return -1;
+	if (hold_lock_file_for_update(&packlock, path, flags) < 0)
+		return -1;
+	packlock_backend = backend;
 	/*
 	 * Get the current packed-refs while holding the lock.  If the
 	 * packed-refs file has been modified since we last read it,
@@ -2458,20 +3312,12 @@ int commit_packed_refs(void)
 		get_packed_ref_cache(&ref_cache);
 	int error = 0;
 	int save_errno = 0;
-	FILE *out;
 
 	if (!packed_ref_cache->lock)
 		die("internal error: packed-refs not locked");
 
-	out = fdopen_lock_file(packed_ref_cache->lock, "w");
-	if (!out)
-		die_errno("unable to fdopen packed-refs descriptor");
-
-	fprintf_or_die(out, "%s", PACKED_REFS_HEADER);
-	do_for_each_entry_in_dir(get_packed_ref_dir(packed_ref_cache),
-				 0, write_packed_entry_fn, out);
-
-	if (commit_lock_file(packed_ref_cache->lock)) {
+	if (packlock_backend->write_refs(get_packed_ref_dir(packed_ref_cache),
+					 packed_ref_cache->lock)) {
 		save_errno = errno;
 		error = -1;
 	}
@@ -2629,7 +3475,7 @@ int pack_refs(unsigned int flags)
 	lock_packed_refs(LOCK_DIE_ON_ERROR);
 	cbdata.packed_refs = get_packed_refs(&ref_cache);
 
-	do_for_each_entry_in_dir(get_loose_refs(&ref_cache), 0,
+	do_for_each_entry_in_dir(get_loose_refs(&ref_cache), 0, NULL,
 				 pack_if_possible_fn, &cbdata);
 
 	if (commit_packed_refs())
@@ -2639,28 +3485,19 @@ int pack_refs(unsigned int flags)
 	return 0;
 }
 
-int repack_without_refs(struct string_list *refnames, struct strbuf *err)
+/*
+ * Remove refnames from the packed-refs file by rewriting it.
+ */
+static int packed_refs_file_delete_refs(struct string_list *refnames,
+					struct strbuf *err)
 {
 	struct ref_dir *packed;
 	struct string_list_item *refname;
-	int ret, needs_repacking = 0, removed = 0;
-
-	assert(err);
-
-	/* Look for a packed ref */
-	for_each_string_list_item(refname, refnames) {
-		if (get_packed_ref(refname->string)) {
-			needs_repacking = 1;
-			break;
-		}
-	}
-
-	/* Avoid locking if we have nothing to do */
-	if (!needs_repacking)
-		return 0; /* no refname exists in packed refs */
+	int ret, removed = 0;
 
 	if (lock_packed_refs(0)) {
-		unable_to_lock_message(git_path("packed-refs"), errno, err);
+		unable_to_lock_message(git_path("%s", packlock_backend->file),
+				       errno, err);
 		return -1;
 	}
 	packed = get_packed_refs(&ref_cache);
@@ -2678,12 +3515,270 @@ int repack_without_refs(struct string_list *refnames, struct strbuf *err)
 		return 0;
 	}
 
-	/* Write what remains */
-	ret = commit_packed_refs();
-	if (ret)
-		strbuf_addf(err, "unable to overwrite old ref-pack file: %s",
-			    strerror(errno));
-	return ret;
+	/* Write what remains */
+	ret = commit_packed_refs();
+	if (ret)
+		strbuf_addf(err, "unable to overwrite old ref-pack file: %s",
+			    strerror(errno));
+	return ret;
+}
+
+/*
+ * An each_ref_entry_fn that adds the entry to the ref_dir cb_data,
+ * replacing an entry of the same name.
+ */
+static int add_packed_entry_fn(struct ref_entry *entry, void *cb_data)
+{
+	struct ref_dir *packed = cb_data;
+	struct ref_entry *packed_entry = find_ref(packed, entry->name);
+
+	if (packed_entry) {
+		packed_entry->flag = REF_ISPACKED;
+		hashcpy(packed_entry->u.value.sha1, entry->u.value.sha1);
+		hashclr(packed_entry->u.value.peeled);
+	} else {
+		add_ref(packed, create_ref_entry(entry->name, entry->u.value.sha1,
+						 REF_ISPACKED, 0));
+	}
+	return 0;
+}
+
+/*
+ * Add the references in dir to the packed-refs file by rewriting it.
+ */
+static int packed_refs_file_add_refs(struct ref_dir *dir, struct strbuf *err)
+{
+	if (lock_packed_refs(0)) {
+		unable_to_lock_message(git_path("%s", packlock_backend->file),
+				       errno, err);
+		return -1;
+	}
+	do_for_each_entry_in_dir(dir, 0, NULL, add_packed_entry_fn,
+				 get_packed_refs(&ref_cache));
+	if (commit_packed_refs()) {
+		strbuf_addf(err, "unable to overwrite old ref-pack file: %s",
+			    strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Commit writer and push the table onto stack, merge the newest
+ * tables if the stack has grown too tall, and replace the list of
+ * ref tables, which must be locked by lock_packed_refs().  The lock
+ * is released either way.
+ */
+static int push_ref_table(struct ref_table_stack *stack,
+			  struct ref_table_writer *writer, struct strbuf *err)
+{
+	struct packed_ref_cache *packed_ref_cache;
+	struct string_list old_names = STRING_LIST_INIT_DUP;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct strbuf name = STRBUF_INIT;
+	char *pushed = NULL;
+	int i, first, ret = 0;
+
+	if (ref_table_writer_commit(writer, &name) ||
+	    ref_table_stack_push(stack, name.buf)) {
+		strbuf_addstr(err, "unable to write a ref table");
+		if (name.len)
+			unlink_or_warn(git_path("%s/%s", REF_TABLE_DIR, name.buf));
+		rollback_packed_refs();
+		ret = -1;
+		goto out;
+	}
+	/* Not listed in tables.list until we commit it. */
+	pushed = strbuf_detach(&name, NULL);
+
+	for (i = 0; i < stack->nr; i++)
+		string_list_append(&old_names, ref_table_name(stack, i));
+	first = ref_table_compaction_start(stack);
+	for (i = 0; i < first; i++)
+		string_list_append(&names, ref_table_name(stack, i));
+	if (first < stack->nr - 1) {
+		if (ref_table_compact(stack, first, &name)) {
+			strbuf_addstr(err, "unable to compact the ref tables");
+			unlink_or_warn(git_path("%s/%s", REF_TABLE_DIR, pushed));
+			rollback_packed_refs();
+			ret = -1;
+			goto out;
+		}
+	} else {
+		strbuf_addstr(&name, pushed);
+	}
+	string_list_append(&names, name.buf);
+
+	if (commit_ref_table_list(&packlock, &names, &old_names)) {
+		strbuf_addf(err, "unable to update %s: %s",
+			    git_path("%s", REF_TABLE_LIST), strerror(errno));
+		unlink_or_warn(git_path("%s/%s", REF_TABLE_DIR, name.buf));
+		if (strcmp(name.buf, pushed))
+			unlink_or_warn(git_path("%s/%s", REF_TABLE_DIR, pushed));
+		ret = -1;
+	}
+	packed_ref_cache = ref_cache.packed;
+	packed_ref_cache->lock = NULL;
+	release_packed_ref_cache(packed_ref_cache);
+	clear_packed_ref_cache(&ref_cache);
+out:
+	string_list_clear(&old_names, 0);
+	string_list_clear(&names, 0);
+	strbuf_release(&name);
+	free(pushed);
+	return ret;
+}
+
+/*
+ * Remove refnames from the packed references by appending a table of
+ * deletion records to the stack of ref tables, and merge the newest
+ * tables if the stack has grown too tall.  The cost depends on the
+ * number of refnames, not on the number of packed references.
+ */
+static int packed_refs_table_delete_refs(struct string_list *refnames,
+					 struct strbuf *err)
+{
+	struct ref_table_stack *stack;
+	struct ref_table_record rec = REF_TABLE_RECORD_INIT;
+	struct string_list deleted = STRING_LIST_INIT_NODUP;
+	struct string_list_item *refname;
+	struct ref_table_writer *writer;
+	int ret = 0;
+
+	/* Convert a packed-refs file to a ref table on the way. */
+	if (!file_exists(git_path("%s", REF_TABLE_LIST)))
+		return packed_refs_file_delete_refs(refnames, err);
+
+	if (lock_packed_refs(0)) {
+		unable_to_lock_message(git_path("%s", REF_TABLE_LIST), errno, err);
+		return -1;
+	}
+	stack = ref_table_stack_read(git_path("%s", REF_TABLE_DIR));
+	if (!stack) {
+		rollback_packed_refs();
+		strbuf_addstr(err, "unable to read the ref tables");
+		return -1;
+	}
+
+	for_each_string_list_item(refname, refnames) {
+		int found = ref_table_stack_lookup(stack, refname->string, &rec);
+		if (found < 0) {
+			ret = -1;
+			strbuf_addf(err, "unable to look up %s in the ref tables",
+				    refname->string);
+			rollback_packed_refs();
+			goto out;
+		}
+		if (!found)
+			string_list_append(&deleted, refname->string);
+	}
+	if (!deleted.nr) {
+		/*
+		 * All packed entries disappeared while we were
+		 * acquiring the lock.
+		 */
+		rollback_packed_refs();
+		goto out;
+	}
+	string_list_sort(&deleted);
+	string_list_remove_duplicates(&deleted, 0);
+
+	writer = ref_table_writer_begin(stack->dir,
+					ref_table_next_generation(stack));
+	for_each_string_list_item(refname, &deleted)
+		ref_table_add(writer, refname->string, REF_TABLE_DELETION,
+			      NULL, NULL);
+	ret = push_ref_table(stack, writer, err);
+
+out:
+	ref_table_stack_free(stack);
+	string_list_clear(&deleted, 0);
+	strbuf_release(&rec.name);
+	return ret;
+}
+
+/*
+ * Add the references in dir to the packed references by appending a
+ * table that holds only them to the stack of ref tables.
+ */
+static int packed_refs_table_add_refs(struct ref_dir *dir, struct strbuf *err)
+{
+	struct ref_table_stack *stack;
+	struct ref_table_writer *writer;
+	int ret;
+
+	/* Convert a packed-refs file to a ref table on the way. */
+	if (!file_exists(git_path("%s", REF_TABLE_LIST)))
+		return packed_refs_file_add_refs(dir, err);
+
+	if (lock_packed_refs(0)) {
+		unable_to_lock_message(git_path("%s", REF_TABLE_LIST), errno, err);
+		return -1;
+	}
+	stack = ref_table_stack_read(git_path("%s", REF_TABLE_DIR));
+	if (!stack) {
+		rollback_packed_refs();
+		strbuf_addstr(err, "unable to read the ref tables");
+		return -1;
+	}
+
+	writer = ref_table_writer_begin(stack->dir,
+					ref_table_next_generation(stack));
+	do_for_each_entry_in_dir(dir, 0, NULL, write_table_entry_fn, writer);
+	ret = push_ref_table(stack, writer, err);
+	ref_table_stack_free(stack);
+	return ret;
+}
+
+static const struct packed_refs_backend packed_refs_file_backend = {
+	"file",
+	"packed-refs",
+	packed_refs_file_open,
+	packed_refs_file_release,
+	packed_refs_file_can_bisect,
+	packed_refs_file_read_ref,
+	packed_refs_file_read_refs,
+	packed_refs_file_write_refs,
+	packed_refs_file_delete_refs,
+	packed_refs_file_add_refs,
+};
+
+static const struct packed_refs_backend packed_refs_table_backend = {
+	"table",
+	REF_TABLE_LIST,
+	packed_refs_table_open,
+	packed_refs_table_release,
+	packed_refs_table_can_bisect,
+	packed_refs_table_read_ref,
+	packed_refs_table_read_refs,
+	packed_refs_table_write_refs,
+	packed_refs_table_delete_refs,
+	packed_refs_table_add_refs,
+};
+
+int repack_without_refs(struct string_list *refnames, struct strbuf *err)
+{
+	struct string_list_item *refname;
+	int needs_repacking = 0;
+
+	assert(err);
+
+	/* Look for a packed ref */
+	for_each_string_list_item(refname, refnames) {
+		struct ref_entry *entry = get_packed_ref(&ref_cache,
+							 refname->string);
+		if (entry) {
+			free_ref_entry(entry);
+			needs_repacking = 1;
+			break;
+		}
+	}
+
+	/* Avoid locking if we have nothing to do */
+	if (!needs_repacking)
+		return 0; /* no refname exists in packed refs */
+
+	return packed_refs_write_backend()->delete_refs(refnames, err);
 }
 
 static int delete_ref_loose(struct ref_lock *lock, int flag, struct strbuf *err)
@@ -2734,6 +3829,8 @@ int delete_ref(const char *refname, const unsigned char *sha1, unsigned int flag
  */
 #define TMP_RENAMED_LOG  "logs/refs/.tmp-renamed-log"
 
+static void remove_reflog_index(const char *refname);
+
 static int rename_tmp_log(const char *newrefname)
 {
 	int attempts_remaining = 4;
@@ -2817,6 +3914,8 @@ int rename_ref(const char *oldrefname, const char *newrefname, const char *logms
 	if (!rename_ref_available(oldrefname, newrefname))
 		return 1;
 
+	if (log)
+		remove_reflog_index(oldrefname);
 	if (log && rename(git_path("logs/%s", oldrefname), git_path(TMP_RENAMED_LOG)))
 		return error("unable to move logfile logs/%s to "TMP_RENAMED_LOG": %s",
 			oldrefname, strerror(errno));
@@ -3083,6 +4182,7 @@ static int write_ref_sha1(struct ref_lock *lock,
 	}
 	if (write_in_full(lock->lock_fd, sha1_to_hex(sha1), 40) != 40 ||
 	    write_in_full(lock->lock_fd, &term, 1) != 1 ||
+	    (fsync_ref_files && fsync(lock->lock_fd) < 0) ||
 	    close_ref(lock) < 0) {
 		int save_errno = errno;
 		error("Couldn't write %s", lock->lk->filename.buf);
@@ -3191,6 +4291,357 @@ int create_symref(const char *ref_target, const char *refs_heads_master,
 	return 0;
 }
 
+/*
+ * Parse the reflog entry in sb (a whole line, including its LF)
+ * without modifying it.  Return 0 on success, or -1 if the line is
+ * corrupt.
+ */
+static int parse_reflog_ent(struct strbuf *sb, unsigned char *osha1,
+			    unsigned char *nsha1, char **email_end,
+			    time_t *timestamp, int *tz, char **message)
+{
+	char *msg;
+
+	/* old SP new SP name <email> SP time TAB msg LF */
+	if (sb->len < 83 || sb->buf[sb->len - 1] != '\n' ||
+	    get_sha1_hex(sb->buf, osha1) || sb->buf[40] != ' ' ||
+	    get_sha1_hex(sb->buf + 41, nsha1) || sb->buf[81] != ' ' ||
+	    !(*email_end = strchr(sb->buf + 82, '>')) ||
+	    (*email_end)[1] != ' ' ||
+	    !(*timestamp = strtoul(*email_end + 2, &msg, 10)) ||
+	    !msg || msg[0] != ' ' ||
+	    (msg[1] != '+' && msg[1] != '-') ||
+	    !isdigit(msg[2]) || !isdigit(msg[3]) ||
+	    !isdigit(msg[4]) || !isdigit(msg[5]))
+		return -1;
+	*tz = strtol(msg + 1, NULL, 10);
+	if (msg[6] != '\t')
+		msg += 6;
+	else
+		msg += 7;
+	*message = msg;
+	return 0;
+}
+
+/*
+ * A reflog index is an optional file next to a reflog, in
+ * $GIT_DIR/logs/.index/<refname>, that records where each entry of the
+ * reflog starts, so that read_ref_at() can bisect for the entry it
+ * wants and reflog_expire() can copy the entries it keeps without
+ * parsing them.  It is used if core.reflogIndex is set.  All numbers
+ * are in network byte order:
+ *
+ *   header:  "RIDX" <be32 version> <be32 number of entries>
+ *            <be64 end of the last entry> <SHA-1 of the last entry>
+ *   entries: <be64 offset of the entry in the reflog>
+ *            <be64 smallest timestamp of this and all later entries>
+ *   trailer: <SHA-1 of everything before it>
+ *
+ * Only entries that the reflog parser accepts are listed.  Because
+ * reflogs are only ever appended to, the entries that follow the
+ * indexed ones are read from the reflog itself; the index is written
+ * anew once there are many of them.  An index whose last entry does
+ * not match the reflog any more is ignored.
+ */
+#define REFLOG_INDEX_SIGNATURE 0x52494458 /* "RIDX" */
+#define REFLOG_INDEX_VERSION 1
+#define REFLOG_INDEX_HEADER_SIZE (4 + 4 + 4 + 8 + 20)
+#define REFLOG_INDEX_ENTRY_SIZE 16
+#define REFLOG_INDEX_MAX_TAIL 256
+
+struct reflog_index_entry {
+	uint64_t offset;
+	time_t min_time;
+};
+
+struct reflog_index {
+	/* The mmapped index file, if there is a usable one: */
+	unsigned char *map;
+	size_t map_size;
+	uint32_t nr_indexed;
+
+	/* The entries that follow the indexed ones: */
+	struct reflog_index_entry *tail;
+	int nr_tail, alloc_tail;
+
+	/* The number of entries, and the end of the last one: */
+	uint32_t nr;
+	uint64_t end;
+};
+
+static inline uint64_t get_be64_split(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void sha1write_be64(struct sha1file *f, uint64_t v)
+{
+	sha1write_be32(f, v >> 32);
+	sha1write_be32(f, v & 0xffffffff);
+}
+
+static const char *reflog_index_path(const char *refname)
+{
+	return git_path("logs/.index/%s", refname);
+}
+
+static void remove_reflog_index(const char *refname)
+{
+	remove_path(reflog_index_path(refname));
+}
+
+static uint64_t reflog_index_offset(struct reflog_index *idx, uint32_t i)
+{
+	if (i >= idx->nr_indexed)
+		return idx->tail[i - idx->nr_indexed].offset;
+	return get_be64_split(idx->map + REFLOG_INDEX_HEADER_SIZE +
+			      (size_t)i * REFLOG_INDEX_ENTRY_SIZE);
+}
+
+/* The smallest timestamp of the i-th entry and all later ones. */
+static time_t reflog_index_min_time(struct reflog_index *idx, uint32_t i)
+{
+	time_t t;
+
+	if (i >= idx->nr_indexed)
+		return idx->tail[i - idx->nr_indexed].min_time;
+	t = get_be64_split(idx->map + REFLOG_INDEX_HEADER_SIZE +
+			   (size_t)i * REFLOG_INDEX_ENTRY_SIZE + 8);
+	if (idx->nr_tail && idx->tail[0].min_time < t)
+		t = idx->tail[0].min_time;
+	return t;
+}
+
+/*
+ * Return the number of entries that are followed (or matched) by an
+ * entry that is not newer than t.  Entry i is the newest entry that
+ * is not newer than t iff the return value is i + 1; if the return
+ * value is i, all entries from i on are newer than t.
+ */
+static uint32_t reflog_index_count_until(struct reflog_index *idx, time_t t)
+{
+	uint32_t lo = 0, hi = idx->nr;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (reflog_index_min_time(idx, mid) <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Compute the SHA-1 of the bytes of fd between start and end. */
+static int hash_reflog_range(int fd, uint64_t start, uint64_t end,
+			     unsigned char *sha1)
+{
+	git_SHA_CTX ctx;
+	size_t len = end - start;
+	char *buf = xmalloc(len);
+
+	if (pread_in_full(fd, buf, len, start) != (ssize_t)len) {
+		free(buf);
+		return -1;
+	}
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, buf, len);
+	git_SHA1_Final(sha1, &ctx);
+	free(buf);
+	return 0;
+}
+
+/*
+ * Map the index of the reflog of refname, which is open on log_fd
+ * and log_size bytes long, into idx if it matches the reflog.
+ */
+static void map_reflog_index(struct reflog_index *idx, const char *refname,
+			     int log_fd, uint64_t log_size)
+{
+	unsigned char sha1[20];
+	unsigned char *map;
+	size_t size;
+	uint32_t nr;
+	uint64_t end, last;
+	struct stat st;
+	int fd = open(reflog_index_path(refname), O_RDONLY);
+
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) ||
+	    st.st_size < REFLOG_INDEX_HEADER_SIZE + 20) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	nr = get_be32(map + 8);
+	end = get_be64_split(map + 12);
+	if (get_be32(map) != REFLOG_INDEX_SIGNATURE ||
+	    get_be32(map + 4) != REFLOG_INDEX_VERSION ||
+	    size != REFLOG_INDEX_HEADER_SIZE +
+		    (uint64_t)nr * REFLOG_INDEX_ENTRY_SIZE + 20 ||
+	    !nr || end > log_size)
+		goto stale;
+	last = get_be64_split(map + REFLOG_INDEX_HEADER_SIZE +
+			      (size_t)(nr - 1) * REFLOG_INDEX_ENTRY_SIZE);
+	if (last >= end || end - last > 65536 ||
+	    hash_reflog_range(log_fd, last, end, sha1) ||
+	    hashcmp(sha1, map + 20))
+		goto stale;
+
+	idx->map = map;
+	idx->map_size = size;
+	idx->nr_indexed = nr;
+	idx->end = end;
+	return;
+
+stale:
+	munmap(map, size);
+}
+
+/* Read the entries after the indexed ones from the reflog open on fp. */
+static void read_reflog_tail(struct reflog_index *idx, FILE *fp)
+{
+	struct strbuf sb = STRBUF_INIT;
+	uint64_t pos = idx->end;
+	int i;
+
+	if (fseek(fp, pos, SEEK_SET))
+		return;
+	while (!strbuf_getwholeline(&sb, fp, '\n')) {
+		unsigned char osha1[20], nsha1[20];
+		char *email_end, *message;
+		time_t timestamp;
+		int tz;
+
+		if (sb.buf[sb.len - 1] != '\n')
+			break; /* still being written */
+		if (!parse_reflog_ent(&sb, osha1, nsha1, &email_end,
+				      &timestamp, &tz, &message)) {
+			ALLOC_GROW(idx->tail, idx->nr_tail + 1, idx->alloc_tail);
+			idx->tail[idx->nr_tail].offset = pos;
+			idx->tail[idx->nr_tail].min_time = timestamp;
+			idx->nr_tail++;
+			idx->end = pos + sb.len;
+		}
+		pos += sb.len;
+	}
+	for (i = idx->nr_tail - 1; i > 0; i--)
+		if (idx->tail[i].min_time < idx->tail[i - 1].min_time)
+			idx->tail[i - 1].min_time = idx->tail[i].min_time;
+	strbuf_release(&sb);
+}
+
+/*
+ * Write an index for the reflog of refname, whose nr entries are
+ * described by entries and whose last entry ends at end.  The
+ * min_time of the entries need only be their own timestamps.  The
+ * index is an optimization, so failing to write it is not an error.
+ */
+static void write_reflog_index(const char *refname,
+			       struct reflog_index_entry *entries, uint32_t nr,
+			       uint64_t end)
+{
+	unsigned char last_sha1[20];
+	char *path, *tmp_path;
+	struct sha1file *f;
+	uint32_t i;
+	int fd;
+
+	if (!nr)
+		return;
+	fd = open(git_path("logs/%s", refname), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (hash_reflog_range(fd, entries[nr - 1].offset, end, last_sha1)) {
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	path = xstrdup(reflog_index_path(refname));
+	tmp_path = git_pathdup("logs/.index/tmp_reflog_index_XXXXXX");
+	if (safe_create_leading_directories(path) ||
+	    (fd = git_mkstemp_mode(tmp_path, 0444)) < 0)
+		goto out;
+
+	for (i = nr - 1; i > 0; i--)
+		if (entries[i].min_time < entries[i - 1].min_time)
+			entries[i - 1].min_time = entries[i].min_time;
+
+	f = sha1fd(fd, tmp_path);
+	sha1write_be32(f, REFLOG_INDEX_SIGNATURE);
+	sha1write_be32(f, REFLOG_INDEX_VERSION);
+	sha1write_be32(f, nr);
+	sha1write_be64(f, end);
+	sha1write(f, last_sha1, 20);
+	for (i = 0; i < nr; i++) {
+		sha1write_be64(f, entries[i].offset);
+		sha1write_be64(f, entries[i].min_time);
+	}
+	sha1close(f, NULL, CSUM_CLOSE);
+
+	if (adjust_shared_perm(tmp_path) || rename(tmp_path, path))
+		unlink_or_warn(tmp_path);
+out:
+	free(tmp_path);
+	free(path);
+}
+
+static void release_reflog_index(struct reflog_index *idx)
+{
+	if (idx->map)
+		munmap(idx->map, idx->map_size);
+	free(idx->tail);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Read the index of the reflog of refname, adding the entries that
+ * were appended to the reflog since it was written, and write it anew
+ * if there are many of those.  Return 0 on success, or -1 if there is
+ * no such reflog.
+ */
+static int read_reflog_index(const char *refname, struct reflog_index *idx)
+{
+	struct stat st;
+	FILE *fp;
+
+	memset(idx, 0, sizeof(*idx));
+	fp = fopen(git_path("logs/%s", refname), "r");
+	if (!fp)
+		return -1;
+	if (fstat(fileno(fp), &st)) {
+		fclose(fp);
+		return -1;
+	}
+	map_reflog_index(idx, refname, fileno(fp), st.st_size);
+	read_reflog_tail(idx, fp);
+	fclose(fp);
+	idx->nr = idx->nr_indexed + idx->nr_tail;
+
+	if (idx->nr_tail >= REFLOG_INDEX_MAX_TAIL) {
+		struct reflog_index_entry *entries;
+		uint32_t i;
+
+		entries = xcalloc(idx->nr, sizeof(*entries));
+		for (i = 0; i < idx->nr; i++) {
+			entries[i].offset = reflog_index_offset(idx, i);
+			entries[i].min_time = reflog_index_min_time(idx, i);
+		}
+		write_reflog_index(refname, entries, idx->nr, idx->end);
+		free(entries);
+	}
+	return 0;
+}
+
+static int for_each_reflog_ent_reverse_from(const char *refname, long end,
+					    each_reflog_ent_fn fn, void *cb_data);
+
 struct read_ref_at_cb {
 	const char *refname;
 	time_t at_time;
@@ -3277,6 +4728,53 @@ static int read_ref_at_ent_oldest(unsigned char *osha1, unsigned char *nsha1,
 	return 1;
 }
 
+/*
+ * Do the work of read_ref_at() with the help of the reflog index:
+ * find the entry that the backward scan would stop at, and only scan
+ * it and the entry after it.  Return -1 if there is no index to use.
+ */
+static int read_ref_at_indexed(struct read_ref_at_cb *cb)
+{
+	struct reflog_index idx;
+	int64_t target = -1;
+	uint32_t start;
+	long end = -1;
+
+	if (read_reflog_index(cb->refname, &idx))
+		return -1;
+	if (!idx.nr) {
+		release_reflog_index(&idx);
+		return -1;
+	}
+
+	/* The newest entry not newer than at_time, or the cnt-th newest: */
+	target = (int64_t)reflog_index_count_until(&idx, cb->at_time) - 1;
+	if (cb->cnt >= 0 && cb->cnt < idx.nr &&
+	    target < (int64_t)idx.nr - 1 - cb->cnt)
+		target = idx.nr - 1 - cb->cnt;
+	if (target < 0) {
+		/* All entries are scanned without success. */
+		cb->reccnt = idx.nr;
+		release_reflog_index(&idx);
+		return 0;
+	}
+
+	/*
+	 * Start at the entry after the target, if any, so that it can be
+	 * checked against the target, and pretend that the entries after
+	 * it have been scanned already.
+	 */
+	start = target + 1 < idx.nr ? target + 1 : target;
+	if (start + 1 < idx.nr)
+		end = reflog_index_offset(&idx, start + 1);
+	cb->reccnt = idx.nr - 1 - start;
+	if (cb->cnt > 0)
+		cb->cnt -= cb->reccnt;
+	release_reflog_index(&idx);
+	for_each_reflog_ent_reverse_from(cb->refname, end, read_ref_at_ent, cb);
+	return 0;
+}
+
 int read_ref_at(const char *refname, unsigned int flags, time_t at_time, int cnt,
 		unsigned char *sha1, char **msg,
 		time_t *cutoff_time, int *cutoff_tz, int *cutoff_cnt)
@@ -3293,7 +4791,8 @@ int read_ref_at(const char *refname, unsigned int flags, time_t at_time, int cnt
 	cb.cutoff_cnt = cutoff_cnt;
 	cb.sha1 = sha1;
 
-	for_each_reflog_ent_reverse(refname, read_ref_at_ent, &cb);
+	if (!core_reflog_index || read_ref_at_indexed(&cb))
+		for_each_reflog_ent_reverse(refname, read_ref_at_ent, &cb);
 
 	if (!cb.reccnt) {
 		if (flags & GET_SHA1_QUIETLY)
@@ -3319,6 +4818,7 @@ int reflog_exists(const char *refname)
 
 int delete_reflog(const char *refname)
 {
+	remove_reflog_index(refname);
 	return remove_path(git_path("logs/%s", refname));
 }
 
@@ -3329,24 +4829,10 @@ static int show_one_reflog_ent(struct strbuf *sb, each_reflog_ent_fn fn, void *c
 	time_t timestamp;
 	int tz;
 
-	/* old SP new SP name <email> SP time TAB msg LF */
-	if (sb->len < 83 || sb->buf[sb->len - 1] != '\n' ||
-	    get_sha1_hex(sb->buf, osha1) || sb->buf[40] != ' ' ||
-	    get_sha1_hex(sb->buf + 41, nsha1) || sb->buf[81] != ' ' ||
-	    !(email_end = strchr(sb->buf + 82, '>')) ||
-	    email_end[1] != ' ' ||
-	    !(timestamp = strtoul(email_end + 2, &message, 10)) ||
-	    !message || message[0] != ' ' ||
-	    (message[1] != '+' && message[1] != '-') ||
-	    !isdigit(message[2]) || !isdigit(message[3]) ||
-	    !isdigit(message[4]) || !isdigit(message[5]))
+	if (parse_reflog_ent(sb, osha1, nsha1, &email_end, &timestamp, &tz,
+			     &message))
 		return 0; /* corrupt? */
 	email_end[1] = '\0';
-	tz = strtol(message + 1, NULL, 10);
-	if (message[6] != '\t')
-		message += 6;
-	else
-		message += 7;
 	return fn(osha1, nsha1, sb->buf + 82, timestamp, tz, message, cb_data);
 }
 
@@ -3361,7 +4847,13 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+/*
+ * Call fn for the entries of the reflog of refname that end at or
+ * before the offset end (at the end of the file if end is negative),
+ * newest first.
+ */
+static int for_each_reflog_ent_reverse_from(const char *refname, long end,
+					    each_reflog_ent_fn fn, void *cb_data)
 {
 	struct strbuf sb = STRBUF_INIT;
 	FILE *logfp;
@@ -3377,6 +4869,8 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void
 		return error("cannot seek back reflog for %s: %s",
 			     refname, strerror(errno));
 	pos = ftell(logfp);
+	if (0 <= end && end < pos)
+		pos = end;
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -3463,22 +4957,41 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void
 	return ret;
 }
 
-int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+{
+	return for_each_reflog_ent_reverse_from(refname, -1, fn, cb_data);
+}
+
+/*
+ * Call fn for the entries of the reflog of refname that start before
+ * the offset end (all of them if end is negative), oldest first.
+ */
+static int for_each_reflog_ent_until(const char *refname, long end,
+				     each_reflog_ent_fn fn, void *cb_data)
 {
 	FILE *logfp;
 	struct strbuf sb = STRBUF_INIT;
+	long pos = 0;
 	int ret = 0;
 
 	logfp = fopen(git_path("logs/%s", refname), "r");
 	if (!logfp)
 		return -1;
 
-	while (!ret && !strbuf_getwholeline(&sb, logfp, '\n'))
+	while (!ret && (end < 0 || pos < end) &&
+	       !strbuf_getwholeline(&sb, logfp, '\n')) {
+		pos += sb.len;
 		ret = show_one_reflog_ent(&sb, fn, cb_data);
+	}
 	fclose(logfp);
 	strbuf_release(&sb);
 	return ret;
 }
+
+int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+{
+	return for_each_reflog_ent_until(refname, -1, fn, cb_data);
+}
 /*
  * Call fn for each reflog in the namespace indicated by name.  name
  * must be empty or end with '/'.  Name will be used as a scratch
@@ -3754,6 +5267,109 @@ static int ref_update_reject_duplicates(struct ref_update **updates, int n,
 	return 0;
 }
 
+/*
+ * Count the updates that set a reference to a new value.
+ */
+static int count_new_values(struct ref_update **updates, int n)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < n; i++)
+		if ((updates[i]->flags & REF_HAVE_NEW) &&
+		    !is_null_sha1(updates[i]->new_sha1))
+			nr++;
+	return nr;
+}
+
+/*
+ * Write the new values of the locked updates that set a reference
+ * that is neither a loose nor a symbolic reference to the packed
+ * references, all at once, and release their locks.  The reflogs of
+ * those references are written first, just like write_ref_sha1()
+ * does.  The other updates are left alone.
+ */
+static int write_packed_ref_updates(struct ref_update **updates, int n,
+				    struct strbuf *err)
+{
+	struct ref_entry *root = create_dir_entry(&ref_cache, "", 0, 0);
+	struct ref_dir *dir = get_ref_dir(root);
+	struct ref_update **batch = NULL;
+	unsigned char head_sha1[20];
+	const char *head_ref;
+	int head_flag, i, nr = 0, alloc = 0, ret = 0;
+
+	for (i = 0; i < n; i++) {
+		struct ref_update *update = updates[i];
+		struct ref_lock *lock = update->lock;
+		struct object *o;
+
+		if (!(update->flags & REF_HAVE_NEW) ||
+		    is_null_sha1(update->new_sha1) ||
+		    !starts_with(lock->ref_name, "refs/") ||
+		    (update->type & REF_ISSYMREF) ||
+		    !((update->type & REF_ISPACKED) ||
+		      is_null_sha1(lock->old_sha1)) ||
+		    !hashcmp(lock->old_sha1, update->new_sha1))
+			continue;
+
+		o = parse_object(update->new_sha1);
+		if (!o) {
+			error("Trying to write ref %s with nonexistent object %s",
+			      lock->ref_name, sha1_to_hex(update->new_sha1));
+			ret = -1;
+		} else if (o->type != OBJ_COMMIT && is_branch(lock->ref_name)) {
+			error("Trying to write non-commit object %s to branch %s",
+			      sha1_to_hex(update->new_sha1), lock->ref_name);
+			ret = -1;
+		} else if (!is_refname_available(lock->ref_name, NULL, dir)) {
+			ret = -1;
+		}
+		if (ret) {
+			strbuf_addf(err, "Cannot update the ref '%s'.",
+				    update->refname);
+			goto out;
+		}
+		add_ref(dir, create_ref_entry(lock->ref_name, update->new_sha1,
+					      REF_ISPACKED, 0));
+		ALLOC_GROW(batch, nr + 1, alloc);
+		batch[nr++] = update;
+	}
+	if (!nr)
+		goto out;
+
+	head_ref = resolve_ref_unsafe("HEAD", RESOLVE_REF_READING,
+				      head_sha1, &head_flag);
+	for (i = 0; i < nr; i++) {
+		struct ref_lock *lock = batch[i]->lock;
+
+		if (log_ref_write(lock->ref_name, lock->old_sha1,
+				  batch[i]->new_sha1, batch[i]->msg) < 0) {
+			strbuf_addf(err, "Cannot update the ref '%s'.",
+				    batch[i]->refname);
+			ret = -1;
+			goto out;
+		}
+		if (head_ref && (head_flag & REF_ISSYMREF) &&
+		    !strcmp(head_ref, lock->ref_name))
+			log_ref_write("HEAD", lock->old_sha1, batch[i]->new_sha1,
+				      batch[i]->msg);
+	}
+
+	if (packed_refs_write_backend()->add_refs(dir, err)) {
+		ret = -1;
+		goto out;
+	}
+	for (i = 0; i < nr; i++) {
+		unlock_ref(batch[i]->lock);
+		batch[i]->lock = NULL;
+	}
+
+out:
+	free(batch);
+	free_ref_entry(root);
+	return ret;
+}
+
 int ref_transaction_commit(struct ref_transaction *transaction,
 			   struct strbuf *err)
 {
@@ -3804,11 +5420,22 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 		}
 	}
 
-	/* Perform updates first so live commits remain referenced */
+	/*
+	 * Perform updates first so live commits remain referenced.
+	 * Many of them are written to the packed refs in one go.
+	 */
+	if (core_batch_ref_updates > 0 &&
+	    count_new_values(updates, n) >= core_batch_ref_updates &&
+	    write_packed_ref_updates(updates, n, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
 	for (i = 0; i < n; i++) {
 		struct ref_update *update = updates[i];
 		int flags = update->flags;
 
+		if (!update->lock)
+			continue; /* written to the packed refs */
 		if ((flags & REF_HAVE_NEW) && !is_null_sha1(update->new_sha1)) {
 			int overwriting_symref = ((update->type & REF_ISSYMREF) &&
 						  (update->flags & REF_NODEREF));
@@ -3856,8 +5483,10 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 		ret = TRANSACTION_GENERIC_ERROR;
 		goto cleanup;
 	}
-	for_each_string_list_item(ref_to_delete, &refs_to_delete)
+	for_each_string_list_item(ref_to_delete, &refs_to_delete) {
 		unlink_or_warn(git_path("logs/%s", ref_to_delete->string));
+		remove_reflog_index(ref_to_delete->string);
+	}
 	clear_loose_ref_cache(&ref_cache);
 
 cleanup:
@@ -3991,19 +5620,18 @@ int parse_hide_refs_config(const char *var, const char *value, const char *secti
 
 int ref_is_hidden(const char *refname)
 {
-	struct string_list_item *item;
+	return ref_excluded(hide_refs, refname) != NULL;
+}
 
-	if (!hide_refs)
-		return 0;
-	for_each_string_list_item(item, hide_refs) {
-		int len;
-		if (!starts_with(refname, item->string))
-			continue;
-		len = strlen(item->string);
-		if (!refname[len] || refname[len] == '/')
-			return 1;
-	}
-	return 0;
+int for_each_namespaced_ref_unhidden(each_ref_fn fn, void *cb_data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+	strbuf_addf(&buf, "%srefs/", get_git_namespace());
+	ret = do_for_each_ref_excluding(&ref_cache, buf.buf, hide_refs,
+					fn, 0, 0, cb_data);
+	strbuf_release(&buf);
+	return ret;
 }
 
 struct expire_reflog_cb {
@@ -4012,6 +5640,10 @@ struct expire_reflog_cb {
 	void *policy_cb;
 	FILE *newlog;
 	unsigned char last_kept_sha1[20];
+
+	/* Where the kept entries start in newlog, if they are tracked: */
+	struct reflog_index_entry *kept;
+	int nr_kept, alloc_kept, track_kept;
 };
 
 static int expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
@@ -4032,6 +5664,13 @@ static int expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
 			printf("prune %s", message);
 	} else {
 		if (cb->newlog) {
+			if (cb->track_kept) {
+				ALLOC_GROW(cb->kept, cb->nr_kept + 1,
+					   cb->alloc_kept);
+				cb->kept[cb->nr_kept].offset = ftell(cb->newlog);
+				cb->kept[cb->nr_kept].min_time = timestamp;
+				cb->nr_kept++;
+			}
 			fprintf(cb->newlog, "%s %s %s %ld %+05d\t%s",
 				sha1_to_hex(osha1), sha1_to_hex(nsha1),
 				email, timestamp, tz, message);
@@ -4043,10 +5682,98 @@ static int expire_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
 	return 0;
 }
 
+/*
+ * Expire the entries of the reflog of refname with the help of its
+ * index: the entries from the first one after which none is older
+ * than since are known to be kept, so only the entries before it are
+ * passed to expire_reflog_ent(), and the rest is copied to cb->newlog
+ * as it is.  Return -1 if nothing was done because there is no index
+ * to use, no entry is known to be kept, or the entries to copy cannot
+ * be read or are not all well-formed; nothing has been written to
+ * cb->newlog then.  Otherwise return 0 and append the entries that
+ * were copied to cb->kept; an error writing them is left for the
+ * caller to find when it closes cb->newlog.
+ */
+static int expire_reflog_indexed(const char *refname, time_t since,
+				 struct expire_reflog_cb *cb)
+{
+	struct reflog_index idx;
+	struct strbuf sb = STRBUF_INIT, ent = STRBUF_INIT;
+	unsigned char osha1[20], nsha1[20];
+	char *email_end, *message;
+	uint64_t start, delta;
+	uint32_t first, i;
+	time_t timestamp;
+	int tz, fd, ret = -1;
+
+	if (read_reflog_index(refname, &idx))
+		return -1;
+	first = reflog_index_count_until(&idx, since - 1);
+	if (first >= idx.nr)
+		goto out;
+
+	/* Read the entries to copy before writing anything. */
+	start = reflog_index_offset(&idx, first);
+	fd = open(git_path("logs/%s", refname), O_RDONLY);
+	if (fd < 0)
+		goto out;
+	strbuf_grow(&sb, idx.end - start);
+	if (pread_in_full(fd, sb.buf, idx.end - start, start) !=
+	    (ssize_t)(idx.end - start)) {
+		close(fd);
+		goto out;
+	}
+	close(fd);
+	strbuf_setlen(&sb, idx.end - start);
+
+	/*
+	 * The normal path drops malformed lines; leave it to do so if
+	 * there are any.  The last entry is the last one that is kept.
+	 */
+	for (i = first; i < idx.nr; i++) {
+		uint64_t off = reflog_index_offset(&idx, i) - start;
+		uint64_t end = i + 1 < idx.nr ?
+			reflog_index_offset(&idx, i + 1) - start : sb.len;
+
+		if (off >= end || end > sb.len ||
+		    memchr(sb.buf + off, '\n', end - off - 1))
+			goto out;
+		strbuf_reset(&ent);
+		strbuf_add(&ent, sb.buf + off, end - off);
+		if (parse_reflog_ent(&ent, osha1, nsha1, &email_end,
+				     &timestamp, &tz, &message))
+			goto out;
+	}
+
+	if (for_each_reflog_ent_until(refname, start, expire_reflog_ent, cb) < 0)
+		goto out;
+	ret = 0;
+	delta = ftell(cb->newlog) - start;
+	fwrite(sb.buf, 1, sb.len, cb->newlog);
+
+	hashcpy(cb->last_kept_sha1, nsha1);
+	if (cb->track_kept) {
+		for (i = first; i < idx.nr; i++) {
+			ALLOC_GROW(cb->kept, cb->nr_kept + 1, cb->alloc_kept);
+			cb->kept[cb->nr_kept].offset =
+				reflog_index_offset(&idx, i) + delta;
+			cb->kept[cb->nr_kept].min_time =
+				reflog_index_min_time(&idx, i);
+			cb->nr_kept++;
+		}
+	}
+out:
+	strbuf_release(&sb);
+	strbuf_release(&ent);
+	release_reflog_index(&idx);
+	return ret;
+}
+
 int reflog_expire(const char *refname, const unsigned char *sha1,
 		 unsigned int flags,
 		 reflog_expiry_prepare_fn prepare_fn,
 		 reflog_expiry_should_prune_fn should_prune_fn,
+		 reflog_expiry_keep_since_fn keep_since_fn,
 		 reflog_expiry_cleanup_fn cleanup_fn,
 		 void *policy_cb_data)
 {
@@ -4054,6 +5781,7 @@ int reflog_expire(const char *refname, const unsigned char *sha1,
 	struct expire_reflog_cb cb;
 	struct ref_lock *lock;
 	char *log_file;
+	time_t since = 0;
 	int status = 0;
 	int type;
 
@@ -4100,7 +5828,14 @@ int reflog_expire(const char *refname, const unsigned char *sha1,
 	}
 
 	(*prepare_fn)(refname, sha1, cb.policy_cb);
-	for_each_reflog_ent(refname, expire_reflog_ent, &cb);
+	if (core_reflog_index && cb.newlog) {
+		cb.track_kept = 1;
+		if (keep_since_fn &&
+		    !(flags & (EXPIRE_REFLOGS_VERBOSE | EXPIRE_REFLOGS_REWRITE)))
+			since = (*keep_since_fn)(cb.policy_cb);
+	}
+	if (!since || expire_reflog_indexed(refname, since, &cb))
+		for_each_reflog_ent(refname, expire_reflog_ent, &cb);
 	(*cleanup_fn)(cb.policy_cb);
 
 	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
@@ -4132,13 +5867,23 @@ int reflog_expire(const char *refname, const unsigned char *sha1,
 		} else if (update && commit_ref(lock)) {
 			status |= error("couldn't set %s", lock->ref_name);
 		}
+
+		remove_reflog_index(refname);
+		if (!status && cb.nr_kept) {
+			struct stat st;
+			if (!stat(log_file, &st))
+				write_reflog_index(refname, cb.kept, cb.nr_kept,
+						   st.st_size);
+		}
 	}
+	free(cb.kept);
 	free(log_file);
 	unlock_ref(lock);
 	return status;
 
  failure:
 	rollback_lock_file(&reflog_lock);
+	free(cb.kept);
 	free(log_file);
 	unlock_ref(lock);
 	return -1;
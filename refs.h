@@ -107,6 +107,13 @@ static inline const char *has_glob_specials(const char *pattern)
 /* can be used to learn about broken ref and symref */
 extern int for_each_rawref(each_ref_fn, void *);
 
+/*
+ * Like for_each_rawref(), but only for the references whose full
+ * names start with prefix, which need not end at a '/'.  Neither the
+ * loose nor the packed references outside of prefix are read.
+ */
+extern int for_each_rawref_in(const char *prefix, each_ref_fn, void *);
+
 extern void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname);
 extern void warn_dangling_symrefs(FILE *fp, const char *msg_fmt, const struct string_list *refnames);
 
@@ -379,6 +386,12 @@ int update_ref(const char *msg, const char *refname,
 extern int parse_hide_refs_config(const char *var, const char *value, const char *);
 extern int ref_is_hidden(const char *);
 
+/*
+ * Like for_each_namespaced_ref(), but skip the references for which
+ * ref_is_hidden() is true, without reading the hidden hierarchies.
+ */
+extern int for_each_namespaced_ref_unhidden(each_ref_fn fn, void *cb_data);
+
 enum expire_reflog_flags {
 	EXPIRE_REFLOGS_DRY_RUN = 1 << 0,
 	EXPIRE_REFLOGS_UPDATE_REF = 1 << 1,
@@ -388,7 +401,7 @@ enum expire_reflog_flags {
 
 /*
  * The following interface is used for reflog expiration. The caller
- * calls reflog_expire(), supplying it with three callback functions,
+ * calls reflog_expire(), supplying it with four callback functions,
  * of the following types. The callback functions define the
  * expiration policy that is desired.
  *
@@ -399,6 +412,12 @@ enum expire_reflog_flags {
  *     existing reflog. It should return true iff that entry should be
  *     pruned.
  *
+ * reflog_expiry_keep_since_fn -- Optional; called once after the
+ *     prepare function. It may return a timestamp such that
+ *     reflog_expiry_should_prune_fn would keep every entry that is not
+ *     older, in which case such entries may be kept without asking
+ *     it; or 0 if every entry has to be asked about.
+ *
  * reflog_expiry_cleanup_fn -- Called once before the reference is
  *     unlocked again.
  */
@@ -410,18 +429,20 @@ typedef int reflog_expiry_should_prune_fn(unsigned char *osha1,
 					  const char *email,
 					  time_t timestamp, int tz,
 					  const char *message, void *cb_data);
+typedef time_t reflog_expiry_keep_since_fn(void *cb_data);
 typedef void reflog_expiry_cleanup_fn(void *cb_data);
 
 /*
  * Expire reflog entries for the specified reference. sha1 is the old
  * value of the reference. flags is a combination of the constants in
- * enum expire_reflog_flags. The three function pointers are described
+ * enum expire_reflog_flags. The four function pointers are described
  * above. On success, return zero.
  */
 extern int reflog_expire(const char *refname, const unsigned char *sha1,
 			 unsigned int flags,
 			 reflog_expiry_prepare_fn prepare_fn,
 			 reflog_expiry_should_prune_fn should_prune_fn,
+			 reflog_expiry_keep_since_fn keep_since_fn,
 			 reflog_expiry_cleanup_fn cleanup_fn,
 			 void *policy_cb_data);
 
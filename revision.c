@@ -18,6 +18,8 @@
 #include "commit-slab.h"
 #include "dir.h"
 #include "cache-tree.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -478,8 +480,91 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	struct pathspec *ps = &revs->pruning.pathspec;
+	const struct bloom_filter_settings *settings;
+	int i;
+
+	if (!revs->prune || !ps->nr || revs->bloom_keys)
+		return;
+	if (ps->magic & ~PATHSPEC_LITERAL)
+		return;
+	settings = commit_graph_bloom_filter_settings();
+	if (!settings)
+		return;
+
+	for (i = 0; i < ps->nr; i++) {
+		const struct pathspec_item *item = &ps->items[i];
+		if (item->magic & ~PATHSPEC_LITERAL)
+			return;
+		if (item->nowildcard_len < item->len)
+			return;
+		if (!item->len || item->match[item->len - 1] == '/')
+			return;
+	}
+
+	revs->bloom_filter_settings = settings;
+	revs->bloom_keys_nr = ps->nr;
+	revs->bloom_keys = xcalloc(ps->nr, sizeof(*revs->bloom_keys));
+	for (i = 0; i < ps->nr; i++)
+		fill_bloom_key(ps->items[i].match, ps->items[i].len,
+			       &revs->bloom_keys[i], settings);
+}
+
+static void release_bloom_keys(struct rev_info *revs)
+{
+	static struct trace_key trace_bloom_stats = TRACE_KEY_INIT(BLOOM_STATS);
+	int i;
+
+	if (!revs->bloom_keys)
+		return;
+	trace_printf_key(&trace_bloom_stats,
+			 "filter not present: %u\n"
+			 "definitely not: %u\n"
+			 "maybe: %u\n",
+			 revs->bloom_filter_not_present,
+			 revs->bloom_definitely_not,
+			 revs->bloom_maybe);
+	revs->bloom_filter_not_present = 0;
+	revs->bloom_definitely_not = 0;
+	revs->bloom_maybe = 0;
+
+	for (i = 0; i < revs->bloom_keys_nr; i++)
+		clear_bloom_key(&revs->bloom_keys[i]);
+	free(revs->bloom_keys);
+	revs->bloom_keys = NULL;
+	revs->bloom_keys_nr = 0;
+}
+
+/*
+ * Returns 0 if the Bloom filter of the commit says none of the paths
+ * we are limited to changed relative to its first parent, 1 if they
+ * may have, and -1 if the commit has no filter.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter filter;
+	int i;
+
+	if (!load_commit_graph_bloom_filter(commit, &filter)) {
+		revs->bloom_filter_not_present++;
+		return -1;
+	}
+	for (i = 0; i < revs->bloom_keys_nr; i++)
+		if (bloom_filter_contains(&filter, &revs->bloom_keys[i],
+					  revs->bloom_filter_settings)) {
+			revs->bloom_maybe++;
+			return 1;
+		}
+	revs->bloom_definitely_not++;
+	return 0;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
 	struct tree *t1 = parent->tree;
 	struct tree *t2 = commit->tree;
@@ -507,6 +592,11 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/* the filters record the changes against the first parent only */
+	if (revs->bloom_keys_nr && !nth_parent &&
+	    !check_maybe_different_in_bloom_filter(revs, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
@@ -709,7 +799,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    sha1_to_hex(commit->object.sha1),
 			    sha1_to_hex(p->object.sha1));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -2776,6 +2866,7 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	prepare_to_use_bloom_filter(revs);
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
@@ -3292,6 +3383,7 @@ struct commit *get_revision(struct rev_info *revs)
 		reversed = NULL;
 		while ((c = get_revision_internal(revs)))
 			commit_list_insert(c, &reversed);
+		release_bloom_keys(revs);
 		revs->commits = reversed;
 		revs->reverse = 0;
 		revs->reverse_output_stage = 1;
@@ -3309,6 +3401,7 @@ struct commit *get_revision(struct rev_info *revs)
 		graph_update(revs->graph, c);
 	if (!c) {
 		free_saved_parents(revs);
+		release_bloom_keys(revs);
 		if (revs->previous_parents) {
 			free_commit_list(revs->previous_parents);
 			revs->previous_parents = NULL;
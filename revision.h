@@ -29,6 +29,8 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct bloom_key;
+struct bloom_filter_settings;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -210,6 +212,21 @@ struct rev_info {
 
 	struct commit_list *previous_parents;
 	const char *break_bar;
+
+	/*
+	 * Changed-path Bloom filter keys for the paths we are limited
+	 * to, if the commit-graph has filters and the pathspec allows
+	 * their use; see prepare_to_use_bloom_filter().  They are
+	 * released once get_revision() has returned the last commit,
+	 * and the counts of the answers the filters gave are then shown
+	 * with GIT_TRACE_BLOOM_STATS.
+	 */
+	struct bloom_key *bloom_keys;
+	int bloom_keys_nr;
+	const struct bloom_filter_settings *bloom_filter_settings;
+	unsigned bloom_filter_not_present;
+	unsigned bloom_definitely_not;
+	unsigned bloom_maybe;
 };
 
 extern int ref_excluded(struct string_list *, const char *path);
@@ -343,12 +343,28 @@ void setup_work_tree(void)
 	initialized = 1;
 }
 
+static struct string_list unknown_extensions = STRING_LIST_INIT_DUP;
+
 static int check_repo_format(const char *var, const char *value, void *cb)
 {
+	const char *ext;
+
 	if (strcmp(var, "core.repositoryformatversion") == 0)
 		repository_format_version = git_config_int(var, value);
 	else if (strcmp(var, "core.sharedrepository") == 0)
 		shared_repository = git_config_perm(var, value);
+	else if (skip_prefix(var, "extensions.", &ext)) {
+		/*
+		 * Record the extensions we know about; any other one
+		 * makes check_repository_format_gently() refuse the
+		 * repository.
+		 */
+		if (!strcmp(ext, "packedrefs") && value &&
+		    (!strcmp(value, "table") || !strcmp(value, "file")))
+			repository_format_ref_tables = !strcmp(value, "table");
+		else
+			string_list_append(&unknown_extensions, ext);
+	}
 	return 0;
 }
 
@@ -375,17 +391,35 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	 * Use a gentler version of git_config() to check if this repo
 	 * is a good one.
 	 */
+	string_list_clear(&unknown_extensions, 0);
+	repository_format_ref_tables = 0;
 	git_config_early(fn, NULL, repo_config);
-	if (GIT_REPO_VERSION < repository_format_version) {
+	if (GIT_REPO_VERSION_READ < repository_format_version) {
 		if (!nongit_ok)
 			die ("Expected git repo version <= %d, found %d",
-			     GIT_REPO_VERSION, repository_format_version);
+			     GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Expected git repo version <= %d, found %d",
-			GIT_REPO_VERSION, repository_format_version);
+			GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Please upgrade Git");
 		*nongit_ok = -1;
 		ret = -1;
 	}
+
+	/* Extensions are only honored by version 1 repositories. */
+	if (repository_format_version < 1) {
+		repository_format_ref_tables = 0;
+	} else if (unknown_extensions.nr && !ret) {
+		int i;
+
+		if (!nongit_ok)
+			die("unknown repository extension found: %s",
+			    unknown_extensions.items[0].string);
+		for (i = 0; i < unknown_extensions.nr; i++)
+			warning("unknown repository extension: %s",
+				unknown_extensions.items[i].string);
+		*nongit_ok = -1;
+		ret = -1;
+	}
 	strbuf_release(&sb);
 	return ret;
 }
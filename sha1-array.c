@@ -33,6 +33,21 @@ int sha1_array_lookup(struct sha1_array *array, const unsigned char *sha1)
 	return sha1_pos(sha1, array->sha1, array->nr, sha1_access);
 }
 
+void sha1_array_insert(struct sha1_array *array, const unsigned char *sha1)
+{
+	int pos = sha1_array_lookup(array, sha1);
+
+	if (pos >= 0)
+		return;
+	pos = -pos - 1;
+
+	ALLOC_GROW(array->sha1, array->nr + 1, array->alloc);
+	memmove(array->sha1 + pos + 1, array->sha1 + pos,
+		(array->nr - pos) * sizeof(*array->sha1));
+	hashcpy(array->sha1[pos], sha1);
+	array->nr++;
+}
+
 void sha1_array_clear(struct sha1_array *array)
 {
 	free(array->sha1);
@@ -23,6 +23,9 @@
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "midx.h"
+#include "thread-utils.h"
+#include "sha1-array.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -66,6 +69,13 @@ static struct cached_object empty_tree = {
  */
 static struct packed_git *last_found_pack;
 
+/*
+ * The multi-pack index of the local object directory, if one exists
+ * and covers every pack it names; see prepare_multi_pack_index().
+ */
+static struct multi_pack_index *multi_pack_index;
+static void close_multi_pack_index(void);
+
 static struct cached_object *find_cached_object(const unsigned char *sha1)
 {
 	int i;
@@ -293,6 +303,7 @@ static int link_alt_odb_entry(const char *entry, const char *relative_base,
 
 	entlen = pfxlen + 43; /* '/' + 2 hex + '/' + 38 hex + NUL */
 	ent = xmalloc(sizeof(*ent) + entlen);
+	ent->loose_cache = NULL;
 	memcpy(ent->base, pathbuf.buf, pfxlen);
 	strbuf_release(&pathbuf);
 
@@ -459,8 +470,83 @@ static int check_and_freshen_file(const char *fn, int freshen)
 	return 1;
 }
 
+/*
+ * With core.looseObjectCache, the loose objects of each fan-out
+ * directory are listed once and kept in a sorted sha1_array, so that
+ * asking for an object we do not have costs a binary search instead
+ * of a round-trip to the filesystem.
+ */
+struct loose_object_cache {
+	unsigned char subdir_seen[256];
+	struct sha1_array subdir[256];
+};
+
+static struct loose_object_cache *local_loose_cache;
+
+static int for_each_file_in_obj_subdir(int subdir_nr,
+				       struct strbuf *path,
+				       each_loose_object_fn obj_cb,
+				       each_loose_cruft_fn cruft_cb,
+				       each_loose_subdir_fn subdir_cb,
+				       void *data);
+
+static int append_loose_object(const unsigned char *sha1, const char *path,
+			       void *data)
+{
+	sha1_array_append(data, sha1);
+	return 0;
+}
+
+static int loose_object_cache_has(struct loose_object_cache **cachep,
+				  const char *objdir,
+				  const unsigned char *sha1)
+{
+	struct loose_object_cache *cache = *cachep;
+	int subdir_nr = sha1[0];
+
+	if (!cache)
+		cache = *cachep = xcalloc(1, sizeof(*cache));
+	if (!cache->subdir_seen[subdir_nr]) {
+		struct strbuf path = STRBUF_INIT;
+
+		strbuf_addf(&path, "%s/%02x", objdir, subdir_nr);
+		for_each_file_in_obj_subdir(subdir_nr, &path,
+					    append_loose_object, NULL, NULL,
+					    &cache->subdir[subdir_nr]);
+		strbuf_release(&path);
+		cache->subdir_seen[subdir_nr] = 1;
+	}
+	return sha1_array_lookup(&cache->subdir[subdir_nr], sha1) >= 0;
+}
+
+/*
+ * Insert sha1 where it sorts, so that writing many objects does not
+ * leave the array to be sorted again on each lookup.
+ */
+static void loose_object_cache_add(struct loose_object_cache *cache,
+				   const unsigned char *sha1)
+{
+	if (!cache || !cache->subdir_seen[sha1[0]])
+		return;
+	sha1_array_insert(&cache->subdir[sha1[0]], sha1);
+}
+
+static void clear_loose_object_cache(struct loose_object_cache *cache)
+{
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < 256; i++)
+		sha1_array_clear(&cache->subdir[i]);
+	memset(cache->subdir_seen, 0, sizeof(cache->subdir_seen));
+}
+
 static int check_and_freshen_local(const unsigned char *sha1, int freshen)
 {
+	if (core_loose_object_cache && !freshen)
+		return loose_object_cache_has(&local_loose_cache,
+					      get_object_directory(), sha1);
 	return check_and_freshen_file(sha1_file_name(sha1), freshen);
 }
 
@@ -469,6 +555,17 @@ static int check_and_freshen_nonlocal(const unsigned char *sha1, int freshen)
 	struct alternate_object_database *alt;
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (core_loose_object_cache && !freshen) {
+			int found;
+
+			alt->name[-1] = 0;
+			found = loose_object_cache_has(&alt->loose_cache,
+						       alt->base, sha1);
+			alt->name[-1] = '/';
+			if (found)
+				return 1;
+			continue;
+		}
 		fill_sha1_path(alt->name, sha1);
 		if (check_and_freshen_file(alt->base, freshen))
 			return 1;
@@ -852,6 +949,7 @@ void free_pack_by_name(const char *pack_name)
 	while (*pp) {
 		p = *pp;
 		if (strcmp(pack_name, p->pack_name) == 0) {
+			close_multi_pack_index();
 			clear_delta_base_cache();
 			close_pack_windows(p);
 			if (p->pack_fd != -1) {
@@ -1277,9 +1375,12 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (!report_garbage)
 			continue;
 
+		if (!strcmp(de->d_name, "multi-pack-index"))
+			continue;
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
+		    ends_with(de->d_name, ".rev") ||
 		    ends_with(de->d_name, ".keep"))
 			string_list_append(&garbage, path.buf);
 		else
@@ -1345,6 +1446,39 @@ static void rearrange_packed_git(void)
 	free(ary);
 }
 
+/*
+ * Load the multi-pack index of the local object directory and mark the
+ * packs it covers, so that find_pack_entry() needs to bisect only the
+ * index and the packs that arrived after it was written.  An index
+ * naming a pack we do not have is stale and left unused.
+ */
+static void prepare_multi_pack_index(void)
+{
+	uint32_t i;
+
+	if (!core_multi_pack_index)
+		return;
+	if (!multi_pack_index)
+		multi_pack_index = load_multi_pack_index(get_object_directory());
+	if (!multi_pack_index || prepare_midx_packs(multi_pack_index))
+		return;
+
+	for (i = 0; i < multi_pack_index->num_packs; i++)
+		multi_pack_index->packs[i]->multi_pack_index = 1;
+}
+
+static void close_multi_pack_index(void)
+{
+	struct packed_git *p;
+
+	if (!multi_pack_index)
+		return;
+	for (p = packed_git; p; p = p->next)
+		p->multi_pack_index = 0;
+	close_midx(multi_pack_index);
+	multi_pack_index = NULL;
+}
+
 static int prepare_packed_git_run_once = 0;
 void prepare_packed_git(void)
 {
@@ -1360,11 +1494,18 @@ void prepare_packed_git(void)
 		alt->name[-1] = '/';
 	}
 	rearrange_packed_git();
+	prepare_multi_pack_index();
 	prepare_packed_git_run_once = 1;
 }
 
 void reprepare_packed_git(void)
 {
+	struct alternate_object_database *alt;
+
+	clear_loose_object_cache(local_loose_cache);
+	for (alt = alt_odb_list; alt; alt = alt->next)
+		clear_loose_object_cache(alt->loose_cache);
+	close_multi_pack_index();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1551,6 +1692,59 @@ unsigned long unpack_object_header_buffer(const unsigned char *buf,
 	return used;
 }
 
+/*
+ * Object reads share the pack list, the pack windows, the delta base
+ * cache and other global state.  Once enable_obj_read_lock() has been
+ * called, the entry points below hold obj_read_mutex while touching
+ * it; the lock is recursive because reads nest (e.g. falling back to
+ * another copy of a corrupt object), and it is dropped while zlib
+ * inflates an object, which is where most of the time goes.  A pack
+ * window stays mapped while in use, so the input it provides remains
+ * valid while the lock is dropped.
+ */
+static int obj_read_use_lock;
+#ifndef NO_PTHREADS
+static pthread_mutex_t obj_read_mutex;
+#endif
+
+void enable_obj_read_lock(void)
+{
+#ifndef NO_PTHREADS
+	if (obj_read_use_lock)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+	enable_delta_base_cache_locking();
+	obj_read_use_lock = 1;
+#endif
+}
+
+void disable_obj_read_lock(void)
+{
+#ifndef NO_PTHREADS
+	if (!obj_read_use_lock)
+		return;
+	obj_read_use_lock = 0;
+	pthread_mutex_destroy(&obj_read_mutex);
+	disable_delta_base_cache_locking();
+#endif
+}
+
+void obj_read_lock(void)
+{
+#ifndef NO_PTHREADS
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+#endif
+}
+
+void obj_read_unlock(void)
+{
+#ifndef NO_PTHREADS
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+#endif
+}
+
 int unpack_sha1_header(git_zstream *stream, unsigned char *map, unsigned long mapsize, void *buffer, unsigned long bufsiz)
 {
 	/* Get the data stream */
@@ -1592,8 +1786,10 @@ static void *unpack_sha1_rest(git_zstream *stream, void *buffer, unsigned long s
 		 */
 		stream->next_out = buf + bytes;
 		stream->avail_out = size - bytes;
+		obj_read_unlock();
 		while (status == Z_OK)
 			status = git_inflate(stream, Z_FINISH);
+		obj_read_lock();
 	}
 	if (status == Z_STREAM_END && !stream->avail_in) {
 		git_inflate_end(stream);
@@ -1712,11 +1908,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1767,18 +1963,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t nr;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (find_pack_revindex(p, base_offset, &nr, NULL))
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, nr);
 	} else
 		return NULL;
 }
@@ -1812,12 +2007,11 @@ int unpack_object_header(struct packed_git *p,
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t nr;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (find_pack_revindex(p, obj_offset, &nr, NULL))
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, nr);
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1928,8 +2122,13 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	}
 
 	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+		uint32_t nr;
+		off_t next;
+		if (find_pack_revindex(p, obj_offset, &nr, &next)) {
+			type = OBJ_BAD;
+			goto out;
+		}
+		*oi->disk_sizep = next - obj_offset;
 	}
 
 	if (oi->typep) {
@@ -1981,7 +2180,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1995,141 +2196,329 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
+void *read_packed_delta(struct packed_git *p, off_t obj_offset,
+			unsigned long *delta_size, off_t *base_offset)
+{
+	struct pack_window *w_curs = NULL;
+	off_t curpos = obj_offset;
+	enum object_type type;
+	void *data = NULL;
 
-static size_t delta_base_cached;
+	obj_read_lock();
+	type = unpack_object_header(p, &w_curs, &curpos, delta_size);
+	if (type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+		*base_offset = get_delta_base(p, &w_curs, &curpos,
+					      type, obj_offset);
+		if (*base_offset)
+			data = unpack_compressed_entry(p, &w_curs, curpos,
+						       *delta_size);
+	}
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return data;
+}
+
+/*
+ * The delta base cache keeps recently reconstructed delta bases, keyed
+ * by pack and offset, so that walking a delta chain does not inflate
+ * and patch the same bases over and over.  Its total size is bounded by
+ * core.deltaBaseCacheLimit; when it is exceeded, the least recently
+ * added entries are dropped, blobs first.
+ *
+ * The cache is split into shards, each with its own hashmap, LRU list
+ * and lock, so that threads reading from packs mostly touch different
+ * shards.  Until enable_delta_base_cache_locking() is called, all
+ * entries go to the first shard and no locks are taken, which gives
+ * single-threaded callers one LRU list over the whole budget; after
+ * it, each shard is allowed an equal part of the budget.  Lookups then
+ * need only the lock of their shard, so cache hits are served without
+ * holding obj_read_mutex.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
 
-static struct delta_base_cache_lru_list {
+struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
+};
 
-static struct delta_base_cache_entry {
+struct delta_base_cache_entry {
+	struct hashmap_entry ent;
 	struct delta_base_cache_lru_list lru;
-	void *data;
 	struct packed_git *p;
 	off_t base_offset;
+	void *data;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+struct delta_base_cache_key {
+	struct packed_git *p;
+	off_t base_offset;
+};
+
+static inline struct delta_base_cache_entry *
+lru_to_delta_base_cache_entry(struct delta_base_cache_lru_list *lru)
+{
+	return (struct delta_base_cache_entry *)
+		((char *)lru - offsetof(struct delta_base_cache_entry, lru));
+}
+
+static struct delta_base_cache_shard {
+	struct hashmap map;
+	struct delta_base_cache_lru_list lru;
+	size_t cached;
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+#endif
+} delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+
+static int delta_base_cache_initialized;
+static int delta_base_cache_use_lock;
+
+static int delta_base_cache_entry_cmp(const struct delta_base_cache_entry *a,
+				      const struct delta_base_cache_entry *b,
+				      const struct delta_base_cache_key *key)
+{
+	if (key)
+		return a->p != key->p || a->base_offset != key->base_offset;
+	return a->p != b->p || a->base_offset != b->base_offset;
+}
+
+static void init_delta_base_cache(void)
+{
+	int i;
+
+	if (delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		hashmap_init(&shard->map,
+			     (hashmap_cmp_fn)delta_base_cache_entry_cmp, 0);
+		shard->lru.next = shard->lru.prev = &shard->lru;
+#ifndef NO_PTHREADS
+		pthread_mutex_init(&shard->mutex, NULL);
+#endif
+	}
+	delta_base_cache_initialized = 1;
+}
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash;
+	unsigned int hash;
 
-	hash = (unsigned long)p + (unsigned long)base_offset;
+	hash = (unsigned int)(intptr_t)p + (unsigned int)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+static struct delta_base_cache_shard *get_delta_base_cache_shard(unsigned int hash)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	return delta_base_cache + hash;
+	init_delta_base_cache();
+	if (!delta_base_cache_use_lock)
+		return &delta_base_cache[0];
+	return &delta_base_cache[hash % DELTA_BASE_CACHE_SHARDS];
 }
 
-static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
-				     struct packed_git *p, off_t base_offset)
+static inline void lock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
 {
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+#ifndef NO_PTHREADS
+	if (delta_base_cache_use_lock)
+		pthread_mutex_lock(&shard->mutex);
+#endif
 }
 
-static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
+static inline void unlock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
 {
-	struct delta_base_cache_entry *ent;
-	ent = get_delta_base_cache_entry(p, base_offset);
-	return eq_delta_base_cache_entry(ent, p, base_offset);
+#ifndef NO_PTHREADS
+	if (delta_base_cache_use_lock)
+		pthread_mutex_unlock(&shard->mutex);
+#endif
 }
 
-static void clear_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static size_t delta_base_cache_shard_limit(void)
 {
-	ent->data = NULL;
+	if (!delta_base_cache_use_lock)
+		return delta_base_cache_limit;
+	return delta_base_cache_limit / DELTA_BASE_CACHE_SHARDS;
+}
+
+/* Must be called with the shard locked. */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_key key;
+
+	key.p = p;
+	key.base_offset = base_offset;
+	return hashmap_get_from_hash(&shard->map, hash, &key);
+}
+
+/*
+ * Remove the entry from its shard, which must be locked, and free it;
+ * the data is freed too unless the caller has taken it over.
+ */
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent,
+					  int free_data)
+{
+	hashmap_remove(&shard->map, ent, NULL);
 	ent->lru.next->prev = ent->lru.prev;
 	ent->lru.prev->next = ent->lru.next;
-	delta_base_cached -= ent->size;
+	shard->cached -= ent->size;
+	if (free_data)
+		free(ent->data);
+	free(ent);
+}
+
+static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = get_delta_base_cache_shard(hash);
+	int ret;
+
+	lock_delta_base_cache_shard(shard);
+	ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+	unlock_delta_base_cache_shard(shard);
+	return ret;
+}
+
+/*
+ * Look up a cached base.  If keep_cache is set, the caller gets a copy
+ * of the data; otherwise the entry leaves the cache and the caller
+ * owns its data.  Returns NULL if the base is not cached.
+ */
+static void *get_cached_delta_base(struct packed_git *p, off_t base_offset,
+				   unsigned long *base_size,
+				   enum object_type *type, int keep_cache)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = get_delta_base_cache_shard(hash);
+	struct delta_base_cache_entry *ent;
+	void *ret = NULL;
+
+	lock_delta_base_cache_shard(shard);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		*type = ent->type;
+		*base_size = ent->size;
+		if (keep_cache)
+			ret = xmemdupz(ent->data, ent->size);
+		else {
+			ret = ent->data;
+			detach_delta_base_cache_entry(shard, ent, 0);
+		}
+	}
+	unlock_delta_base_cache_shard(shard);
+	return ret;
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
-	struct delta_base_cache_entry *ent;
 	void *ret;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
+	/* a hit only needs the lock of its shard, taken inside */
+	ret = get_cached_delta_base(p, base_offset, base_size, type, keep_cache);
+	if (!ret)
+		ret = unpack_entry(p, base_offset, type, base_size);
+	return ret;
+}
 
-	if (!eq_delta_base_cache_entry(ent, p, base_offset))
-		return unpack_entry(p, base_offset, type, base_size);
+static void clear_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	while (shard->lru.next != &shard->lru)
+		detach_delta_base_cache_entry(shard,
+			lru_to_delta_base_cache_entry(shard->lru.next), 1);
+}
 
-	ret = ent->data;
+void clear_delta_base_cache(void)
+{
+	int i;
 
-	if (!keep_cache)
-		clear_delta_base_cache_entry(ent);
-	else
-		ret = xmemdupz(ent->data, ent->size);
-	*type = ent->type;
-	*base_size = ent->size;
-	return ret;
+	if (!delta_base_cache_initialized)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		lock_delta_base_cache_shard(shard);
+		clear_delta_base_cache_shard(shard);
+		unlock_delta_base_cache_shard(shard);
+	}
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+void enable_delta_base_cache_locking(void)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	if (delta_base_cache_use_lock)
+		return;
+	init_delta_base_cache();
+	/* entries cached so far live in the first shard only */
+	clear_delta_base_cache();
+	delta_base_cache_use_lock = 1;
 }
 
-void clear_delta_base_cache(void)
+void disable_delta_base_cache_locking(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	if (!delta_base_cache_use_lock)
+		return;
+	/* go back to a single shard with the whole budget */
+	clear_delta_base_cache();
+	delta_base_cache_use_lock = 0;
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
-
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
-
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
-	}
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = get_delta_base_cache_shard(hash);
+	size_t limit = delta_base_cache_shard_limit();
+	struct delta_base_cache_entry *ent, *old;
+	struct delta_base_cache_lru_list *lru, *next;
 
+	ent = xmalloc(sizeof(*ent));
+	hashmap_entry_init(ent, hash);
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+
+	lock_delta_base_cache_shard(shard);
+
+	old = hashmap_get(&shard->map, ent, NULL);
+	if (old)
+		detach_delta_base_cache_entry(shard, old, 1);
+	shard->cached += base_size;
+
+	for (lru = shard->lru.next;
+	     shard->cached > limit && lru != &shard->lru;
+	     lru = next) {
+		struct delta_base_cache_entry *f = lru_to_delta_base_cache_entry(lru);
+		next = lru->next;
+		if (f->type == OBJ_BLOB)
+			detach_delta_base_cache_entry(shard, f, 1);
+	}
+	for (lru = shard->lru.next;
+	     shard->cached > limit && lru != &shard->lru;
+	     lru = next) {
+		struct delta_base_cache_entry *f = lru_to_delta_base_cache_entry(lru);
+		next = lru->next;
+		detach_delta_base_cache_entry(shard, f, 1);
+	}
+
+	hashmap_add(&shard->map, ent);
+	ent->lru.next = &shard->lru;
+	ent->lru.prev = shard->lru.prev;
+	shard->lru.prev->next = &ent->lru;
+	shard->lru.prev = &ent->lru;
+
+	unlock_delta_base_cache_shard(shard);
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
 			 unsigned long *size);
 
+/* Must be called with obj_read_mutex held. */
 static void write_pack_access_log(struct packed_git *p, off_t obj_offset)
 {
 	static struct trace_key pack_access = TRACE_KEY_INIT(PACK_ACCESS);
@@ -2146,8 +2535,9 @@ struct unpack_entry_stack_ent {
 	unsigned long size;
 };
 
-void *unpack_entry(struct packed_git *p, off_t obj_offset,
-		   enum object_type *final_type, unsigned long *final_size)
+static void *do_unpack_entry(struct packed_git *p, off_t obj_offset,
+			     enum object_type *final_type,
+			     unsigned long *final_size)
 {
 	struct pack_window *w_curs = NULL;
 	off_t curpos = obj_offset;
@@ -2165,24 +2555,25 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (eq_delta_base_cache_entry(ent, p, curpos)) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			clear_delta_base_cache_entry(ent);
+
+		data = get_cached_delta_base(p, curpos, &size, &type, 0);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			unsigned long len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t nr;
+			off_t next;
+			unsigned long len;
+			if (find_pack_revindex(p, obj_offset, &nr, &next)) {
+				unuse_pack(&w_curs);
+				return NULL;
+			}
+			len = next - obj_offset;
+			if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, nr);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -2266,11 +2657,10 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t nr;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			if (!find_pack_revindex(p, obj_offset, &nr, NULL)) {
+				base_sha1 = nth_packed_object_sha1(p, nr);
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -2481,6 +2871,41 @@ static int fill_pack_entry(const unsigned char *sha1,
 	return 1;
 }
 
+/*
+ * Look the object up in the multi-pack index.  Returns 1 and fills e
+ * when found, 0 when the index does not know the object, and -1 when
+ * it names a copy we cannot use (bad object, vanished pack), in which
+ * case the caller must fall back to searching every pack.
+ */
+static int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e,
+			   struct multi_pack_index *m)
+{
+	struct packed_git *p;
+	uint32_t pos, pack_int_id;
+	unsigned i;
+
+	if (!m->packs_ready)
+		return 0;
+	if (!bsearch_midx(sha1, m, &pos))
+		return 0;
+
+	pack_int_id = nth_midxed_pack_int_id(m, pos);
+	if (pack_int_id >= m->num_packs)
+		return -1;
+	p = m->packs[pack_int_id];
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return -1;
+	if (!is_pack_valid(p))
+		return -1;
+
+	e->offset = nth_midxed_offset(m, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
 /*
  * Iff a pack file contains the object named by sha1, return true and
  * store its location to e.
@@ -2488,6 +2913,7 @@ static int fill_pack_entry(const unsigned char *sha1,
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int skip_midx_packs = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2496,9 +2922,20 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	if (multi_pack_index) {
+		int ret = fill_midx_entry(sha1, e, multi_pack_index);
+		if (ret > 0) {
+			last_found_pack = e->p;
+			return 1;
+		}
+		skip_midx_packs = !ret && multi_pack_index->packs_ready;
+	}
+
 	for (p = packed_git; p; p = p->next) {
 		if (p == last_found_pack)
 			continue; /* we already checked this one */
+		if (skip_midx_packs && p->multi_pack_index)
+			continue; /* the multi-pack index answered for it */
 
 		if (fill_pack_entry(sha1, e, p)) {
 			last_found_pack = p;
@@ -2569,7 +3006,28 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	return 0;
 }
 
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+void *unpack_entry(struct packed_git *p, off_t obj_offset,
+		   enum object_type *final_type, unsigned long *final_size)
+{
+	void *data;
+
+	/* the lookup itself only needs the lock of its shard */
+	data = get_cached_delta_base(p, obj_offset, final_size, final_type, 0);
+	if (data) {
+		obj_read_lock();
+		write_pack_access_log(p, obj_offset);
+		obj_read_unlock();
+		return data;
+	}
+
+	obj_read_lock();
+	data = do_unpack_entry(p, obj_offset, final_type, final_size);
+	obj_read_unlock();
+	return data;
+}
+
+static int do_sha1_object_info_extended(const unsigned char *sha1,
+					struct object_info *oi, unsigned flags)
 {
 	struct cached_object *co;
 	struct pack_entry e;
@@ -2591,8 +3049,13 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	}
 
 	if (!find_pack_entry(real, &e)) {
-		/* Most likely it's a loose object. */
-		if (!sha1_loose_object_info(real, oi)) {
+		/*
+		 * Most likely it's a loose object.  The loose object cache
+		 * can rule that out without opening the file, but not that
+		 * the object has been packed since the pack list was read.
+		 */
+		if ((!core_loose_object_cache || has_loose_object(real)) &&
+		    !sha1_loose_object_info(real, oi)) {
 			oi->whence = OI_LOOSE;
 			return 0;
 		}
@@ -2606,7 +3069,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	rtype = packed_object_info(e.p, e.offset, oi);
 	if (rtype < 0) {
 		mark_bad_packed_object(e.p, real);
-		return sha1_object_info_extended(real, oi, 0);
+		return do_sha1_object_info_extended(real, oi, 0);
 	} else if (in_delta_base_cache(e.p, e.offset)) {
 		oi->whence = OI_DBCACHED;
 	} else {
@@ -2620,6 +3083,16 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	return 0;
 }
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_sha1_object_info_extended(sha1, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -2714,12 +3187,16 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 {
 	void *data;
 	const struct packed_git *p;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
+	obj_read_lock();
+	repl = lookup_replace_object_extended(sha1, flag);
 	errno = 0;
 	data = read_object(repl, type, size);
-	if (data)
+	if (data) {
+		obj_read_unlock();
 		return data;
+	}
 
 	if (errno && errno != ENOENT)
 		die_errno("failed to read object %s", sha1_to_hex(sha1));
@@ -2740,6 +3217,7 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 		die("packed object %s (stored in %s) is corrupt",
 		    sha1_to_hex(repl), p->pack_name);
 
+	obj_read_unlock();
 	return NULL;
 }
 
@@ -2986,7 +3464,10 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	ret = move_temp_to_file(tmp_file, filename);
+	if (!ret)
+		loose_object_cache_add(local_loose_cache, sha1);
+	return ret;
 }
 
 static int freshen_loose_object(const unsigned char *sha1)
@@ -3354,8 +3835,10 @@ static int for_each_file_in_obj_subdir(int subdir_nr,
 			char hex[41];
 			unsigned char sha1[20];
 
-			snprintf(hex, sizeof(hex), "%02x%s",
-				 subdir_nr, de->d_name);
+			hex[0] = "0123456789abcdef"[(subdir_nr >> 4) & 0xf];
+			hex[1] = "0123456789abcdef"[subdir_nr & 0xf];
+			memcpy(hex + 2, de->d_name, 38);
+			hex[40] = '\0';
 			if (!get_sha1_hex(hex, sha1)) {
 				if (obj_cb) {
 					r = obj_cb(sha1, path->buf, data);
@@ -3487,6 +3970,9 @@ int for_each_packed_object(each_packed_object_fn cb, void *data, unsigned flags)
 	for (p = packed_git; p; p = p->next) {
 		if ((flags & FOR_EACH_OBJECT_LOCAL_ONLY) && !p->pack_local)
 			continue;
+		/* a broken index has already been reported; skip its pack */
+		if (open_pack_index(p))
+			continue;
 		r = for_each_object_in_pack(p, cb, data);
 		if (r)
 			break;
@@ -6,6 +6,7 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "remote.h"
+#include "sparse-index.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -89,6 +90,7 @@ static void find_short_object_filename(int len, const char *hex_pfx, struct disa
 		int objdir_len = strlen(objdir);
 		int entlen = objdir_len + 43;
 		fakeent = xmalloc(sizeof(*fakeent) + entlen);
+		fakeent->loose_cache = NULL;
 		memcpy(fakeent->base, objdir, objdir_len);
 		fakeent->name = fakeent->base + objdir_len + 1;
 		fakeent->name[-1] = '/';
@@ -1394,7 +1396,8 @@ static int get_sha1_with_context_1(const char *name,
 		strlcpy(oc->path, cp, sizeof(oc->path));
 
 		if (!active_cache)
-			read_cache();
+			read_cache_sparse();
+		expand_to_path(&the_index, cp, namelen);
 		pos = cache_name_pos(cp, namelen);
 		if (pos < 0)
 			pos = -pos - 1;
@@ -0,0 +1,343 @@
+#include "cache.h"
+#include "cache-tree.h"
+#include "sparse-index.h"
+
+int sparse_index_enabled(void)
+{
+	int sparse_checkout = 0, sparse_index = 0;
+
+	git_config_get_bool("core.sparsecheckout", &sparse_checkout);
+	git_config_get_bool("index.sparse", &sparse_index);
+	return sparse_checkout && sparse_index;
+}
+
+struct collapse_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	int nr;
+	int removed;
+	int collapsed;
+};
+
+static struct cache_entry *sparse_dir_entry(const char *path, int len,
+					    const unsigned char *sha1)
+{
+	struct cache_entry *ce = xcalloc(1, cache_entry_size(len));
+
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	ce->ce_namelen = len;
+	hashcpy(ce->sha1, sha1);
+	memcpy(ce->name, path, len);
+	return ce;
+}
+
+/*
+ * Only merged, skip-worktree blobs with nothing else to remember
+ * can be given back by ensure_full_index().
+ */
+static int can_collapse(struct cache_entry **cache, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		const struct cache_entry *ce = cache[i];
+
+		if (ce_stage(ce) || !ce_skip_worktree(ce) ||
+		    S_ISGITLINK(ce->ce_mode) ||
+		    (ce->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD | CE_VALID)))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The entries from cache[start] on that are below "base" (which the
+ * one at start is) are contiguous: find where they end.
+ */
+static int directory_end(struct cache_entry **cache, int start, int end,
+			 const struct strbuf *base)
+{
+	int lo = start + 1, hi = end;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+
+		if (strncmp(cache[mi]->name, base->buf, base->len) > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return lo;
+}
+
+/*
+ * Copy the entries cache[start..end) of the directory "base" (empty
+ * for the top level) to d->cache, collapsing the directories we can.
+ * ct is the cache-tree of the directory, if any; returns the
+ * cache-tree that goes with the copied entries.
+ */
+static struct cache_tree *collapse_directory(struct collapse_data *d,
+					     int start, int end,
+					     struct strbuf *base,
+					     struct cache_tree *ct)
+{
+	struct cache_entry **cache = d->istate->cache;
+	struct cache_tree *sparse_ct;
+	int i, first = d->nr, first_removed = d->removed;
+
+	if (base->len && ct && ct->entry_count >= 0 &&
+	    can_collapse(cache + start, end - start)) {
+		d->cache[d->nr++] = sparse_dir_entry(base->buf, base->len, ct->sha1);
+		d->collapsed++;
+		sparse_ct = cache_tree();
+		sparse_ct->entry_count = 1;
+		hashcpy(sparse_ct->sha1, ct->sha1);
+		return sparse_ct;
+	}
+
+	sparse_ct = ct ? cache_tree() : NULL;
+	for (i = start; i < end; ) {
+		const char *name = cache[i]->name + base->len;
+		const char *slash = strchr(name, '/');
+		struct cache_tree *sub = NULL, *sparse_sub;
+		size_t baselen = base->len;
+		int span;
+
+		if (!slash) {
+			if (cache[i]->ce_flags & CE_REMOVE)
+				d->removed++;
+			d->cache[d->nr++] = cache[i++];
+			continue;
+		}
+
+		if (ct) {
+			int pos = cache_tree_subtree_pos(ct, name, slash - name);
+			if (pos >= 0)
+				sub = ct->down[pos]->cache_tree;
+		}
+		strbuf_add(base, name, slash - name + 1);
+		span = directory_end(cache, i, end, base);
+		sparse_sub = collapse_directory(d, i, span, base, sub);
+		if (sparse_sub) {
+			char *component = xmemdupz(name, slash - name);
+			cache_tree_sub(sparse_ct, component)->cache_tree = sparse_sub;
+			free(component);
+		}
+		strbuf_setlen(base, baselen);
+		i = span;
+	}
+
+	if (sparse_ct) {
+		if (ct->entry_count < 0)
+			sparse_ct->entry_count = -1;
+		else
+			sparse_ct->entry_count = (d->nr - first) -
+						 (d->removed - first_removed);
+		hashcpy(sparse_ct->sha1, ct->sha1);
+	}
+	return sparse_ct;
+}
+
+int convert_to_sparse(struct index_state *istate, struct index_state *full)
+{
+	struct collapse_data d;
+	struct strbuf base = STRBUF_INIT;
+	struct cache_tree *ct;
+
+	/* the directories to collapse are found with the cache-tree */
+	if (istate->sparse_index || istate->split_index ||
+	    !istate->cache_tree || !sparse_index_enabled())
+		return 0;
+
+	memset(&d, 0, sizeof(d));
+	d.istate = istate;
+	d.cache = xmalloc(istate->cache_nr * sizeof(*d.cache));
+	ct = collapse_directory(&d, 0, istate->cache_nr, &base,
+				istate->cache_tree);
+	strbuf_release(&base);
+	if (!d.collapsed) {
+		free(d.cache);
+		cache_tree_free(&ct);
+		return 0;
+	}
+
+	full->cache = istate->cache;
+	full->cache_nr = istate->cache_nr;
+	full->cache_alloc = istate->cache_alloc;
+	full->cache_tree = istate->cache_tree;
+
+	istate->cache = d.cache;
+	istate->cache_alloc = istate->cache_nr;
+	istate->cache_nr = d.nr;
+	istate->cache_tree = ct;
+	istate->sparse_index = 1;
+	return 1;
+}
+
+void restore_full_index(struct index_state *istate, struct index_state *full)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISSPARSEDIR(istate->cache[i]->ce_mode))
+			free(istate->cache[i]);
+	free(istate->cache);
+	cache_tree_free(&istate->cache_tree);
+
+	istate->cache = full->cache;
+	istate->cache_nr = full->cache_nr;
+	istate->cache_alloc = full->cache_alloc;
+	istate->cache_tree = full->cache_tree;
+	istate->sparse_index = 0;
+}
+
+struct expand_data {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	int nr, alloc;
+};
+
+/*
+ * Append the blobs of the tree to d->cache with "base" in front of
+ * their names, and fill "it" with the cache-tree of the tree.
+ */
+static int add_tree_entries(struct expand_data *d, const unsigned char *sha1,
+			    struct strbuf *base, struct cache_tree *it)
+{
+	struct tree *tree = parse_tree_indirect(sha1);
+	struct tree_desc desc;
+	struct name_entry entry;
+	int nr = 0;
+
+	if (!tree)
+		die("unable to read tree %s of sparse directory '%s'",
+		    sha1_to_hex(sha1), base->buf);
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+	while (tree_entry(&desc, &entry)) {
+		size_t baselen = base->len;
+
+		strbuf_add(base, entry.path, tree_entry_len(&entry));
+		if (S_ISDIR(entry.mode)) {
+			struct cache_tree_sub *sub;
+
+			sub = cache_tree_sub(it, base->buf + baselen);
+			cache_tree_free(&sub->cache_tree);
+			sub->cache_tree = cache_tree();
+			strbuf_addch(base, '/');
+			nr += add_tree_entries(d, entry.sha1, base, sub->cache_tree);
+		} else {
+			struct cache_entry *ce;
+
+			ce = xcalloc(1, cache_entry_size(base->len));
+			ce->ce_mode = create_ce_mode(entry.mode);
+			ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+			ce->ce_namelen = base->len;
+			hashcpy(ce->sha1, entry.sha1);
+			memcpy(ce->name, base->buf, base->len);
+
+			ALLOC_GROW(d->cache, d->nr + 1, d->alloc);
+			d->cache[d->nr++] = ce;
+			add_name_hash(d->istate, ce);
+			nr++;
+		}
+		strbuf_setlen(base, baselen);
+	}
+	free_tree_buffer(tree);
+
+	it->entry_count = nr;
+	hashcpy(it->sha1, sha1);
+	return nr;
+}
+
+/*
+ * Put "it", the cache-tree of the expanded directory "path", in place
+ * of the one of its sparse directory entry, and count the nr entries
+ * that replace that entry in the cache-trees above it.
+ */
+static void graft_cache_tree(struct cache_tree *ct, const char *path,
+			     struct cache_tree *it, int nr)
+{
+	const char *slash;
+
+	while (ct && (slash = strchr(path, '/'))) {
+		int pos = cache_tree_subtree_pos(ct, path, slash - path);
+
+		if (ct->entry_count >= 0)
+			ct->entry_count += nr - 1;
+		if (pos < 0)
+			break;
+		if (!slash[1]) {
+			cache_tree_free(&ct->down[pos]->cache_tree);
+			ct->down[pos]->cache_tree = it;
+			return;
+		}
+		ct = ct->down[pos]->cache_tree;
+		path = slash + 1;
+	}
+	cache_tree_free(&it);
+}
+
+void expand_to_path(struct index_state *istate, const char *path, int pathlen)
+{
+	const struct cache_entry *ce;
+	int pos;
+
+	if (!istate->sparse_index)
+		return;
+	pos = index_name_pos(istate, path, pathlen);
+	if (pos >= 0)
+		return;
+	/* the sparse directory holding path would sort right before it */
+	pos = -pos - 1;
+	if (!pos)
+		return;
+	ce = istate->cache[pos - 1];
+	if (S_ISSPARSEDIR(ce->ce_mode) && ce_namelen(ce) < pathlen &&
+	    !memcmp(ce->name, path, ce_namelen(ce)))
+		ensure_full_index(istate);
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_data d;
+	struct strbuf base = STRBUF_INIT;
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	memset(&d, 0, sizeof(d));
+	d.istate = istate;
+	d.alloc = alloc_nr(istate->cache_nr);
+	d.cache = xmalloc(d.alloc * sizeof(*d.cache));
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct cache_tree *it;
+		int nr;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(d.cache, d.nr + 1, d.alloc);
+			d.cache[d.nr++] = ce;
+			continue;
+		}
+
+		strbuf_reset(&base);
+		strbuf_add(&base, ce->name, ce_namelen(ce));
+		it = cache_tree();
+		nr = add_tree_entries(&d, ce->sha1, &base, it);
+		graft_cache_tree(istate->cache_tree, ce->name, it, nr);
+
+		remove_name_hash(istate, ce);
+		free(ce);
+	}
+	strbuf_release(&base);
+
+	free(istate->cache);
+	istate->cache = d.cache;
+	istate->cache_nr = d.nr;
+	istate->cache_alloc = d.alloc;
+	istate->sparse_index = 0;
+}
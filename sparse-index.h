@@ -0,0 +1,44 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+/*
+ * A sparse index stores a directory whose entries are all outside the
+ * sparse checkout (all CE_SKIP_WORKTREE) as a single "sparse directory"
+ * entry: its name ends with a slash, its mode is S_IFDIR and its sha1
+ * is the tree of the directory.  The "sdir" index extension tells that
+ * the index may hold such entries.
+ */
+
+/*
+ * Returns true when index.sparse and core.sparseCheckout are both set.
+ */
+extern int sparse_index_enabled(void);
+
+/*
+ * Collapse the directories that can be into sparse directory entries,
+ * for writing the index.  The full list of entries and its cache-tree
+ * are saved in *full for restore_full_index() to put back.  Returns 0
+ * and leaves istate alone if nothing was collapsed.
+ */
+extern int convert_to_sparse(struct index_state *istate,
+			     struct index_state *full);
+extern void restore_full_index(struct index_state *istate,
+			       struct index_state *full);
+
+/*
+ * Replace every sparse directory entry with the entries of its tree,
+ * which are marked CE_SKIP_WORKTREE.  Code that needs to look at the
+ * paths inside a sparse directory calls this first.
+ */
+extern void ensure_full_index(struct index_state *istate);
+
+/*
+ * Expand the index as ensure_full_index() does if path is inside one
+ * of its sparse directories, so that the entries for path can be
+ * looked up.  This moves and frees entries, so it must be called
+ * before looking anything up, not while holding positions or entries.
+ */
+extern void expand_to_path(struct index_state *istate,
+			   const char *path, int pathlen);
+
+#endif
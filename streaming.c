@@ -3,12 +3,14 @@
  */
 #include "cache.h"
 #include "streaming.h"
+#include "delta.h"
 
 enum input_source {
 	stream_error = -1,
 	incore = 0,
 	loose = 1,
-	pack_non_delta = 2
+	pack_non_delta = 2,
+	pack_delta = 3
 };
 
 typedef int (*open_istream_fn)(struct git_istream *,
@@ -41,6 +43,7 @@ struct stream_vtbl {
 static open_method_decl(incore);
 static open_method_decl(loose);
 static open_method_decl(pack_non_delta);
+static open_method_decl(pack_delta);
 static struct git_istream *attach_stream_filter(struct git_istream *st,
 						struct stream_filter *filter);
 
@@ -49,6 +52,7 @@ static open_istream_fn open_istream_tbl[] = {
 	open_istream_incore,
 	open_istream_loose,
 	open_istream_pack_non_delta,
+	open_istream_pack_delta,
 };
 
 #define FILTER_BUFFER (1024*16)
@@ -88,6 +92,20 @@ struct git_istream {
 			off_t pos;
 		} in_pack;
 
+		struct {
+			struct packed_git *pack;
+			/* the deltas, outermost (our object) first */
+			struct delta_level *level;
+			int nr_level;
+			unsigned long read_ptr;
+
+			/* the non-delta base at the bottom of the chain */
+			off_t base_start, base_pos;
+			unsigned long base_size, base_inflated;
+			unsigned char *window;
+			unsigned long window_start, window_len, window_alloc;
+		} in_delta;
+
 		struct filtered_istream filtered;
 	} u;
 };
@@ -121,8 +139,8 @@ static enum input_source istream_source(const unsigned char *sha1,
 	case OI_LOOSE:
 		return loose;
 	case OI_PACKED:
-		if (!oi->u.packed.is_delta && big_file_threshold < size)
-			return pack_non_delta;
+		if (big_file_threshold < size)
+			return oi->u.packed.is_delta ? pack_delta : pack_non_delta;
 		/* fallthru */
 	default:
 		return incore;
@@ -452,6 +470,323 @@ static open_method_decl(pack_non_delta)
 }
 
 
+/*****************************************************************
+ *
+ * Delta packed object stream
+ *
+ * Instead of building every object of the delta chain in memory, we
+ * keep only the (inflated) deltas, each parsed into a list of
+ * instructions sorted by the offset in its result they produce.  A
+ * range of our object is then produced by following copy instructions
+ * down the chain until they either hit a literal or the non-delta
+ * base, which is inflated through a window of
+ * core.deltaStreamBufferSize bytes and restarted from its beginning
+ * when a delta copies from before the window.
+ *
+ *****************************************************************/
+
+struct delta_op {
+	unsigned long out;	/* offset in the result of the delta */
+	unsigned long size;
+	unsigned long src;	/* offset in the base, or in the delta data */
+	int literal;
+};
+
+struct delta_level {
+	unsigned char *data;
+	unsigned long base_size, size;
+	struct delta_op *op;
+	int nr_op, alloc_op;
+};
+
+static int parse_delta_level(struct delta_level *lvl, unsigned long delta_size)
+{
+	const unsigned char *data = lvl->data;
+	const unsigned char *top = data + delta_size;
+	unsigned long out = 0;
+
+	if (delta_size < DELTA_SIZE_MIN)
+		return -1;
+	lvl->base_size = get_delta_hdr_size(&data, top);
+	lvl->size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		unsigned char cmd = *data++;
+		struct delta_op *op;
+
+		ALLOC_GROW(lvl->op, lvl->nr_op + 1, lvl->alloc_op);
+		op = &lvl->op[lvl->nr_op++];
+		op->out = out;
+		if (cmd & 0x80) {
+			unsigned long cp_off = 0, cp_size = 0;
+			int i, need = 0;
+			for (i = 0; i < 7; i++)
+				need += !!(cmd & (1 << i));
+			if (top - data < need)
+				return -1;
+			if (cmd & 0x01) cp_off = *data++;
+			if (cmd & 0x02) cp_off |= (*data++ << 8);
+			if (cmd & 0x04) cp_off |= (*data++ << 16);
+			if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
+			if (cmd & 0x10) cp_size = *data++;
+			if (cmd & 0x20) cp_size |= (*data++ << 8);
+			if (cmd & 0x40) cp_size |= (*data++ << 16);
+			if (cp_size == 0) cp_size = 0x10000;
+			if (unsigned_add_overflows(cp_off, cp_size) ||
+			    cp_off + cp_size > lvl->base_size ||
+			    cp_size > lvl->size - out)
+				return -1;
+			op->src = cp_off;
+			op->size = cp_size;
+			op->literal = 0;
+		} else if (cmd) {
+			if (cmd > lvl->size - out || cmd > top - data)
+				return -1;
+			op->src = data - lvl->data;
+			op->size = cmd;
+			op->literal = 1;
+			data += cmd;
+		} else {
+			return error("unexpected delta opcode 0");
+		}
+		out += op->size;
+	}
+	if (out != lvl->size)
+		return error("delta replay has gone wild");
+	return 0;
+}
+
+static int read_delta_base(struct git_istream *st, unsigned long ofs,
+			   unsigned long len, unsigned char *out)
+{
+	while (len) {
+		unsigned long avail;
+		int status;
+
+		if (st->u.in_delta.window_start <= ofs &&
+		    ofs < st->u.in_delta.window_start + st->u.in_delta.window_len) {
+			unsigned long skip = ofs - st->u.in_delta.window_start;
+			avail = st->u.in_delta.window_len - skip;
+			if (len < avail)
+				avail = len;
+			memcpy(out, st->u.in_delta.window + skip, avail);
+			out += avail;
+			ofs += avail;
+			len -= avail;
+			continue;
+		}
+
+		if (ofs < st->u.in_delta.window_start ||
+		    st->z_state == z_unused) {
+			/* start (again) from the beginning of the base */
+			if (st->z_state == z_used)
+				git_inflate_end(&st->z);
+			memset(&st->z, 0, sizeof(st->z));
+			git_inflate_init(&st->z);
+			st->z_state = z_used;
+			st->u.in_delta.base_pos = st->u.in_delta.base_start;
+			st->u.in_delta.base_inflated = 0;
+		}
+		if (st->z_state != z_used)
+			return -1;
+
+		/* slide the window forward by inflating the next part */
+		st->u.in_delta.window_start = st->u.in_delta.base_inflated;
+		st->u.in_delta.window_len = 0;
+		st->z.next_out = st->u.in_delta.window;
+		st->z.avail_out = st->u.in_delta.window_alloc;
+		do {
+			struct pack_window *window = NULL;
+			unsigned char *mapped;
+
+			mapped = use_pack(st->u.in_delta.pack, &window,
+					  st->u.in_delta.base_pos,
+					  &st->z.avail_in);
+			st->z.next_in = mapped;
+			status = git_inflate(&st->z, Z_FINISH);
+			st->u.in_delta.base_pos += st->z.next_in - mapped;
+			unuse_pack(&window);
+		} while (status == Z_OK && st->z.avail_out);
+
+		st->u.in_delta.window_len =
+			st->z.next_out - st->u.in_delta.window;
+		st->u.in_delta.base_inflated += st->u.in_delta.window_len;
+		if (status == Z_STREAM_END) {
+			git_inflate_end(&st->z);
+			st->z_state = z_done;
+		} else if (status != Z_OK && status != Z_BUF_ERROR) {
+			git_inflate_end(&st->z);
+			st->z_state = z_error;
+			return -1;
+		}
+		if (!st->u.in_delta.window_len ||
+		    st->u.in_delta.base_inflated > st->u.in_delta.base_size)
+			return -1;
+		if (st->z_state == z_done &&
+		    st->u.in_delta.base_inflated != st->u.in_delta.base_size)
+			return -1;
+	}
+	return 0;
+}
+
+static int read_delta_range(struct git_istream *st, int nth,
+			    unsigned long ofs, unsigned long len,
+			    unsigned char *out)
+{
+	struct delta_level *lvl;
+	int lo, hi;
+
+	if (nth == st->u.in_delta.nr_level)
+		return read_delta_base(st, ofs, len, out);
+
+	lvl = &st->u.in_delta.level[nth];
+	lo = 0;
+	hi = lvl->nr_op;
+	while (hi - lo > 1) {
+		int mi = lo + (hi - lo) / 2;
+		if (lvl->op[mi].out <= ofs)
+			lo = mi;
+		else
+			hi = mi;
+	}
+
+	while (len) {
+		struct delta_op *op = &lvl->op[lo++];
+		unsigned long skip = ofs - op->out;
+		unsigned long n = op->size - skip;
+
+		if (len < n)
+			n = len;
+		if (op->literal)
+			memcpy(out, lvl->data + op->src + skip, n);
+		else if (read_delta_range(st, nth + 1, op->src + skip, n, out))
+			return -1;
+		out += n;
+		ofs += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static read_method_decl(pack_delta)
+{
+	unsigned long remainder = st->size - st->u.in_delta.read_ptr;
+
+	if (sz > remainder)
+		sz = remainder;
+	if (!sz)
+		return 0;
+	if (read_delta_range(st, 0, st->u.in_delta.read_ptr, sz,
+			     (unsigned char *)buf))
+		return -1;
+	st->u.in_delta.read_ptr += sz;
+	return sz;
+}
+
+static void free_delta_levels(struct git_istream *st)
+{
+	int i;
+
+	for (i = 0; i < st->u.in_delta.nr_level; i++) {
+		free(st->u.in_delta.level[i].data);
+		free(st->u.in_delta.level[i].op);
+	}
+	free(st->u.in_delta.level);
+}
+
+static close_method_decl(pack_delta)
+{
+	close_deflated_stream(st);
+	free_delta_levels(st);
+	free(st->u.in_delta.window);
+	return 0;
+}
+
+static struct stream_vtbl pack_delta_vtbl = {
+	close_istream_pack_delta,
+	read_istream_pack_delta,
+};
+
+static open_method_decl(pack_delta)
+{
+	struct packed_git *p = oi->u.packed.pack;
+	off_t pos = oi->u.packed.offset;
+	int alloc_level = 0;
+	unsigned long expect_size;
+
+	st->u.in_delta.pack = p;
+	st->u.in_delta.level = NULL;
+	st->u.in_delta.nr_level = 0;
+
+	for (;;) {
+		struct pack_window *window = NULL;
+		struct delta_level *lvl;
+		enum object_type in_pack_type;
+		unsigned long size;
+		off_t base_offset;
+		off_t curpos = pos;
+
+		in_pack_type = unpack_object_header(p, &window, &curpos, &size);
+		unuse_pack(&window);
+		if (in_pack_type != OBJ_OFS_DELTA &&
+		    in_pack_type != OBJ_REF_DELTA) {
+			if (in_pack_type <= OBJ_NONE ||
+			    in_pack_type > OBJ_TAG ||
+			    !st->u.in_delta.nr_level)
+				goto fail;
+			st->u.in_delta.base_start = curpos;
+			st->u.in_delta.base_size = size;
+			break;
+		}
+
+		if (st->u.in_delta.nr_level >= 10000)
+			goto fail; /* surely a cycle */
+		ALLOC_GROW(st->u.in_delta.level, st->u.in_delta.nr_level + 1,
+			   alloc_level);
+		lvl = &st->u.in_delta.level[st->u.in_delta.nr_level];
+		memset(lvl, 0, sizeof(*lvl));
+		lvl->data = read_packed_delta(p, pos, &size, &base_offset);
+		if (!lvl->data)
+			goto fail;
+		st->u.in_delta.nr_level++;
+		if (parse_delta_level(lvl, size))
+			goto fail;
+		pos = base_offset;
+	}
+
+	/* each delta must produce what the one above it expects */
+	expect_size = st->u.in_delta.level[0].size;
+	st->size = expect_size;
+	{
+		int i;
+		for (i = 0; i < st->u.in_delta.nr_level; i++) {
+			if (st->u.in_delta.level[i].size != expect_size)
+				goto fail;
+			expect_size = st->u.in_delta.level[i].base_size;
+		}
+	}
+	if (expect_size != st->u.in_delta.base_size)
+		goto fail;
+
+	st->u.in_delta.window_alloc = delta_stream_buffer_size;
+	if (st->u.in_delta.window_alloc > st->u.in_delta.base_size)
+		st->u.in_delta.window_alloc = st->u.in_delta.base_size;
+	if (!st->u.in_delta.window_alloc)
+		st->u.in_delta.window_alloc = 1;
+	st->u.in_delta.window = xmalloc(st->u.in_delta.window_alloc);
+	st->u.in_delta.window_start = 0;
+	st->u.in_delta.window_len = 0;
+	st->u.in_delta.read_ptr = 0;
+	st->z_state = z_unused;
+	st->vtbl = &pack_delta_vtbl;
+	return 0;
+
+fail:
+	free_delta_levels(st);
+	return -1;
+}
+
+
 /*****************************************************************
  *
  * In-core stream
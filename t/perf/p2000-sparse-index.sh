@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description="Tests performance of commands in a sparse checkout
+
+The same commands run with and without index.sparse, so that the
+default (a full index) can be compared with older versions and with
+the sparse index.
+"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'set up a sparse checkout' '
+	git config core.sparseCheckout true &&
+	echo "/t/" >.git/info/sparse-checkout &&
+	git read-tree -m -u HEAD &&
+	path=$(git ls-files t | head -n 1) &&
+	echo "$path" >in-path &&
+	path=$(git ls-files Documentation | head -n 1) &&
+	echo "$path" >out-path
+'
+
+for sparse in false true
+do
+	test_expect_success "rewrite the index with index.sparse=$sparse" "
+		git config index.sparse $sparse &&
+		git read-tree -m -u HEAD
+	"
+
+	test_perf "status, index.sparse=$sparse" "
+		git status --untracked-files=no
+	"
+
+	test_perf "add -u, index.sparse=$sparse" "
+		git add -u
+	"
+
+	test_perf "ls-files, index.sparse=$sparse" "
+		git ls-files >/dev/null
+	"
+
+	test_perf "rev-parse :<path in the checkout>, index.sparse=$sparse" "
+		git rev-parse :\$(cat in-path)
+	"
+
+	test_perf "rev-parse :<path outside it>, index.sparse=$sparse" "
+		git rev-parse :\$(cat out-path)
+	"
+done
+
+test_done
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description='Tests memory use and speed of pack-objects on a large repository'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'repack' '
+	git repack -ad
+'
+
+test_perf 'pack-objects --all' '
+	git pack-objects --stdout --all </dev/null >/dev/null
+'
+
+test_perf 'pack-objects --all --no-reuse-delta' '
+	git pack-objects --stdout --all --no-reuse-delta </dev/null >/dev/null
+'
+
+# The perf library only records times; show the peak resident set size
+# (in kilobytes) of packing everything when run with -v.  This needs a
+# time(1) that reports it, as GNU time does with %M.
+test_lazy_prereq TIME_MAXRSS '
+	/usr/bin/time -f "%M" -o rss true &&
+	test -s rss
+'
+
+test_expect_success TIME_MAXRSS 'peak memory of pack-objects --all' '
+	/usr/bin/time -f "%M" -o rss \
+		git pack-objects --stdout --all </dev/null >/dev/null &&
+	echo "peak RSS: $(tail -n 1 rss) kB"
+'
+
+test_done
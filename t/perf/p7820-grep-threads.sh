@@ -0,0 +1,23 @@
+#!/bin/sh
+
+test_description="git-grep performance with various numbers of threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+for threads in 1 2 4 8 16
+do
+	test_perf "grep HEAD, $threads threads" "
+		git grep --threads=$threads some_nonexistent_string HEAD || :
+	"
+done
+
+for threads in 1 8 16
+do
+	test_perf "grep --cached, $threads threads" "
+		git grep --cached --threads=$threads some_nonexistent_string || :
+	"
+done
+
+test_done
@@ -165,6 +165,51 @@ test_expect_success 'pack-objects with large loose object' '
 	test_cmp huge actual
 '
 
+test_expect_success 'setup delta chain of large blobs' '
+	test-genrandom a 800000 >part1 &&
+	test-genrandom b 800000 >part2 &&
+	cat part1 part2 >delta1 &&
+	cat part2 part1 part2 >delta2 &&
+	cat part2 part2 part1 >delta3 &&
+	test_create_repo deltas &&
+	(
+		cd deltas &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		git config core.bigfilethreshold 10m &&
+		for i in 1 2 3
+		do
+			cp ../delta$i file &&
+			git add file &&
+			git commit -q -m delta$i || return 1
+		done &&
+		git repack -adf --window=10 --depth=10 &&
+		git verify-pack -v .git/objects/pack/*.idx >verify &&
+		grep "^[0-9a-f]* blob .* 1 [0-9a-f]*$" verify &&
+		git config core.bigfilethreshold 200k
+	)
+'
+
+test_expect_success 'cat-file streams a delta blob in bounded memory' '
+	for i in 1 2 3
+	do
+		git -C deltas -c core.deltaStreamBufferSize=64k \
+			cat-file blob HEAD~$((3 - $i)):file >actual &&
+		test_cmp delta$i actual || return 1
+	done
+'
+
+test_expect_success 'checkout streams a delta blob' '
+	rm -f deltas/file &&
+	git -C deltas -c core.deltaStreamBufferSize=64k checkout file &&
+	test_cmp delta3 deltas/file
+'
+
+test_expect_success 'delta streaming works with a single-byte buffer' '
+	git -C deltas -c core.deltaStreamBufferSize=1 \
+		cat-file blob HEAD~1:file >actual &&
+	test_cmp delta2 actual
+'
+
 test_expect_success 'tar achiving' '
 	git archive --format=tar HEAD >/dev/null
 '
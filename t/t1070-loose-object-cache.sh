@@ -0,0 +1,75 @@
+#!/bin/sh
+
+test_description='answering loose object lookups from core.looseObjectCache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git rev-list --objects --all | cut -d" " -f1 >present &&
+	echo 0000000000000000000000000000000000000001 >missing &&
+	echo 1111111111111111111111111111111111111111 >>missing &&
+	sed -n 1p present >>missing
+'
+
+test_expect_success 'cached lookups agree with uncached ones' '
+	cat present missing >query &&
+	git cat-file --batch-check <query >expect &&
+	git -c core.looseObjectCache=true cat-file --batch-check \
+		<query >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects written by the same process are found' '
+	echo content >file &&
+	git -c core.looseObjectCache=true add file &&
+	git -c core.looseObjectCache=true commit -m three &&
+	git -c core.looseObjectCache=true rev-parse --verify HEAD:file &&
+	git -c core.looseObjectCache=true fsck
+'
+
+test_expect_success PIPE 'objects packed after the cache was filled are found' '
+	blob=$(echo packed-later | git hash-object --stdin) &&
+	mkfifo in out &&
+	(git -c core.looseObjectCache=true cat-file --batch-check \
+		<in >out &) &&
+	exec 9>in &&
+	exec 8<out &&
+	test_when_finished "exec 9>&-" &&
+	test_when_finished "exec 8<&-" &&
+	echo $blob >&9 &&
+	read response <&8 &&
+	test "$response" = "$blob missing" &&
+	echo packed-later | git hash-object -w --stdin &&
+	echo $blob | git pack-objects .git/objects/pack/pack &&
+	git prune-packed &&
+	echo $blob >&9 &&
+	read response <&8 &&
+	test "$response" = "$blob blob 13"
+'
+
+test_expect_success 'alternates are consulted through the cache' '
+	git clone -s . alt &&
+	(
+		cd alt &&
+		git -c core.looseObjectCache=true cat-file --batch-check \
+			<../query >../actual
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index-pack --strict works with the cache' '
+	pack=$(git pack-objects --revs --all --stdout </dev/null |
+		(cd alt && git -c core.looseObjectCache=true \
+			index-pack --strict --stdin)) &&
+	test -n "$pack"
+'
+
+test_expect_success 'fetch works with the cache' '
+	git init fetcher &&
+	git -C fetcher -c core.looseObjectCache=true \
+		fetch .. refs/heads/master:refs/remotes/origin/master &&
+	git -C fetcher -c core.looseObjectCache=true fsck
+'
+
+test_done
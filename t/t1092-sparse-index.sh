@@ -0,0 +1,124 @@
+#!/bin/sh
+
+test_description='sparse index
+
+With core.sparseCheckout and index.sparse, the directories outside the
+sparse checkout are stored in the index as single tree entries, and are
+expanded back when a command reads the index.
+'
+. ./test-lib.sh
+
+has_extension () {
+	grep "$1" .git/index >/dev/null
+}
+
+test_expect_success 'setup' '
+	for d in in out/a out/b/c deep/in deep/out
+	do
+		mkdir -p $d &&
+		for i in 1 2 3
+		do
+			echo $d/$i >$d/file$i || return 1
+		done
+	done &&
+	echo top >top &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git ls-files --stage >full &&
+	git config core.sparseCheckout true &&
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/top
+	/in/
+	/deep/in/
+	EOF
+	git read-tree -m -u HEAD &&
+	test_path_is_missing out &&
+	test_path_is_missing deep/out &&
+	test_path_is_file deep/in/file1
+'
+
+test_expect_success 'index.sparse is off by default' '
+	git update-index --index-version 4 &&
+	! has_extension sdir &&
+	git ls-files --sparse >actual &&
+	test_line_count = 16 actual
+'
+
+test_expect_success 'directories outside the sparse checkout are collapsed' '
+	git config index.sparse true &&
+	git update-index --index-version 3 &&
+	has_extension sdir &&
+	deep_out=$(git rev-parse HEAD:deep/out) &&
+	out=$(git rev-parse HEAD:out) &&
+	cat >expect <<-EOF &&
+	040000 $deep_out 0	deep/out/
+	040000 $out 0	out/
+	EOF
+	git ls-files --stage --sparse >actual &&
+	grep "^040000" actual >sparse-dirs &&
+	test_cmp expect sparse-dirs &&
+	test_line_count = 9 actual
+'
+
+test_expect_success 'sparse directories are expanded on read' '
+	git ls-files --stage >actual &&
+	test_cmp full actual &&
+	git ls-files -t out >actual &&
+	cat >expect <<-\EOF &&
+	S out/a/file1
+	S out/a/file2
+	S out/a/file3
+	S out/b/c/file1
+	S out/b/c/file2
+	S out/b/c/file3
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'paths are looked up inside sparse directories' '
+	git rev-parse HEAD:out/b/c/file2 HEAD:in/file1 HEAD:top >expect &&
+	git rev-parse :out/b/c/file2 :in/file1 :top >actual &&
+	test_cmp expect actual &&
+	git cat-file -p :deep/out/file3 >actual &&
+	echo deep/out/3 >expect &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q :out/nothing
+'
+
+test_expect_success 'status and commit work on a sparse index' '
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual &&
+	echo changed >in/file1 &&
+	git commit -a -m changed &&
+	has_extension sdir &&
+	test "$(git write-tree)" = "$(git rev-parse HEAD^{tree})" &&
+	git diff --name-only HEAD^ HEAD >actual &&
+	echo in/file1 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'checkout updates the collapsed directories' '
+	git checkout -b other &&
+	git update-index --no-skip-worktree out/a/file1 &&
+	mkdir -p out/a &&
+	echo other >out/a/file1 &&
+	git update-index out/a/file1 &&
+	git commit -m other &&
+	git ls-files --stage --sparse out >actual &&
+	test_line_count = 4 actual &&
+	git checkout master &&
+	git ls-files --stage --sparse >actual &&
+	grep "^040000 $(git rev-parse HEAD:out) 0	out/\$" actual &&
+	git checkout other &&
+	test "$(git rev-parse :out/a/file1)" = "$(git rev-parse other:out/a/file1)"
+'
+
+test_expect_success 'the index is written in full without index.sparse' '
+	git -c index.sparse=false update-index --index-version 4 &&
+	! has_extension sdir &&
+	git ls-files --sparse >actual &&
+	test_line_count = 16 actual
+'
+
+test_done
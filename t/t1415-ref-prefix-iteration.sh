@@ -0,0 +1,94 @@
+#!/bin/sh
+
+test_description='iterating over the references below a prefix
+
+Iterating over the references that start with a prefix reads only the
+loose directories and the packed references that can hold them, and
+hidden hierarchies are skipped without being read.
+'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	for name in v1.0 v1.9 v2.0 v2.1 v2.10 v2 v20.0 v2x/a v2.x/a
+	do
+		git tag $name one || return 1
+	done &&
+	git branch topic one &&
+	git update-ref refs/pull/1/head one &&
+	git update-ref refs/pull/2/head two &&
+	git update-ref refs/pullx/1 two &&
+	git pack-refs --all --prune &&
+	git tag v2.2 two &&
+	git update-ref refs/tags/v2.0 two &&
+	git update-ref refs/pull/3/head two
+'
+
+test_expect_success 'for-each-ref with a prefix that is not a directory' '
+	git for-each-ref --format="%(refname) %(objectname)" >all &&
+	grep "^refs/tags/v2\." all >expect &&
+	git for-each-ref --format="%(refname) %(objectname)" \
+		"refs/tags/v2.*" refs/tags/v2.x >actual &&
+	test_cmp expect actual &&
+	grep "^refs/tags/v2\.0 $(git rev-parse two)" actual
+'
+
+test_expect_success 'for-each-ref with several patterns' '
+	grep -e "^refs/heads/" -e "^refs/tags/v1" all >expect &&
+	git for-each-ref --format="%(refname) %(objectname)" \
+		refs/heads refs/tags/v1.0 "refs/tags/v1.[0-9]" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set up refs that break when read' '
+	git for-each-ref >expect.heads refs/heads/ &&
+	>.git/refs/pull/bad..name &&
+	test_when_finished "rm -f .git/refs/pull/bad..name" &&
+	git for-each-ref >/dev/null 2>err &&
+	grep "broken name" err
+'
+
+test_expect_success 'for-each-ref does not read refs outside of its patterns' '
+	>.git/refs/pull/bad..name &&
+	test_when_finished "rm -f .git/refs/pull/bad..name" &&
+	git for-each-ref refs/heads/ >actual 2>err &&
+	test_cmp expect.heads actual &&
+	test_must_be_empty err
+'
+
+test_expect_success 'packed refs outside of the patterns are not read' '
+	cp .git/packed-refs packed-refs.orig &&
+	test_when_finished "mv packed-refs.orig .git/packed-refs" &&
+	sed "s|refs/pull/1/head|refs/pull/../../../x|" \
+		packed-refs.orig >.git/packed-refs &&
+	test_must_fail git for-each-ref &&
+	git for-each-ref refs/heads/ >actual &&
+	test_cmp expect.heads actual
+'
+
+test_expect_success 'upload-pack does not advertise hidden refs' '
+	git upload-pack --advertise-refs . >out &&
+	grep refs/pull/ out &&
+	git -c transfer.hiderefs=refs/pull \
+		upload-pack --advertise-refs . >out &&
+	! grep refs/pull/ out &&
+	grep refs/pullx/1 out &&
+	grep refs/heads/topic out
+'
+
+test_expect_success 'hidden refs are not read by upload-pack' '
+	cp .git/packed-refs packed-refs.orig &&
+	test_when_finished "mv packed-refs.orig .git/packed-refs" &&
+	sed "s|refs/pull/1/head|refs/pull/../../../x|" \
+		packed-refs.orig >.git/packed-refs &&
+	test_must_fail git upload-pack --advertise-refs . >out &&
+	git -c transfer.hiderefs=refs/pull \
+		upload-pack --advertise-refs . >out &&
+	grep refs/pullx/1 out &&
+	test_must_fail git -c transfer.hiderefs=refs/pull \
+		-c uploadpack.allowtipsha1inwant=true \
+		upload-pack --advertise-refs . >out
+'
+
+test_done
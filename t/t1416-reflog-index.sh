@@ -0,0 +1,169 @@
+#!/bin/sh
+
+test_description='reflog index
+
+With core.reflogIndex, reflog lookups by date and by count and reflog
+expiry use an index of the reflog; their results must be the same as
+without it.
+'
+. ./test-lib.sh
+
+# Write a reflog for refs/heads/many with $1 entries, starting at
+# entry $2.  Every 50th entry goes back in time.
+write_reflog () {
+	awk -v n="$1" -v first="$2" -v c="$C" '
+	BEGIN {
+		split(c, sha, " ")
+		for (i = first; i < first + n; i++) {
+			t = 1112911993 + i * 60
+			if (i % 50 == 25)
+				t -= 3000
+			printf "%s %s C O Mitter <committer@example.com> %d -0700\tmove %d\n",
+				sha[i % 4 + 1], sha[(i + 1) % 4 + 1], t, i
+		}
+	}'
+}
+
+# Compare the output of "git $*" with and without the index.
+check () {
+	git -c core.reflogIndex=false "$@" >expect 2>&1
+	echo $? >>expect &&
+	git -c core.reflogIndex=true "$@" >actual 2>&1
+	echo $? >>actual &&
+	test_cmp expect actual
+}
+
+check_lookups () {
+	for n in 0 1 2 24 25 26 100 254 255 256 $(($1 - 1)) $1 $(($1 + 10))
+	do
+		check rev-parse "many@{$n}" || return 1
+	done &&
+	for t in 1 1112911000 1112912053 1112913493 1112913494 1112913495 \
+		 1112914993 1112915000 1112920000 1112930000 2000000000
+	do
+		check rev-parse "many@{$t}" || return 1
+		check log -g -1 --format="%H %gd %gs" "many@{$t}" || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	test_commit three &&
+	test_commit four &&
+	C=$(git rev-parse one two three four | tr "\n" " ") &&
+	echo "$C" >commits &&
+	git update-ref refs/heads/many four &&
+	write_reflog 400 0 >.git/logs/refs/heads/many
+'
+
+test_expect_success 'lookups without an index' '
+	C=$(cat commits) &&
+	check_lookups 400
+'
+
+test_expect_success 'index is written for a long reflog' '
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	test_path_is_file .git/logs/.index/refs/heads/many &&
+	check_lookups 400
+'
+
+test_expect_success 'entries appended after the index' '
+	C=$(cat commits) &&
+	cp .git/logs/.index/refs/heads/many index.orig &&
+	write_reflog 20 400 >>.git/logs/refs/heads/many &&
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	test_cmp index.orig .git/logs/.index/refs/heads/many &&
+	check_lookups 420
+'
+
+test_expect_success 'index is rewritten once many entries were appended' '
+	C=$(cat commits) &&
+	write_reflog 300 420 >>.git/logs/refs/heads/many &&
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	! test_cmp index.orig .git/logs/.index/refs/heads/many &&
+	check_lookups 720
+'
+
+test_expect_success 'index of a rewritten reflog is ignored' '
+	C=$(cat commits) &&
+	cp .git/logs/refs/heads/many log.orig &&
+	test_when_finished "mv log.orig .git/logs/refs/heads/many" &&
+	write_reflog 500 3 >.git/logs/refs/heads/many &&
+	check_lookups 500 &&
+	write_reflog 10 0 >.git/logs/refs/heads/many &&
+	check_lookups 10
+'
+
+test_expect_success 'reflog expire keeps the same entries' '
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	cp .git/logs/refs/heads/many log.orig &&
+	for t in 1 1112913494 1112913495 1112930000 2000000000
+	do
+		cp log.orig .git/logs/refs/heads/many &&
+		rm -rf copy &&
+		cp -R .git copy &&
+		git -c core.reflogIndex=false reflog expire \
+			--expire=$t --expire-unreachable=$t refs/heads/many &&
+		GIT_DIR=copy git -c core.reflogIndex=true reflog expire \
+			--expire=$t --expire-unreachable=$t refs/heads/many &&
+		test_cmp .git/logs/refs/heads/many copy/logs/refs/heads/many &&
+		(
+			GIT_DIR=copy &&
+			export GIT_DIR &&
+			n=$(wc -l <copy/logs/refs/heads/many) &&
+			check_lookups $n
+		) || return 1
+	done &&
+	cp log.orig .git/logs/refs/heads/many
+'
+
+test_expect_success 'reflog expire drops malformed entries it would copy' '
+	C=$(cat commits) &&
+	cp .git/logs/refs/heads/many log.orig &&
+	test_when_finished "mv log.orig .git/logs/refs/heads/many" &&
+	{
+		write_reflog 390 0 &&
+		echo "this is not a reflog entry" &&
+		write_reflog 10 390
+	} >.git/logs/refs/heads/many &&
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	test_path_is_file .git/logs/.index/refs/heads/many &&
+	rm -rf copy &&
+	cp -R .git copy &&
+	git -c core.reflogIndex=false reflog expire \
+		--expire=1112913494 --expire-unreachable=1112913494 \
+		refs/heads/many &&
+	GIT_DIR=copy git -c core.reflogIndex=true reflog expire \
+		--expire=1112913494 --expire-unreachable=1112913494 \
+		refs/heads/many &&
+	! grep "not a reflog entry" copy/logs/refs/heads/many &&
+	test_cmp .git/logs/refs/heads/many copy/logs/refs/heads/many
+'
+
+test_expect_success 'reflog expire writes the index' '
+	rm -rf copy &&
+	cp -R .git copy &&
+	rm -rf copy/logs/.index &&
+	GIT_DIR=copy git -c core.reflogIndex=true reflog expire \
+		--expire=1112913494 --expire-unreachable=1112913494 \
+		refs/heads/many &&
+	test_path_is_file copy/logs/.index/refs/heads/many &&
+	GIT_DIR=copy check_lookups 650
+'
+
+test_expect_success 'deleting a reflog entry does not leave a stale index' '
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	test_path_is_file .git/logs/.index/refs/heads/many &&
+	git reflog delete "many@{10}" &&
+	check_lookups 719
+'
+
+test_expect_success 'deleting the ref removes its index' '
+	git -c core.reflogIndex=true rev-parse "many@{3}" &&
+	test_path_is_file .git/logs/.index/refs/heads/many &&
+	git branch -D many &&
+	test_path_is_missing .git/logs/.index/refs/heads/many
+'
+
+test_done
@@ -0,0 +1,169 @@
+#!/bin/sh
+
+test_description='batched ref updates
+
+With core.batchRefUpdates, a transaction that sets many refs writes
+the new values of those that are not loose refs to the packed refs in
+one go.
+'
+. ./test-lib.sh
+
+# Create refs/heads/$1-1 ... refs/heads/$1-$2 pointing at $3.
+create_input () {
+	for i in $(test_seq 1 $2)
+	do
+		echo "create refs/heads/$1-$i $3" || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated one &&
+	git branch loose one
+'
+
+test_expect_success 'small transactions write loose refs' '
+	create_input small 5 HEAD >input &&
+	git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_path_is_file .git/refs/heads/small-1 &&
+	test_path_is_missing .git/packed-refs
+'
+
+test_expect_success 'large transactions write packed refs' '
+	create_input batch 50 HEAD >input &&
+	echo "update refs/heads/loose two one" >>input &&
+	echo "create refs/tags/batch-tag annotated" >>input &&
+	git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_path_is_missing .git/refs/heads/batch-1 &&
+	test_path_is_missing .git/refs/heads/batch-50 &&
+	test_path_is_missing .git/refs/heads/batch-1.lock &&
+	grep "refs/heads/batch-50$" .git/packed-refs &&
+	test_path_is_file .git/refs/heads/loose &&
+	git rev-parse two two two >expect &&
+	git rev-parse batch-1 batch-50 loose >actual &&
+	test_cmp expect actual &&
+	git rev-parse one >expect &&
+	git rev-parse batch-tag^{} >actual &&
+	test_cmp expect actual &&
+	git show-ref -d batch-tag >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'batched refs get reflog entries' '
+	git reflog batch-7 >actual &&
+	test_line_count = 1 actual &&
+	git reflog loose >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'packed refs are updated in place' '
+	for i in $(test_seq 1 20)
+	do
+		echo "update refs/heads/batch-$i one two" || return 1
+	done >input &&
+	git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_path_is_missing .git/refs/heads/batch-1 &&
+	git rev-parse one one >expect &&
+	git rev-parse batch-1 batch-20 >actual &&
+	test_cmp expect actual &&
+	git rev-parse two >expect &&
+	git rev-parse batch-21 >actual &&
+	test_cmp expect actual &&
+	git reflog batch-20 >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'the reflog of HEAD follows a batched update' '
+	git checkout batch-30 &&
+	for i in $(test_seq 21 40)
+	do
+		echo "update refs/heads/batch-$i one two" || return 1
+	done >input &&
+	git -c core.batchRefUpdates=10 update-ref -m batched --stdin <input &&
+	git rev-parse one >expect &&
+	git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git reflog -1 --format=%gs HEAD >actual &&
+	echo batched >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a failed check leaves all refs alone' '
+	cp .git/packed-refs packed-refs.orig &&
+	create_input fail 20 HEAD >input &&
+	echo "update refs/heads/batch-41 one one" >>input &&
+	test_must_fail git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_cmp packed-refs.orig .git/packed-refs &&
+	test_must_fail git rev-parse --verify -q fail-1 &&
+	test_path_is_missing .git/refs/heads/fail-1.lock
+'
+
+test_expect_success 'a batch cannot create conflicting refs' '
+	create_input conflict 20 HEAD >input &&
+	echo "create refs/heads/conflict-1/sub HEAD" >>input &&
+	test_must_fail git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_cmp packed-refs.orig .git/packed-refs &&
+	test_must_fail git rev-parse --verify -q conflict-2
+'
+
+test_expect_success 'a batch cannot set a branch to a non-commit' '
+	create_input tree 20 HEAD >input &&
+	echo "create refs/heads/tree-tree HEAD^{tree}" >>input &&
+	test_must_fail git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+	test_cmp packed-refs.orig .git/packed-refs
+'
+
+test_expect_success 'batched updates with core.fsyncRefFiles' '
+	create_input fsync 20 HEAD >input &&
+	git -c core.batchRefUpdates=10 -c core.fsyncRefFiles=true \
+		update-ref --stdin <input &&
+	test_path_is_missing .git/refs/heads/fsync-1 &&
+	git rev-parse --verify fsync-20
+'
+
+test_expect_success 'batched updates append a ref table' '
+	git init tables &&
+	(
+		cd tables &&
+		git config core.repositoryformatversion 1 &&
+		git config extensions.packedRefs table &&
+		test_commit one &&
+		create_input base 100 HEAD >input &&
+		git update-ref --stdin <input &&
+		git pack-refs --all --prune &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		create_input batch 20 HEAD >input &&
+		git -c core.batchRefUpdates=10 update-ref --stdin <input &&
+		test_path_is_missing .git/packed-refs &&
+		test_path_is_missing .git/refs/heads/batch-1 &&
+		test_line_count = 2 .git/reftable/tables.list &&
+		git for-each-ref --format="%(refname)" refs/heads/batch-\* >actual &&
+		test_line_count = 20 actual &&
+		git rev-parse --verify batch-13 &&
+		git rev-parse --verify master
+	)
+'
+
+test_expect_success 'fetch --prune removes packed refs in one go' '
+	git clone . clone &&
+	(
+		cd clone &&
+		git pack-refs --all --prune &&
+		grep refs/remotes/origin/batch-1$ .git/packed-refs
+	) &&
+	for i in $(test_seq 1 50)
+	do
+		echo "delete refs/heads/batch-$i" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	(
+		cd clone &&
+		git fetch --prune origin &&
+		! grep refs/remotes/origin/batch- .git/packed-refs &&
+		test_must_fail git rev-parse --verify -q origin/batch-1 &&
+		git rev-parse --verify origin/loose
+	)
+'
+
+test_done
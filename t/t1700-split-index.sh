@@ -5,7 +5,7 @@ test_description='split index mode tests'
 . ./test-lib.sh
 
 # We need total control of index splitting here
-sane_unset GIT_TEST_SPLIT_INDEX
+sane_unset GIT_TEST_SPLIT_INDEX GIT_TEST_INDEX_THREADS
 
 test_expect_success 'enable split index' '
 	git update-index --split-index &&
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='loading the index on several threads
+
+With index.threads, the index records where blocks of its entries and
+its extensions start, and is loaded on several threads; the result must
+be the same as when it is loaded on one.
+'
+. ./test-lib.sh
+
+sane_unset GIT_TEST_INDEX_THREADS
+
+# Compare what the index holds when loaded on one and on several threads.
+check_index () {
+	git -c index.threads=false ls-files --stage --debug >expect &&
+	git -c index.threads=4 ls-files --stage --debug >actual &&
+	test_cmp expect actual &&
+	git -c index.threads=false ls-files --resolve-undo >expect &&
+	git -c index.threads=4 ls-files --resolve-undo >actual &&
+	test_cmp expect actual
+}
+
+has_extension () {
+	grep "$1" .git/index >/dev/null
+}
+
+test_expect_success 'setup' '
+	for d in a b/c b/d e
+	do
+		mkdir -p $d &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo $d/$i >$d/file$i || return 1
+		done
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial
+'
+
+test_expect_success 'index.threads=false writes no offset table' '
+	git -c index.threads=false update-index --index-version 3 &&
+	! has_extension EOIE &&
+	! has_extension IEOT
+'
+
+test_expect_success 'index.threads=1 writes no offset table' '
+	git -c index.threads=1 update-index --index-version 2 &&
+	! has_extension EOIE &&
+	! has_extension IEOT
+'
+
+for version in 2 3 4
+do
+	test_expect_success "index v$version is loaded the same on several threads" '
+		other=4 &&
+		if test $version = 4
+		then
+			other=2
+		fi &&
+		git -c index.threads=false update-index --index-version $other &&
+		git -c index.threads=4 update-index --index-version $version &&
+		has_extension EOIE &&
+		has_extension IEOT &&
+		check_index &&
+		git -c index.threads=4 status --porcelain -uno >actual &&
+		test_must_be_empty actual
+	'
+done
+
+test_expect_success 'an index without the extensions is loaded on one thread' '
+	git -c index.threads=false update-index --index-version 3 &&
+	check_index
+'
+
+test_expect_success 'index v4 written in blocks is read on one thread' '
+	git -c index.threads=false update-index --index-version 3 &&
+	git -c index.threads=3 update-index --index-version 4 &&
+	git -c index.threads=false ls-files >actual &&
+	git ls-tree -r --name-only HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'extensions are loaded on their own thread' '
+	git -c index.threads=4 checkout -b side &&
+	echo side >a/file1 &&
+	git commit -a -m side &&
+	git checkout master &&
+	echo master >a/file1 &&
+	git commit -a -m master &&
+	test_must_fail git -c index.threads=4 merge side &&
+	check_index &&
+	git -c index.threads=4 checkout --theirs a/file1 &&
+	git -c index.threads=4 add a/file1 &&
+	has_extension REUC &&
+	has_extension IEOT &&
+	check_index &&
+	git -c index.threads=4 commit -m merged &&
+	has_extension TREE &&
+	check_index &&
+	git -c index.threads=4 update-index --untracked-cache &&
+	git -c index.threads=4 status &&
+	has_extension UNTR &&
+	check_index
+'
+
+test_expect_success 'a split index is loaded on several threads' '
+	git -c index.threads=4 update-index --split-index &&
+	: >new &&
+	git -c index.threads=4 add new &&
+	grep IEOT .git/sharedindex.* >/dev/null &&
+	check_index &&
+	git -c index.threads=4 status --porcelain -uno >actual &&
+	echo "A  new" >expect &&
+	test_cmp expect actual &&
+	git -c index.threads=4 update-index --no-split-index
+'
+
+test_done
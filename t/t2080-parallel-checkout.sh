@@ -0,0 +1,141 @@
+#!/bin/sh
+
+test_description='parallel checkout
+
+With checkout.workers, the files that unpack_trees() checks out are
+written by several threads; the working tree and the index must end up
+as they do when the files are written one after the other.
+'
+. ./test-lib.sh
+
+# Check out "$2" in a clone of the repository with checkout.workers="$1",
+# and check that the stat data was recorded for every file.
+parallel_clone () {
+	git clone -q --no-checkout . "$3" &&
+	(
+		cd "$3" &&
+		git -c checkout.workers=$1 \
+		    -c checkout.thresholdForParallelism=0 \
+		    checkout -q "$2" &&
+		git diff-files --quiet
+	)
+}
+
+test_expect_success 'setup' '
+	for d in a b/c b/d e
+	do
+		mkdir -p $d &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo $d/$i >$d/file$i || return 1
+		done
+	done &&
+	echo "#!/bin/sh" >script &&
+	chmod +x script &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git tag initial
+'
+
+test_expect_success 'checkout with workers matches serial checkout' '
+	parallel_clone 1 initial serial &&
+	parallel_clone 4 initial parallel &&
+	git -C serial ls-files --stage >expect &&
+	git -C parallel ls-files --stage >actual &&
+	test_cmp expect actual &&
+	for f in $(git ls-files)
+	do
+		test_cmp serial/$f parallel/$f || return 1
+	done &&
+	test -x parallel/script
+'
+
+test_expect_success 'checkout.workers=0 uses all processors' '
+	parallel_clone 0 initial auto &&
+	test_cmp a/file1 auto/a/file1
+'
+
+test_expect_success 'switching branches updates the changed files' '
+	git checkout -b changed &&
+	echo changed >a/file1 &&
+	git rm -q b/c/file2 &&
+	mkdir -p f &&
+	echo new >f/new &&
+	git add a/file1 f/new &&
+	test_tick &&
+	git commit -m changed &&
+	git checkout -q initial &&
+	parallel_clone 4 initial switch &&
+	(
+		cd switch &&
+		git -c checkout.workers=4 \
+		    -c checkout.thresholdForParallelism=0 \
+		    checkout -q changed &&
+		git diff-files --quiet &&
+		echo changed >expect &&
+		test_cmp expect a/file1 &&
+		test_path_is_missing b/c/file2 &&
+		echo new >expect &&
+		test_cmp expect f/new
+	)
+'
+
+test_expect_success 'streamable conversions are done by the workers' '
+	git checkout -q -b attributes initial &&
+	cat >.gitattributes <<-\EOF &&
+	a/* eol=crlf
+	b/c/* ident
+	EOF
+	echo "\$Id\$" >b/c/file1 &&
+	git add .gitattributes b/c/file1 &&
+	test_tick &&
+	git commit -m attributes &&
+	git checkout -q initial &&
+	parallel_clone 1 attributes serial-attr &&
+	parallel_clone 4 attributes parallel-attr &&
+	for f in a/file1 b/c/file1
+	do
+		test_cmp serial-attr/$f parallel-attr/$f || return 1
+	done &&
+	printf "a/1\r\n" >expect &&
+	test_cmp expect parallel-attr/a/file1 &&
+	grep "\\\$Id: [0-9a-f]* \\\$" parallel-attr/b/c/file1
+'
+
+test_expect_success 'smudge filters and large files are checked out serially' '
+	git checkout -q -b filter initial &&
+	echo "e/* filter=rot13" >.gitattributes &&
+	test_seq 1 1000 >large &&
+	git add .gitattributes large &&
+	test_tick &&
+	git commit -m filter &&
+	git checkout -q initial &&
+	git clone -q --no-checkout . filter &&
+	(
+		cd filter &&
+		git config filter.rot13.smudge "tr a-z n-za-m" &&
+		git -c checkout.workers=4 \
+		    -c checkout.thresholdForParallelism=0 \
+		    -c core.bigFileThreshold=1k \
+		    checkout -q filter &&
+		echo r/1 >expect &&
+		test_cmp expect e/file1 &&
+		test_seq 1 1000 >expect &&
+		test_cmp expect large &&
+		echo a/1 >expect &&
+		test_cmp expect a/file1
+	)
+'
+
+test_expect_success SYMLINKS 'symbolic links are checked out' '
+	git checkout -q -b symlink initial &&
+	test_ln_s_add a/file1 link &&
+	test_tick &&
+	git commit -m symlink &&
+	git checkout -q initial &&
+	parallel_clone 4 symlink symlink &&
+	test_cmp a/file1 symlink/link
+'
+
+test_done
@@ -0,0 +1,105 @@
+#!/bin/sh
+
+test_description='looking up references in a sorted packed-refs file
+
+A packed-refs file whose header carries the "sorted" trait is bisected
+to look up single references and the references below a prefix,
+instead of being read completely.
+'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	for name in a-b a/b a/c a0 b/a/x b/b z
+	do
+		git branch $name one || return 1
+	done &&
+	git tag -a -m annotated annotated two &&
+	git tag lightweight one &&
+	git update-ref refs/top one &&
+	git for-each-ref >expect.all &&
+	git for-each-ref refs/heads/a/ >expect.a &&
+	git for-each-ref refs/heads/b/ >expect.b &&
+	git show-ref -d --tags >expect.tags &&
+	git pack-refs --all --prune &&
+	test_path_is_missing .git/refs/heads/a/b
+'
+
+test_expect_success 'pack-refs writes the sorted trait' '
+	head -n 1 .git/packed-refs >header &&
+	grep "^# pack-refs with:.* sorted $" header
+'
+
+test_expect_success 'packed-refs file is in sorted order' '
+	grep -v "^[#^]" .git/packed-refs | cut -c42- >names &&
+	LC_ALL=C sort names >sorted &&
+	test_cmp sorted names
+'
+
+test_expect_success 'look up each packed ref' '
+	while read sha1 type refname
+	do
+		echo "$sha1" >expect &&
+		git rev-parse --verify "$refname" >actual &&
+		test_cmp expect actual || return 1
+	done <expect.all
+'
+
+test_expect_success 'missing refs next to packed ones are not found' '
+	test_must_fail git rev-parse --verify refs/heads/a- &&
+	test_must_fail git rev-parse --verify refs/heads/a/a &&
+	test_must_fail git rev-parse --verify refs/heads/zz &&
+	test_must_fail git rev-parse --verify refs/aaa
+'
+
+test_expect_success 'iterate over packed refs below a prefix' '
+	git for-each-ref >actual &&
+	test_cmp expect.all actual &&
+	git for-each-ref refs/heads/a/ >actual &&
+	test_cmp expect.a actual &&
+	git for-each-ref refs/heads/b/ >actual &&
+	test_cmp expect.b actual
+'
+
+test_expect_success 'peeled values are read from the packed-refs file' '
+	git show-ref -d --tags >actual &&
+	test_cmp expect.tags actual &&
+	git rev-parse two >expect &&
+	git rev-parse annotated^{} >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'loose refs override packed refs below a prefix' '
+	git update-ref refs/heads/a/b two &&
+	git for-each-ref --format="%(objectname) %(refname)" refs/heads/a/ >actual &&
+	cat >expect <<-EOF &&
+	$(git rev-parse two) refs/heads/a/b
+	$(git rev-parse one) refs/heads/a/c
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'deleting a packed ref keeps its neighbours' '
+	git branch -D a-b &&
+	test_must_fail git rev-parse --verify refs/heads/a-b &&
+	git rev-parse --verify refs/heads/a/c &&
+	git rev-parse --verify refs/heads/a0 &&
+	grep "^# pack-refs with:.* sorted $" .git/packed-refs
+'
+
+test_expect_success 'unsorted packed-refs without the trait is still read' '
+	git pack-refs --all --prune &&
+	{
+		echo "# pack-refs with: peeled fully-peeled " &&
+		grep -v "^#" .git/packed-refs | grep -v "^\^" | sort -r
+	} >packed &&
+	mv packed .git/packed-refs &&
+	git rev-parse --verify refs/heads/a/c &&
+	git rev-parse --verify refs/heads/z &&
+	git rev-parse --verify refs/top &&
+	git for-each-ref refs/heads/b/ >actual &&
+	test_cmp expect.b actual
+'
+
+test_done
@@ -0,0 +1,144 @@
+#!/bin/sh
+
+test_description='packed references stored in ref tables
+
+With extensions.packedRefs set to "table", packed references are kept
+in a stack of block-based ref tables in .git/reftable instead of the
+packed-refs file; deleting a packed reference appends a small table.
+'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git config core.repositoryformatversion 1 &&
+	git config extensions.packedRefs table &&
+	test_commit one &&
+	test_commit two &&
+	for i in $(test_seq 1 200)
+	do
+		echo "create refs/heads/branch-$i HEAD" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	git tag -a -m annotated annotated one &&
+	git for-each-ref >expect.all &&
+	git show-ref -d --tags >expect.tags
+'
+
+test_expect_success 'pack-refs writes a single ref table' '
+	git pack-refs --all --prune &&
+	test_path_is_missing .git/packed-refs &&
+	test_path_is_missing .git/refs/heads/branch-1 &&
+	test_line_count = 1 .git/reftable/tables.list &&
+	table=$(cat .git/reftable/tables.list) &&
+	test_path_is_file .git/reftable/$table
+'
+
+test_expect_success 'packed refs are read from the ref table' '
+	git for-each-ref >actual &&
+	test_cmp expect.all actual &&
+	git show-ref -d --tags >actual &&
+	test_cmp expect.tags actual &&
+	git rev-parse two >expect &&
+	git rev-parse --verify branch-137 >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify branch-1370
+'
+
+test_expect_success 'deleting a packed ref appends a table' '
+	git branch -D branch-100 &&
+	test_line_count = 2 .git/reftable/tables.list &&
+	test_must_fail git rev-parse --verify branch-100 &&
+	git rev-parse --verify branch-10 &&
+	git rev-parse --verify branch-101 &&
+	git for-each-ref refs/heads/ >actual &&
+	grep -v refs/heads/branch-100 expect.all |
+	grep refs/heads/ >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a transaction deletes several packed refs at once' '
+	for i in $(test_seq 20 29)
+	do
+		echo "delete refs/heads/branch-$i" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	for i in $(test_seq 20 29)
+	do
+		test_must_fail git rev-parse --verify branch-$i || return 1
+	done &&
+	git rev-parse --verify branch-2
+'
+
+test_expect_success 'newest tables are compacted as they accumulate' '
+	for i in $(test_seq 30 79)
+	do
+		git branch -D branch-$i >/dev/null || return 1
+	done &&
+	test $(wc -l <.git/reftable/tables.list) -le 8 &&
+	ls .git/reftable/*.ref >tables &&
+	test_line_count = $(wc -l <.git/reftable/tables.list) tables &&
+	git for-each-ref refs/heads/ >actual &&
+	test_line_count = 140 actual
+'
+
+test_expect_success 'loose refs override the ref tables' '
+	git update-ref refs/heads/branch-1 one &&
+	git rev-parse one >expect &&
+	git rev-parse branch-1 >actual &&
+	test_cmp expect actual &&
+	git for-each-ref --format="%(objectname)" refs/heads/branch-1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-refs folds the stack into one table' '
+	git pack-refs --all --prune &&
+	test_line_count = 1 .git/reftable/tables.list &&
+	ls .git/reftable/*.ref >tables &&
+	test_line_count = 1 tables &&
+	git for-each-ref refs/heads/ >actual &&
+	test_line_count = 140 actual &&
+	git rev-parse one >expect &&
+	git rev-parse branch-1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc and fsck find objects through the ref tables' '
+	git branch -D branch-1 &&
+	git gc &&
+	git fsck &&
+	git rev-parse --verify annotated^{commit}
+'
+
+test_expect_success 'a packed-refs file is converted on the first deletion' '
+	git init converted &&
+	(
+		cd converted &&
+		test_commit one &&
+		git branch side &&
+		git branch other &&
+		git pack-refs --all --prune &&
+		test_path_is_file .git/packed-refs &&
+		git config core.repositoryformatversion 1 &&
+		git config extensions.packedRefs table &&
+		git rev-parse --verify side &&
+		git branch -D side &&
+		test_path_is_missing .git/packed-refs &&
+		test_path_is_file .git/reftable/tables.list &&
+		test_must_fail git rev-parse --verify side &&
+		git rev-parse --verify other &&
+		git rev-parse --verify one
+	)
+'
+
+test_expect_success 'unknown extensions are refused in version 1 repositories' '
+	git init unknown &&
+	(
+		cd unknown &&
+		git config extensions.unknown value &&
+		git rev-parse --git-dir &&
+		git config core.repositoryformatversion 1 &&
+		test_must_fail git rev-parse --git-dir 2>err &&
+		grep "unknown repository extension" err
+	)
+'
+
+test_done
@@ -0,0 +1,94 @@
+#!/bin/sh
+
+test_description='git log for a path with changed-path Bloom filters'
+. ./test-lib.sh
+
+test_expect_success 'setup history' '
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	git checkout -b side HEAD~4 &&
+	test_commit side1 A/B/C/side &&
+	git checkout master &&
+	git merge -m merge side &&
+	git rm A/B/file2 &&
+	git commit -m "remove file2" &&
+	mkdir big &&
+	for i in $(test_seq 600)
+	do
+		echo $i >big/$i || return 1
+	done &&
+	git add big &&
+	git commit -m "add many files" &&
+	test_commit c10 file4 &&
+	git commit-graph write --reachable --changed-paths &&
+	test-read-graph >output &&
+	grep "bloom_indexes bloom_data" output
+'
+
+log_two_modes () {
+	git -c core.commitGraph=true log --pretty=%s $1 >output &&
+	git -c core.commitGraph=false log --pretty=%s $1 >expect &&
+	test_cmp expect output
+}
+
+for path in A A/B A/B/C A/file1 A/B/file2 A/B/C/file3 A/B/C/side \
+	    file4 big big/17 missing "A/file1 A/B/file2" "A/B/C file4"
+do
+	for option in "" --full-history --first-parent --simplify-merges \
+		      --topo-order --parents
+	do
+		test_expect_success "git log $option -- $path" "
+			log_two_modes \"$option -- $path\"
+		"
+	done
+done
+
+test_expect_success 'the filters rule out commits that did not touch the path' '
+	test_when_finished "rm -f trace" &&
+	GIT_TRACE_BLOOM_STATS="$(pwd)/trace" \
+		git -c core.commitGraph=true log --pretty=%s -- A/B/C/file3 &&
+	grep "filter not present: 0$" trace &&
+	grep "definitely not: [1-9]" trace &&
+	grep "maybe: [1-9]" trace
+'
+
+test_expect_success 'the filters are not used without the commit-graph' '
+	test_when_finished "rm -f trace" &&
+	GIT_TRACE_BLOOM_STATS="$(pwd)/trace" \
+		git -c core.commitGraph=false log --pretty=%s -- A/B/C/file3 &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'wildcard pathspecs do not use the filters' '
+	test_when_finished "rm -f trace" &&
+	log_two_modes "-- A/*/file2" &&
+	log_two_modes "-- :(glob)A/**" &&
+	GIT_TRACE_BLOOM_STATS="$(pwd)/trace" \
+		git -c core.commitGraph=true log --pretty=%s -- "A/*/file2" &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'filters are kept when the graph is appended' '
+	test_commit c11 A/file1 &&
+	git rev-parse HEAD | git commit-graph write --stdin-commits --append &&
+	test-read-graph >output &&
+	grep "bloom_indexes bloom_data" output &&
+	git commit-graph verify &&
+	log_two_modes "-- A/file1"
+'
+
+test_expect_success '--no-changed-paths drops the filters' '
+	git commit-graph write --reachable --no-changed-paths &&
+	test-read-graph >output &&
+	! grep bloom output
+'
+
+test_done
@@ -400,6 +400,35 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'delta search is shared between threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 8)
+		do
+			mkdir dir$i &&
+			for j in $(test_seq 1 20)
+			do
+				test_seq 1 $j >dir$i/file &&
+				git add dir$i/file &&
+				git commit -q -m "$i $j" || return 1
+			done || return 1
+		done &&
+		git rev-list --objects --all >objs &&
+		GIT_TRACE_PERFORMANCE="$(pwd)/trace" \
+			git pack-objects --threads=4 --no-reuse-delta \
+			--window=5 threaded <objs >pack-name &&
+		git verify-pack -v threaded-$(cat pack-name).pack >verify &&
+		grep "chain length" verify &&
+		grep "delta search thread 0: busy" trace &&
+		grep "delta search thread 0: idle" trace &&
+		grep "delta search on [1-4] threads" trace &&
+		git pack-objects --threads=1 --no-reuse-delta \
+			--window=5 serial <objs >pack-name &&
+		git verify-pack serial-$(cat pack-name).pack
+	)
+'
+
 #
 # WARNING!
 #
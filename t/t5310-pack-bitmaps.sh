@@ -119,6 +119,91 @@ test_expect_success 'fetch (full bitmap)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'full repack writes a lookup table' '
+	git -c pack.writeBitmapLookupTable=true repack -ad &&
+	# the options of the header: FULL_DAG, HASH_CACHE and LOOKUP_TABLE
+	od -An -tx1 -j6 -N2 .git/objects/pack/*.bitmap >options &&
+	echo " 00 15" >expect &&
+	test_cmp expect options
+'
+
+test_expect_success 'rev-list --test-bitmap verifies bitmaps (lookup table)' '
+	git rev-list --test-bitmap HEAD
+'
+
+rev_list_tests 'lookup table'
+
+test_expect_success 'full repack, reusing bitmaps from a lookup table' '
+	test_commit lookup-1 &&
+	git -c pack.writeBitmapLookupTable=true repack -ad &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'fetch (lookup table)' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'full repack drops the lookup table by default' '
+	git repack -ad &&
+	od -An -tx1 -j6 -N2 .git/objects/pack/*.bitmap >options &&
+	echo " 00 05" >expect &&
+	test_cmp expect options &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'setup history with deltas for partial reuse' '
+	git init reuse &&
+	(
+		cd reuse &&
+		test_seq 1 1000 >file &&
+		git add file &&
+		git commit -q -m base &&
+		git tag base &&
+		for i in $(test_seq 1 10)
+		do
+			echo $i >>file &&
+			echo $i >master-$i &&
+			git add file master-$i &&
+			git commit -q -m $i || return 1
+		done &&
+		git checkout -q -b side base &&
+		for i in $(test_seq 1 10)
+		do
+			echo side-$i >>file &&
+			git commit -q -a -m side-$i || return 1
+		done &&
+		git checkout -q master &&
+		git repack -adb
+	)
+'
+
+# The objects reachable from only one of the branches are interleaved
+# in the pack, so sending one of them leaves gaps before the bases of
+# the deltas that are sent as they are.
+for rev in side master "side ^master" "master ^base"
+do
+	test_expect_success "pack reuse of part of the pack ($rev)" '
+		(
+			cd reuse &&
+			git rev-list --objects --use-bitmap-index $rev >objs &&
+			cut -d" " -f1 objs | sort >expect &&
+			for r in $rev
+			do
+				echo $r || return 1
+			done |
+			git pack-objects --revs --delta-base-offset --stdout \
+				>partial.pack &&
+			git index-pack --strict -o partial.idx partial.pack &&
+			git show-index <partial.idx >index &&
+			cut -d" " -f2 index | sort >actual &&
+			test_cmp expect actual
+		)
+	'
+done
+
 test_expect_success 'create objects for missing-HAVE tests' '
 	blob=$(echo "missing have" | git hash-object -w --stdin) &&
 	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
@@ -0,0 +1,57 @@
+#!/bin/sh
+
+test_description='checking packs with several threads'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 50)
+	do
+		test-genrandom "file$i" 3000 >file$i &&
+		echo "change $i" >>file1 &&
+		git add file1 file$i &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adf &&
+	pack=$(ls .git/objects/pack/pack-*.pack) &&
+	git show-index <${pack%.pack}.idx | sort -n >offsets
+'
+
+test_expect_success 'fsck with threads finds nothing wrong' '
+	git fsck --full --threads=1 >expect 2>&1 &&
+	git fsck --full --threads=4 >actual 2>&1 &&
+	test_cmp expect actual &&
+	git -c pack.threads=3 fsck --full >actual 2>&1 &&
+	test_cmp expect actual
+'
+
+test_expect_success 'verify-pack passes --threads on' '
+	git verify-pack -v --threads=1 "$pack" >expect &&
+	git verify-pack -v --threads=4 "$pack" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck rejects a negative thread count' '
+	test_must_fail git fsck --threads=-1
+'
+
+test_expect_success 'corruption is found by every thread count' '
+	# damage the data of objects at the start, middle and end of the pack
+	nr=$(wc -l <offsets) &&
+	chmod +w "$pack" &&
+	for n in 2 $(($nr / 2)) $nr
+	do
+		ofs=$(sed -n "${n}p" offsets | cut -d" " -f1) &&
+		printf "XXXXXX" |
+		dd of="$pack" bs=1 conv=notrunc seek=$(($ofs + 3)) ||
+		return 1
+	done &&
+	test_must_fail git fsck --full --threads=1 2>err1 &&
+	test_must_fail git fsck --full --threads=4 2>err4 &&
+	grep "index CRC mismatch" err1 | sort >expect &&
+	test_line_count = 3 expect &&
+	grep "index CRC mismatch" err4 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_done
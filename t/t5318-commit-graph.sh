@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='commit graph'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+graph_read_expect () {
+	OPTIONAL=""
+	NUM_CHUNKS=3
+	if test -n "$2"
+	then
+		OPTIONAL=" $2"
+		NUM_CHUNKS=$((3 + $(echo "$2" | wc -w)))
+	fi
+	cat >expect <<-EOF
+	header: 43475048 1 1 $NUM_CHUNKS
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	EOF
+	test-read-graph >output &&
+	test_cmp expect output
+}
+
+graph_git_two_modes () {
+	git -c core.commitGraph=true $1 >output &&
+	git -c core.commitGraph=false $1 >expect &&
+	test_cmp expect output
+}
+
+graph_git_behavior () {
+	MSG=$1
+	BRANCH=$2
+	COMPARE=$3
+	test_expect_success "check normal git operations: $MSG" '
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE" &&
+		graph_git_two_modes "merge-base --independent $BRANCH $COMPARE" &&
+		graph_git_two_modes "branch --contains $COMPARE" &&
+		graph_git_two_modes "tag --contains $COMPARE" &&
+		graph_git_two_modes "tag --contains $BRANCH"
+	'
+}
+
+test_expect_success 'write graph with no packs' '
+	git commit-graph write &&
+	test_path_is_missing $objdir/info/commit-graph
+'
+
+test_expect_success 'create commits and repack' '
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git repack
+'
+
+test_expect_success 'write graph' '
+	git commit-graph write &&
+	test_path_is_file $objdir/info/commit-graph &&
+	graph_read_expect 3 &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'graph exists' commits/3 commits/1
+
+test_expect_success 'add more commits, including an octopus merge' '
+	git reset --hard commits/2 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 7)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/3 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git reset --hard commits/3 &&
+	git merge commits/5 commits/7 &&
+	git branch merge/3 &&
+	git repack
+'
+
+graph_git_behavior 'graph is stale' merge/3 commits/1
+
+test_expect_success 'write graph with merges' '
+	git commit-graph write &&
+	graph_read_expect 10 "extra_edges" &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'merge 1 vs 2' merge/1 merge/2
+graph_git_behavior 'merge 1 vs 3' merge/1 merge/3
+graph_git_behavior 'merge 2 vs 3' merge/2 merge/3
+
+test_expect_success 'write graph from refs, then append new history' '
+	git checkout -b loose commits/7 &&
+	test_commit 8 &&
+	git branch commits/8 &&
+	git commit-graph write --reachable &&
+	graph_read_expect 11 "extra_edges" &&
+	test_commit 9 &&
+	git branch commits/9 &&
+	echo $(git rev-parse commits/9) | git commit-graph write --stdin-commits --append &&
+	graph_read_expect 12 "extra_edges" &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'appended graph' commits/9 merge/3
+
+test_expect_success 'write graph from a single commit drops unrelated history' '
+	git rev-parse commits/3 | git commit-graph write --stdin-commits &&
+	graph_read_expect 3 &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'partial graph' merge/3 commits/9
+
+test_expect_success 'graph is ignored with grafts' '
+	git commit-graph write --reachable &&
+	echo "$(git rev-parse commits/3)" >.git/info/grafts &&
+	git rev-list commits/3 >output &&
+	test_line_count = 1 output &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'graph is ignored with replace objects' '
+	root=$(git commit-tree -m root commits/2^{tree}) &&
+	git replace commits/2 $root &&
+	git rev-list commits/3 >output &&
+	test_line_count = 2 output &&
+	git replace -d commits/2
+'
+
+test_expect_success 'verify detects a corrupt trailing checksum' '
+	cp $objdir/info/commit-graph graph-backup &&
+	chmod u+w $objdir/info/commit-graph &&
+	size=$(wc -c <$objdir/info/commit-graph) &&
+	printf "\377" |
+	dd of=$objdir/info/commit-graph bs=1 seek=$(($size - 21)) \
+		conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify 2>err &&
+	grep "incorrect checksum" err &&
+	mv graph-backup $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'verify detects a corrupt commit date' '
+	cp $objdir/info/commit-graph graph-backup &&
+	test_when_finished "mv graph-backup $objdir/info/commit-graph" &&
+	test-read-graph >info &&
+	chunks=$(sed -n "s/^header: .* //p" info) &&
+	commits=$(sed -n "s/^num_commits: //p" info) &&
+	# the CDAT chunk follows the chunk lookup table, OIDF and OIDL;
+	# clobber the top byte of the low 32 bits of the first date
+	cdat=$((8 + ($chunks + 1) * 12 + 256 * 4 + $commits * 20)) &&
+	size=$(wc -c <graph-backup) &&
+	dd if=graph-backup of=graph-date bs=1 count=$(($size - 20)) \
+		2>/dev/null &&
+	printf "\0" |
+	dd of=graph-date bs=1 seek=$(($cdat + 32)) conv=notrunc 2>/dev/null &&
+	test-sha1 -b <graph-date >trailer &&
+	cat graph-date trailer >$objdir/info/commit-graph &&
+	test_must_fail git commit-graph verify 2>err &&
+	! grep "incorrect checksum" err &&
+	grep "commit date for commit .* in commit-graph is" err
+'
+
+test_expect_success 'gc.writeCommitGraph writes the graph' '
+	rm -f $objdir/info/commit-graph &&
+	git -c gc.writeCommitGraph=true gc &&
+	test_path_is_file $objdir/info/commit-graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'fetch.writeCommitGraph appends fetched history' '
+	git init --bare fetch-target.git &&
+	git -C fetch-target.git config fetch.writeCommitGraph true &&
+	git -C fetch-target.git fetch .. commits/3:refs/heads/a &&
+	test_path_is_file fetch-target.git/objects/info/commit-graph &&
+	git -C fetch-target.git fetch .. merge/3:refs/heads/b &&
+	git -C fetch-target.git commit-graph verify &&
+	git -C fetch-target.git rev-list --count b >count &&
+	echo 8 >expect &&
+	test_cmp expect count
+'
+
+test_expect_success 'push --follow-tags with references of several generations' '
+	git init --bare follow-tags.git &&
+	git tag -a -m "annotated" follow-tag merge/3~1 &&
+	git commit-graph write --reachable &&
+	git -c core.commitGraph=true push follow-tags.git \
+		commits/1 merge/3 --follow-tags &&
+	git -C follow-tags.git rev-parse --verify follow-tag &&
+	git tag -d follow-tag
+'
+
+test_done
@@ -0,0 +1,126 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+objdir=.git/objects
+
+midx_read_expect () {
+	NUM_PACKS=$1
+	NUM_OBJECTS=$2
+	{
+		cat <<-EOF &&
+		header: 4d494458 1 1 4
+		chunks: pack-names oid-fanout oid-lookup object-offsets
+		num_packs: $NUM_PACKS
+		num_objects: $NUM_OBJECTS
+		packs:
+		EOF
+		ls $objdir/pack | grep "\.idx$" | sort
+	} >expect &&
+	test-read-midx $objdir >actual &&
+	test_cmp expect actual
+}
+
+all_objects () {
+	git rev-list --objects --all |
+	cut -d" " -f1 |
+	git cat-file --batch-check
+}
+
+test_expect_success 'write with no packs' '
+	git multi-pack-index write &&
+	test_path_is_missing $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'create packs' '
+	for i in 1 2 3
+	do
+		test_commit $i &&
+		git repack -q || return 1
+	done &&
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'write midx with three packs' '
+	git multi-pack-index write &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	midx_read_expect 3 9 &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'objects are found through the midx' '
+	git -c core.multiPackIndex=false rev-list --objects --all |
+	cut -d" " -f1 |
+	git -c core.multiPackIndex=false cat-file --batch-check >expect &&
+	all_objects >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'count-objects does not report the midx as garbage' '
+	git count-objects -v >output &&
+	grep "^garbage: 0" output
+'
+
+test_expect_success 'packs added after the midx are still searched' '
+	test_commit 4 &&
+	git repack -q &&
+	ls $objdir/pack/*.pack >packs &&
+	test_line_count = 4 packs &&
+	git cat-file -e 4^{tree} &&
+	git fsck &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'midx prefers the youngest copy of duplicated objects' '
+	git multi-pack-index write &&
+	midx_read_expect 4 12 &&
+	git repack -a -q &&
+	git multi-pack-index write &&
+	midx_read_expect 5 12 &&
+	git multi-pack-index verify &&
+	all_objects >actual &&
+	test_line_count = 12 actual
+'
+
+test_expect_success 'stale midx naming a missing pack is ignored' '
+	git multi-pack-index write &&
+	newest=$(ls -t $objdir/pack/*.pack | head -n 1) &&
+	for p in $objdir/pack/pack-*.pack
+	do
+		test "$p" = "$newest" && continue
+		rm -f "$p" "${p%.pack}.idx" || return 1
+	done &&
+	test_path_is_file $objdir/pack/multi-pack-index &&
+	test_must_fail git multi-pack-index verify &&
+	all_objects >actual &&
+	test_line_count = 12 actual &&
+	git fsck
+'
+
+test_expect_success 'verify detects a corrupt midx' '
+	git multi-pack-index write &&
+	git multi-pack-index verify &&
+	cp $objdir/pack/multi-pack-index midx-backup &&
+	chmod u+w $objdir/pack/multi-pack-index &&
+	size=$(wc -c <$objdir/pack/multi-pack-index) &&
+	printf "\377" |
+	dd of=$objdir/pack/multi-pack-index bs=1 seek=$(($size - 30)) \
+		conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify 2>err &&
+	grep "incorrect checksum" err &&
+	mv midx-backup $objdir/pack/multi-pack-index
+'
+
+test_expect_success 'repack -d removes the midx' '
+	test_commit 5 &&
+	git repack -q &&
+	git multi-pack-index write &&
+	git repack -adq &&
+	test_path_is_missing $objdir/pack/multi-pack-index &&
+	git fsck
+'
+
+test_done
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+	test_commit other &&
+	git repack -ad &&
+	pack=$(ls $packdir/pack-*.pack) &&
+	test_path_is_file "$pack" &&
+	rev=${pack%.pack}.rev &&
+	test_path_is_missing "$rev" &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect
+'
+
+test_expect_success 'index-pack writes .rev with --rev-index' '
+	git index-pack --rev-index "$pack" &&
+	test_path_is_file "$rev"
+'
+
+test_expect_success '.rev file has the expected size' '
+	nr=$(wc -l <objects) &&
+	test $(wc -c <"$rev") = $((12 + 4 * $nr + 40))
+'
+
+test_expect_success 'disk sizes are the same with a .rev file' '
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck accepts the .rev file' '
+	git fsck --full
+'
+
+test_expect_success 'index-pack --no-rev-index overrides config' '
+	rm -f "$rev" &&
+	git -c pack.writeReverseIndex=true index-pack --no-rev-index "$pack" &&
+	test_path_is_missing "$rev"
+'
+
+test_expect_success 'index-pack honors pack.writeReverseIndex' '
+	git -c pack.writeReverseIndex=true index-pack "$pack" &&
+	test_path_is_file "$rev"
+'
+
+test_expect_success 'index-pack --stdin writes .rev' '
+	git init stdin &&
+	git -C stdin -c pack.writeReverseIndex=true \
+		index-pack --stdin <"$pack" &&
+	ls stdin/$packdir/pack-*.rev >revs &&
+	test_line_count = 1 revs
+'
+
+test_expect_success 'repack writes .rev with pack.writeReverseIndex' '
+	test_commit third &&
+	git -c pack.writeReverseIndex=true repack -ad &&
+	ls $packdir/pack-*.rev >revs &&
+	test_line_count = 1 revs &&
+	ls $packdir/pack-*.pack >packs &&
+	test_line_count = 1 packs &&
+	pack=$(cat packs) &&
+	test "$(cat revs)" = "${pack%.pack}.rev" &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual &&
+	mv ${pack%.pack}.rev rev.save &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect &&
+	mv rev.save ${pack%.pack}.rev &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack without config drops the old .rev' '
+	test_commit fourth &&
+	git repack -ad &&
+	test_path_is_missing $packdir/pack-*.rev
+'
+
+test_expect_success 'corrupt .rev file is ignored with an error' '
+	git -c pack.writeReverseIndex=true repack -ad &&
+	rev=$(ls $packdir/pack-*.rev) &&
+	chmod u+w "$rev" &&
+	printf "XXXX" | dd of="$rev" bs=1 seek=0 conv=notrunc &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual 2>err &&
+	test_i18ngrep "unknown signature" err &&
+	mv "$rev" rev.save &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsck notices a broken .rev' '
+	mv rev.save "$rev" &&
+	printf "RIDX\0\0\0\1\0\0\0\1\0\0\0\0\0\0\0\0" |
+		dd of="$rev" bs=1 seek=0 conv=notrunc &&
+	test_must_fail git fsck --full 2>err &&
+	test_i18ngrep "reverse-index" err
+'
+
+test_expect_success 'garbage .rev without pack is reported' '
+	touch $packdir/pack-0000000000000000000000000000000000000000.rev &&
+	git count-objects -v >out &&
+	grep "^garbage: 1" out
+'
+
+test_done
@@ -0,0 +1,189 @@
+#!/bin/sh
+
+test_description='git status with the untracked cache
+
+The untracked cache in the index lets "git status" skip reading the
+directories that did not change; its output must be the same as
+without it.
+'
+. ./test-lib.sh
+
+# Directories that were modified in the same second as the index was
+# written are read again, and so are the ones modified since then the
+# next time the index is written.  Wait for the next second and update
+# the cache twice so that the cache is trusted.
+avoid_racy () {
+	sleep 1 &&
+	(
+		cd repo &&
+		git status >/dev/null &&
+		git status >/dev/null
+	)
+}
+
+# Compare the output of "git status" with and without the cache.
+check_status () {
+	(
+		cd repo &&
+		GIT_DISABLE_UNTRACKED_CACHE=1 git status --porcelain "$@" >../expect &&
+		git status --porcelain "$@" >../actual
+	) &&
+	test_cmp expect actual
+}
+
+# Print how many directories "git status" opened.
+opendir_count () {
+	rm -f trace &&
+	(
+		cd repo &&
+		GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+			git status --porcelain >/dev/null
+	) &&
+	sed -n "s/^opendir: //p" trace
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		mkdir -p done dthree dtwo/sub four five &&
+		: >one &&
+		: >two &&
+		: >done/one &&
+		: >dtwo/sub/two &&
+		: >four/four &&
+		: >five/five &&
+		echo "*.o" >.gitignore &&
+		: >dthree/three.o &&
+		git add one done/one four/four .gitignore &&
+		test_tick &&
+		git commit -m initial &&
+		git update-index --untracked-cache
+	) &&
+	grep -q UNTR repo/.git/index
+'
+
+test_expect_success 'status with the cache matches status without it' '
+	avoid_racy &&
+	check_status &&
+	check_status -uno &&
+	check_status -uall &&
+	check_status --ignored
+'
+
+test_expect_success 'unchanged directories are not read again' '
+	echo 0 >expect &&
+	opendir_count >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'new untracked files are found' '
+	: >repo/done/two &&
+	: >repo/dthree/three &&
+	avoid_racy &&
+	check_status &&
+	echo 0 >expect &&
+	opendir_count >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a directory that becomes empty is not shown' '
+	rm repo/dtwo/sub/two &&
+	check_status &&
+	avoid_racy &&
+	check_status
+'
+
+test_expect_success 'changing .gitignore' '
+	echo "/two" >>repo/.gitignore &&
+	check_status &&
+	echo "!three.o" >repo/dthree/.gitignore &&
+	check_status &&
+	rm repo/dthree/.gitignore &&
+	check_status
+'
+
+test_expect_success 'changing info/exclude' '
+	echo done >repo/.git/info/exclude &&
+	check_status &&
+	: >repo/.git/info/exclude &&
+	check_status
+'
+
+test_expect_success 'adding and removing files in the index' '
+	(
+		cd repo &&
+		git add done/two &&
+		git rm -q --cached four/four
+	) &&
+	check_status &&
+	(
+		cd repo &&
+		git add five/five &&
+		git rm -q --cached done/one
+	) &&
+	check_status
+'
+
+test_expect_success 'checking out another commit' '
+	(
+		cd repo &&
+		git add . &&
+		test_tick &&
+		git commit -q -m second &&
+		git checkout -q HEAD^
+	) &&
+	check_status &&
+	(
+		cd repo &&
+		git checkout -q master
+	) &&
+	check_status
+'
+
+test_expect_success 'status with a pathspec does not use the cache' '
+	: >repo/five/six &&
+	check_status five &&
+	check_status
+'
+
+test_expect_success '--no-untracked-cache removes the cache' '
+	(
+		cd repo &&
+		git update-index --no-untracked-cache
+	) &&
+	! grep -q UNTR repo/.git/index &&
+	check_status
+'
+
+test_expect_success 'core.untrackedCache adds and removes the cache' '
+	(
+		cd repo &&
+		git config core.untrackedCache true &&
+		git status >/dev/null
+	) &&
+	grep -q UNTR repo/.git/index &&
+	check_status &&
+	(
+		cd repo &&
+		git config core.untrackedCache keep &&
+		git status >/dev/null
+	) &&
+	grep -q UNTR repo/.git/index &&
+	(
+		cd repo &&
+		git config core.untrackedCache false &&
+		git status >/dev/null
+	) &&
+	! grep -q UNTR repo/.git/index
+'
+
+test_expect_success 'update-index warns about a conflicting config' '
+	(
+		cd repo &&
+		git update-index --untracked-cache 2>../err
+	) &&
+	test_i18ngrep "core.untrackedCache is set to false" err
+'
+
+test_done
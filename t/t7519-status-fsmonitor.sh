@@ -0,0 +1,248 @@
+#!/bin/sh
+
+test_description='git status with file system watcher
+
+The core.fsmonitor hook tells git which paths changed since it was last
+asked; index entries and untracked cache directories that it does not
+report are trusted without lstat().
+'
+. ./test-lib.sh
+
+# The hook reports the paths listed in .git/fsmonitor-paths, one per
+# line, and logs its arguments to .git/fsmonitor-args.
+write_integration_script () {
+	write_script .git/fsmonitor-test <<-\EOF
+	if test "$#" -ne 2
+	then
+		echo "$0: exactly 2 arguments expected" >&2
+		exit 2
+	fi
+	if test "$1" != 1
+	then
+		echo "Unsupported core.fsmonitor hook version." >&2
+		exit 1
+	fi
+	echo "$*" >>.git/fsmonitor-args
+	test -f .git/fsmonitor-paths || exit 0
+	tr "\n" "\0" <.git/fsmonitor-paths
+	EOF
+}
+
+# Report the given paths from now on.
+report () {
+	printf "%s\n" "$@" >.git/fsmonitor-paths
+}
+
+report_nothing () {
+	rm -f .git/fsmonitor-paths
+}
+
+# Directories that were modified in the same second as the index was
+# written are not trusted by the untracked cache; see t7063.
+avoid_racy () {
+	sleep 1 &&
+	git status >/dev/null &&
+	git status >/dev/null
+}
+
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	for f in modified dir1/modified dir2/modified unchanged
+	do
+		echo initial >$f || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	write_integration_script &&
+	git config core.fsmonitor .git/fsmonitor-test &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	expect*
+	actual*
+	err
+	EOF
+	git update-index --fsmonitor &&
+	git status &&
+	grep FSMN .git/index >/dev/null
+'
+
+test_expect_success 'clean entries are marked fsmonitor valid' '
+	cat >expect <<-\EOF &&
+	h dir1/modified
+	h dir2/modified
+	h modified
+	h unchanged
+	EOF
+	git ls-files -f >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the hook is given the version and a timestamp' '
+	rm -f .git/fsmonitor-args &&
+	git status &&
+	test_line_count = 1 .git/fsmonitor-args &&
+	grep "^1 [1-9][0-9]*$" .git/fsmonitor-args
+'
+
+test_expect_success 'changes that the hook does not report are not seen' '
+	echo changed >modified &&
+	echo changed >dir1/modified &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'changes that the hook reports are seen' '
+	report modified &&
+	echo " M modified" >expect &&
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	h dir1/modified
+	h dir2/modified
+	H modified
+	h unchanged
+	EOF
+	git ls-files -f >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a reported directory covers the files below it' '
+	report dir1 &&
+	cat >expect <<-\EOF &&
+	 M dir1/modified
+	 M modified
+	EOF
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '"/" reports that everything may have changed' '
+	git checkout -- . &&
+	report_nothing &&
+	git status &&
+	echo changed >dir2/modified &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	report / &&
+	echo " M dir2/modified" >expect &&
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'everything is checked when the hook fails' '
+	git checkout -- . &&
+	report_nothing &&
+	git status &&
+	echo changed >unchanged &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	write_script .git/fsmonitor-fail <<-\EOF &&
+	exit 1
+	EOF
+	echo " M unchanged" >expect &&
+	git -c core.fsmonitor=.git/fsmonitor-fail \
+		status --porcelain -uno >actual &&
+	test_cmp expect actual &&
+	git checkout -- unchanged
+'
+
+test_expect_success '--really-refresh ignores the fsmonitor valid bit' '
+	report_nothing &&
+	git status &&
+	echo changed >unchanged &&
+	git update-index --refresh &&
+	test_must_fail git update-index --really-refresh &&
+	report unchanged &&
+	git checkout -- unchanged
+'
+
+test_expect_success 'new untracked files are found when reported' '
+	report_nothing &&
+	git update-index --untracked-cache &&
+	avoid_racy &&
+	: >dir1/new &&
+	git status --porcelain >actual &&
+	test_must_be_empty actual &&
+	report dir1/new &&
+	echo "?? dir1/new" >expect &&
+	git status --porcelain >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a reported directory is read again with its subdirectories' '
+	rm dir1/new &&
+	mkdir -p sub/dir &&
+	: >sub/dir/a &&
+	report sub &&
+	git status &&
+	report_nothing &&
+	avoid_racy &&
+	mv sub moved &&
+	mkdir -p sub/dir &&
+	: >sub/dir/b &&
+	git status --porcelain >actual &&
+	grep "sub/$" actual &&
+	! grep moved actual &&
+	report moved sub &&
+	cat >expect <<-\EOF &&
+	?? moved/
+	?? sub/
+	EOF
+	git status --porcelain >actual &&
+	test_cmp expect actual &&
+	git status --porcelain -uall >actual &&
+	grep "sub/dir/b" actual &&
+	rm -rf moved sub
+'
+
+test_expect_success 'update-index --[no-]fsmonitor-valid' '
+	report_nothing &&
+	git status &&
+	git update-index --no-fsmonitor-valid modified &&
+	git ls-files -f modified >actual &&
+	echo "H modified" >expect &&
+	test_cmp expect actual &&
+	git update-index --fsmonitor-valid modified &&
+	git ls-files -f modified >actual &&
+	echo "h modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'update-index --no-fsmonitor removes the extension' '
+	git update-index --no-fsmonitor 2>err &&
+	test_i18ngrep "core.fsmonitor is set" err &&
+	! grep FSMN .git/index >/dev/null
+'
+
+test_expect_success 'unsetting core.fsmonitor removes the extension' '
+	git status &&
+	grep FSMN .git/index >/dev/null &&
+	git config --unset core.fsmonitor &&
+	git status &&
+	! grep FSMN .git/index >/dev/null &&
+	cat >expect <<-\EOF &&
+	H dir1/modified
+	H dir2/modified
+	H modified
+	H unchanged
+	EOF
+	git ls-files -f >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fsmonitor works with a split index' '
+	git config core.fsmonitor .git/fsmonitor-test &&
+	git update-index --split-index &&
+	report_nothing &&
+	git status &&
+	echo changed >dir2/modified &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual &&
+	report dir2/modified &&
+	echo " M dir2/modified" >expect &&
+	git status --porcelain -uno >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -1296,4 +1296,24 @@ test_expect_success 'grep --color -e A --and -e B -p with context' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep with threads searches trees and the index' '
+	git add -A &&
+	test_tick &&
+	git commit -q -m "grep threads" &&
+	git grep --threads=1 -n -e int HEAD >expected &&
+	git grep --threads=8 -n -e int HEAD >actual &&
+	test_cmp expected actual &&
+	git grep --threads=1 -c -e a --cached >expected &&
+	git grep --threads=8 -c -e a --cached >actual &&
+	test_cmp expected actual &&
+	git -c grep.threads=1 grep -h -e a HEAD >expected &&
+	git -c grep.threads=8 grep -h -e a HEAD >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep rejects a negative number of threads' '
+	test_must_fail git grep --threads=-1 int HEAD &&
+	test_must_fail git -c grep.threads=-1 grep int HEAD
+'
+
 test_done
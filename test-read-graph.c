@@ -0,0 +1,36 @@
+#include "cache.h"
+#include "commit-graph.h"
+
+int main(int argc, char **argv)
+{
+	struct commit_graph *g;
+	char *graph_name;
+
+	setup_git_directory();
+	graph_name = get_commit_graph_filename(get_object_directory());
+	g = load_commit_graph_one(graph_name);
+	free(graph_name);
+	if (!g)
+		return 1;
+
+	printf("header: %08x %d %d %d\n",
+	       get_be32(g->data), g->data[4], g->data[5], g->data[6]);
+	printf("num_commits: %"PRIu32"\n", g->num_commits);
+	printf("chunks:");
+	if (g->chunk_oid_fanout)
+		printf(" oid_fanout");
+	if (g->chunk_oid_lookup)
+		printf(" oid_lookup");
+	if (g->chunk_commit_data)
+		printf(" commit_metadata");
+	if (g->chunk_extra_edges)
+		printf(" extra_edges");
+	if (g->chunk_bloom_indexes)
+		printf(" bloom_indexes");
+	if (g->chunk_bloom_data)
+		printf(" bloom_data");
+	printf("\n");
+
+	close_commit_graph(g);
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include "cache.h"
+#include "midx.h"
+
+int main(int argc, char **argv)
+{
+	struct multi_pack_index *m;
+	uint32_t i;
+
+	if (argc != 2)
+		usage("test-read-midx <object-dir>");
+
+	setup_git_directory();
+	m = load_multi_pack_index(argv[1]);
+	if (!m)
+		return 1;
+
+	printf("header: %08x %d %d %d\n",
+	       get_be32(m->data), m->data[4], m->data[5], m->data[6]);
+	printf("chunks:");
+	if (m->chunk_pack_names)
+		printf(" pack-names");
+	if (m->chunk_oid_fanout)
+		printf(" oid-fanout");
+	if (m->chunk_oid_lookup)
+		printf(" oid-lookup");
+	if (m->chunk_object_offsets)
+		printf(" object-offsets");
+	if (m->chunk_large_offsets)
+		printf(" large-offsets");
+	printf("\nnum_packs: %"PRIu32"\n", m->num_packs);
+	printf("num_objects: %"PRIu32"\n", m->num_objects);
+	printf("packs:\n");
+	for (i = 0; i < m->num_packs; i++)
+		printf("%s\n", m->pack_names[i]);
+
+	close_midx(m);
+	return 0;
+}
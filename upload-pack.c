@@ -758,6 +758,17 @@ static int find_symref(const char *refname, const unsigned char *sha1, int flag,
 	return 0;
 }
 
+/*
+ * Hidden refs only need to be looked at if their tips may be asked
+ * for; otherwise their hierarchies are not even read.
+ */
+static int for_each_our_ref(each_ref_fn fn, void *cb_data)
+{
+	if (allow_tip_sha1_in_want)
+		return for_each_namespaced_ref(fn, cb_data);
+	return for_each_namespaced_ref_unhidden(fn, cb_data);
+}
+
 static void upload_pack(void)
 {
 	struct string_list symref = STRING_LIST_INIT_DUP;
@@ -767,12 +778,12 @@ static void upload_pack(void)
 	if (advertise_refs || !stateless_rpc) {
 		reset_timeout();
 		head_ref_namespaced(send_ref, &symref);
-		for_each_namespaced_ref(send_ref, &symref);
+		for_each_our_ref(send_ref, &symref);
 		advertise_shallow_grafts(1);
 		packet_flush(1);
 	} else {
 		head_ref_namespaced(check_ref, NULL);
-		for_each_namespaced_ref(check_ref, NULL);
+		for_each_our_ref(check_ref, NULL);
 	}
 	string_list_clear(&symref, 1);
 	if (advertise_refs)
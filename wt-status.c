@@ -16,6 +16,7 @@
 #include "column.h"
 #include "strbuf.h"
 #include "utf8.h"
+#include "fsmonitor.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -585,6 +586,11 @@ static void wt_status_collect_untracked(struct wt_status *s)
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	if (s->show_ignored_files)
 		dir.flags |= DIR_SHOW_IGNORED_TOO;
+	else {
+		/* this may drop the untracked cache, so ask first */
+		refresh_fsmonitor(&the_index);
+		dir.untracked = the_index.untracked;
+	}
 	setup_standard_excludes(&dir);
 
 	fill_directory(&dir, &s->pathspec);